@@ -0,0 +1,502 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains a tiny assembler buffer used by the code generators.
+ * Every instruction is given both as assembly text (which is what ends up
+ * in the generated source file) and as an encoding, so that the very same
+ * code can be executed by the built-in CPU cores.
+ *
+ * An encoding is a space-separated list of tokens:
+ *
+ * XX       a literal byte (two hex digits)
+ * #expr    the value of expr as a byte
+ * <expr    the low byte of expr
+ * >expr    the high byte of expr
+ * ^expr    the bank byte (bits 16-23) of expr
+ * !expr    the value of expr as a little-endian word
+ * @expr    8-bit displacement from the next instruction to expr
+ * @@expr   16-bit displacement from the next instruction to expr
+ *
+ * where expr is a sequence of symbols and numbers ($hex, %binary or
+ * decimal) separated by + or -.
+ *
+ * Symbol names that start with a period are local: in labels, encodings and
+ * instruction operands, ".name" is replaced by "scope_name", where scope is
+ * set with asm_scope(). This lets a generator derive all of its labels from
+ * one user-supplied routine name. The operation itself is never expanded,
+ * so directives such as ".db" are written as given.
+ *
+ * When the buffer is linked, the text of every data directive is read back
+ * and checked against the machine code, and every other operation must be a
+ * plain mnemonic, so that the file that is written assembles to the code
+ * that the CPU cores ran.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include "asmgen.h"
+
+#define ASM_FIXUP_IMM8  0
+#define ASM_FIXUP_LO    1
+#define ASM_FIXUP_HI    2
+#define ASM_FIXUP_BANK  3
+#define ASM_FIXUP_WORD  4
+#define ASM_FIXUP_REL8  5
+#define ASM_FIXUP_REL16 6
+
+/**
+ * Initializes an assembler buffer.
+ * @param a The buffer
+ * @param origin Address of the first byte of code
+ */
+void asm_init(asm_buffer_t *a, int origin)
+{
+    memset(a, 0, sizeof(asm_buffer_t));
+    a->origin = origin;
+}
+
+/**
+ * Frees the resources held by an assembler buffer.
+ * @param a The buffer
+ */
+void asm_free(asm_buffer_t *a)
+{
+    int i;
+    for (i = 0; i < a->symbol_count; ++i)
+        free(a->symbols[i].name);
+    for (i = 0; i < a->fixup_count; ++i)
+        free(a->fixups[i].expr);
+    free(a->symbols);
+    free(a->fixups);
+    free(a->lines);
+    free(a->code);
+    free(a->text);
+    memset(a, 0, sizeof(asm_buffer_t));
+}
+
+/**
+ * Sets the name that local symbols are prefixed with.
+ * @param a The buffer
+ * @param scope The scope name
+ */
+void asm_scope(asm_buffer_t *a, const char *scope)
+{
+    strncpy(a->scope, scope, sizeof(a->scope) - 1);
+    a->scope[sizeof(a->scope) - 1] = 0;
+}
+
+#define IS_IDENT(c) (isalnum((unsigned char)(c)) || ((c) == '_'))
+
+/**
+ * Replaces local symbol names (".name") in a string by scope-qualified names.
+ * @param a The buffer
+ * @param in String to expand
+ * @param out Where to store the result
+ * @param size Size of out
+ * @param operands If set, in is an instruction and its operation is kept
+ */
+static void expand_locals(const asm_buffer_t *a, const char *in,
+                          char *out, int size, int operands)
+{
+    int i = 0;
+    const char *p = in;
+    if (operands) {
+        while (*p && isspace((unsigned char)*p) && (i < size - 1))
+            out[i++] = *(p++);
+        while (*p && !isspace((unsigned char)*p) && (i < size - 1))
+            out[i++] = *(p++);
+    }
+    for ( ; *p && (i < size - 1); p++) {
+        if ((*p == '.') && IS_IDENT(p[1]) && ((p == in) || !IS_IDENT(p[-1]))) {
+            const char *s;
+            for (s = a->scope; *s && (i < size - 2); s++)
+                out[i++] = *s;
+            out[i++] = '_';
+        } else {
+            out[i++] = *p;
+        }
+    }
+    out[i] = 0;
+}
+
+/**
+ * Defines (or redefines) a symbol.
+ * @param a The buffer
+ * @param name Name of the symbol
+ * @param value Value of the symbol
+ */
+void asm_define(asm_buffer_t *a, const char *name, int value)
+{
+    int i;
+    for (i = 0; i < a->symbol_count; ++i) {
+        if (!strcmp(a->symbols[i].name, name)) {
+            a->symbols[i].value = value;
+            return;
+        }
+    }
+    a->symbols = (struct asm_symbol *)realloc(
+        a->symbols, (a->symbol_count + 1) * sizeof(struct asm_symbol));
+    a->symbols[a->symbol_count].name = strdup(name);
+    a->symbols[a->symbol_count].value = value;
+    a->symbol_count++;
+}
+
+/**
+ * Looks up the value of a symbol.
+ * @param a The buffer
+ * @param name Name of the symbol
+ * @param value Where to store the value
+ * @return 0 if the symbol is undefined, 1 if OK
+ */
+int asm_lookup(const asm_buffer_t *a, const char *name, int *value)
+{
+    int i;
+    for (i = 0; i < a->symbol_count; ++i) {
+        if (!strcmp(a->symbols[i].name, name)) {
+            *value = a->symbols[i].value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Appends a string to the assembly text of the buffer.
+ */
+static void append_text(asm_buffer_t *a, const char *s)
+{
+    int len = strlen(s);
+    if (a->text_length + len + 1 > a->max_text_length) {
+        a->max_text_length += len + 4096;
+        a->text = (char *)realloc(a->text, a->max_text_length);
+    }
+    memcpy(&a->text[a->text_length], s, len + 1);
+    a->text_length += len;
+}
+
+/**
+ * Defines a label at the current location and writes it to the text.
+ * @param a The buffer
+ * @param fmt printf-style format string for the label name
+ */
+void asm_label(asm_buffer_t *a, const char *fmt, ...)
+{
+    char local[256];
+    char name[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(local, sizeof(local), fmt, ap);
+    va_end(ap);
+    expand_locals(a, local, name, sizeof(name), 0);
+    asm_define(a, name, a->origin + a->size);
+    asm_text(a, "%s:", name);
+}
+
+/**
+ * Writes a line of text (comment, directive, ...) that produces no code.
+ * @param a The buffer
+ * @param fmt printf-style format string
+ */
+void asm_text(asm_buffer_t *a, const char *fmt, ...)
+{
+    char line[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    append_text(a, line);
+    append_text(a, "\n");
+}
+
+/**
+ * Appends a byte of machine code.
+ */
+static void put_byte(asm_buffer_t *a, int value)
+{
+    if (a->size == a->max_size) {
+        a->max_size += 256;
+        a->code = (unsigned char *)realloc(a->code, a->max_size);
+    }
+    a->code[a->size++] = (unsigned char)value;
+}
+
+/**
+ * Emits an instruction.
+ * @param a The buffer
+ * @param encoding Encoding of the instruction (see top of file)
+ * @param fmt printf-style format string for the assembly text
+ */
+void asm_emit(asm_buffer_t *a, const char *encoding, const char *fmt, ...)
+{
+    char local[1024];
+    char line[1024];
+    char expanded_encoding[1024];
+    va_list ap;
+    const char *p;
+    int first_fixup = a->fixup_count;
+    int i;
+    /* Text */
+    va_start(ap, fmt);
+    vsnprintf(local, sizeof(local), fmt, ap);
+    va_end(ap);
+    expand_locals(a, local, line, sizeof(line), 1);
+    a->lines = (struct asm_line *)realloc(
+        a->lines, (a->line_count + 1) * sizeof(struct asm_line));
+    a->lines[a->line_count].text_offset = a->text_length + 1;
+    a->lines[a->line_count].offset = a->size;
+    asm_text(a, "\t%s", line);
+    expand_locals(a, encoding, expanded_encoding, sizeof(expanded_encoding), 0);
+    encoding = expanded_encoding;
+    /* Code */
+    for (p = encoding; *p; ) {
+        const char *q;
+        int kind;
+        int size;
+        if (*p == ' ') {
+            p++;
+            continue;
+        }
+        for (q = p; *q && (*q != ' '); q++) ;
+        if (isxdigit((unsigned char)p[0]) && (q - p == 2)) {
+            put_byte(a, strtol(p, NULL, 16));
+            p = q;
+            continue;
+        }
+        switch (*p++) {
+            case '#': kind = ASM_FIXUP_IMM8; size = 1; break;
+            case '<': kind = ASM_FIXUP_LO; size = 1; break;
+            case '>': kind = ASM_FIXUP_HI; size = 1; break;
+            case '^': kind = ASM_FIXUP_BANK; size = 1; break;
+            case '!': kind = ASM_FIXUP_WORD; size = 2; break;
+            case '@':
+                if (*p == '@') {
+                    p++;
+                    kind = ASM_FIXUP_REL16;
+                    size = 2;
+                } else {
+                    kind = ASM_FIXUP_REL8;
+                    size = 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "huffpuff: internal error: bad encoding `%s'\n",
+                        encoding);
+                abort();
+        }
+        a->fixups = (struct asm_fixup *)realloc(
+            a->fixups, (a->fixup_count + 1) * sizeof(struct asm_fixup));
+        a->fixups[a->fixup_count].offset = a->size;
+        a->fixups[a->fixup_count].kind = kind;
+        a->fixups[a->fixup_count].expr = (char *)malloc(q - p + 1);
+        memcpy(a->fixups[a->fixup_count].expr, p, q - p);
+        a->fixups[a->fixup_count].expr[q - p] = 0;
+        a->fixup_count++;
+        while (size--)
+            put_byte(a, 0);
+        p = q;
+    }
+    for (i = first_fixup; i < a->fixup_count; ++i)
+        a->fixups[i].next_pc = a->origin + a->size;
+    a->lines[a->line_count].size = a->size - a->lines[a->line_count].offset;
+    a->line_count++;
+}
+
+/**
+ * Evaluates an expression.
+ * @return 0 if the expression refers to an undefined symbol, 1 if OK
+ */
+static int evaluate(const asm_buffer_t *a, const char *expr, int *result)
+{
+    const char *p = expr;
+    int sign = 1;
+    *result = 0;
+    while (*p) {
+        int value;
+        if (*p == '$') {
+            value = strtol(p + 1, (char **)&p, 16);
+        } else if (*p == '%') {
+            value = strtol(p + 1, (char **)&p, 2);
+        } else if (isdigit((unsigned char)*p)) {
+            value = strtol(p, (char **)&p, 10);
+        } else {
+            char name[256];
+            int len = 0;
+            while (*p && (*p != '+') && (*p != '-') && (len < 255))
+                name[len++] = *(p++);
+            name[len] = 0;
+            if (!asm_lookup(a, name, &value)) {
+                fprintf(stderr, "error: generated code: undefined symbol `%s'\n", name);
+                return 0;
+            }
+        }
+        *result += sign * value;
+        if (*p == '+')
+            sign = 1;
+        else if (*p == '-')
+            sign = -1;
+        else
+            break;
+        p++;
+    }
+    return 1;
+}
+
+/**
+ * Checks that the text of an emitted line assembles to its machine code:
+ * the operands of a data directive must give its bytes, and any other
+ * operation must be a mnemonic.
+ * @return 0 if they differ, 1 if OK
+ */
+static int check_line(const asm_buffer_t *a, const struct asm_line *l)
+{
+    char line[1024];
+    char *op;
+    char *p;
+    int width;
+    int len;
+    int n = 0;
+    for (len = 0; a->text[l->text_offset + len] && (a->text[l->text_offset + len] != '\n')
+         && (len < (int)sizeof(line) - 1); len++)
+        line[len] = a->text[l->text_offset + len];
+    line[len] = 0;
+    op = line;
+    for (p = op; *p && !isspace((unsigned char)*p); p++) ;
+    if (*p)
+        *(p++) = 0;
+    if (!strcmp(op, ".db") || !strcmp(op, "db"))
+        width = 1;
+    else if (!strcmp(op, ".dw") || !strcmp(op, "dw"))
+        width = 2;
+    else {
+        for (p = op; *p; p++) {
+            if (!isalpha((unsigned char)*p))
+                break;
+        }
+        if (*p || (p == op)) {
+            fprintf(stderr, "error: generated code: `%s' is not an instruction\n", op);
+            return 0;
+        }
+        return 1;
+    }
+    while (*p) {
+        char expr[256];
+        int i = 0;
+        int value;
+        int part = 0;
+        while (isspace((unsigned char)*p))
+            p++;
+        if ((*p == '<') || (*p == '>'))
+            part = *(p++);
+        while (*p && (*p != ',') && !isspace((unsigned char)*p) && (i < 255))
+            expr[i++] = *(p++);
+        expr[i] = 0;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == ',')
+            p++;
+        if (!evaluate(a, expr, &value))
+            return 0;
+        if (part == '<')
+            value &= 0xFF;
+        else if (part == '>')
+            value = (value >> 8) & 0xFF;
+        if ((n + width > l->size)
+            || (a->code[l->offset + n] != (value & 0xFF))
+            || ((width == 2) && (a->code[l->offset + n + 1] != ((value >> 8) & 0xFF)))) {
+            fprintf(stderr, "error: generated code: `%s' does not match its encoding\n", line);
+            return 0;
+        }
+        n += width;
+    }
+    if (n != l->size) {
+        fprintf(stderr, "error: generated code: `%s' does not match its encoding\n", line);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Resolves all symbol references in the buffer's machine code.
+ * @param a The buffer
+ * @return 0 if fail, 1 if OK
+ */
+int asm_link(asm_buffer_t *a)
+{
+    int i;
+    int ok = 1;
+    for (i = 0; i < a->fixup_count; ++i) {
+        const struct asm_fixup *f = &a->fixups[i];
+        unsigned char *dest = &a->code[f->offset];
+        int value;
+        if (!evaluate(a, f->expr, &value)) {
+            ok = 0;
+            continue;
+        }
+        switch (f->kind) {
+            case ASM_FIXUP_IMM8:
+            if ((value < -128) || (value > 255)) {
+                fprintf(stderr, "error: generated code: value of `%s' out of range\n", f->expr);
+                ok = 0;
+            }
+            dest[0] = value & 0xFF;
+            break;
+            case ASM_FIXUP_LO:
+            dest[0] = value & 0xFF;
+            break;
+            case ASM_FIXUP_HI:
+            dest[0] = (value >> 8) & 0xFF;
+            break;
+            case ASM_FIXUP_BANK:
+            dest[0] = (value >> 16) & 0xFF;
+            break;
+            case ASM_FIXUP_WORD:
+            dest[0] = value & 0xFF;
+            dest[1] = (value >> 8) & 0xFF;
+            break;
+            case ASM_FIXUP_REL8:
+            value -= f->next_pc;
+            if ((value < -128) || (value > 127)) {
+                fprintf(stderr, "error: generated code: branch to `%s' out of range\n", f->expr);
+                ok = 0;
+            }
+            dest[0] = value & 0xFF;
+            break;
+            case ASM_FIXUP_REL16:
+            value -= f->next_pc;
+            dest[0] = value & 0xFF;
+            dest[1] = (value >> 8) & 0xFF;
+            break;
+        }
+    }
+    for (i = 0; ok && (i < a->line_count); ++i)
+        ok = check_line(a, &a->lines[i]);
+    return ok;
+}
+
+/**
+ * Writes the assembly text of the buffer to file.
+ * @param a The buffer
+ * @param out File to write to
+ */
+void asm_write(const asm_buffer_t *a, FILE *out)
+{
+    if (a->text_length)
+        fwrite(a->text, 1, a->text_length, out);
+}
@@ -0,0 +1,75 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASMGEN_H
+#define ASMGEN_H
+
+#include <stdio.h>
+
+/* A symbol known to the assembler buffer. */
+struct asm_symbol {
+    char *name;
+    int value;
+};
+
+/* A reference to a symbol that is resolved when the buffer is linked. */
+struct asm_fixup {
+    int offset;     /* where in the code to store the value */
+    int kind;       /* one of the ASM_FIXUP_* kinds */
+    int next_pc;    /* address of the following instruction */
+    char *expr;
+};
+
+/* An emitted line, kept so that its text can be checked against its code. */
+struct asm_line {
+    int text_offset;
+    int offset;
+    int size;
+};
+
+/* Generated code, kept both as assembly text and as machine code. */
+struct asm_buffer {
+    int origin;
+    char scope[128];
+    unsigned char *code;
+    int size;
+    int max_size;
+    char *text;
+    int text_length;
+    int max_text_length;
+    struct asm_symbol *symbols;
+    int symbol_count;
+    struct asm_fixup *fixups;
+    int fixup_count;
+    struct asm_line *lines;
+    int line_count;
+};
+
+typedef struct asm_buffer asm_buffer_t;
+
+void asm_init(asm_buffer_t *, int);
+void asm_free(asm_buffer_t *);
+void asm_scope(asm_buffer_t *, const char *);
+void asm_define(asm_buffer_t *, const char *, int);
+int asm_lookup(const asm_buffer_t *, const char *, int *);
+void asm_label(asm_buffer_t *, const char *, ...);
+void asm_text(asm_buffer_t *, const char *, ...);
+void asm_emit(asm_buffer_t *, const char *, const char *, ...);
+int asm_link(asm_buffer_t *);
+void asm_write(const asm_buffer_t *, FILE *);
+
+#endif  /* !ASMGEN_H */
@@ -0,0 +1,267 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the search for bucket boundaries.
+ *
+ * In bucket mode, the characters are sorted by frequency and split into
+ * consecutive groups whose sizes are powers of two. Each group is a leaf of
+ * the Huffman tree, and the index of a character in its group follows the
+ * code of the leaf as raw extra bits; a group of one character is an
+ * ordinary leaf. Rare characters thus cost a few extra bits each in the
+ * data, but no leaves of their own in the decoder table.
+ *
+ * The groups are chosen by dynamic programming on an estimate of the table
+ * and data size, in which the code length of a group is derived from its
+ * probability. This is done once for every limit on the group size; each
+ * of these candidates is then built and measured exactly, and the smallest
+ * one wins. The measure includes the decoder that the target CPU and table
+ * format need: a bucket decoder is larger than the plain one, so without a
+ * limit on the group size, which gives groups of one character only, the
+ * candidate is an ordinary Huffman tree.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include "bucket.h"
+#include "m65dec.h"
+#include "z80dec.h"
+
+/* A partition of the sorted characters into consecutive groups */
+struct partition {
+    int count;
+    int extra_bits[256];
+};
+
+/**
+ * Sorts the used characters by decreasing frequency.
+ * @param freq Character frequencies
+ * @param sorted Where to store the used characters
+ * @return Number of used characters
+ */
+static int sort_characters(const int *freq, int *sorted)
+{
+    int count = 0;
+    int i, j;
+    for (i = 0; i < 256; i++) {
+        if (freq[i] == 0)
+            continue;
+        /* Insertion sort; characters of equal frequency stay in order */
+        for (j = count; (j > 0) && (freq[sorted[j-1]] < freq[i]); j--)
+            sorted[j] = sorted[j-1];
+        sorted[j] = i;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Chooses the groups that minimise the estimated table and data size.
+ * @param freq Character frequencies
+ * @param sorted Used characters, sorted by decreasing frequency
+ * @param count Number of used characters
+ * @param max_extra_bits Maximum number of extra bits of a group
+ * @param part Where to store the groups
+ */
+static void estimate_partition(const int *freq, const int *sorted, int count,
+                               int max_extra_bits, struct partition *part)
+{
+    double cost[257];
+    int choice[257];
+    long prefix[257];
+    double total;
+    int i, j;
+    prefix[0] = 0;
+    for (i = 0; i < count; i++)
+        prefix[i+1] = prefix[i] + freq[sorted[i]];
+    total = (double)prefix[count];
+    cost[0] = 0;
+    for (j = 1; j <= count; j++) {
+        int e;
+        cost[j] = -1;
+        for (e = 0; (e <= max_extra_bits) && ((1 << e) <= j); e++) {
+            int size = 1 << e;
+            double weight = (double)(prefix[j] - prefix[j - size]);
+            /* The code and extra bits of every occurrence, plus the leaf
+               and its parent node in the table */
+            double c = cost[j - size]
+                + weight * (log(total / weight) / log(2) + e)
+                + 8 * (2 + 2 + size);
+            if ((cost[j] < 0) || (c < cost[j])) {
+                cost[j] = c;
+                choice[j] = e;
+            }
+        }
+    }
+    /* Trace back the groups, then put them in order */
+    part->count = 0;
+    for (j = count; j > 0; j -= 1 << choice[j])
+        part->extra_bits[part->count++] = choice[j];
+    for (i = 0; i < part->count / 2; i++) {
+        int tmp = part->extra_bits[i];
+        part->extra_bits[i] = part->extra_bits[part->count - 1 - i];
+        part->extra_bits[part->count - 1 - i] = tmp;
+    }
+}
+
+/**
+ * Builds the Huffman tree for a partition. The leaves are buckets unless
+ * every group holds a single character.
+ * @param freq Character frequencies
+ * @param sorted Used characters, sorted by decreasing frequency
+ * @param part The groups
+ * @param codes Where to store the mapping from character to leaf
+ * @return Root of the tree
+ */
+static huffman_node_t *build_tree(const int *freq, const int *sorted,
+                                  const struct partition *part,
+                                  huffman_node_t **codes)
+{
+    huffman_node_t *leaves[256];
+    int buckets = 0;
+    int i, g, k;
+    for (i = 0; i < 256; i++)
+        codes[i] = 0;
+    for (g = 0; g < part->count; g++) {
+        if (part->extra_bits[g])
+            buckets = 1;
+    }
+    for (g = 0, k = 0; g < part->count; g++) {
+        huffman_node_t *node;
+        int size = 1 << part->extra_bits[g];
+        node = huffman_create_node(
+            /*symbol=*/sorted[k], /*weight=*/0,
+            /*left=*/NULL, /*right=*/NULL);
+        if (buckets) {
+            node->bucket = (struct huffman_bucket *)malloc(sizeof(struct huffman_bucket));
+            node->bucket->extra_bits = part->extra_bits[g];
+        }
+        for (i = 0; i < size; i++, k++) {
+            if (buckets)
+                node->bucket->symbols[i] = sorted[k];
+            node->weight += freq[sorted[k]];
+            codes[sorted[k]] = node;
+        }
+        leaves[g] = node;
+    }
+    return huffman_build_tree(leaves, part->count);
+}
+
+/**
+ * Measures the size of the decoder table, the generated decoder and the
+ * encoded strings. The table format is chosen as it is for the output:
+ * rel8 if its offsets reach every node, else the smaller of the others.
+ * @param root Root of the tree
+ * @param codes Mapping from character to leaf
+ * @param head Strings
+ * @param charmap Character map
+ * @param cpu CPU_6502, CPU_SM83 or CPU_Z80
+ * @param table_format Format of the interior nodes, or TABLE_AUTO
+ * @param decoder DECODER_TABLE, or DECODER_CODE for the tree-as-code 6502 decoder
+ * @return Total size in bytes, or -1 if the table does not fit the format
+ */
+static int measure(huffman_node_t *root, huffman_node_t * const *codes,
+                   const string_list_t *head, const unsigned short *charmap,
+                   int cpu, int table_format, int decoder)
+{
+    const string_list_t *str;
+    int size = -1;
+    int format;
+    for (format = TABLE_REL8; format <= TABLE_ABS16; format++) {
+        int table_size;
+        int code_size;
+        double cycles;
+        int ok;
+        if ((table_format != TABLE_AUTO) && (format != table_format))
+            continue;
+        table_size = huffman_table_image(root, charmap, NULL, cpu, format, 0, NULL);
+        if (table_size < 0)
+            continue;
+        /* Build the decoder without running it, for its size */
+        if (cpu == CPU_6502) {
+            ok = m65dec_validate(cpu, root, charmap, NULL, format, decoder, 0,
+                                 NULL, NULL, &code_size, &cycles);
+        } else {
+            ok = z80dec_validate(cpu, root, charmap, NULL, format, 0,
+                                 NULL, NULL, &code_size, &cycles);
+        }
+        if (!ok)
+            continue;
+        /* The tree-as-code decoder holds the tree itself */
+        if (decoder == DECODER_CODE)
+            table_size = 0;
+        if ((size < 0) || (table_size + code_size < size))
+            size = table_size + code_size;
+        if (format == TABLE_REL8)
+            break;
+    }
+    if (size < 0)
+        return -1;
+    for (str = head; str != NULL; str = str->next) {
+        long bits = 0;
+        int i;
+        for (i = 0; i < str->length; i++) {
+            const huffman_node_t *leaf = codes[str->symbols[i]];
+            bits += leaf->code.length;
+            if (leaf->bucket)
+                bits += leaf->bucket->extra_bits;
+        }
+        size += (bits + 7) / 8;
+    }
+    return size;
+}
+
+/**
+ * Builds a Huffman tree whose leaves are buckets of characters, or an
+ * ordinary Huffman tree if that takes less space with its decoder.
+ * @param freq Character frequencies
+ * @param head Strings to encode
+ * @param charmap Character map
+ * @param cpu CPU_6502, CPU_SM83 or CPU_Z80
+ * @param table_format Format of the interior nodes, or TABLE_AUTO
+ * @param decoder DECODER_TABLE or DECODER_CODE
+ * @param codes Where to store the mapping from character to leaf
+ * @param leaf_count Where to store the number of leaves
+ * @return Root of the tree
+ */
+huffman_node_t *bucket_build_tree(const int *freq, const string_list_t *head,
+                                  const unsigned short *charmap, int cpu,
+                                  int table_format, int decoder,
+                                  huffman_node_t **codes, int *leaf_count)
+{
+    int sorted[256];
+    int count;
+    struct partition part;
+    struct partition best;
+    int best_size = -1;
+    int e;
+    count = sort_characters(freq, sorted);
+    estimate_partition(freq, sorted, count, 0, &best);
+    for (e = 0; e <= HUFFMAN_MAX_EXTRA_BITS; e++) {
+        huffman_node_t *root;
+        int size;
+        estimate_partition(freq, sorted, count, e, &part);
+        root = build_tree(freq, sorted, &part, codes);
+        size = measure(root, codes, head, charmap, cpu, table_format, decoder);
+        if ((size >= 0) && ((best_size < 0) || (size < best_size))) {
+            best = part;
+            best_size = size;
+        }
+        huffman_delete_node(root);
+    }
+    *leaf_count = best.count;
+    return build_tree(freq, sorted, &best, codes);
+}
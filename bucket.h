@@ -0,0 +1,27 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BUCKET_H
+#define BUCKET_H
+
+#include "huffpuff.h"
+
+huffman_node_t *bucket_build_tree(const int *, const string_list_t *,
+                                  const unsigned short *, int, int, int,
+                                  huffman_node_t **, int *);
+
+#endif  /* !BUCKET_H */
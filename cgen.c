@@ -0,0 +1,246 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the C output, for ports that run on a host CPU.
+ *
+ * The outputs are C headers. The decoder table is an array of the
+ * children of the interior nodes in breadth-first order, with the leaf
+ * values in an array of their own. The strings are kept in one array, so
+ * that a string can be addressed as an offset into it, and it is followed
+ * by padding for the read-ahead of the decoder.
+ *
+ * The decoder is specialised to the tree: the first bits of a code select
+ * a case of a switch, and the rest of the tree becomes nested tests of
+ * single bits, with every bit position and code length a constant. The
+ * bits are kept left-aligned in a 32-bit buffer that holds at least
+ * CGEN_MAX_CODE_LENGTH bits before a code is decoded.
+ */
+
+#include <stdlib.h>
+#include "cgen.h"
+
+/* How many bits select a case of the switch, at most */
+#define SWITCH_BITS 8
+
+/**
+ * Determines the length of the longest code of a tree.
+ * @param node Root of the tree
+ * @return The length in bits
+ */
+int cgen_code_length(const huffman_node_t *node)
+{
+    int left, right;
+    if (node->symbol != -1)
+        return 0;
+    left = cgen_code_length(node->left);
+    right = cgen_code_length(node->right);
+    return 1 + ((left > right) ? left : right);
+}
+
+/**
+ * Writes the decoder table: the children of every interior node, where a
+ * child below $8000 is an interior node and $8000 plus an index is a leaf
+ * value, followed by the leaf values.
+ * @param out File to write to
+ * @param label Name of the table; the values are <label>_values
+ * @param root Root of Huffman tree
+ * @param charmap Character map
+ */
+void cgen_write_table(FILE *out, const char *label, huffman_node_t *root,
+                      const unsigned short *charmap)
+{
+    huffman_node_t **queue;
+    int *index;
+    int count = 1;
+    int interior = 0;
+    int leaves = 0;
+    int i;
+    queue = (huffman_node_t **)malloc(2 * HUFFMAN_MAX_SYMBOLS * sizeof(huffman_node_t *));
+    index = (int *)malloc(2 * HUFFMAN_MAX_SYMBOLS * sizeof(int));
+    /* Number the interior nodes and the leaves in breadth-first order */
+    queue[0] = root;
+    for (i = 0; i < count; i++) {
+        if (queue[i]->symbol == -1) {
+            index[i] = interior++;
+            queue[count++] = queue[i]->left;
+            queue[count++] = queue[i]->right;
+        } else {
+            index[i] = 0x8000 | leaves++;
+        }
+    }
+    /* The children of the n-th interior node were queued at 2n+1 and 2n+2 */
+    fprintf(out, "static const unsigned short %s[][2] = {\n", label);
+    for (i = 0; i < interior; i++)
+        fprintf(out, "    { 0x%.4X, 0x%.4X },\n", index[2 * i + 1], index[2 * i + 2]);
+    if (!interior)
+        fprintf(out, "    { 0x8000, 0x8000 }\n");
+    fprintf(out, "};\n");
+    fprintf(out, "static const unsigned short %s_values[] = {\n", label);
+    for (i = 0; i < count; i++) {
+        if (queue[i]->symbol != -1)
+            fprintf(out, "    0x%.4X,\n", charmap[queue[i]->symbol]);
+    }
+    fprintf(out, "};\n");
+    free(index);
+    free(queue);
+}
+
+/**
+ * Writes the encoded strings as one array, and a string pointer table.
+ * @param out File to write to
+ * @param label_prefix Prefix of the names
+ * @param pointer_label Name of the string pointer table, or NULL for none
+ * @param head Encoded strings
+ * @param labels Nonzero to define <label_prefix>String<n> for every string
+ */
+void cgen_write_strings(FILE *out, const char *label_prefix, const char *pointer_label,
+                        const string_list_t *head, int labels)
+{
+    const string_list_t *str;
+    long offset;
+    int i, j;
+    fprintf(out, "static const unsigned char %sStrings[] = {\n", label_prefix);
+    for (i = 0, str = head; str != NULL; str = str->next, i++) {
+        fprintf(out, "    /* String%d */\n", i);
+        for (j = 0; j < str->huff_size; j++) {
+            fprintf(out, "%s0x%.2X,", ((j % 16) == 0) ? "    " : " ", str->huff_data[j]);
+            if (((j % 16) == 15) || (j == str->huff_size - 1))
+                fprintf(out, "\n");
+        }
+    }
+    fprintf(out, "    /* read-ahead of the decoder */\n");
+    fprintf(out, "    0x00, 0x00, 0x00, 0x00\n");
+    fprintf(out, "};\n");
+    if (labels) {
+        for (i = 0, offset = 0, str = head; str != NULL; str = str->next, i++) {
+            fprintf(out, "#define %sString%d (%sStrings + %ld)\n",
+                    label_prefix, i, label_prefix, offset);
+            offset += str->huff_size;
+        }
+    }
+    if (pointer_label) {
+        fprintf(out, "static const unsigned char *const %s[] = {\n", pointer_label);
+        for (offset = 0, str = head; str != NULL; str = str->next) {
+            fprintf(out, "    %sStrings + %ld,\n", label_prefix, offset);
+            offset += str->huff_size;
+        }
+        fprintf(out, "};\n");
+    }
+}
+
+/**
+ * Writes the code that decodes a subtree whose first bits have been tested.
+ * @param out File to write to
+ * @param node Root of the subtree
+ * @param depth Length of the code of the node
+ * @param charmap Character map
+ * @param indent Indentation of the code
+ */
+static void write_subtree(FILE *out, const huffman_node_t *node, int depth,
+                          const unsigned short *charmap, int indent)
+{
+    if (node->symbol != -1) {
+        fprintf(out, "%*ss->bits = (b << %d) & 0xFFFFFFFFUL;\n", indent, "", depth);
+        fprintf(out, "%*ss->count -= %d;\n", indent, "", depth);
+        fprintf(out, "%*sreturn 0x%.2X;\n", indent, "", charmap[node->symbol]);
+        return;
+    }
+    fprintf(out, "%*sif (b & 0x%.8lXUL) {\n", indent, "", 0x80000000UL >> depth);
+    write_subtree(out, node->right, depth + 1, charmap, indent + 4);
+    fprintf(out, "%*s} else {\n", indent, "");
+    write_subtree(out, node->left, depth + 1, charmap, indent + 4);
+    fprintf(out, "%*s}\n", indent, "");
+}
+
+/**
+ * Writes the cases of the switch for the subtrees at a given depth.
+ * @param out File to write to
+ * @param node Root of the subtree
+ * @param depth Length of the code of the node
+ * @param code The code of the node
+ * @param bits Number of bits that the switch tests
+ * @param charmap Character map
+ */
+static void write_cases(FILE *out, const huffman_node_t *node, int depth,
+                        unsigned long code, int bits, const unsigned short *charmap)
+{
+    unsigned long first, last;
+    if ((node->symbol == -1) && (depth < bits)) {
+        write_cases(out, node->left, depth + 1, code << 1, bits, charmap);
+        write_cases(out, node->right, depth + 1, (code << 1) | 1, bits, charmap);
+        return;
+    }
+    /* A leaf above the depth of the switch covers several cases */
+    first = code << (bits - depth);
+    last = first + (1UL << (bits - depth)) - 1;
+    for (; first <= last; first++) {
+        fprintf(out, "%s0x%.2lX:", ((first & 7) == 0) || (first == code << (bits - depth))
+                ? "    case " : " case ", first);
+        if (((first & 7) == 7) || (first == last))
+            fprintf(out, "\n");
+    }
+    write_subtree(out, node, depth, charmap, 8);
+}
+
+/**
+ * Writes a C decoder specialised to a tree. It is used as:
+ *   struct <label>_state s;
+ *   <label>_start(&s, data);
+ *   c = <label>(&s);   (once for every character)
+ * @param out File to write to
+ * @param label Name of the decoder
+ * @param root Root of Huffman tree; no code may be longer than
+ *        CGEN_MAX_CODE_LENGTH bits
+ * @param charmap Character map
+ */
+void cgen_write_decoder(FILE *out, const char *label, const huffman_node_t *root,
+                        const unsigned short *charmap)
+{
+    int bits = cgen_code_length(root);
+    if (bits > SWITCH_BITS)
+        bits = SWITCH_BITS;
+    fprintf(out, "struct %s_state {\n", label);
+    fprintf(out, "    const unsigned char *data;  /* next byte to read */\n");
+    fprintf(out, "    unsigned long bits;         /* next bits, left-aligned in 32 bits */\n");
+    fprintf(out, "    int count;                  /* number of bits in bits */\n");
+    fprintf(out, "};\n\n");
+    fprintf(out, "/* Starts decoding a string. */\n");
+    fprintf(out, "static void %s_start(struct %s_state *s, const unsigned char *data)\n", label, label);
+    fprintf(out, "{\n");
+    fprintf(out, "    s->data = data;\n");
+    fprintf(out, "    s->bits = 0;\n");
+    fprintf(out, "    s->count = 0;\n");
+    fprintf(out, "}\n\n");
+    fprintf(out, "/* Decodes the next character of the string. */\n");
+    fprintf(out, "static unsigned %s(struct %s_state *s)\n", label, label);
+    fprintf(out, "{\n");
+    fprintf(out, "    unsigned long b;\n");
+    fprintf(out, "    while (s->count <= 24) {\n");
+    fprintf(out, "        s->bits |= (unsigned long)*s->data++ << (24 - s->count);\n");
+    fprintf(out, "        s->count += 8;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    b = s->bits;\n");
+    if (bits == 0) {
+        write_subtree(out, root, 0, charmap, 4);
+    } else {
+        fprintf(out, "    switch ((unsigned)(b >> %d)) {\n", 32 - bits);
+        write_cases(out, root, 0, 0, bits, charmap);
+        fprintf(out, "    }\n");
+        fprintf(out, "    return 0;  /* not reached */\n");
+    }
+    fprintf(out, "}\n");
+}
@@ -0,0 +1,32 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CGEN_H
+#define CGEN_H
+
+#include <stdio.h>
+#include "huffpuff.h"
+
+/* Longest code the C decoder can read */
+#define CGEN_MAX_CODE_LENGTH 25
+
+int cgen_code_length(const huffman_node_t *);
+void cgen_write_table(FILE *, const char *, huffman_node_t *, const unsigned short *);
+void cgen_write_strings(FILE *, const char *, const char *, const string_list_t *, int);
+void cgen_write_decoder(FILE *, const char *, const huffman_node_t *, const unsigned short *);
+
+#endif  /* !CGEN_H */
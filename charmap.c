@@ -21,8 +21,11 @@
  *
  * key=value
  * OR: keylo-keyhi=value (specifies a range of keys starting at value)
+ * OR: key=value,value,... (maps the key to a sequence of bytes)
  *
- * where key is a character or C escape sequence, and value is an integer.
+ * where key is a character or C escape sequence, and value is an integer
+ * (0..65535; values above 255 are only useful for 16-bit targets).
+ * The values of a sequence must be bytes.
  * # is considered the start of a comment; the rest of the line is ignored.
  *
  * Examples:
@@ -31,6 +34,8 @@
  * # map some punctuation
  * !=0x60
  * ?=0x63
+ * # a wide letter made of two tiles
+ * W=$45,$46
  */
 
 #include <stdio.h>
@@ -110,24 +115,27 @@ static int get_key(char *s, int *i, unsigned char *d)
 /**
  * Parses a value.
  * @param s Pointer to first character of value
+ * @param end Where to store a pointer to the first character after the value
  */
-static unsigned char get_value(char *s)
+static long get_value(char *s, char **end)
 {
     if (s[0] == '$') {
-        return strtol(&s[1], NULL, 16);
+        return strtol(&s[1], end, 16);
     } else if (s[0] == '%') {
-        return strtol(&s[1], NULL, 2);
+        return strtol(&s[1], end, 2);
     }
-    return strtol(s, NULL, 0);
+    return strtol(s, end, 0);
 }
 
 /**
  * Parses a character map from file.
  * @param filename Name of the character map file
- * @param map 256-byte buffer where parsed map shall be stored
+ * @param map 256-entry buffer where parsed map shall be stored
+ * @param sequences 256-entry buffer where byte sequences shall be stored
  * @return 0 if fail, 1 if OK
  */
-int charmap_parse(const char *filename, unsigned char *map)
+int charmap_parse(const char *filename, unsigned short *map,
+                  charmap_sequence_t *sequences)
 {
     int lineno;
     FILE *fp;
@@ -143,7 +151,10 @@ int charmap_parse(const char *filename, unsigned char *map)
     while (fgets(line, 1023, fp) != NULL) {
         unsigned char key;
         unsigned char hkey;
-        unsigned char value;
+        long value;
+        char *end;
+        char *error;
+        charmap_sequence_t seq;
         int i;
         /* Increase line number */
         lineno++;
@@ -192,10 +203,53 @@ int charmap_parse(const char *filename, unsigned char *map)
             return 0;
         }
         /* Read value */
-        value = get_value(&line[i]);
+        value = get_value(&line[i], &end);
+        if ((value < 0) || (value + (hkey - key) > 0xFFFF)) {
+            maperr(filename, lineno, "value out of range");
+            continue;
+        }
+        /* Read the rest of a sequence */
+        seq.length = 0;
+        error = 0;
+        while (1) {
+            i = 0;
+            eat_ws(end, &i);
+            if ((end[i] != ',') && (seq.length == 0))
+                break;  /* a single value */
+            if (value > 0xFF) {
+                error = "sequence value out of range";
+                break;
+            }
+            if (seq.length == CHARMAP_MAX_SEQUENCE) {
+                error = "sequence too long";
+                break;
+            }
+            seq.bytes[seq.length++] = (unsigned char)value;
+            if (end[i] != ',')
+                break;
+            /* Eat , */
+            i++;
+            eat_ws(end, &i);
+            value = get_value(&end[i], &end);
+            if (value < 0) {
+                error = "sequence value out of range";
+                break;
+            }
+        }
+        if (!error && seq.length && (hkey != key))
+            error = "a range cannot be mapped to a sequence";
+        if (error) {
+            maperr(filename, lineno, error);
+            continue;
+        }
+        if (seq.length)
+            value = seq.bytes[0];
         /* Store mapping(s) */
         for (; key <= hkey; key++) {
-            map[key] = value++;
+            map[key] = (unsigned short)value++;
+            sequences[key] = seq;
+            if (key == 0xFF)
+                break;
         }
     }
     /* Close the file */
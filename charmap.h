@@ -18,6 +18,17 @@
 #ifndef CHARMAP_H
 #define CHARMAP_H
 
-int charmap_parse(const char *, unsigned char *);
+/* Maximum number of bytes a character can be mapped to */
+#define CHARMAP_MAX_SEQUENCE 16
+
+/* A sequence of output bytes for one character */
+struct charmap_sequence {
+    int length;     /* 0 if the character is mapped to a single value */
+    unsigned char bytes[CHARMAP_MAX_SEQUENCE];
+};
+
+typedef struct charmap_sequence charmap_sequence_t;
+
+int charmap_parse(const char *, unsigned short *, charmap_sequence_t *);
 
 #endif  /* !CHARMAP_H */
@@ -0,0 +1,409 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the context-mixing codec, for text that is read
+ * rarely and should take as little space as possible.
+ *
+ * A character is coded as the branches taken on the path from the root of
+ * the Huffman tree to its leaf, and every branch is coded with a binary
+ * arithmetic coder. The probability of a branch is kept in an 8-bit
+ * counter that adapts as the string is decoded; the counter is chosen by
+ * a hash of the node and the previous leaf, so every node has its own
+ * statistics for every character that precedes it, as far as the 512
+ * counters go.
+ *
+ * The counters start from values in ROM, which are the statistics of all
+ * strings: the order-1 counts of every counter, with the order-0 counts
+ * of its node standing in where a counter has seen little. So every
+ * string can be decoded on its own, starting with a model of the others.
+ *
+ * The arithmetic coder works on 24-bit bounds and shifts out a byte when
+ * the top bytes of the bounds are equal. At the end of a string, the
+ * fewest bytes are written that make any bytes that follow decode right.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cm.h"
+
+/* How fast the counters adapt: they move 1/2^CM_RATE of the way */
+#define CM_RATE 4
+
+/* Largest hash shift that is tried */
+#define MAX_HASH_SHIFT 7
+
+/* Counts of the branches taken at a counter */
+struct branch_counts {
+    long n[2];
+};
+
+/* Path from the root to a leaf */
+struct path {
+    int length;
+    unsigned char nodes[CM_MAX_LEAVES];
+    unsigned char bits[CM_MAX_LEAVES];
+};
+
+/* State of the arithmetic coder */
+struct coder {
+    unsigned long x1;
+    unsigned long x2;
+    unsigned long x;        /* decoder only */
+    unsigned char *out;     /* encoder only */
+    int size;
+    int max_size;
+    const unsigned char *in;    /* decoder only */
+    int in_size;
+    int pos;
+};
+
+/**
+ * Numbers the nodes of the tree breadth-first.
+ * @return 0 if the tree has too many leaves, 1 if OK
+ */
+static int number_nodes(huffman_node_t *root, const int *symbols, cm_model_t *model)
+{
+    huffman_node_t *queue[CM_MAX_LEAVES];
+    int head = 0;
+    int i;
+    model->node_count = 0;
+    model->leaf_count = 0;
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++)
+        model->leaves[i] = -1;
+    queue[model->node_count++] = root;
+    while (head < model->node_count) {
+        huffman_node_t *node = queue[head];
+        int side;
+        for (side = 0; side < 2; side++) {
+            huffman_node_t *child = side ? node->right : node->left;
+            if (child->left) {
+                if (model->node_count == CM_MAX_LEAVES - 1)
+                    return 0;
+                model->children[side][head] = (unsigned char)model->node_count;
+                queue[model->node_count++] = child;
+            } else {
+                if (model->leaf_count == CM_MAX_LEAVES)
+                    return 0;
+                model->children[side][head] = (unsigned char)(CM_LEAF + model->leaf_count);
+                model->leaf_symbols[model->leaf_count] = child->symbol;
+                model->leaves[child->symbol] = model->leaf_count++;
+            }
+        }
+        head++;
+    }
+    /* Characters that share a leaf */
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++)
+        model->leaves[i] = model->leaves[symbols[i]];
+    return 1;
+}
+
+/**
+ * Finds the path from the root to every leaf.
+ */
+static void find_paths(const cm_model_t *model, struct path *paths)
+{
+    struct path here;
+    int depth = 0;
+    /* Depth-first walk that keeps the branches taken */
+    here.nodes[0] = 0;
+    here.bits[0] = 0;
+    for (;;) {
+        int child = model->children[here.bits[depth]][here.nodes[depth]];
+        if (!(child & CM_LEAF)) {
+            depth++;
+            here.nodes[depth] = (unsigned char)child;
+            here.bits[depth] = 0;
+            continue;
+        }
+        paths[child - CM_LEAF] = here;
+        paths[child - CM_LEAF].length = depth + 1;
+        /* Back up past the right branches, and take the next one */
+        while ((depth >= 0) && here.bits[depth])
+            depth--;
+        if (depth < 0)
+            break;
+        here.bits[depth] = 1;
+    }
+}
+
+/**
+ * Returns the counter of a node after a given leaf.
+ */
+static int counter_index(const cm_model_t *model, int node, int previous)
+{
+    return (node ^ (previous << model->hash_shift)) & (CM_COUNTERS - 1);
+}
+
+/**
+ * Sets the start values of the counters from the strings.
+ */
+static void prime_counters(cm_model_t *model, const string_list_t *head,
+                           const struct path *paths)
+{
+    static struct branch_counts counts[CM_COUNTERS];
+    struct branch_counts node_counts[CM_MAX_LEAVES];
+    int owner[CM_COUNTERS];
+    const string_list_t *str;
+    int i, j;
+    memset(counts, 0, sizeof(counts));
+    memset(node_counts, 0, sizeof(node_counts));
+    for (i = 0; i < CM_COUNTERS; i++)
+        owner[i] = -1;
+    for (str = head; str != NULL; str = str->next) {
+        int previous = 0;
+        for (i = 0; i < str->length; i++) {
+            const struct path *path = &paths[model->leaves[str->symbols[i]]];
+            for (j = 0; j < path->length; j++) {
+                int k = counter_index(model, path->nodes[j], previous);
+                counts[k].n[path->bits[j]]++;
+                node_counts[path->nodes[j]].n[path->bits[j]]++;
+                owner[k] = path->nodes[j];
+            }
+            previous = model->leaves[str->symbols[i]];
+        }
+    }
+    for (i = 0; i < CM_COUNTERS; i++) {
+        /* Start from the node's own statistics, worth two observations */
+        double p0 = 0.5;
+        double p;
+        int v;
+        if (owner[i] != -1) {
+            const struct branch_counts *nc = &node_counts[owner[i]];
+            p0 = (nc->n[1] + 0.5) / (nc->n[0] + nc->n[1] + 1.0);
+        }
+        p = (counts[i].n[1] + 2 * p0) / (counts[i].n[0] + counts[i].n[1] + 2.0);
+        v = (int)(p * 256 + 0.5);
+        model->counters[i] = (unsigned char)((v < 1) ? 1 : (v > 255) ? 255 : v);
+    }
+}
+
+/**
+ * Moves a counter towards the branch taken.
+ */
+static void adapt(unsigned char *counter, int bit)
+{
+    if (bit)
+        *counter += (256 - *counter) >> CM_RATE;
+    else
+        *counter -= *counter >> CM_RATE;
+}
+
+/**
+ * Returns the bound between the two branches.
+ */
+static unsigned long split(const struct coder *c, int p)
+{
+    return c->x1 + (((c->x2 - c->x1) * p) >> 8);
+}
+
+/**
+ * Appends a byte to the encoded data.
+ */
+static void put_byte(struct coder *c, int value)
+{
+    if (c->size == c->max_size) {
+        c->max_size = c->max_size ? 2 * c->max_size : 16;
+        c->out = (unsigned char *)realloc(c->out, c->max_size);
+    }
+    c->out[c->size++] = (unsigned char)value;
+}
+
+/**
+ * Codes one branch.
+ * @param c The coder
+ * @param bit The branch
+ * @param p Probability of the right branch, in 256ths
+ */
+static void encode_bit(struct coder *c, int bit, int p)
+{
+    unsigned long xmid = split(c, p);
+    if (bit)
+        c->x2 = xmid;
+    else
+        c->x1 = xmid + 1;
+    while (((c->x1 ^ c->x2) & 0xFF0000) == 0) {
+        put_byte(c, c->x2 >> 16);
+        c->x1 = (c->x1 << 8) & 0xFFFFFF;
+        c->x2 = ((c->x2 << 8) & 0xFFFFFF) | 0xFF;
+    }
+}
+
+/**
+ * Writes the fewest bytes that make any bytes that follow decode to a
+ * value within the bounds.
+ */
+static void flush(struct coder *c)
+{
+    int bytes;
+    for (bytes = 1; bytes < 3; bytes++) {
+        unsigned long unit = 1UL << (24 - 8 * bytes);
+        unsigned long v = (c->x1 + unit - 1) & ~(unit - 1);
+        if (v + unit - 1 <= c->x2)
+            break;
+    }
+    {
+        unsigned long unit = 1UL << (24 - 8 * bytes);
+        unsigned long v = (c->x1 + unit - 1) & ~(unit - 1);
+        int i;
+        for (i = 0; i < bytes; i++)
+            put_byte(c, (v >> (16 - 8 * i)) & 0xFF);
+    }
+}
+
+/**
+ * Codes one string.
+ * @return Size of the encoded string
+ */
+static int encode_string(string_list_t *str, const cm_model_t *model,
+                         const struct path *paths)
+{
+    unsigned char counters[CM_COUNTERS];
+    struct coder c;
+    int previous = 0;
+    int i, j;
+    memcpy(counters, model->counters, CM_COUNTERS);
+    c.x1 = 0;
+    c.x2 = 0xFFFFFF;
+    c.out = NULL;
+    c.size = c.max_size = 0;
+    for (i = 0; i < str->length; i++) {
+        int leaf = model->leaves[str->symbols[i]];
+        const struct path *path = &paths[leaf];
+        for (j = 0; j < path->length; j++) {
+            unsigned char *counter = &counters[counter_index(model, path->nodes[j], previous)];
+            encode_bit(&c, path->bits[j], *counter);
+            adapt(counter, path->bits[j]);
+        }
+        previous = leaf;
+    }
+    flush(&c);
+    free(str->huff_data);
+    str->huff_data = c.out;
+    str->huff_size = c.size;
+    return c.size;
+}
+
+/**
+ * Builds the model of a set of strings: numbers the nodes of their
+ * Huffman tree, chooses the hash that codes them in the fewest bytes, and
+ * sets the start values of the counters.
+ * @param root Root of Huffman tree; it must have two leaves at least
+ * @param head Parsed strings
+ * @param symbols Mapping from symbol to the symbol of its leaf
+ * @param model Where to store the model
+ * @return 0 if the tree has more than CM_MAX_LEAVES leaves, 1 if OK
+ */
+int cm_build_model(huffman_node_t *root, string_list_t *head, const int *symbols,
+                   cm_model_t *model)
+{
+    static struct path paths[CM_MAX_LEAVES];
+    int best_shift = 0;
+    int best_size = -1;
+    int shift;
+    if (!root->left || !number_nodes(root, symbols, model))
+        return 0;
+    find_paths(model, paths);
+    for (shift = 0; shift <= MAX_HASH_SHIFT; shift++) {
+        string_list_t *str;
+        int size = 0;
+        model->hash_shift = shift;
+        prime_counters(model, head, paths);
+        for (str = head; str != NULL; str = str->next)
+            size += encode_string(str, model, paths);
+        if ((best_size == -1) || (size < best_size)) {
+            best_size = size;
+            best_shift = shift;
+        }
+    }
+    model->hash_shift = best_shift;
+    prime_counters(model, head, paths);
+    return 1;
+}
+
+/**
+ * Codes the strings with a model.
+ * @param head Parsed strings
+ * @param model The model
+ * @return Total size of the encoded strings
+ */
+int cm_encode_strings(string_list_t *head, const cm_model_t *model)
+{
+    static struct path paths[CM_MAX_LEAVES];
+    string_list_t *str;
+    int size = 0;
+    find_paths(model, paths);
+    for (str = head; str != NULL; str = str->next)
+        size += encode_string(str, model, paths);
+    return size;
+}
+
+/**
+ * Returns the next byte of encoded data; past its end, zero.
+ */
+static int get_byte(struct coder *c)
+{
+    return (c->pos < c->in_size) ? c->in[c->pos++] : 0;
+}
+
+/**
+ * Decodes a string that was coded with a model.
+ * @param model The model
+ * @param data Encoded data
+ * @param size Size of encoded data
+ * @param len Number of symbols in string
+ * @param out Where to store decoded symbols
+ */
+void cm_decode(const cm_model_t *model, const unsigned char *data, int size,
+               int len, int *out)
+{
+    unsigned char counters[CM_COUNTERS];
+    struct coder c;
+    int previous = 0;
+    int i;
+    memcpy(counters, model->counters, CM_COUNTERS);
+    c.in = data;
+    c.in_size = size;
+    c.pos = 0;
+    c.x1 = 0;
+    c.x2 = 0xFFFFFF;
+    c.x = get_byte(&c) << 16;
+    c.x |= get_byte(&c) << 8;
+    c.x |= get_byte(&c);
+    for (i = 0; i < len; i++) {
+        int node = 0;
+        int child;
+        do {
+            unsigned char *counter = &counters[counter_index(model, node, previous)];
+            unsigned long xmid = split(&c, *counter);
+            int bit = (c.x <= xmid);
+            if (bit)
+                c.x2 = xmid;
+            else
+                c.x1 = xmid + 1;
+            adapt(counter, bit);
+            while (((c.x1 ^ c.x2) & 0xFF0000) == 0) {
+                c.x1 = (c.x1 << 8) & 0xFFFFFF;
+                c.x2 = ((c.x2 << 8) & 0xFFFFFF) | 0xFF;
+                c.x = ((c.x << 8) & 0xFFFFFF) | get_byte(&c);
+            }
+            child = model->children[bit][node];
+            node = child;
+        } while (!(child & CM_LEAF));
+        previous = child - CM_LEAF;
+        out[i] = model->leaf_symbols[previous];
+    }
+}
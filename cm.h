@@ -0,0 +1,49 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CM_H
+#define CM_H
+
+#include "huffpuff.h"
+
+/* Number of adaptive counters, one byte each */
+#define CM_COUNTERS 512
+
+/* Maximum number of leaves of the tree */
+#define CM_MAX_LEAVES 128
+
+/* A child in the tree: an interior node, or CM_LEAF + the number of a leaf */
+#define CM_LEAF 0x80
+
+/* A context-mixing model of the strings */
+struct cm_model {
+    int node_count;                             /* interior nodes; the root is 0 */
+    unsigned char children[2][CM_MAX_LEAVES];   /* left and right child of every node */
+    int leaf_count;
+    int leaf_symbols[CM_MAX_LEAVES];            /* the symbol of every leaf */
+    int leaves[HUFFMAN_MAX_SYMBOLS];            /* the leaf of every symbol, or -1 */
+    int hash_shift;                             /* how far the previous leaf is shifted */
+    unsigned char counters[CM_COUNTERS];        /* start value of every counter */
+};
+
+typedef struct cm_model cm_model_t;
+
+int cm_build_model(huffman_node_t *, string_list_t *, const int *, cm_model_t *);
+int cm_encode_strings(string_list_t *, const cm_model_t *);
+void cm_decode(const cm_model_t *, const unsigned char *, int, int, int *);
+
+#endif  /* !CM_H */
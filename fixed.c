@@ -0,0 +1,71 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the fixed-width codec.
+ *
+ * The symbols that occur in the strings are numbered densely, and every
+ * symbol is coded as its number in the smallest number of bits that can
+ * hold all numbers. The decoder reads that many bits and looks the symbol
+ * up in a table, so decoding takes the same time for every symbol.
+ */
+
+#include "fixed.h"
+
+/**
+ * Numbers the used symbols and assigns their codes.
+ * @param freq Symbol frequencies (HUFFMAN_MAX_SYMBOLS entries)
+ * @param fixed Where to store the code
+ * @param codes Where to store the code of every used symbol
+ */
+void fixed_assign_codes(const int *freq, fixed_code_t *fixed,
+                        struct huffman_code *codes)
+{
+    int i;
+    fixed->count = 0;
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        if (freq[i] > 0)
+            fixed->symbols[fixed->count++] = i;
+    }
+    /* Even a single symbol takes a bit */
+    fixed->width = 1;
+    while ((1 << fixed->width) < fixed->count)
+        fixed->width++;
+    for (i = 0; i < fixed->count; i++) {
+        codes[fixed->symbols[i]].code = i;
+        codes[fixed->symbols[i]].length = fixed->width;
+    }
+}
+
+/**
+ * Decodes a string that was coded with a fixed-width code.
+ * @param fixed The code
+ * @param data Encoded data
+ * @param len Number of symbols in string
+ * @param out Where to store decoded symbols (-1 for a number without a symbol)
+ */
+void fixed_decode(const fixed_code_t *fixed, const unsigned char *data,
+                  int len, int *out)
+{
+    long bit = 0;
+    int i, j;
+    for (i = 0; i < len; ++i) {
+        int index = 0;
+        for (j = 0; j < fixed->width; ++j, ++bit)
+            index = (index << 1) | ((data[bit >> 3] >> (7 - (bit & 7))) & 1);
+        out[i] = (index < fixed->count) ? fixed->symbols[index] : -1;
+    }
+}
@@ -0,0 +1,35 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include "huffpuff.h"
+
+/* A fixed-width code: every symbol is coded as its index in a table */
+struct fixed_code {
+    int width;                          /* bits per symbol */
+    int count;                          /* number of symbols */
+    int symbols[HUFFMAN_MAX_SYMBOLS];   /* the symbol of every index */
+};
+
+typedef struct fixed_code fixed_code_t;
+
+void fixed_assign_codes(const int *, fixed_code_t *, struct huffman_code *);
+void fixed_decode(const fixed_code_t *, const unsigned char *, int, int *);
+
+#endif  /* !FIXED_H */
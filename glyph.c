@@ -0,0 +1,357 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the glyph sets, for streaming font tiles.
+ *
+ * The glyphs are the values that the character map gives the characters
+ * of the strings (every byte of a sequence is a glyph of its own). The
+ * glyphs that occur are numbered in order of their values, and the glyph
+ * set of a string is a bitmap with a bit for each: glyph n is bit n % 8 of
+ * byte n / 8. All sets have the same size, so that the set of a string can
+ * be found from its number without decoding the string.
+ *
+ * A scene is a range of strings. Its set is the union of the sets of its
+ * strings, and its upload list holds the number of its glyphs followed by
+ * their values, which is all that must be in tile RAM for the scene.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "glyph.h"
+
+/**
+ * Determines the glyphs of a character.
+ * @param c The character
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters
+ * @param out Where to store the glyphs (CHARMAP_MAX_SEQUENCE entries)
+ * @return Number of glyphs
+ */
+static int char_glyphs(int c, const unsigned short *charmap,
+                       const charmap_sequence_t *sequences, unsigned short *out)
+{
+    int i;
+    if (!sequences[c].length) {
+        out[0] = charmap[c];
+        return 1;
+    }
+    for (i = 0; i < sequences[c].length; i++)
+        out[i] = sequences[c].bytes[i];
+    return sequences[c].length;
+}
+
+/**
+ * Finds the number of a glyph.
+ * @return The number, or -1 if the strings do not use the glyph
+ */
+static int glyph_number(const glyph_table_t *g, unsigned short value)
+{
+    int lo = 0, hi = g->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (g->values[mid] == value)
+            return mid;
+        if (g->values[mid] < value)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+/**
+ * Collects the glyphs of the strings, and builds the glyph set of every string.
+ * @param head Strings
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters
+ * @param g Where to store the glyphs and sets
+ */
+void glyph_collect(const string_list_t *head, const unsigned short *charmap,
+                   const charmap_sequence_t *sequences, glyph_table_t *g)
+{
+    const string_list_t *str;
+    unsigned short glyphs[CHARMAP_MAX_SEQUENCE];
+    int used[256];
+    int i, j, k;
+
+    /* The characters that occur, and their glyphs in order of value */
+    memset(used, 0, sizeof(used));
+    g->string_count = 0;
+    for (str = head; str != NULL; str = str->next) {
+        for (i = 0; i < str->text_length; i++)
+            used[str->text[i]] = 1;
+        g->string_count++;
+    }
+    g->count = 0;
+    for (i = 0; i < 256; i++) {
+        int n;
+        if (!used[i])
+            continue;
+        n = char_glyphs(i, charmap, sequences, glyphs);
+        for (j = 0; j < n; j++) {
+            for (k = g->count; (k > 0) && (g->values[k - 1] > glyphs[j]); k--)
+                ;
+            if ((k > 0) && (g->values[k - 1] == glyphs[j]))
+                continue;
+            memmove(&g->values[k + 1], &g->values[k], (g->count - k) * sizeof(g->values[0]));
+            g->values[k] = glyphs[j];
+            g->count++;
+        }
+    }
+
+    /* The set of every string */
+    g->set_size = (g->count + 7) / 8;
+    g->sets = (unsigned char *)calloc(g->string_count * g->set_size + 1, 1);
+    for (i = 0, str = head; str != NULL; str = str->next, i++) {
+        unsigned char *set = &g->sets[i * g->set_size];
+        for (j = 0; j < str->text_length; j++) {
+            int n = char_glyphs(str->text[j], charmap, sequences, glyphs);
+            for (k = 0; k < n; k++) {
+                int number = glyph_number(g, glyphs[k]);
+                set[number / 8] |= 1 << (number % 8);
+            }
+        }
+    }
+}
+
+/**
+ * Reads the scenes from a file. Every line holds the name of a scene and
+ * the numbers of its first and last strings; a line that starts with #
+ * is a comment.
+ * @param filename Name of the file
+ * @param string_count Number of strings
+ * @param scenes Where to store the scenes
+ * @param count Where to store the number of scenes
+ * @return 0 if the file is bad, 1 if OK
+ */
+int glyph_read_scenes(const char *filename, int string_count,
+                      glyph_scene_t **scenes, int *count)
+{
+    FILE *in;
+    char line[1024];
+    int lineno = 0;
+    *scenes = 0;
+    *count = 0;
+    in = fopen(filename, "rt");
+    if (!in) {
+        fprintf(stderr, "error: failed to open `%s' for reading\n", filename);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), in)) {
+        char name[GLYPH_MAX_NAME + 1];
+        glyph_scene_t *scene;
+        int first, last;
+        char *p;
+        lineno++;
+        for (p = line; isspace((unsigned char)*p); p++)
+            ;
+        if (!*p || (*p == '#'))
+            continue;
+        if ((sscanf(p, "%64s %d %d", name, &first, &last) != 3)
+            || (strlen(name) >= GLYPH_MAX_NAME)) {
+            fprintf(stderr, "error: %s:%d: expected a name and two string numbers\n",
+                    filename, lineno);
+            fclose(in);
+            return 0;
+        }
+        for (p = name; *p && (isalnum((unsigned char)*p) || (*p == '_')); p++)
+            ;
+        if (*p) {
+            fprintf(stderr, "error: %s:%d: `%s' is not a valid label\n", filename, lineno, name);
+            fclose(in);
+            return 0;
+        }
+        if ((first < 0) || (first > last) || (last >= string_count)) {
+            fprintf(stderr, "error: %s:%d: strings %d to %d are not in 0 to %d\n",
+                    filename, lineno, first, last, string_count - 1);
+            fclose(in);
+            return 0;
+        }
+        *scenes = (glyph_scene_t *)realloc(*scenes, (*count + 1) * sizeof(glyph_scene_t));
+        scene = &(*scenes)[(*count)++];
+        strcpy(scene->name, name);
+        scene->first = first;
+        scene->last = last;
+    }
+    fclose(in);
+    return 1;
+}
+
+/**
+ * Writes a list of values as assembler or C data.
+ * @param out File to write to
+ * @param label Label of the list, or NULL
+ * @param comment Comment, or NULL
+ * @param values The values
+ * @param size Number of values
+ * @param width 1 for bytes, 2 for words
+ * @param output_format OUTPUT_ASM or OUTPUT_C
+ * @param cpu Target CPU
+ */
+static void write_values(FILE *out, const char *label, const char *comment,
+                         const unsigned short *values, int size, int width,
+                         int output_format, int cpu)
+{
+    int i;
+    if (output_format == OUTPUT_C) {
+        if (comment)
+            fprintf(out, "    /* %s */\n", comment);
+        for (i = 0; i < size; i++) {
+            fprintf(out, ((i % 16) == 0) ? "    " : " ");
+            fprintf(out, (width == 2) ? "0x%.4X," : "0x%.2X,", values[i]);
+            if (((i % 16) == 15) || (i == size - 1))
+                fprintf(out, "\n");
+        }
+        return;
+    }
+    if (label)
+        fprintf(out, "%s:%s", label, comment ? " " : "\n");
+    if (comment)
+        fprintf(out, "; %s\n", comment);
+    for (i = 0; i < size; i++) {
+        if ((i % 16) == 0) {
+            if (width == 2)
+                fprintf(out, "%s ", (cpu == CPU_SM83) ? "dw" : ".dw");
+            else
+                fprintf(out, "%s ", (cpu == CPU_SM83) ? "db" : ".db");
+        }
+        fprintf(out, (width == 2) ? "$%.4X" : "$%.2X", values[i]);
+        fprintf(out, (((i % 16) == 15) || (i == size - 1)) ? "\n" : ",");
+    }
+}
+
+/**
+ * Starts an array of the C output.
+ */
+static void start_array(FILE *out, const char *type, const char *prefix, const char *name)
+{
+    fprintf(out, "static const %s %s%s[] = {\n", type, prefix, name);
+}
+
+/**
+ * Writes the glyphs, the glyph set of every string and the set and upload
+ * list of every scene. The labels are <label_prefix>Glyphs,
+ * <label_prefix>GlyphSets (and <label_prefix>GlyphSet<n> for every string
+ * if labels are wanted), <label_prefix><scene>GlyphSet and
+ * <label_prefix><scene>Upload.
+ * @param out File to write to
+ * @param g The glyphs and sets
+ * @param scenes Scenes
+ * @param scene_count Number of scenes
+ * @param label_prefix Prefix of the labels
+ * @param labels Nonzero to label the set of every string
+ * @param output_format OUTPUT_ASM or OUTPUT_C
+ * @param cpu Target CPU
+ */
+void glyph_write(FILE *out, const glyph_table_t *g, const glyph_scene_t *scenes,
+                 int scene_count, const char *label_prefix, int labels,
+                 int output_format, int cpu)
+{
+    unsigned short *values;
+    unsigned short *list;
+    char label[GLYPH_MAX_NAME + 300];
+    char comment[GLYPH_MAX_NAME + 100];
+    const char *type;
+    int width = 1;
+    int i, j;
+
+    /* Values or counts beyond a byte make the lists words */
+    for (i = 0; i < g->count; i++) {
+        if (g->values[i] > 0xFF)
+            width = 2;
+    }
+    if (g->count > 0xFF)
+        width = 2;
+    type = (width == 2) ? "unsigned short" : "unsigned char";
+    values = (unsigned short *)malloc((g->set_size + 1) * sizeof(unsigned short));
+    list = (unsigned short *)malloc((g->count + 1) * sizeof(unsigned short));
+
+    if (output_format == OUTPUT_C) {
+        fprintf(out, "/* Glyph sets automatically generated by huffpuff. */\n");
+        fprintf(out, "/* %d glyphs; glyph n is bit n %% 8 of byte n / 8 of a set of %d bytes */\n",
+                g->count, g->set_size);
+        start_array(out, type, label_prefix, "Glyphs");
+    } else {
+        fprintf(out, "; Glyph sets automatically generated by huffpuff.\n");
+        fprintf(out, "; %d glyphs; glyph n is bit n %% 8 of byte n / 8 of a set of %d bytes\n",
+                g->count, g->set_size);
+    }
+    sprintf(label, "%.255sGlyphs", label_prefix);
+    write_values(out, label, NULL, g->values, g->count, width, output_format, cpu);
+    if (output_format == OUTPUT_C) {
+        fprintf(out, "};\n");
+        start_array(out, "unsigned char", label_prefix, "GlyphSets");
+    } else {
+        fprintf(out, "%sGlyphSets:\n", label_prefix);
+    }
+    for (i = 0; i < g->string_count; i++) {
+        for (j = 0; j < g->set_size; j++)
+            values[j] = g->sets[i * g->set_size + j];
+        sprintf(label, "%.255sGlyphSet%d", label_prefix, i);
+        sprintf(comment, "String%d", i);
+        write_values(out, labels ? label : NULL, comment, values, g->set_size, 1,
+                     output_format, cpu);
+    }
+    if (output_format == OUTPUT_C)
+        fprintf(out, "};\n");
+
+    for (i = 0; i < scene_count; i++) {
+        const glyph_scene_t *scene = &scenes[i];
+        int count = 0;
+        int k;
+        for (j = 0; j < g->set_size; j++) {
+            values[j] = 0;
+            for (k = scene->first; k <= scene->last; k++)
+                values[j] |= g->sets[k * g->set_size + j];
+        }
+        for (j = 0; j < g->count; j++) {
+            if (values[j / 8] & (1 << (j % 8)))
+                list[1 + count++] = g->values[j];
+        }
+        list[0] = (unsigned short)count;
+        sprintf(comment, "scene %s: strings %d to %d, %d glyphs",
+                scene->name, scene->first, scene->last, count);
+        if (output_format == OUTPUT_C) {
+            fprintf(out, "/* %s */\n", comment);
+            sprintf(label, "%sGlyphSet", scene->name);
+            start_array(out, "unsigned char", label_prefix, label);
+            write_values(out, NULL, NULL, values, g->set_size, 1, output_format, cpu);
+            fprintf(out, "};\n");
+            sprintf(label, "%sUpload", scene->name);
+            start_array(out, type, label_prefix, label);
+            write_values(out, NULL, NULL, list, count + 1, width, output_format, cpu);
+            fprintf(out, "};\n");
+        } else {
+            fprintf(out, "; %s\n", comment);
+            sprintf(label, "%.255s%sGlyphSet", label_prefix, scene->name);
+            write_values(out, label, NULL, values, g->set_size, 1, output_format, cpu);
+            sprintf(label, "%.255s%sUpload", label_prefix, scene->name);
+            write_values(out, label, NULL, list, count + 1, width, output_format, cpu);
+        }
+    }
+    free(list);
+    free(values);
+}
+
+/**
+ * Frees the glyph sets.
+ */
+void glyph_free(glyph_table_t *g)
+{
+    free(g->sets);
+}
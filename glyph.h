@@ -0,0 +1,57 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GLYPH_H
+#define GLYPH_H
+
+#include <stdio.h>
+#include "huffpuff.h"
+
+/* Most glyphs: 256 character values and the 256 byte values of sequences */
+#define GLYPH_MAX_GLYPHS 512
+
+/* Longest name of a scene */
+#define GLYPH_MAX_NAME 64
+
+/* The glyphs that the strings use, and the glyph set of every string */
+struct glyph_table {
+    int count;                                  /* number of glyphs */
+    unsigned short values[GLYPH_MAX_GLYPHS];    /* the glyphs, in order */
+    int set_size;                               /* bytes per set */
+    int string_count;
+    unsigned char *sets;                        /* set of every string */
+};
+
+typedef struct glyph_table glyph_table_t;
+
+/* A range of strings that are shown together */
+struct glyph_scene {
+    char name[GLYPH_MAX_NAME];
+    int first;
+    int last;
+};
+
+typedef struct glyph_scene glyph_scene_t;
+
+void glyph_collect(const string_list_t *, const unsigned short *,
+                   const charmap_sequence_t *, glyph_table_t *);
+int glyph_read_scenes(const char *, int, glyph_scene_t **, int *);
+void glyph_write(FILE *, const glyph_table_t *, const glyph_scene_t *, int,
+                 const char *, int, int, int);
+void glyph_free(glyph_table_t *);
+
+#endif  /* !GLYPH_H */
@@ -19,8 +19,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <ctype.h>
 #include "huffpuff.h"
 #include "charmap.h"
+#include "asmgen.h"
+#include "z80dec.h"
+#include "m65dec.h"
+#include "m65enc.h"
+#include "m65cm.h"
+#include "bucket.h"
+#include "parse.h"
+#include "fixed.h"
+#include "cm.h"
+#include "template.h"
+#include "search.h"
+#include "json.h"
+#include "import.h"
+#include "stats.h"
+#include "sample.h"
+#include "o65.h"
+#include "cgen.h"
+#include "glyph.h"
+#include "layout.h"
+#include "trace.h"
 
 /**
  * Creates a Huffman node.
@@ -37,6 +59,8 @@ huffman_node_t *huffman_create_node(int symbol, int weight, huffman_node_t *left
     node->weight = weight;
     node->left = left;
     node->right = right;
+    node->bucket = 0;
+    node->position = 0;
     return node;
 }
 
@@ -52,6 +76,7 @@ void huffman_delete_node(huffman_node_t *node)
         huffman_delete_node(node->left);
         huffman_delete_node(node->right);
     }
+    free(node->bucket);
     free(node);
 }
 
@@ -113,74 +138,619 @@ huffman_node_t *huffman_build_tree(huffman_node_t **nodes, int nodecount)
     return root;
 }
 
-struct huffman_node_list {
-    struct huffman_node_list *next;
-    huffman_node_t *node;
-};
+/**
+ * Determines the format of the leaves in the 8-bit decoder tables.
+ * @param root Root node of Huffman tree
+ * @param sequences Byte sequences of the characters, or NULL
+ * @return LEAF_VALUE, LEAF_SEQUENCE or LEAF_BUCKET
+ */
+int huffman_leaf_format(const huffman_node_t *root, const charmap_sequence_t *sequences)
+{
+    if (sequences)
+        return LEAF_SEQUENCE;
+    /* Either all leaves are buckets or none is */
+    while (root && (root->symbol == -1))
+        root = root->left;
+    return (root && root->bucket) ? LEAF_BUCKET : LEAF_VALUE;
+}
+
+/**
+ * Returns the size of a node in an 8-bit decoder table.
+ * @param node The node
+ * @param sequences Byte sequences of the characters, or NULL
+ * @param format TABLE_REL8, TABLE_REL16 or TABLE_ABS16
+ */
+static int node_size(const huffman_node_t *node,
+                     const charmap_sequence_t *sequences, int format)
+{
+    if (node->symbol == -1)
+        return (format == TABLE_REL8) ? 2 : 4;
+    if (sequences)
+        return 2 + sequences[node->symbol].length;
+    if (node->bucket)
+        return 2 + (1 << node->bucket->extra_bits);
+    return 2;
+}
+
+/**
+ * Returns the amount subtracted from a child offset. The 6502 decoder adds
+ * offsets to the address of the node; the SM83/Z80 decoder adds them to the
+ * address of the byte after the one it has just read.
+ * @param cpu Target CPU
+ * @param format TABLE_REL8 or TABLE_REL16
+ * @param right 1 for the offset of the right child
+ */
+static int child_bias(int cpu, int format, int right)
+{
+    if (cpu == CPU_6502)
+        return 0;
+    return (right && (format == TABLE_REL16)) ? 3 : 1;
+}
+
+/**
+ * Returns the largest child offset that a table format can hold.
+ */
+static int max_offset(int format)
+{
+    return (format == TABLE_REL8) ? 0xFF : (format == TABLE_REL16) ? 0x7FFF : 0xFFFF;
+}
+
+/**
+ * Checks whether all child offsets fit in the table format.
+ * @return 1 if they do, 0 otherwise
+ */
+static int layout_fits(huffman_node_t **order, int count, int cpu, int format)
+{
+    int i;
+    if (format == TABLE_ABS16)
+        return 1;
+    for (i = 0; i < count; ++i) {
+        const huffman_node_t *node = order[i];
+        if (node->symbol == -1) {
+            if ((node->left->position - node->position - child_bias(cpu, format, 0)
+                 > max_offset(format))
+                || (node->right->position - node->position - child_bias(cpu, format, 1)
+                    > max_offset(format))) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * Checks whether the pending nodes can still be placed before their
+ * deadlines, in deadline order, if the given node is placed next.
+ * @param pending Nodes whose parents have been placed
+ * @param deadline Last position at which each pending node can be placed
+ * @param count Number of pending nodes
+ * @param pick Index of the node to place next
+ * @param pos Position of the next node
+ * @param reach Deadline of the picked node's children, relative to pos
+ */
+static int deadlines_met(huffman_node_t **pending, const int *deadline, int count,
+                         int pick, int pos, int reach,
+                         const charmap_sequence_t *sequences)
+{
+    int order[2 * HUFFMAN_MAX_SYMBOLS + 2];
+    int dl[2 * HUFFMAN_MAX_SYMBOLS + 2];
+    int size[2 * HUFFMAN_MAX_SYMBOLS + 2];
+    int n = 0;
+    int i, j;
+    if (pos > deadline[pick])
+        return 0;
+    for (i = 0; i < count; ++i) {
+        if (i == pick)
+            continue;
+        dl[n] = deadline[i];
+        size[n++] = node_size(pending[i], sequences, TABLE_REL8);
+    }
+    if (pending[pick]->symbol == -1) {
+        dl[n] = pos + reach;
+        size[n++] = node_size(pending[pick]->left, sequences, TABLE_REL8);
+        dl[n] = pos + reach;
+        size[n++] = node_size(pending[pick]->right, sequences, TABLE_REL8);
+    }
+    /* Insertion sort by deadline */
+    for (i = 0; i < n; ++i) {
+        for (j = i; (j > 0) && (dl[order[j-1]] > dl[i]); --j)
+            order[j] = order[j-1];
+        order[j] = i;
+    }
+    pos += node_size(pending[pick], sequences, TABLE_REL8);
+    for (i = 0; i < n; ++i) {
+        if (pos > dl[order[i]])
+            return 0;
+        pos += size[order[i]];
+    }
+    return 1;
+}
+
+/**
+ * Lays out the nodes depth-first, but places a node out of turn as soon as
+ * waiting any longer would put it out of reach of a one-byte offset from
+ * its parent (earliest deadline first).
+ * @return Number of nodes
+ */
+static int layout_reach(huffman_node_t *root, const charmap_sequence_t *sequences,
+                        int cpu, huffman_node_t **order)
+{
+    huffman_node_t *pending[2 * HUFFMAN_MAX_SYMBOLS];
+    int deadline[2 * HUFFMAN_MAX_SYMBOLS];
+    int reach = max_offset(TABLE_REL8) + child_bias(cpu, TABLE_REL8, 0);
+    int count = 0;
+    int pending_count = 1;
+    int pos = 0;
+    pending[0] = root;
+    deadline[0] = 0;
+    while (pending_count > 0) {
+        huffman_node_t *node;
+        int pick = pending_count - 1;
+        int i;
+        if (!deadlines_met(pending, deadline, pending_count, pick, pos, reach, sequences)) {
+            /* Place the most urgent node instead */
+            for (i = 0; i < pending_count; ++i) {
+                if (deadline[i] < deadline[pick])
+                    pick = i;
+            }
+        }
+        node = pending[pick];
+        for (i = pick; i < pending_count - 1; ++i) {
+            pending[i] = pending[i+1];
+            deadline[i] = deadline[i+1];
+        }
+        pending_count--;
+        node->position = pos;
+        order[count++] = node;
+        pos += node_size(node, sequences, TABLE_REL8);
+        if (node->symbol == -1) {
+            /* The left child is placed first */
+            pending[pending_count] = node->right;
+            deadline[pending_count++] = node->position + reach;
+            pending[pending_count] = node->left;
+            deadline[pending_count++] = node->position + reach;
+        }
+    }
+    return count;
+}
+
+/**
+ * Lays out the nodes of an 8-bit decoder table, and stores the offset of
+ * every node in its position field. The nodes are laid out in breadth-first
+ * order. If the one-byte offsets of the TABLE_REL8 format do not reach all
+ * children in that order, a layout that keeps every child within reach of
+ * its parent is tried.
+ * @param root Root node of Huffman tree
+ * @param sequences Byte sequences of the characters, or NULL
+ * @param cpu Target CPU
+ * @param format TABLE_REL8, TABLE_REL16 or TABLE_ABS16
+ * @param order Where to store the nodes in table order (room for 2 * HUFFMAN_MAX_SYMBOLS)
+ * @param size Where to store the size of the table, or NULL
+ * @return Number of nodes, or -1 if an offset does not fit the format
+ */
+int huffman_table_layout(huffman_node_t *root, const charmap_sequence_t *sequences,
+                         int cpu, int format, huffman_node_t **order, int *size)
+{
+    int count;
+    int pos;
+    int i;
+    if (root == 0)
+        return 0;
+    /* Breadth-first */
+    order[0] = root;
+    count = 1;
+    pos = 0;
+    for (i = 0; i < count; ++i) {
+        huffman_node_t *node = order[i];
+        node->position = pos;
+        pos += node_size(node, sequences, format);
+        if (node->symbol == -1) {
+            order[count++] = node->left;
+            order[count++] = node->right;
+        }
+    }
+    if (!layout_fits(order, count, cpu, format)) {
+        if (format != TABLE_REL8)
+            return -1;
+        count = layout_reach(root, sequences, cpu, order);
+        if (!layout_fits(order, count, cpu, format))
+            return -1;
+    }
+    if ((format == TABLE_ABS16) && (pos > 0x10000))
+        return -1;
+    if (size)
+        *size = pos;
+    return count;
+}
+
+/**
+ * Finds the nodes that the first bits of a code lead to, for a root lookup
+ * table that takes them at once in front of the table walk. The positions
+ * of the nodes must have been set by huffman_table_layout().
+ * @param root Root node of Huffman tree
+ * @param bits Number of bits (1 to HUFFMAN_MAX_ROOT_BITS)
+ * @param positions Where to store the table offset of the node that every
+ *        value of the bits leads to (room for 1 << bits)
+ * @return 0 if a leaf is reached in fewer bits, 1 if OK
+ */
+int huffman_root_positions(const huffman_node_t *root, int bits, int *positions)
+{
+    int value;
+    for (value = 0; value < (1 << bits); ++value) {
+        const huffman_node_t *node = root;
+        int bit;
+        for (bit = bits - 1; bit >= 0; --bit) {
+            if ((node == 0) || (node->symbol != -1))
+                return 0;
+            node = ((value >> bit) & 1) ? node->right : node->left;
+        }
+        positions[value] = node->position;
+    }
+    return 1;
+}
+
+/**
+ * Builds the binary image of the decoder table, as the assembler would.
+ * When the characters are mapped to byte sequences, a leaf holds the length
+ * of its sequence and the sequence itself after the byte that marks it as a
+ * leaf. A bucket leaf holds a sentinel bit for reading its extra bits,
+ * followed by the values of its characters.
+ * @param root Root node of Huffman tree
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters, or NULL
+ * @param cpu Target CPU (the child offsets of the SM83/Z80 table are biased)
+ * @param format TABLE_REL8, TABLE_REL16 or TABLE_ABS16
+ * @param address Address of the table (TABLE_ABS16 only)
+ * @param buf Where to store the image, or NULL to only compute its size
+ * @return Size of the table in bytes, or -1 if an offset does not fit the format
+ */
+int huffman_table_image(huffman_node_t *root, const unsigned short *charmap,
+                        const charmap_sequence_t *sequences,
+                        int cpu, int format, int address, unsigned char *buf)
+{
+    huffman_node_t **order;
+    int count;
+    int size;
+    int i;
+    if (root == 0)
+        return 0;
+    order = (huffman_node_t **)malloc(2 * HUFFMAN_MAX_SYMBOLS * sizeof(huffman_node_t *));
+    count = huffman_table_layout(root, sequences, cpu, format, order, &size);
+    for (i = 0; buf && (i < count); ++i) {
+        huffman_node_t *node = order[i];
+        unsigned char *rec = &buf[node->position];
+        int left, right;
+        if (node->symbol != -1) {
+            rec[0] = (format == TABLE_REL16) ? 0x80 : 0;
+            if (sequences) {
+                const charmap_sequence_t *seq = &sequences[node->symbol];
+                rec[1] = (unsigned char)seq->length;
+                memcpy(&rec[2], seq->bytes, seq->length);
+            } else if (node->bucket) {
+                const struct huffman_bucket *bucket = node->bucket;
+                int j;
+                rec[1] = (0x100 >> bucket->extra_bits) & 0xFF;
+                for (j = 0; j < (1 << bucket->extra_bits); ++j)
+                    rec[2 + j] = (unsigned char)charmap[bucket->symbols[j]];
+            } else {
+                rec[1] = (unsigned char)charmap[node->symbol];
+            }
+            continue;
+        }
+        if (format == TABLE_ABS16) {
+            left = address + node->left->position;
+            right = address + node->right->position;
+        } else {
+            left = node->left->position - node->position - child_bias(cpu, format, 0);
+            right = node->right->position - node->position - child_bias(cpu, format, 1);
+        }
+        if (format == TABLE_REL8) {
+            rec[0] = (unsigned char)left;
+            rec[1] = (unsigned char)right;
+        } else {
+            /* High byte first, so that the first byte tells a leaf apart */
+            rec[0] = (unsigned char)(left >> 8);
+            rec[1] = (unsigned char)left;
+            rec[2] = (unsigned char)(right >> 8);
+            rec[3] = (unsigned char)right;
+        }
+    }
+    free(order);
+    return (count < 0) ? -1 : size;
+}
+
+/**
+ * Builds the binary image of the 65816 decoder table.
+ * Nodes are laid out in breadth-first order, so that siblings are adjacent.
+ * @param root Root node of Huffman tree
+ * @param charmap Character map
+ * @param record_size Size of a node record (2 or 4 bytes)
+ * @param buf Where to store the image, or NULL to only compute its size
+ * @return Size of the table in bytes, or -1 if it is too large
+ */
+int huffman_table_image16(huffman_node_t *root, const unsigned short *charmap,
+                          int record_size, unsigned char *buf)
+{
+    huffman_node_t **queue;
+    int count;
+    int i;
+    if (root == 0)
+        return 0;
+    queue = (huffman_node_t **)malloc(2 * HUFFMAN_MAX_SYMBOLS * sizeof(huffman_node_t *));
+    queue[0] = root;
+    count = 1;
+    for (i = 0; i < count; ++i) {
+        huffman_node_t *node = queue[i];
+        node->position = i * record_size;
+        if (node->symbol == -1) {
+            queue[count++] = node->left;
+            queue[count++] = node->right;
+        }
+    }
+    if (count * record_size > 0x8000) {
+        free(queue);
+        return -1;
+    }
+    for (i = 0; buf && (i < count); ++i) {
+        huffman_node_t *node = queue[i];
+        unsigned char *rec = &buf[node->position];
+        int word;
+        if (node->symbol != -1)
+            word = (record_size == 4) ? 0x8000 : (0x8000 | charmap[node->symbol]);
+        else
+            word = node->left->position;
+        rec[0] = word & 0xFF;
+        rec[1] = word >> 8;
+        if (record_size == 4) {
+            word = (node->symbol != -1) ? charmap[node->symbol] : 0;
+            rec[2] = word & 0xFF;
+            rec[3] = word >> 8;
+        }
+    }
+    free(queue);
+    return count * record_size;
+}
 
-typedef struct huffman_node_list huffman_node_list_t;
+/**
+ * Writes one byte of a child pointer of the TABLE_REL16 and TABLE_ABS16
+ * formats as an assembler expression.
+ * @param out File to write to
+ * @param op Operator that selects the high or low byte
+ * @param label_prefix Prefix of node labels
+ * @param node Interior node
+ * @param right 1 for the right child
+ * @param cpu Target CPU
+ * @param format TABLE_REL16 or TABLE_ABS16
+ */
+static void write_wide_child(FILE *out, const char *op, const char *label_prefix,
+                             const huffman_node_t *node, int right, int cpu, int format)
+{
+    int bias = child_bias(cpu, format, right);
+    fprintf(out, "%s(%snode_%d_%d", op, label_prefix,
+            (node->code.code << 1) | right, node->code.length+1);
+    if (format == TABLE_REL16) {
+        fprintf(out, "-%snode_%d_%d", label_prefix, node->code.code, node->code.length);
+        if (bias)
+            fprintf(out, "-%d", bias);
+    }
+    fprintf(out, ")");
+}
 
 /**
- * Writes codes for nodes in a Huffman tree recursively.
+ * Writes the nodes of a Huffman tree in decoder table order.
  * @param out File to write to
  * @param root Root node of Huffman tree
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters, or NULL
+ * @param label_prefix Prefix of node labels
+ * @param cpu Target CPU
+ * @param format Format of the 8-bit decoder tables (TABLE_REL8 etc.)
  */
 static void write_huffman_codes(FILE *out, huffman_node_t *root,
-                                const unsigned char *charmap,
-                                const char *label_prefix)
+                                const unsigned short *charmap,
+                                const charmap_sequence_t *sequences,
+                                const char *label_prefix, int cpu, int format)
 {
-    huffman_node_list_t *current;
-    huffman_node_list_t *tail;
+    huffman_node_t **order;
+    const char *db = (cpu == CPU_SM83) ? "db" : ".db";
+    const char *hi = (cpu == CPU_SM83) ? "HIGH" : ">";
+    const char *lo = (cpu == CPU_SM83) ? "LOW" : "<";
+    int leaf_marker = (format == TABLE_REL16) ? 0x80 : 0x00;
+    int record_size = (cpu == CPU_65816) ? m65dec_record_size(root, charmap) : 2;
+    int count;
+    int i;
     if (root == 0)
         return;
-    current = (huffman_node_list_t*)malloc(sizeof(huffman_node_list_t));
-    current->node = root;
-    current->next = 0;
-    tail = current;
-    while (current) {
-        huffman_node_list_t *tmp;
-        huffman_node_t *node;
-        node = current->node;
+    order = (huffman_node_t **)malloc(2 * HUFFMAN_MAX_SYMBOLS * sizeof(huffman_node_t *));
+    /* The 65816 table is breadth-first, like the ABS16 layout */
+    count = huffman_table_layout(root, sequences, cpu,
+                                 (cpu == CPU_65816) ? TABLE_ABS16 : format, order, 0);
+    for (i = 0; i < count; ++i) {
+        huffman_node_t *node = order[i];
         /* label */
-        if (node != root)
+        if ((node != root) || (cpu != CPU_6502) || (format != TABLE_REL8))
             fprintf(out, "%snode_%d_%d: ", label_prefix,
                     node->code.code, node->code.length);
-        if (node->symbol != -1) {
+        if ((node->symbol != -1) && (cpu == CPU_65816)) {
+            /* a leaf node -- bit 15 set */
+            if (record_size == 4)
+                fprintf(out, ".dw $8000, $%.4X\n", charmap[node->symbol]);
+            else
+                fprintf(out, ".dw $%.4X\n", 0x8000 | charmap[node->symbol]);
+        } else if ((node->symbol != -1) && sequences) {
+            /* a leaf node -- length and bytes of the sequence */
+            const charmap_sequence_t *seq = &sequences[node->symbol];
+            int j;
+            fprintf(out, "%s $%.2X, $%.2X", db, leaf_marker, seq->length);
+            for (j = 0; j < seq->length; ++j)
+                fprintf(out, ", $%.2X", seq->bytes[j]);
+            fprintf(out, "\n");
+        } else if ((node->symbol != -1) && node->bucket) {
+            /* a bucket -- sentinel for the extra bits, then the values */
+            const struct huffman_bucket *bucket = node->bucket;
+            int j;
+            fprintf(out, "%s $%.2X, $%.2X", db, leaf_marker,
+                    (0x100 >> bucket->extra_bits) & 0xFF);
+            for (j = 0; j < (1 << bucket->extra_bits); ++j)
+                fprintf(out, ", $%.2X", charmap[bucket->symbols[j]]);
+            fprintf(out, "\n");
+        } else if (node->symbol != -1) {
             /* a leaf node */
-            fprintf(out, ".db $00, $%.2X\n", charmap[node->symbol]);
-        } else {
-            /* an interior node -- print pointers to children */
-            huffman_node_list_t *succ;
-            fprintf(out, ".db %snode_%d_%d-$, %snode_%d_%d-$+1\n",
+            fprintf(out, "%s $%.2X, $%.2X\n", db, leaf_marker, charmap[node->symbol]);
+        } else if (cpu == CPU_65816) {
+            /* index of the left child; the right child follows it */
+            fprintf(out, ".dw %snode_%d_%d-%snode_0_0%s\n",
                     label_prefix, node->code.code << 1, node->code.length+1,
-                    label_prefix, (node->code.code << 1) | 1, node->code.length+1);
-            /* add child nodes to list */
-            succ = (huffman_node_list_t*)malloc(sizeof(huffman_node_list_t));
-            succ->node = node->left;
-            succ->next = (huffman_node_list_t*)malloc(sizeof(huffman_node_list_t));
-            succ->next->node = node->right;
-            succ->next->next = 0;
-            tail->next = succ;
-            tail = succ->next;
-        }
-        tmp = current->next;
-        free(current);
-        current = tmp;
-    }
-}
-
-/* A linked list of text strings. */
-struct string_list {
-    struct string_list *next;
-    unsigned char *text;
-    unsigned char *huff_data;
-    int huff_size;
-};
+                    label_prefix, (record_size == 4) ? ", $0000" : "");
+        } else if (format == TABLE_REL8) {
+            /* an interior node -- print pointers to children */
+            if (cpu == CPU_6502) {
+                fprintf(out, ".db %snode_%d_%d-$, %snode_%d_%d-$+1\n",
+                        label_prefix, node->code.code << 1, node->code.length+1,
+                        label_prefix, (node->code.code << 1) | 1, node->code.length+1);
+            } else {
+                /* offsets are relative to the node's second byte */
+                fprintf(out, "%s %snode_%d_%d-%snode_%d_%d-1, %snode_%d_%d-%snode_%d_%d-1\n", db,
+                        label_prefix, node->code.code << 1, node->code.length+1,
+                        label_prefix, node->code.code, node->code.length,
+                        label_prefix, (node->code.code << 1) | 1, node->code.length+1,
+                        label_prefix, node->code.code, node->code.length);
+            }
+        } else {
+            /* an interior node -- 16-bit offsets or addresses, high byte first */
+            fprintf(out, "%s ", db);
+            write_wide_child(out, hi, label_prefix, node, 0, cpu, format);
+            fprintf(out, ", ");
+            write_wide_child(out, lo, label_prefix, node, 0, cpu, format);
+            fprintf(out, ", ");
+            write_wide_child(out, hi, label_prefix, node, 1, cpu, format);
+            fprintf(out, ", ");
+            write_wide_child(out, lo, label_prefix, node, 1, cpu, format);
+            fprintf(out, "\n");
+        }
+    }
+    free(order);
+}
+
+/**
+ * Builds the binary image of the decoder table of the target CPU.
+ * @param root Root node of Huffman tree
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters, or NULL
+ * @param cpu Target CPU
+ * @param format Format of the 8-bit decoder tables (TABLE_REL8 etc.)
+ * @param address Address of the table (TABLE_ABS16 only)
+ * @param size Where to store the size of the image
+ * @return The image, to be freed by the caller
+ */
+static unsigned char *decoder_table_image(huffman_node_t *root, const unsigned short *charmap,
+                                          const charmap_sequence_t *sequences,
+                                          int cpu, int format, int address, int *size)
+{
+    unsigned char *image;
+    if (cpu == CPU_65816) {
+        int record_size = m65dec_record_size(root, charmap);
+        *size = huffman_table_image16(root, charmap, record_size, 0);
+        image = (unsigned char *)malloc(*size + 1);
+        huffman_table_image16(root, charmap, record_size, image);
+    } else {
+        *size = huffman_table_image(root, charmap, sequences, cpu, format, 0, 0);
+        image = (unsigned char *)malloc(*size + 1);
+        huffman_table_image(root, charmap, sequences, cpu, format, address, image);
+    }
+    return image;
+}
+
+/**
+ * Writes a decoder table image without node labels. The bytes that differ
+ * from the image laid out at another address are child addresses (high
+ * byte first), and are written as offsets from the table label.
+ * @param out File to write to
+ * @param image Decoder table, laid out at address 0
+ * @param moved Decoder table laid out at another address, or NULL
+ * @param size Size of the table
+ * @param label Label of the table, which the caller writes
+ * @param cpu Target CPU
+ */
+static void write_table_image(FILE *out, const unsigned char *image,
+                              const unsigned char *moved, int size,
+                              const char *label, int cpu)
+{
+    const char *db = (cpu == CPU_SM83) ? "db" : ".db";
+    int i = 0;
+    while (i < size) {
+        int n;
+        fprintf(out, "%s ", db);
+        for (n = 0; (n < 16) && (i < size); n++) {
+            if (n)
+                fprintf(out, ", ");
+            if (moved && (image[i] != moved[i])) {
+                int offset = (image[i] << 8) | image[i + 1];
+                if (cpu == CPU_SM83) {
+                    fprintf(out, "HIGH(%s+$%.4X), LOW(%s+$%.4X)",
+                            label, offset, label, offset);
+                } else {
+                    fprintf(out, ">(%s+$%.4X), <(%s+$%.4X)",
+                            label, offset, label, offset);
+                }
+                i += 2;
+                n++;
+            } else {
+                fprintf(out, "$%.2X", image[i++]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+/* Names of the table formats, for --table-format */
+static const char *table_format_names[] = { "rel8", "rel16", "abs16" };
 
-typedef struct string_list string_list_t;
+/* Names of the target CPUs */
+static const char *cpu_names[] = { "6502", "SM83", "Z80", "65816" };
 
-/* The end-of-string token. */
-#define STRING_SEPARATOR 0x0A
+/**
+ * Reads one string (all characters until STRING_SEPARATOR) from a file. A
+ * comment line reads as an empty string.
+ * @param in File to read from
+ * @param ignore_case Nonzero to convert characters to lower-case
+ * @param buf Buffer for the string; it is made larger when needed
+ * @param max_len Size of the buffer
+ * @return Length of the string
+ */
+int read_string(FILE *in, int ignore_case, unsigned char **buf, int *max_len)
+{
+    int c;
+    int in_comment = 0;
+    int i = 0;
+    while (((c = fgetc(in)) != -1) && (c != STRING_SEPARATOR)) {
+        if (c == '\\') {
+            /* Check for line escape */
+            int d;
+            d = fgetc(in);
+            if (d == STRING_SEPARATOR) {
+                continue;
+            } else if (d == '#') {
+                c = '#';
+            } else {
+                ungetc(d, in);
+            }
+        } else if ((i == 0) && (c == '#')) {
+            in_comment = 1;
+        }
+        if (in_comment)
+            continue;
+        if (i == *max_len) {
+            /* Allocate larger buffer */
+            *max_len += 64;
+            *buf = (unsigned char *)realloc(*buf, *max_len);
+        }
+        if (ignore_case && (c >= 'A') && (c <= 'Z'))
+            c += 0x20;
+        (*buf)[i++] = (unsigned char)c;
+    }
+    return i;
+}
 
 /**
  * Reads strings from a file and computes the frequencies of the characters.
@@ -212,42 +782,19 @@ string_list_t *read_strings(FILE *in, int ignore_case, int *freq,
     if (total_length)
         *total_length = 0;
     while (!feof(in)) {
-        /* Read one string (all chars until STRING_SEPARATOR) into temp buffer */
-        int c;
-        int in_comment = 0;
-        i = 0;
-        while (((c = fgetc(in)) != -1) && (c != STRING_SEPARATOR)) {
-            if (c == '\\') {
-                /* Check for line escape */
-                int d;
-                d = fgetc(in);
-                if (d == STRING_SEPARATOR) {
-                    continue;
-                } else if (d == '#') {
-                    c = '#';
-                } else {
-                    ungetc(d, in);
-                }
-            } else if ((i == 0) && (c == '#')) {
-                in_comment = 1;
-	    }
-            if (in_comment)
-                continue;
-            if (i == max_len) {
-                /* Allocate larger buffer */
-                max_len += 64;
-                buf = (unsigned char *)realloc(buf, max_len);
-            }
-            if (ignore_case && (c >= 'A') && (c <= 'Z'))
-                c += 0x20;
-            buf[i++] = (unsigned char)c;
-            freq[c]++;
-        }
+        int j;
+        i = read_string(in, ignore_case, &buf, &max_len);
+        for (j = 0; j < i; j++)
+            freq[buf[j]]++;
 
         if (i > 0) {
             /* Add string to list */
             string_list_t *lst = (string_list_t *)malloc(sizeof(string_list_t));
             lst->text = (unsigned char *)malloc(i+1);
+            lst->text_length = i;
+            lst->symbols = 0;
+            lst->length = 0;
+            lst->id = 0;
             lst->huff_data = 0;
             lst->huff_size = 0;
             memcpy(lst->text, buf, i);
@@ -265,14 +812,67 @@ string_list_t *read_strings(FILE *in, int ignore_case, int *freq,
     return head;
 }
 
+/**
+ * Reads binary records from a file and computes the frequencies of the
+ * bytes. Every record is a 16-bit little-endian length followed by that
+ * many bytes, which may have any value.
+ * @param in File to read from
+ * @param head Where to store the list of records
+ * @param freq Where to store computed frequencies
+ * @param total_length If not NULL, the total number of bytes is stored here
+ * @param string_count If not NULL, the number of records is stored here
+ * @return 0 if fail (a record is cut short), 1 if OK
+ */
+static int read_records(FILE *in, string_list_t **head, int *freq,
+                        int *total_length, int *string_count)
+{
+    string_list_t **nextp = head;
+    int lo, hi;
+    int i;
+    *head = NULL;
+    for (i = 0; i < 256; i++)
+        freq[i] = 0;
+    if (total_length)
+        *total_length = 0;
+    if (string_count)
+        *string_count = 0;
+    while ((lo = fgetc(in)) != EOF) {
+        string_list_t *lst;
+        int len;
+        if ((hi = fgetc(in)) == EOF)
+            return 0;
+        len = lo | (hi << 8);
+        lst = (string_list_t *)malloc(sizeof(string_list_t));
+        lst->text = (unsigned char *)malloc(len + 1);
+        lst->text_length = len;
+        lst->symbols = 0;
+        lst->length = 0;
+        lst->id = 0;
+        lst->huff_data = 0;
+        lst->huff_size = 0;
+        lst->next = NULL;
+        *nextp = lst;
+        nextp = &(lst->next);
+        if ((int)fread(lst->text, 1, len, in) != len)
+            return 0;
+        lst->text[len] = 0;
+        for (i = 0; i < len; i++)
+            freq[lst->text[i]]++;
+        if (total_length)
+            *total_length = *total_length + len;
+        if (string_count)
+            *string_count = *string_count + 1;
+    }
+    return 1;
+}
+
 /**
  * Encodes the given list of strings.
  * @param head Head of list of strings to encode
- * @param codes Mapping from character to Huffman node
+ * @param codes Mapping from symbol to code
  * @return The size of the encoded string data
  */
-static int encode_strings(string_list_t *head, huffman_node_t * const *codes,
-                          int append_byte)
+static int encode_strings(string_list_t *head, const struct huffman_code *codes)
 {
     string_list_t *string;
     unsigned char *buf = 0;
@@ -280,27 +880,15 @@ static int encode_strings(string_list_t *head, huffman_node_t * const *codes,
     int total_size = 0;
     /* Do all strings. */
     for (string = head; string != NULL; string = string->next) {
-        /* Do all characters in string. */
+        /* Do all symbols in string. */
         unsigned char enc = 0;
-        int i;
+        int i, j;
         int len = 0;
         int bitnum = 7;
-        const unsigned char *p = string->text;
-        int apd = append_byte;
-        while (1) {
-            const huffman_node_t *node;
-            unsigned char c;
-            if (*p) {
-                c = *(p++);
-            } else if (apd != -1) {
-                c = (unsigned char)append_byte;
-                apd = -1;
-            } else {
-                break;
-            }
-            node = codes[c];
-            for (i = node->code.length-1; i >= 0; i--) {
-                enc |= ((node->code.code >> i) & 1) << bitnum--;
+        for (j = 0; j < string->length; ++j) {
+            const struct huffman_code *code = &codes[string->symbols[j]];
+            for (i = code->length-1; i >= 0; i--) {
+                enc |= ((code->code >> i) & 1) << bitnum--;
                 if (bitnum < 0) {
                     if (len == maxlen) {
                         maxlen += 128;
@@ -320,6 +908,7 @@ static int encode_strings(string_list_t *head, huffman_node_t * const *codes,
             buf[len++] = enc;
         }
         /* Store encoded buffer */
+        free(string->huff_data);
         string->huff_data = (unsigned char *)malloc(len);
         memcpy(string->huff_data, buf, len);
         string->huff_size = len;
@@ -329,63 +918,98 @@ static int encode_strings(string_list_t *head, huffman_node_t * const *codes,
     return total_size;
 }
 
+/**
+ * Reads the next bit of Huffman-encoded data.
+ * @param data Pointer to the next byte of data
+ * @param mask Mask of the next bit in the current byte; 0 if a byte must be read
+ * @param bite The current byte
+ * @return The bit
+ */
+static int read_bit(const unsigned char **data, int *mask, unsigned char *bite)
+{
+    int isset;
+    if (!*mask) {
+        *bite = *((*data)++);
+        *mask = 0x80;
+    }
+    isset = (*bite & *mask) != 0;
+    *mask >>= 1;
+    return isset;
+}
+
 /**
  * Decodes a Huffman-encoded string; helpful for debugging.
  * @param root Root node of Huffman tree
  * @param data Encoded data
- * @param len Length of string
- * @param out Where to store decoded string
+ * @param len Number of symbols in string
+ * @param out Where to store decoded symbols
  */
 static void decode_string(huffman_node_t *root, const unsigned char *data,
-                          int len, unsigned char *out)
+                          int len, int *out)
 {
     huffman_node_t *n;
     int mask = 0;
-    unsigned char bite;
+    unsigned char bite = 0;
     int i;
     for (i = 0; i < len; ++i) {
         n = root;
-        while (1) {
-            if (n->symbol != -1) {
-                out[i] = (char)n->symbol;
-                break;
-            }
-            if (!mask) {
-                bite = *(data++);
-                mask = 0x80;
-            }
-            int isset = (bite & mask) != 0;
-            mask >>= 1;
-            if (isset)
+        while (n->symbol == -1) {
+            if (read_bit(&data, &mask, &bite))
                 n = n->right;
             else
                 n = n->left;
         }
+        if (n->bucket) {
+            /* The index in the bucket follows */
+            int index = 0;
+            int j;
+            for (j = 0; j < n->bucket->extra_bits; ++j)
+                index = (index << 1) | read_bit(&data, &mask, &bite);
+            out[i] = n->bucket->symbols[index];
+        } else {
+            out[i] = n->symbol;
+        }
     }
-    out[len] = 0;
 }
 
 /**
  * Verifies that decoding the Huffman data results in the original strings.
  * @param head Strings
  * @param root Root of Huffman tree
+ * @param fixed The fixed-width code of the strings, or NULL if they are Huffman-coded
+ * @param cm The context-mixing model of the strings, or NULL
+ * @param symbols Mapping from symbol to the symbol of its leaf
  */
-static int verify_data_integrity(string_list_t *head, huffman_node_t *root)
+static int verify_data_integrity(string_list_t *head, huffman_node_t *root,
+                                 const fixed_code_t *fixed, const cm_model_t *cm,
+                                 const int *symbols)
 {
     string_list_t *str;
-    unsigned char *buf = 0;
+    int *buf = 0;
     int max_len = 0;
     for (str = head; str != NULL; str = str->next) {
-        int len = strlen((char *)str->text);
+        int len = str->length;
+        int i;
         if (len > max_len) {
-            buf = (unsigned char *)realloc(buf, len + 1);
+            buf = (int *)realloc(buf, len * sizeof(int));
             max_len = len;
         }
-        decode_string(root, str->huff_data, len, buf);
-        if (strcmp((char *)buf, (char *)str->text)) {
+        if (fixed)
+            fixed_decode(fixed, str->huff_data, len, buf);
+        else if (cm)
+            cm_decode(cm, str->huff_data, str->huff_size, len, buf);
+        else
+            decode_string(root, str->huff_data, len, buf);
+        /* Symbols may share a leaf, so compare the leaves */
+        for (i = 0; i < len; ++i) {
+            if (buf[i] != symbols[str->symbols[i]])
+                break;
+        }
+        if (i != len) {
             fprintf(stderr, "*** fatal error: decoded string is not equal to original string\n");
             fprintf(stderr, "    original: %s\n", str->text);
-            fprintf(stderr, "    decoded:  %s\n", buf);
+            fprintf(stderr, "    mismatch at symbol %d\n", i);
+            free(buf);
             return 0;
         }
 
@@ -395,76 +1019,1117 @@ static int verify_data_integrity(string_list_t *head, huffman_node_t *root)
 }
 
 /**
- * Writes a chunk of data as assembly .db statements.
- * @param out File to write to
- * @param label Data label
- * @param comment Comment that describes the data
- * @param buf Data
- * @param size Total number of bytes
- * @param cols Number of columns
+ * Measures how fast the host encodes the strings, and decodes and checks them.
+ * @param strings Strings
+ * @param codes Codes of the symbols
+ * @param root Root of Huffman tree
+ * @param fixed The fixed-width code of the strings, or NULL if they are Huffman-coded
+ * @param cm The context-mixing model of the strings, or NULL
+ * @param symbols Mapping from symbol to the symbol of its leaf
+ * @param char_count Number of characters in the strings
+ * @param encode_rate Where to store the encoding throughput, in MB/s
+ * @param decode_rate Where to store the decoding throughput, in MB/s
  */
-static void write_chunk(FILE *out, const char *label, const char *comment,
-                        const unsigned char *buf, int size, int cols)
+static void measure_throughput(string_list_t *strings, const struct huffman_code *codes,
+                               huffman_node_t *root, const fixed_code_t *fixed,
+                               const cm_model_t *cm, const int *symbols, int char_count,
+                               double *encode_rate, double *decode_rate)
 {
-    int i, j, k, m;
-    int has_label = (label && strlen(label)) ? 1 : 0;
-    int has_comment = (comment && strlen(comment)) ? 1 : 0;
-    if (has_label)
-        fprintf(out, "%s:", label);
-    if (has_comment) {
-        if (has_label)
-            fprintf(out, " ");
-        fprintf(out, "; %s", comment);
-    }
-    fprintf(out, "\n");
-    k=0;
-    for (i=0; i<size/cols; i++) {
-        fprintf(out, ".db ");
-        for (j=0; j<cols-1; j++) {
-            fprintf(out, "$%.2X,", buf[k++]);
-        }
-        fprintf(out, "$%.2X\n", buf[k++]);
-    }
-    m = size % cols;
-    if (m > 0) {
-        fprintf(out, ".db ");
-        for (j=0; j<m-1; j++) {
-            fprintf(out, "$%.2X,", buf[k++]);
+    double encode_time = 0, decode_time = 0;
+    int round;
+    /* The best of a few rounds is the least disturbed by other work */
+    for (round = 0; round < 3; round++) {
+        double t;
+        long runs;
+        clock_t start = clock();
+        for (runs = 0; (runs == 0) || (clock() - start < CLOCKS_PER_SEC / 10); runs++) {
+            if (cm)
+                cm_encode_strings(strings, cm);
+            else
+                encode_strings(strings, codes);
         }
-        fprintf(out, "$%.2X\n", buf[k++]);
+        t = (double)(clock() - start) / CLOCKS_PER_SEC / runs;
+        if ((round == 0) || (t < encode_time))
+            encode_time = t;
+        start = clock();
+        for (runs = 0; (runs == 0) || (clock() - start < CLOCKS_PER_SEC / 10); runs++)
+            verify_data_integrity(strings, root, fixed, cm, symbols);
+        t = (double)(clock() - start) / CLOCKS_PER_SEC / runs;
+        if ((round == 0) || (t < decode_time))
+            decode_time = t;
     }
+    *encode_rate = encode_time > 0 ? char_count / encode_time / 1e6 : 0.0;
+    *decode_rate = decode_time > 0 ? char_count / decode_time / 1e6 : 0.0;
 }
 
+/* Most candidates: every table format with every root lookup, the tree
+   as code, fixed-width codes and context mixing */
+#define MAX_CANDIDATES ((TABLE_ABS16 + 1) * (HUFFMAN_MAX_ROOT_BITS + 1) + 3)
+
+/* A combination of codec, table format and decoder that decodes the strings */
+struct candidate {
+    int codec;
+    int format;
+    int decoder;
+    int root_bits;      /* of the root lookup, or 0 */
+    int rom_size;       /* encoded strings, table and decoder */
+    int rom_margin;     /* half width of the 95% interval of rom_size, if it is estimated */
+    double cycles;      /* per character */
+};
+
 /**
- * Encodes the strings and writes the encoded data to file.
- * @param out File to write to
- * @param head Head of list of strings to encode & write
- * @param label_prefix
+ * Gives the size of the encoded strings, or estimates that of the whole
+ * file when the strings are a sample.
+ * @param sample The sample that the strings were drawn in, or NULL
+ * @param size Size of the encoded strings
+ * @param margin Where to store the half width of the 95% interval, or 0
+ * @return The size
  */
-static void write_huffman_strings(FILE *out, const string_list_t *head,
-                                  const char *label_prefix)
+static int estimate_data_size(const sample_t *sample, int size, int *margin)
 {
-    const string_list_t *string;
-    int string_id = 0;
-    for (string = head; string != NULL; string = string->next) {
-        char strlabel[256];
-        char strcomment[80];
-
-        sprintf(strlabel, "%sString%d", label_prefix, string_id++);
-
-        strcpy(strcomment, "\"");
-        if (strlen((char *)string->text) < 40) {
-            strcat(strcomment, (char *)string->text);
-        } else {
-            strncat(strcomment, (char *)string->text, 37);
-            strcat(strcomment, "...");
-        }
-        strcat(strcomment, "\"");
+    double estimate, half_width;
+    *margin = 0;
+    if (!sample)
+        return size;
+    sample_estimate(sample, SAMPLE_DATA_BYTES, &estimate, &half_width);
+    *margin = (int)(half_width + 0.5);
+    return (int)(estimate + 0.5);
+}
 
-        /* Write encoded data */
-        write_chunk(out, strlabel, strcomment,
-                    string->huff_data, string->huff_size, 16);
+/**
+ * Tells whether a candidate is one of a given set.
+ * @param c The candidate
+ * @param only The set, or NULL for every candidate
+ * @param only_count Number of candidates in the set
+ * @return 1 if it is, 0 if not
+ */
+static int candidate_wanted(const struct candidate *c, const struct candidate *only,
+                            int only_count)
+{
+    int i;
+    if (!only)
+        return 1;
+    for (i = 0; i < only_count; i++) {
+        if ((only[i].codec == c->codec) && (only[i].format == c->format)
+            && (only[i].decoder == c->decoder) && (only[i].root_bits == c->root_bits))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Runs one candidate decoder on the built-in CPU core.
+ * @return 0 if the decoder fails, 1 if OK
+ */
+static int measure_candidate(struct candidate *c, int cpu, huffman_node_t *root,
+                             const unsigned short *charmap,
+                             const charmap_sequence_t *sequences,
+                             const fixed_code_t *fixed, string_list_t *strings,
+                             int data_size, int data_margin, int table_size)
+{
+    int code_size;
+    double start = trace_now();
+    if ((cpu == CPU_SM83) || (cpu == CPU_Z80)) {
+        if (!z80dec_validate(cpu, root, charmap, sequences, c->format, c->root_bits,
+                             fixed, strings, &code_size, &c->cycles))
+            return 0;
+    } else {
+        if (!m65dec_validate(cpu, root, charmap, sequences, c->format, c->decoder,
+                             c->root_bits, fixed, strings, &code_size, &c->cycles))
+            return 0;
+    }
+    c->rom_size = data_size + table_size + code_size;
+    c->rom_margin = data_margin;
+    trace_span("decoder candidate", TRACE_MAIN_THREAD, start, "rom_bytes", c->rom_size);
+    return 1;
+}
+
+/**
+ * Chooses the codec, table format and decoder that decode the strings in
+ * the fewest cycles per character, taking at most a given amount of ROM,
+ * and prints the size-against-speed Pareto frontier of the candidates.
+ *
+ * When the strings are a sample of a file, their sizes are scaled up to
+ * the whole file and nothing is chosen: the candidates that may fit the
+ * budget, and that no candidate which surely fits beats, are stored as
+ * the finalists, for an exact run on all strings.
+ * @param strings Strings, Huffman-coded with codes
+ * @param root Root of Huffman tree
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters, or NULL
+ * @param cpu Target CPU
+ * @param allow_fixed Nonzero if the fixed-width codec may be used
+ * @param allow_cm Nonzero if the context-mixing codec may be used
+ * @param freq Symbol frequencies
+ * @param symbols Mapping from symbol to the symbol of its leaf
+ * @param codes Huffman codes of the symbols
+ * @param encoded_size Size of the Huffman-coded strings
+ * @param rom_budget Most bytes the strings, table and decoder may take, or -1
+ * @param sample The sample that the strings were drawn in, or NULL
+ * @param only Candidates to measure, or NULL for all of them
+ * @param only_count Number of candidates in only
+ * @param finalists Where to store the finalists of a sample (room for
+ *        MAX_CANDIDATES)
+ * @param finalist_count Where to store the number of finalists
+ * @param codec Where to store the chosen codec
+ * @param format Where to store the chosen table format
+ * @param decoder Where to store the chosen kind of decoder
+ * @param root_bits Where to store the number of bits of the chosen root lookup
+ * @return 0 if nothing fits or a decoder fails, 1 if OK
+ */
+static int optimize_speed(string_list_t *strings, huffman_node_t *root,
+                          const unsigned short *charmap,
+                          const charmap_sequence_t *sequences, int cpu,
+                          int allow_fixed, int allow_cm, const int *freq,
+                          const int *symbols, const struct huffman_code *codes,
+                          int encoded_size, long rom_budget, const sample_t *sample,
+                          const struct candidate *only, int only_count,
+                          struct candidate *finalists, int *finalist_count,
+                          int *codec, int *format, int *decoder, int *root_bits)
+{
+    struct candidate cands[MAX_CANDIDATES];
+    int positions[1 << HUFFMAN_MAX_ROOT_BITS];
+    struct candidate tmp;
+    const char *cycle_name = (cpu == CPU_Z80) ? "T-states" : "cycles";
+    int count = 0;
+    int best = -1;
+    int fitting_format = -1;
+    int data_size, data_margin;
+    int i, j;
+    double frontier_cycles;
+
+    /* Huffman codes with a table-walk decoder, in every table format, and
+       with a root lookup of every size that the shortest code allows */
+    data_size = estimate_data_size(sample, encoded_size, &data_margin);
+    for (i = TABLE_REL8; i <= TABLE_ABS16; i++) {
+        struct candidate *c;
+        int table_size;
+        int bits;
+        if (cpu == CPU_65816) {
+            if (i != TABLE_REL8)
+                continue;
+            table_size = huffman_table_image16(root, charmap,
+                                               m65dec_record_size(root, charmap), 0);
+        } else {
+            table_size = huffman_table_image(root, charmap, sequences, cpu, i, 0, 0);
+        }
+        if (table_size < 0)
+            continue;
+        if (fitting_format == -1)
+            fitting_format = i;
+        for (bits = 0; (bits == 0) || ((cpu != CPU_65816) && (bits <= HUFFMAN_MAX_ROOT_BITS)
+                                       && huffman_root_positions(root, bits, positions));
+             bits++) {
+            c = &cands[count];
+            c->codec = CODEC_HUFFMAN;
+            c->format = i;
+            c->decoder = DECODER_TABLE;
+            c->root_bits = bits;
+            if (!candidate_wanted(c, only, only_count))
+                continue;
+            if (!measure_candidate(c, cpu, root, charmap, sequences, NULL, strings,
+                                   data_size, data_margin, table_size))
+                return 0;
+            count++;
+        }
+    }
+
+    /* Huffman codes with the tree as code */
+    if ((cpu == CPU_6502) && (fitting_format != -1)) {
+        struct candidate *c = &cands[count];
+        c->codec = CODEC_HUFFMAN;
+        c->format = fitting_format;
+        c->decoder = DECODER_CODE;
+        c->root_bits = 0;
+        if (candidate_wanted(c, only, only_count)) {
+            if (!measure_candidate(c, cpu, root, charmap, sequences, NULL, strings,
+                                   data_size, data_margin, 0))
+                return 0;
+            count++;
+        }
+    }
+
+    /* Fixed-width codes; the strings are coded again for the measurement */
+    if (allow_fixed) {
+        struct candidate *c = &cands[count];
+        c->codec = CODEC_FIXED;
+        c->format = TABLE_REL8;
+        c->decoder = DECODER_TABLE;
+        c->root_bits = 0;
+        if (candidate_wanted(c, only, only_count)) {
+            struct huffman_code fixed_codes[HUFFMAN_MAX_SYMBOLS];
+            fixed_code_t fixed;
+            int ok;
+            memcpy(fixed_codes, codes, sizeof(fixed_codes));
+            fixed_assign_codes(freq, &fixed, fixed_codes);
+            data_size = estimate_data_size(sample, encode_strings(strings, fixed_codes),
+                                           &data_margin);
+            ok = measure_candidate(c, cpu, root, charmap, NULL, &fixed, strings,
+                                   data_size, data_margin, fixed.count);
+            encode_strings(strings, codes);
+            if (!ok)
+                return 0;
+            count++;
+        }
+    }
+
+    /* Context mixing, if the model fits; the strings are coded again */
+    if (allow_cm) {
+        struct candidate *c = &cands[count];
+        cm_model_t cm;
+        c->codec = CODEC_CM;
+        c->format = TABLE_REL8;
+        c->decoder = DECODER_TABLE;
+        c->root_bits = 0;
+        if (candidate_wanted(c, only, only_count)
+            && cm_build_model(root, strings, symbols, &cm)) {
+            int code_size;
+            double start = trace_now();
+            int ok;
+            data_size = estimate_data_size(sample, cm_encode_strings(strings, &cm),
+                                           &data_margin);
+            ok = m65cm_validate(&cm, charmap, strings, &code_size, &c->cycles);
+            encode_strings(strings, codes);
+            if (!ok)
+                return 0;
+            c->rom_size = data_size + m65cm_table_size(&cm) + code_size;
+            c->rom_margin = data_margin;
+            trace_span("decoder candidate", TRACE_MAIN_THREAD, start,
+                       "rom_bytes", c->rom_size);
+            count++;
+        }
+    }
+
+    /* Sort by size, then by time */
+    for (i = 1; i < count; i++) {
+        tmp = cands[i];
+        for (j = i; (j > 0) && ((cands[j-1].rom_size > tmp.rom_size)
+                                || ((cands[j-1].rom_size == tmp.rom_size)
+                                    && (cands[j-1].cycles > tmp.cycles))); j--)
+            cands[j] = cands[j-1];
+        cands[j] = tmp;
+    }
+
+    for (i = 0; i < count; i++) {
+        if ((rom_budget == -1) || (cands[i].rom_size <= rom_budget)) {
+            if ((best == -1) || (cands[i].cycles < cands[best].cycles))
+                best = i;
+        }
+    }
+
+    if (sample) {
+        /* A candidate is a finalist if it may fit, and no candidate that
+           surely fits is faster */
+        *finalist_count = 0;
+        for (i = 0; i < count; i++) {
+            if ((rom_budget != -1) && (cands[i].rom_size - cands[i].rom_margin > rom_budget))
+                continue;
+            for (j = 0; j < count; j++) {
+                if (((rom_budget == -1) || (cands[j].rom_size + cands[j].rom_margin <= rom_budget))
+                    && (cands[j].cycles < cands[i].cycles))
+                    break;
+            }
+            if (j == count)
+                finalists[(*finalist_count)++] = cands[i];
+        }
+    }
+
+    /* A candidate is on the frontier if every smaller one is slower */
+    fprintf(stdout, "size/speed Pareto frontier%s:\n",
+            sample ? ", estimated from the sample" : "");
+    frontier_cycles = -1;
+    for (i = 0; i < count; i++) {
+        const struct candidate *c = &cands[i];
+        char name[48];
+        char size[32];
+        const char *mark = "";
+        if ((frontier_cycles >= 0) && (c->cycles >= frontier_cycles))
+            continue;
+        frontier_cycles = c->cycles;
+        if (c->codec == CODEC_FIXED)
+            strcpy(name, "fixed-width");
+        else if (c->codec == CODEC_CM)
+            strcpy(name, "context mixing");
+        else if (c->decoder == DECODER_CODE)
+            strcpy(name, "huffman, tree as code");
+        else if (cpu == CPU_65816)
+            strcpy(name, "huffman");
+        else if (c->root_bits)
+            sprintf(name, "huffman, %s table, %d-bit root lookup",
+                    table_format_names[c->format], c->root_bits);
+        else
+            sprintf(name, "huffman, %s table", table_format_names[c->format]);
+        if (sample) {
+            sprintf(size, "%6d +/- %d bytes", c->rom_size, c->rom_margin);
+            if (candidate_wanted(c, finalists, *finalist_count))
+                mark = "  (finalist)";
+        } else {
+            sprintf(size, "%6d bytes", c->rom_size);
+            if (i == best)
+                mark = "  (chosen)";
+        }
+        fprintf(stdout, "  %s %9.1f %s per character  %s%s\n", size,
+                c->cycles, cycle_name, name, mark);
+    }
+
+    if (sample) {
+        fprintf(stdout, "finalists, to be measured on all strings: %d of %d\n",
+                *finalist_count, count);
+    }
+
+    if (sample ? !*finalist_count : (best == -1)) {
+        fprintf(stderr, "error: --rom-budget: nothing fits in %ld bytes; the smallest "
+                "choice takes %d\n", rom_budget, count ? cands[0].rom_size : 0);
+        return 0;
+    }
+    if (sample)
+        return 1;
+    *codec = cands[best].codec;
+    *format = cands[best].format;
+    *decoder = cands[best].decoder;
+    *root_bits = cands[best].root_bits;
+    return 1;
+}
+
+/**
+ * Decodes a string and spells it out in the characters it is printed as.
+ * @param str String
+ * @param root Root of Huffman tree
+ * @param fixed The fixed-width code of the strings, or NULL if they are Huffman-coded
+ * @param dict Dictionary
+ * @param map Character that every character is printed as
+ * @param append_byte Byte appended to the string, or -1
+ * @param symbols Work buffer with room for the symbols of the string
+ * @param text Where to store the characters
+ * @return Number of characters, or -1 if the data is not valid
+ */
+static int decode_text(const string_list_t *str, huffman_node_t *root,
+                       const fixed_code_t *fixed, const dictionary_t *dict,
+                       const int *map, int append_byte, int *symbols,
+                       unsigned char *text)
+{
+    int len = str->length - ((append_byte != -1) ? 1 : 0);
+    int n = 0;
+    int i, j;
+    if (fixed)
+        fixed_decode(fixed, str->huff_data, len, symbols);
+    else
+        decode_string(root, str->huff_data, len, symbols);
+    for (i = 0; i < len; ++i) {
+        if (symbols[i] < 0) {
+            return -1;
+        } else if (symbols[i] < 256) {
+            text[n++] = (unsigned char)map[symbols[i]];
+        } else {
+            const unsigned char *tok = dict->tokens[symbols[i] - 256];
+            for (j = 0; j < dict->lengths[symbols[i] - 256]; ++j)
+                text[n++] = (unsigned char)map[tok[j]];
+        }
+    }
+    return n;
+}
+
+/**
+ * Checks whether a text contains a pattern.
+ */
+static int contains(const unsigned char *text, int len,
+                    const unsigned char *pattern, int pattern_len)
+{
+    int i;
+    for (i = 0; i + pattern_len <= len; ++i) {
+        if (!memcmp(&text[i], pattern, pattern_len))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Finds the strings that contain a pattern. The candidates come from the
+ * index; only they are decoded to confirm the match.
+ * @param strings Strings, by number
+ * @param string_count Number of strings
+ * @param index Trigram index of the strings, or NULL to decode every string
+ * @param pattern The pattern, with characters already mapped
+ * @param len Length of the pattern
+ * @param root, fixed, dict, map, append_byte See decode_text()
+ * @param ids Where to store the numbers of the matching strings
+ * @param candidates Where to store the number of candidates
+ * @return Number of matching strings
+ */
+static int search_strings(string_list_t **strings, int string_count,
+                          const search_index_t *index,
+                          const unsigned char *pattern, int len,
+                          huffman_node_t *root, const fixed_code_t *fixed,
+                          const dictionary_t *dict, const int *map,
+                          int append_byte, int *ids, int *candidates)
+{
+    int *symbols = 0;
+    unsigned char *text = 0;
+    int max_len = 0;
+    int matches = 0;
+    int count;
+    int i;
+    if (index) {
+        count = search_candidates(index, pattern, len, ids);
+    } else {
+        for (i = 0; i < string_count; ++i)
+            ids[i] = i;
+        count = string_count;
+    }
+    for (i = 0; i < count; ++i) {
+        const string_list_t *str = strings[ids[i]];
+        int text_len = str->text_length;
+        if (text_len < len)
+            continue;
+        if (str->length > max_len || text_len > max_len) {
+            max_len = (str->length > text_len) ? str->length : text_len;
+            symbols = (int *)realloc(symbols, max_len * sizeof(int));
+            text = (unsigned char *)realloc(text, max_len);
+        }
+        text_len = decode_text(str, root, fixed, dict, map, append_byte, symbols, text);
+        if ((text_len >= 0) && contains(text, text_len, pattern, len))
+            ids[matches++] = ids[i];
+    }
+    free(symbols);
+    free(text);
+    *candidates = count;
+    return matches;
+}
+
+/* Cost of a symbol without a code, for --serve */
+#define SERVE_UNCODED 0x10000
+
+/**
+ * Reads a line of any length.
+ * @param in File to read from
+ * @param line Buffer, grown as needed
+ * @param size Size of the buffer
+ * @return 0 at the end of the input, 1 if OK
+ */
+static int read_line(FILE *in, char **line, int *size)
+{
+    int len = 0;
+    for (;;) {
+        if (*size - len < 2) {
+            *size += 256;
+            *line = (char *)realloc(*line, *size);
+        }
+        if (!fgets(*line + len, *size - len, in))
+            return (len > 0);
+        len += strlen(*line + len);
+        if ((*line)[len-1] == '\n') {
+            (*line)[len-1] = '\0';
+            return 1;
+        }
+    }
+}
+
+/**
+ * Starts the reply to a request, echoing its id.
+ */
+static void serve_reply(FILE *out, const json_object_t *req, int ok)
+{
+    long id;
+    fprintf(out, "{");
+    if (json_get_int(req, "id", &id))
+        fprintf(out, "\"id\":%ld,", id);
+    fprintf(out, "\"ok\":%s", ok ? "true" : "false");
+}
+
+/**
+ * Replies to a request with an error.
+ */
+static void serve_error(FILE *out, const json_object_t *req, const char *message)
+{
+    serve_reply(out, req, 0);
+    fprintf(out, ",\"error\":");
+    json_write_string(out, (const unsigned char *)message, strlen(message));
+    fprintf(out, "}\n");
+}
+
+/**
+ * Answers JSON requests, one per line, until the end of the input. Every
+ * request is an object with an "op" member, and optionally an "id" that
+ * is echoed in the reply:
+ *   encode  "text": the symbols, bits and hex data of the text
+ *   cost    "text": the bits of the text, and the characters without a code
+ *   decode  "data", "symbols": the text
+ *   search  "text": the numbers of the strings that contain the text
+ *   stats   the bits per character of all strings
+ * The tree and code are those of the output, so the answers hold for the
+ * strings as they are encoded now.
+ * @param in, out Files to read requests from and to write replies to
+ * @param strings, string_count The strings
+ * @param root, fixed, dict, map, append_byte See decode_text()
+ * @param codes Code of every symbol
+ * @param ignore_case Convert characters to lower-case
+ */
+static void serve(FILE *in, FILE *out, string_list_t *strings, int string_count,
+                  huffman_node_t *root, const fixed_code_t *fixed,
+                  const struct huffman_code *codes, const dictionary_t *dict,
+                  const int *map, int append_byte, int ignore_case)
+{
+    search_index_t index;
+    string_list_t **by_number;
+    string_list_t *str;
+    int lengths[HUFFMAN_MAX_SYMBOLS];
+    int *ids;
+    char *line = 0;
+    int line_size = 0;
+    long corpus_chars = 0;
+    long corpus_bits = 0;
+    int max_code = 1;
+    int i, j;
+
+    /* Keep the code lengths and the index at hand */
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        lengths[i] = codes[i].length ? codes[i].length : SERVE_UNCODED;
+        if (codes[i].length > max_code)
+            max_code = codes[i].length;
+    }
+    search_build(strings, map, &index);
+    by_number = (string_list_t **)malloc((string_count + 1) * sizeof(string_list_t *));
+    ids = (int *)malloc((string_count + 1) * sizeof(int));
+    for (i = 0, str = strings; str != NULL; str = str->next, i++) {
+        by_number[i] = str;
+        corpus_chars += str->text_length;
+        for (j = 0; j < str->length; j++)
+            corpus_bits += codes[str->symbols[j]].length;
+    }
+
+    while (read_line(in, &line, &line_size)) {
+        json_object_t req;
+        const char *op;
+        const char *text;
+        int len;
+        if (!json_parse(line, &req)) {
+            serve_error(out, &req, "bad request");
+            fflush(out);
+            continue;
+        }
+        op = json_get_string(&req, "op", NULL);
+        text = json_get_string(&req, "text", &len);
+        if (!op) {
+            serve_error(out, &req, "missing op");
+        } else if (!strcmp(op, "encode") || !strcmp(op, "cost")) {
+            string_list_t one;
+            long bits = 0;
+            int missing = 0;
+            if (!text) {
+                serve_error(out, &req, "missing text");
+                json_free(&req);
+                fflush(out);
+                continue;
+            }
+            one.next = NULL;
+            one.text = (unsigned char *)malloc(len + 1);
+            one.text_length = len;
+            for (i = 0; i <= len; i++) {
+                int c = (unsigned char)text[i];
+                if (ignore_case && (c >= 'A') && (c <= 'Z'))
+                    c += 0x20;
+                one.text[i] = (unsigned char)c;
+            }
+            one.huff_data = 0;
+            parse_string(&one, dict, lengths, append_byte);
+            for (i = 0; i < one.length; i++) {
+                if (codes[one.symbols[i]].length)
+                    bits += codes[one.symbols[i]].length;
+                else
+                    missing++;
+            }
+            if (!strcmp(op, "cost")) {
+                serve_reply(out, &req, 1);
+                fprintf(out, ",\"symbols\":%d,\"bits\":%ld,\"bytes\":%ld,"
+                        "\"bits_per_char\":%.3f,\"missing\":%d}\n", one.length, bits,
+                        (bits + 7) / 8, len ? (double)bits / len : 0.0, missing);
+            } else if (missing) {
+                serve_error(out, &req, "text has characters without a code");
+            } else {
+                encode_strings(&one, codes);
+                serve_reply(out, &req, 1);
+                fprintf(out, ",\"symbols\":%d,\"bits\":%ld,\"data\":\"", one.length, bits);
+                for (i = 0; i < one.huff_size; i++)
+                    fprintf(out, "%.2X", one.huff_data[i]);
+                fprintf(out, "\"}\n");
+            }
+            free(one.text);
+            free(one.symbols);
+            free(one.huff_data);
+        } else if (!strcmp(op, "decode")) {
+            const char *hex = json_get_string(&req, "data", &len);
+            long symbols;
+            string_list_t one;
+            int *decoded;
+            unsigned char *chars;
+            int bytes;
+            int n;
+            if (!hex || (len % 2) || !json_get_int(&req, "symbols", &symbols)
+                || (symbols < 0) || (symbols > 0x100000)) {
+                serve_error(out, &req, "decode needs hex data and a number of symbols");
+                json_free(&req);
+                fflush(out);
+                continue;
+            }
+            /* Pad the data so that decoding never runs past its end */
+            bytes = len / 2 + (int)((symbols * max_code + 7) / 8) + 1;
+            one.huff_data = (unsigned char *)calloc(bytes, 1);
+            one.length = (int)symbols;
+            for (i = 0; i < len; i++) {
+                int c = tolower((unsigned char)hex[i]);
+                int d = isdigit(c) ? c - '0' : ((c >= 'a') && (c <= 'f')) ? c - 'a' + 10 : -1;
+                if (d == -1)
+                    break;
+                one.huff_data[i / 2] |= d << ((i % 2) ? 0 : 4);
+            }
+            decoded = (int *)malloc((symbols + 1) * sizeof(int));
+            chars = (unsigned char *)malloc((symbols + 1) * CHARMAP_MAX_SEQUENCE);
+            n = (i < len) ? -1 : decode_text(&one, root, fixed, dict, map, append_byte,
+                                             decoded, chars);
+            if (n < 0) {
+                serve_error(out, &req, "bad data");
+            } else {
+                serve_reply(out, &req, 1);
+                fprintf(out, ",\"text\":");
+                json_write_string(out, chars, n);
+                fprintf(out, "}\n");
+            }
+            free(one.huff_data);
+            free(decoded);
+            free(chars);
+        } else if (!strcmp(op, "search")) {
+            unsigned char *pattern;
+            int candidates;
+            int matches;
+            if (!text) {
+                serve_error(out, &req, "missing text");
+                json_free(&req);
+                fflush(out);
+                continue;
+            }
+            pattern = (unsigned char *)malloc(len + 1);
+            for (i = 0; i < len; i++) {
+                int c = (unsigned char)text[i];
+                if (ignore_case && (c >= 'A') && (c <= 'Z'))
+                    c += 0x20;
+                pattern[i] = (unsigned char)map[c];
+            }
+            matches = search_strings(by_number, string_count, &index, pattern, len,
+                                     root, fixed, dict, map, append_byte, ids, &candidates);
+            serve_reply(out, &req, 1);
+            fprintf(out, ",\"ids\":[");
+            for (i = 0; i < matches; i++)
+                fprintf(out, "%s%d", i ? "," : "", ids[i]);
+            fprintf(out, "]}\n");
+            free(pattern);
+        } else if (!strcmp(op, "stats")) {
+            serve_reply(out, &req, 1);
+            fprintf(out, ",\"strings\":%d,\"characters\":%ld,\"bits\":%ld,"
+                    "\"bits_per_char\":%.3f}\n", string_count, corpus_chars, corpus_bits,
+                    corpus_chars ? (double)corpus_bits / corpus_chars : 0.0);
+        } else {
+            serve_error(out, &req, "unknown op");
+        }
+        json_free(&req);
+        fflush(out);
+    }
+    free(line);
+    free(ids);
+    free(by_number);
+    search_free(&index);
+}
+
+/**
+ * Writes a chunk of data as assembly .db statements.
+ * @param out File to write to
+ * @param label Data label
+ * @param comment Comment that describes the data
+ * @param buf Data
+ * @param size Total number of bytes
+ * @param cols Number of columns
+ * @param db Byte directive of the target assembler
+ */
+static void write_chunk(FILE *out, const char *label, const char *comment,
+                        const unsigned char *buf, int size, int cols,
+                        const char *db)
+{
+    int i, j, k, m;
+    int has_label = (label && strlen(label)) ? 1 : 0;
+    int has_comment = (comment && strlen(comment)) ? 1 : 0;
+    if (has_label)
+        fprintf(out, "%s:", label);
+    if (has_comment) {
+        if (has_label)
+            fprintf(out, " ");
+        fprintf(out, "; %s", comment);
+    }
+    fprintf(out, "\n");
+    k=0;
+    for (i=0; i<size/cols; i++) {
+        fprintf(out, "%s ", db);
+        for (j=0; j<cols-1; j++) {
+            fprintf(out, "$%.2X,", buf[k++]);
+        }
+        fprintf(out, "$%.2X\n", buf[k++]);
+    }
+    m = size % cols;
+    if (m > 0) {
+        fprintf(out, "%s ", db);
+        for (j=0; j<m-1; j++) {
+            fprintf(out, "$%.2X,", buf[k++]);
+        }
+        fprintf(out, "$%.2X\n", buf[k++]);
+    }
+}
+
+/* A string and where it goes */
+struct placed_string {
+    const string_list_t *string;
+    int id;         /* number of the string */
+    int bank;       /* index of its bank in the layout */
+    long offset;    /* in the bank */
+};
+
+/**
+ * Orders strings by bank and offset, for qsort().
+ */
+static int compare_placed_strings(const void *a, const void *b)
+{
+    const struct placed_string *p = (const struct placed_string *)a;
+    const struct placed_string *q = (const struct placed_string *)b;
+    if (p->bank != q->bank)
+        return p->bank - q->bank;
+    return (p->offset > q->offset) - (p->offset < q->offset);
+}
+
+/**
+ * Encodes the strings and writes the encoded data to file.
+ * @param out File to write to
+ * @param head Head of list of strings to encode & write
+ * @param label_prefix
+ * @param db Byte directive of the target assembler
+ * @param input_format Format the strings were read in (INPUT_*)
+ * @param banks Bank of every string, or NULL
+ * @param bank_directive Line written before the strings of a bank, with
+ *        %d standing for its number; or NULL for a comment
+ * @param labels 0 to label only the first string of the data or of a
+ *        bank, as <label_prefix>Strings or <label_prefix>Bank<n>
+ * @param layout Where the strings go, with the slack between them; or
+ *        NULL to write them in order
+ */
+static void write_huffman_strings(FILE *out, const string_list_t *head,
+                                  const char *label_prefix, const char *db,
+                                  int input_format, const int *banks,
+                                  const char *bank_directive, int labels,
+                                  const layout_t *layout)
+{
+    struct placed_string *order;
+    const string_list_t *string;
+    long pos = 0;
+    int count = 0;
+    int k;
+    for (string = head; string != NULL; string = string->next)
+        count++;
+    order = (struct placed_string *)malloc((count + 1) * sizeof(struct placed_string));
+    for (k = 0, string = head; string != NULL; string = string->next, k++) {
+        order[k].string = string;
+        order[k].id = k;
+        order[k].bank = 0;
+        order[k].offset = 0;
+        if (layout) {
+            while (layout->banks[order[k].bank].number != layout->strings[k].bank)
+                order[k].bank++;
+            order[k].offset = layout->strings[k].offset;
+        }
+    }
+    if (layout)
+        qsort(order, count, sizeof(struct placed_string), compare_placed_strings);
+
+    for (k = 0; k < count; k++) {
+        char strlabel[256];
+        char strcomment[80];
+        int string_id = order[k].id;
+        int first = (k == 0) || (order[k].bank != order[k - 1].bank);
+        string = order[k].string;
+
+        if (banks && (first || (banks[string_id] != banks[order[k - 1].id]))) {
+            /* Start a bank */
+            const char *p;
+            if (!bank_directive)
+                bank_directive = "; bank %d";
+            for (p = bank_directive; *p; p++) {
+                if ((p[0] == '%') && (p[1] == 'd')) {
+                    fprintf(out, "%d", banks[string_id]);
+                    p++;
+                } else {
+                    fputc(*p, out);
+                }
+            }
+            fprintf(out, "\n");
+            if (!labels)
+                fprintf(out, "%sBank%d:\n", label_prefix, banks[string_id]);
+        } else if (!labels && (k == 0)) {
+            fprintf(out, "%sStrings:\n", label_prefix);
+        }
+
+        if (layout) {
+            /* The slack before the string keeps its old bytes */
+            const layout_bank_t *bank = &layout->banks[order[k].bank];
+            if (first)
+                pos = 0;
+            if (order[k].offset > pos) {
+                write_chunk(out, NULL, "slack", &bank->bytes[pos],
+                            order[k].offset - pos, 16, db);
+            }
+            pos = order[k].offset + string->huff_size;
+        }
+
+        sprintf(strlabel, "%sString%d", label_prefix, string_id);
+
+        if (input_format == INPUT_RECORDS) {
+            /* The bytes of a record are not fit for a comment */
+            sprintf(strcomment, "%d bytes", string->text_length);
+        } else if ((input_format == INPUT_PO) || (input_format == INPUT_CSV)) {
+            /* Messages may span lines; name them by ID where there is one */
+            const char *name = string->id ? string->id : (const char *)string->text;
+            int i;
+            strcomment[0] = string->id ? '<' : '"';
+            for (i = 0; name[i] && (i < 37); i++) {
+                unsigned char c = (unsigned char)name[i];
+                strcomment[i+1] = ((c < 0x20) || (c == 0x7F)) ? ' ' : c;
+            }
+            if (name[i]) {
+                strcpy(&strcomment[i+1], "...");
+                i += 3;
+            }
+            strcomment[i+1] = string->id ? '>' : '"';
+            strcomment[i+2] = 0;
+        } else {
+            strcpy(strcomment, "\"");
+            if (strlen((char *)string->text) < 40) {
+                strcat(strcomment, (char *)string->text);
+            } else {
+                strncat(strcomment, (char *)string->text, 37);
+                strcat(strcomment, "...");
+            }
+            strcat(strcomment, "\"");
+        }
+
+        /* Write encoded data */
+        write_chunk(out, labels ? strlabel : NULL, strcomment,
+                    string->huff_data, string->huff_size, 16, db);
+
+        if (layout && ((k == count - 1) || (order[k + 1].bank != order[k].bank))) {
+            /* A bank does not shrink */
+            const layout_bank_t *bank = &layout->banks[order[k].bank];
+            if (bank->size > pos)
+                write_chunk(out, NULL, "slack", &bank->bytes[pos], bank->size - pos, 16, db);
+        }
+    }
+    free(order);
+}
+
+/**
+ * Puts the encoded strings in banks, in order; a string does not cross
+ * the end of a bank.
+ * @param head Encoded strings
+ * @param bank_size Size of a bank
+ * @param first_bank Number of the first bank
+ * @param banks Where to store the bank of every string
+ * @param offsets Where to store the offset of every string in its bank
+ * @return Number of banks used, or 0 if a string does not fit a bank
+ */
+static int assign_banks(const string_list_t *head, long bank_size, int first_bank,
+                        int *banks, int *offsets)
+{
+    const string_list_t *str;
+    int bank = first_bank;
+    long used = 0;
+    int i;
+    for (i = 0, str = head; str != NULL; str = str->next, i++) {
+        if (str->huff_size > bank_size)
+            return 0;
+        if (used + str->huff_size > bank_size) {
+            bank++;
+            used = 0;
+        }
+        banks[i] = bank;
+        offsets[i] = (int)used;
+        used += str->huff_size;
+    }
+    return bank - first_bank + 1;
+}
+
+/**
+ * Writes the string pointer table.
+ * @param out File to write to
+ * @param head Encoded strings
+ * @param label Name of the table, or an empty string for none
+ * @param label_prefix Prefix of the string labels
+ * @param dw Word directive of the target assembler
+ * @param labels 0 to address the strings from <label_prefix>Strings
+ * @param layout Where the strings go, or NULL if they follow each other
+ */
+static void write_string_table(FILE *out, const string_list_t *head, const char *label,
+                               const char *label_prefix, const char *dw, int labels,
+                               const layout_t *layout)
+{
+    const string_list_t *lst;
+    long offset = 0;
+    int i;
+    if (label && strlen(label))
+        fprintf(out, "%s:\n", label);
+    for (i = 0, lst = head; lst != 0; lst = lst->next, ++i) {
+        if (layout)
+            offset = layout->strings[i].offset;
+        if (labels) {
+            fprintf(out, "%s %sString%d\n", dw, label_prefix, i);
+        } else {
+            fprintf(out, "%s %sStrings+$%.4lX\n", dw, label_prefix, offset);
+        }
+        offset += lst->huff_size;
+    }
+}
+
+/**
+ * Writes the string pointer table as far pointers: arrays of the low
+ * bytes, high bytes and banks of the string addresses, so that Y can
+ * index all three. Every 256 strings start a sub-table with a label of
+ * its own.
+ * @param out File to write to
+ * @param label Name of the table; the arrays are <label>_lo, _hi and _bank
+ * @param label_prefix Prefix of the string labels
+ * @param banks Bank of every string
+ * @param offsets Offset of every string in its bank, to address the
+ *        strings from the bank labels; or NULL to use the string labels
+ * @param count Number of strings
+ * @param cpu Target CPU
+ */
+static void write_far_pointers(FILE *out, const char *label, const char *label_prefix,
+                               const int *banks, const int *offsets, int count, int cpu)
+{
+    static const char *parts[3] = { "lo", "hi", "bank" };
+    const char *db = (cpu == CPU_SM83) ? "db" : ".db";
+    int part;
+    int i;
+    for (part = 0; part < 3; part++) {
+        fprintf(out, "%s_%s:\n", label, parts[part]);
+        for (i = 0; i < count; i++) {
+            if ((count > 256) && ((i % 256) == 0))
+                fprintf(out, "%s_%s%d:\n", label, parts[part], i / 256);
+            if (part == 2)
+                fprintf(out, "%s $%.2X\n", db, banks[i]);
+            else if (offsets && (cpu == CPU_SM83))
+                fprintf(out, "%s %s(%sBank%d+$%.4X)\n", db, part ? "HIGH" : "LOW",
+                        label_prefix, banks[i], offsets[i]);
+            else if (offsets)
+                fprintf(out, "%s %s(%sBank%d+$%.4X)\n", db, part ? ">" : "<",
+                        label_prefix, banks[i], offsets[i]);
+            else if (cpu == CPU_SM83)
+                fprintf(out, "%s %s(%sString%d)\n", db, part ? "HIGH" : "LOW", label_prefix, i);
+            else
+                fprintf(out, "%s %s%sString%d\n", db, part ? ">" : "<", label_prefix, i);
+        }
+    }
+}
+
+/**
+ * Writes the output as a chain of o65 object modules, so that it can be
+ * linked without assembling any text: the decoder table, the encoded
+ * strings and, if there is one, the string pointer table. Every label is
+ * exported, and the pointer table refers to the strings through undefined
+ * symbols. Banked strings get one module per bank, named after the bank.
+ * @param out File to write to
+ * @param cpu Target CPU
+ * @param table Decoder table, laid out at address 0
+ * @param moved Decoder table laid out at address $100, where it holds
+ *        addresses (high byte first); or NULL
+ * @param table_size Size of the decoder table
+ * @param table_label Name of the decoder table
+ * @param head Encoded strings
+ * @param label_prefix Prefix of the string labels
+ * @param pointer_label Name of the string pointer table, or NULL for none
+ * @param banks Bank of every string for far pointers, or NULL
+ * @param count Number of strings
+ */
+static void write_object_file(FILE *out, int cpu, const unsigned char *table,
+                              const unsigned char *moved, int table_size,
+                              const char *table_label, const string_list_t *head,
+                              const char *label_prefix, const char *pointer_label,
+                              const int *banks, int count)
+{
+    o65_module_t *modules;
+    const string_list_t *str;
+    char label[300];
+    int module_count = 1;
+    int i;
+
+    modules = (o65_module_t *)malloc((3 + (banks ? count : 0)) * sizeof(o65_module_t));
+
+    o65_init(&modules[0], "table");
+    o65_bytes(&modules[0], table, table_size);
+    o65_export(&modules[0], table_label, 0);
+    for (i = 0; moved && (i < table_size); i++) {
+        if (table[i] != moved[i]) {
+            o65_reloc(&modules[0], i, O65_HIGH, -1, table[i + 1]);
+            o65_reloc(&modules[0], i + 1, O65_LOW, -1, 0);
+            i++;
+        }
+    }
+
+    for (i = 0, str = head; str != NULL; str = str->next, i++) {
+        o65_module_t *m = &modules[module_count - 1];
+        if ((i == 0) || (banks && (banks[i] != banks[i - 1]))) {
+            m = &modules[module_count++];
+            if (banks)
+                sprintf(label, "bank %d", banks[i]);
+            o65_init(m, banks ? label : "strings");
+        }
+        sprintf(label, "%.255sString%d", label_prefix, i);
+        o65_export(m, label, m->size);
+        o65_bytes(m, str->huff_data, str->huff_size);
+    }
+
+    if (pointer_label) {
+        o65_module_t *m = &modules[module_count++];
+        unsigned char zero[2] = { 0, 0 };
+        o65_init(m, "pointers");
+        for (i = 0; i < count; i++) {
+            sprintf(label, "%.255sString%d", label_prefix, i);
+            o65_import(m, label);
+        }
+        if (banks) {
+            static const char *parts[3] = { "lo", "hi", "bank" };
+            int part;
+            for (part = 0; part < 3; part++) {
+                sprintf(label, "%.255s_%s", pointer_label, parts[part]);
+                o65_export(m, label, m->size);
+                for (i = 0; i < count; i++) {
+                    unsigned char bank = (unsigned char)banks[i];
+                    if ((count > 256) && ((i % 256) == 0)) {
+                        sprintf(label, "%.255s_%s%d", pointer_label, parts[part], i / 256);
+                        o65_export(m, label, m->size);
+                    }
+                    if (part == 0)
+                        o65_reloc(m, m->size, O65_LOW, i, 0);
+                    else if (part == 1)
+                        o65_reloc(m, m->size, O65_HIGH, i, 0);
+                    o65_bytes(m, (part == 2) ? &bank : zero, 1);
+                }
+            }
+        } else {
+            o65_export(m, pointer_label, 0);
+            for (i = 0; i < count; i++) {
+                o65_reloc(m, m->size, O65_WORD, i, 0);
+                o65_bytes(m, zero, 2);
+            }
+        }
     }
+
+    o65_write(out, modules, module_count, cpu);
+    for (i = 0; i < module_count; i++)
+        o65_free(&modules[i]);
+    free(modules);
 }
 
 /**
@@ -477,6 +2142,8 @@ void destroy_string_list(string_list_t *lst)
     for ( ; lst != 0; lst = tmp) {
         tmp = lst->next;
         free(lst->text);
+        free(lst->id);
+        free(lst->symbols);
         free(lst->huff_data);
         free(lst);
     }
@@ -490,9 +2157,26 @@ static void usage()
     printf(
         "Usage: huffpuff [--character-map=FILE]\n"
         "                [--table-output=FILE] [--data-output=FILE]\n"
+        "                [--object-output=FILE]\n"
         "                [--table-label=LABEL] [--node-label-prefix=PREFIX]\n"
         "                [--string-label-prefix=PREFIX]\n"
         "                [--generate-string-table] [--append-byte=VALUE]\n"
+        "                [--cpu=6502|65816|sm83|z80] [--decoder-output=FILE]\n"
+        "                [--decoder-label=LABEL] [--buckets]\n"
+        "                [--dictionary=FILE] [--parse=greedy|optimal]\n"
+        "                [--table-format=auto|rel8|rel16|abs16]\n"
+        "                [--emit-decoder=table|code] [--codec=huffman|fixed|cm]\n"
+        "                [--root-lookup=BITS]\n"
+        "                [--optimize=size|speed] [--rom-budget=BYTES]\n"
+        "                [--stats-output=FILE] [--compare=BASELINE] [--tolerance=PERCENT]\n"
+        "                [--trace=FILE] [--sample=COUNT]\n"
+        "                [--bank-size=BYTES] [--first-bank=N] [--bank-directive=TEXT]\n"
+        "                [--no-labels] [--output-format=asm|c]\n"
+        "                [--glyph-output=FILE] [--scenes=FILE]\n"
+        "                [--previous-layout=FILE] [--layout-output=FILE]\n"
+        "                [--templates] [--index-output=FILE] [--search=TEXT]\n"
+        "                [--serve] [--encoder-output=FILE] [--encoder-label=LABEL]\n"
+        "                [--input-format=text|records|po|csv]\n"
         "                [--ignore-case] [--verbose]\n"
         "                [--help] [--usage] [--version]\n"
         "                FILE\n");
@@ -508,12 +2192,48 @@ static void help()
            "  --character-map=FILE            Transform characters according to the rules in FILE before encoding\n"
            "  --table-output=FILE             Store Huffman decoder table definition in FILE\n"
            "  --data-output=FILE              Store Huffman string data definition in FILE\n"
+           "  --object-output=FILE            Store decoder table, string data and pointer table as o65 objects in FILE\n"
            "  --table-label=LABEL             Create symbolic label LABEL for decoder table definition\n"
            "  --node-label-prefix=PREFIX      Prefix symbolic labels in decoder table definition by PREFIX\n"
            "  --string-label-prefix=PREFIX    Prefix symbolic labels in data definition by PREFIX\n"
            "  --generate-string-table         Generate string pointer table\n"
            "  --string-table-label=LABEL      Create symbolic label LABEL for string pointer table definition\n"
+           "  --no-labels                     Label only the decoder table and the start of the string data, and address the rest by offset\n"
+           "  --output-format=FORMAT          Write assembler source (asm) or C headers (c)\n"
+           "  --glyph-output=FILE             Store the glyphs that every string needs in FILE\n"
+           "  --scenes=FILE                   Also store the glyphs and upload list of the scenes in FILE\n"
+           "  --previous-layout=FILE          Keep the code and string places of the layout in FILE\n"
+           "  --layout-output=FILE            Store the code and string places in FILE\n"
            "  --append-byte=VALUE             Append VALUE to every string before encoding\n"
+           "  --cpu=CPU                       Generate output for CPU (6502, 65816, sm83 or z80)\n"
+           "  --decoder-output=FILE           Store generated Huffman decoder in FILE\n"
+           "  --decoder-label=LABEL           Create symbolic label LABEL for generated decoder\n"
+           "  --encoder-output=FILE           Store generated encoder and its tables in FILE (6502)\n"
+           "  --encoder-label=LABEL           Create symbolic label LABEL for generated encoder\n"
+           "  --input-format=FORMAT           Read lines of text, binary records with 16-bit lengths,\n"
+           "                                  gettext .po messages or CSV rows\n"
+           "  --buckets                       Group rare characters into buckets that share a leaf\n"
+           "  --dictionary=FILE               Replace the tokens listed in FILE by symbols of their own\n"
+           "  --parse=METHOD                  Choose tokens with METHOD (greedy or optimal)\n"
+           "  --table-format=FORMAT           Use FORMAT for the decoder table nodes (auto, rel8, rel16 or abs16)\n"
+           "  --emit-decoder=KIND             Generate a decoder that walks the table, or that is the tree as code (6502)\n"
+           "  --codec=CODEC                   Encode strings with CODEC (huffman, fixed for fixed-width codes, or cm)\n"
+           "  --root-lookup=BITS              Take the first BITS of every code at once, from a table in the decoder\n"
+           "  --optimize=GOAL                 Make the output small (size), or decode fast (speed)\n"
+           "  --rom-budget=BYTES              With --optimize=speed, take at most BYTES of ROM\n"
+           "  --stats-output=FILE             Record the sizes and speeds of the output in FILE\n"
+           "  --compare=BASELINE              Fail if a size or speed is worse than recorded in BASELINE\n"
+           "  --tolerance=PERCENT             Let throughput drop by PERCENT in --compare (10)\n"
+           "  --trace=FILE                    Store a Chrome trace of where the time goes in FILE\n"
+           "  --sample=COUNT                  Estimate the sizes from COUNT strings drawn at random,\n"
+           "                                  or with --optimize=speed, measure only the likely decoders on all strings\n"
+           "  --bank-size=BYTES               Put the strings in banks of BYTES, with far pointers to them\n"
+           "  --first-bank=N                  Number the banks from N (0)\n"
+           "  --bank-directive=TEXT           Write TEXT before the strings of every bank; %%d is its number\n"
+           "  --templates                     Factor near-duplicate strings into templates with a slot\n"
+           "  --index-output=FILE             Store the trigram search index of the strings in FILE\n"
+           "  --search=TEXT                   Print the numbers of the strings that contain TEXT\n"
+           "  --serve                         Answer JSON requests on standard input after encoding\n"
            "  --ignore-case                   Convert characters to lower-case before processing\n"
            "  --verbose                       Print progress information to standard output\n"
            "  --help                          Give this help list\n"
@@ -530,34 +2250,109 @@ static void version()
 }
 
 /**
- * Program entrypoint.
+ * Runs the program.
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @param only Decoder candidates that --optimize=speed chooses from, or NULL for all
+ * @param only_count Number of candidates in only
+ * @return Exit status
  */
-int main(int argc, char **argv)
+static int run(int argc, char **argv, const struct candidate *only, int only_count)
 {
+    char **args = argv;
+    struct candidate finalists[MAX_CANDIDATES];
+    int finalist_count = 0;
     int char_count;
     int string_count;
     int encoded_size;
-    unsigned char charmap[256];
-    int frequencies[256];
-    huffman_node_t *leaf_nodes[256];
-    huffman_node_t *code_nodes[256];
+    unsigned short charmap[256];
+    charmap_sequence_t sequences[HUFFMAN_MAX_SYMBOLS];
+    const charmap_sequence_t *leaf_sequences = 0;
+    int frequencies[HUFFMAN_MAX_SYMBOLS];
+    int shared_leaf[HUFFMAN_MAX_SYMBOLS];
+    int shared_leaf_count = 0;
+    huffman_node_t *leaf_nodes[HUFFMAN_MAX_SYMBOLS];
+    huffman_node_t *code_nodes[HUFFMAN_MAX_SYMBOLS];
+    struct huffman_code codes[HUFFMAN_MAX_SYMBOLS];
     huffman_node_t *root;
     int symbol_count;
     string_list_t *strings;
+    string_list_t *run_strings;
     FILE *input;
-    FILE *table_output;
-    FILE *data_output;
+    FILE *table_output = 0;
+    FILE *data_output = 0;
+    FILE *decoder_output;
     int append_byte = -1;
     int ignore_case = 0;
+    int use_buckets = 0;
+    const char *dictionary_filename = 0;
+    dictionary_t dictionary;
+    int parse_method = PARSE_GREEDY;
+    int table_format = TABLE_AUTO;
+    int chosen_format = TABLE_REL8;
+    int decoder_kind = DECODER_TABLE;
+    int root_bits = 0;
+    int root_positions[1 << HUFFMAN_MAX_ROOT_BITS];
+    int codec = CODEC_HUFFMAN;
+    int optimize = OPTIMIZE_SIZE;
+    long rom_budget = -1;
+    int sample_count = 0;
+    sample_t sample;
+    long bank_size = 0;
+    int first_bank = -1;
+    const char *bank_directive = 0;
+    int *banks = 0;
+    int *bank_offsets = 0;
+    int bank_count = 0;
+    int pointer_size;
+    char far_label[256];
+    int decoder_given = 0;
+    int rom_table_size = 0;
+    int rom_decoder_size = 0;
+    double decode_cycles = 0;
+    const char *stats_output_filename = 0;
+    const char *trace_filename = 0;
+    const char *object_output_filename = 0;
+    const char *glyph_output_filename = 0;
+    const char *scenes_filename = 0;
+    glyph_scene_t *scenes = 0;
+    int scene_count = 0;
+    const char *previous_layout_filename = 0;
+    const char *layout_output_filename = 0;
+    int use_layout = 0;
+    int have_previous = 0;
+    layout_t previous;
+    layout_t layout;
+    const char *baseline_filename = 0;
+    double tolerance = 0.10;
+    int use_templates = 0;
+    int input_format = INPUT_TEXT;
+    clock_t read_start;
+    const char *search_pattern = 0;
+    int serve_requests = 0;
+    const char *index_output_filename = 0;
+    int user_tokens;
+    int char_sequences = 0;
+    fixed_code_t fixed;
+    static cm_model_t cm;
     const char *input_filename = 0;
     const char *charmap_filename = 0;
     const char *table_output_filename = 0;
     const char *data_output_filename = 0;
+    const char *decoder_output_filename = 0;
+    const char *decoder_label = "huff_decode";
+    const char *encoder_output_filename = 0;
+    const char *encoder_label = "huff_encode";
     const char *table_label = "";
     const char *node_label_prefix = "";
     const char *string_table_label = "";
     const char *string_label_prefix = "";
     int generate_string_table = 0;
+    int labels = 1;
+    int output_format = OUTPUT_ASM;
+    int cpu = CPU_6502;
+    const char *db;
+    const char *dw;
     int verbose = 0;
 
     /* Process arguments. */
@@ -589,6 +2384,178 @@ int main(int argc, char **argv)
                         fprintf(stderr, "huffpuff: --append-byte: value must be in range 0..255\n");
                         return(-1);
                     }
+                } else if (!strncmp("cpu=", opt, 4)) {
+                    if (!strcmp("6502", &opt[4])) {
+                        cpu = CPU_6502;
+                    } else if (!strcmp("65816", &opt[4])) {
+                        cpu = CPU_65816;
+                    } else if (!strcmp("sm83", &opt[4])) {
+                        cpu = CPU_SM83;
+                    } else if (!strcmp("z80", &opt[4])) {
+                        cpu = CPU_Z80;
+                    } else {
+                        fprintf(stderr, "huffpuff: --cpu: unsupported CPU `%s'\n", &opt[4]);
+                        return(-1);
+                    }
+                } else if (!strncmp("decoder-output=", opt, 15)) {
+                    decoder_output_filename = &opt[15];
+                } else if (!strncmp("encoder-output=", opt, 15)) {
+                    encoder_output_filename = &opt[15];
+                } else if (!strncmp("encoder-label=", opt, 14)) {
+                    encoder_label = &opt[14];
+                } else if (!strncmp("decoder-label=", opt, 14)) {
+                    decoder_label = &opt[14];
+                } else if (!strncmp("dictionary=", opt, 11)) {
+                    dictionary_filename = &opt[11];
+                } else if (!strncmp("parse=", opt, 6)) {
+                    if (!strcmp("greedy", &opt[6])) {
+                        parse_method = PARSE_GREEDY;
+                    } else if (!strcmp("optimal", &opt[6])) {
+                        parse_method = PARSE_OPTIMAL;
+                    } else {
+                        fprintf(stderr, "huffpuff: --parse: unknown method `%s'\n", &opt[6]);
+                        return(-1);
+                    }
+                } else if (!strcmp("serve", opt)) {
+                    serve_requests = 1;
+                } else if (!strncmp("search=", opt, 7)) {
+                    search_pattern = &opt[7];
+                } else if (!strncmp("index-output=", opt, 13)) {
+                    index_output_filename = &opt[13];
+                } else if (!strncmp("input-format=", opt, 13)) {
+                    if (!strcmp("text", &opt[13])) {
+                        input_format = INPUT_TEXT;
+                    } else if (!strcmp("records", &opt[13])) {
+                        input_format = INPUT_RECORDS;
+                    } else if (!strcmp("po", &opt[13])) {
+                        input_format = INPUT_PO;
+                    } else if (!strcmp("csv", &opt[13])) {
+                        input_format = INPUT_CSV;
+                    } else {
+                        fprintf(stderr, "huffpuff: --input-format: unknown format `%s'\n", &opt[13]);
+                        return(-1);
+                    }
+                } else if (!strcmp("templates", opt)) {
+                    use_templates = 1;
+                } else if (!strncmp("output-format=", opt, 14)) {
+                    if (!strcmp("asm", &opt[14])) {
+                        output_format = OUTPUT_ASM;
+                    } else if (!strcmp("c", &opt[14])) {
+                        output_format = OUTPUT_C;
+                    } else {
+                        fprintf(stderr, "huffpuff: --output-format: unknown format `%s'\n", &opt[14]);
+                        return(-1);
+                    }
+                } else if (!strcmp("no-labels", opt)) {
+                    labels = 0;
+                } else if (!strncmp("codec=", opt, 6)) {
+                    decoder_given = 1;
+                    if (!strcmp("huffman", &opt[6])) {
+                        codec = CODEC_HUFFMAN;
+                    } else if (!strcmp("fixed", &opt[6])) {
+                        codec = CODEC_FIXED;
+                    } else if (!strcmp("cm", &opt[6])) {
+                        codec = CODEC_CM;
+                    } else {
+                        fprintf(stderr, "huffpuff: --codec: unknown codec `%s'\n", &opt[6]);
+                        return(-1);
+                    }
+                } else if (!strncmp("emit-decoder=", opt, 13)) {
+                    decoder_given = 1;
+                    if (!strcmp("table", &opt[13])) {
+                        decoder_kind = DECODER_TABLE;
+                    } else if (!strcmp("code", &opt[13])) {
+                        decoder_kind = DECODER_CODE;
+                    } else {
+                        fprintf(stderr, "huffpuff: --emit-decoder: unknown decoder `%s'\n", &opt[13]);
+                        return(-1);
+                    }
+                } else if (!strncmp("root-lookup=", opt, 12)) {
+                    char *end;
+                    decoder_given = 1;
+                    root_bits = strtol(&opt[12], &end, 0);
+                    if ((end == &opt[12]) || *end || (root_bits < 1)
+                        || (root_bits > HUFFMAN_MAX_ROOT_BITS)) {
+                        fprintf(stderr, "huffpuff: --root-lookup: bad number of bits `%s' "
+                                "(1 to %d)\n", &opt[12], HUFFMAN_MAX_ROOT_BITS);
+                        return(-1);
+                    }
+                } else if (!strncmp("table-format=", opt, 13)) {
+                    decoder_given = 1;
+                    for (table_format = TABLE_REL8; table_format <= TABLE_ABS16; table_format++) {
+                        if (!strcmp(table_format_names[table_format], &opt[13]))
+                            break;
+                    }
+                    if (!strcmp("auto", &opt[13])) {
+                        table_format = TABLE_AUTO;
+                    } else if (table_format > TABLE_ABS16) {
+                        fprintf(stderr, "huffpuff: --table-format: unknown format `%s'\n", &opt[13]);
+                        return(-1);
+                    }
+                } else if (!strncmp("optimize=", opt, 9)) {
+                    if (!strcmp("size", &opt[9])) {
+                        optimize = OPTIMIZE_SIZE;
+                    } else if (!strcmp("speed", &opt[9])) {
+                        optimize = OPTIMIZE_SPEED;
+                    } else {
+                        fprintf(stderr, "huffpuff: --optimize: unknown goal `%s'\n", &opt[9]);
+                        return(-1);
+                    }
+                } else if (!strncmp("rom-budget=", opt, 11)) {
+                    char *end;
+                    rom_budget = strtol(&opt[11], &end, 0);
+                    if ((end == &opt[11]) || *end || (rom_budget < 0)) {
+                        fprintf(stderr, "huffpuff: --rom-budget: bad number of bytes `%s'\n", &opt[11]);
+                        return(-1);
+                    }
+                } else if (!strncmp("bank-size=", opt, 10)) {
+                    char *end;
+                    bank_size = strtol(&opt[10], &end, 0);
+                    if ((end == &opt[10]) || *end || (bank_size <= 0)) {
+                        fprintf(stderr, "huffpuff: --bank-size: bad number of bytes `%s'\n", &opt[10]);
+                        return(-1);
+                    }
+                } else if (!strncmp("first-bank=", opt, 11)) {
+                    char *end;
+                    first_bank = (int)strtol(&opt[11], &end, 0);
+                    if ((end == &opt[11]) || *end || (first_bank < 0) || (first_bank > 255)) {
+                        fprintf(stderr, "huffpuff: --first-bank: bad bank number `%s'\n", &opt[11]);
+                        return(-1);
+                    }
+                } else if (!strncmp("bank-directive=", opt, 15)) {
+                    bank_directive = &opt[15];
+                } else if (!strncmp("sample=", opt, 7)) {
+                    char *end;
+                    sample_count = (int)strtol(&opt[7], &end, 0);
+                    if ((end == &opt[7]) || *end || (sample_count < 2)) {
+                        fprintf(stderr, "huffpuff: --sample: bad number of strings `%s'\n", &opt[7]);
+                        return(-1);
+                    }
+                } else if (!strncmp("previous-layout=", opt, 16)) {
+                    previous_layout_filename = &opt[16];
+                } else if (!strncmp("layout-output=", opt, 14)) {
+                    layout_output_filename = &opt[14];
+                } else if (!strncmp("glyph-output=", opt, 13)) {
+                    glyph_output_filename = &opt[13];
+                } else if (!strncmp("scenes=", opt, 7)) {
+                    scenes_filename = &opt[7];
+                } else if (!strncmp("object-output=", opt, 14)) {
+                    object_output_filename = &opt[14];
+                } else if (!strncmp("trace=", opt, 6)) {
+                    trace_filename = &opt[6];
+                } else if (!strncmp("stats-output=", opt, 13)) {
+                    stats_output_filename = &opt[13];
+                } else if (!strncmp("compare=", opt, 8)) {
+                    baseline_filename = &opt[8];
+                } else if (!strncmp("tolerance=", opt, 10)) {
+                    char *end;
+                    tolerance = strtod(&opt[10], &end) / 100;
+                    if ((end == &opt[10]) || *end || (tolerance < 0)) {
+                        fprintf(stderr, "huffpuff: --tolerance: bad percentage `%s'\n", &opt[10]);
+                        return(-1);
+                    }
+                } else if (!strcmp("buckets", opt)) {
+                    use_buckets = 1;
                 } else if (!strcmp("ignore-case", opt)) {
                     ignore_case = 1;
                 } else if (!strcmp("verbose", opt)) {
@@ -610,150 +2577,1494 @@ int main(int argc, char **argv)
         }
     }
 
-    /* Set default character mapping f(c)=c */
-    {
-        int i;
-        for (i=0; i<256; i++)
-            charmap[i] = (unsigned char)i;
+    /* Set default character mapping f(c)=c */
+    {
+        int i;
+        for (i=0; i<256; i++)
+            charmap[i] = (unsigned short)i;
+        for (i=0; i<HUFFMAN_MAX_SYMBOLS; i++) {
+            sequences[i].length = 0;
+            shared_leaf[i] = i;
+            code_nodes[i] = 0;
+            codes[i].length = 0;
+        }
+        dictionary_init(&dictionary);
+    }
+
+    if (scenes_filename && !glyph_output_filename) {
+        fprintf(stderr, "error: --scenes: only used with --glyph-output\n");
+        return(-1);
+    }
+
+    if (object_output_filename && (cpu != CPU_6502) && (cpu != CPU_65816)) {
+        fprintf(stderr, "error: --object-output: o65 objects are for the 6502 and 65816\n");
+        return(-1);
+    }
+
+    if (!bank_size && ((first_bank != -1) || bank_directive)) {
+        fprintf(stderr, "error: --first-bank and --bank-directive: only used with --bank-size\n");
+        return(-1);
+    }
+    if (first_bank == -1)
+        first_bank = 0;
+    pointer_size = bank_size ? 3 : 2;
+
+    layout_init(&previous);
+    layout_init(&layout);
+    use_layout = previous_layout_filename || layout_output_filename;
+    if (use_layout
+        && ((codec != CODEC_HUFFMAN) || use_buckets || use_templates
+            || (optimize == OPTIMIZE_SPEED) || (output_format != OUTPUT_ASM)
+            || object_output_filename)) {
+        fprintf(stderr, "error: --previous-layout and --layout-output: not supported with "
+                "--codec, --buckets, --templates, --optimize=speed, --output-format=c "
+                "or --object-output\n");
+        return(-1);
+    }
+    if (previous_layout_filename) {
+        if (!layout_read(previous_layout_filename, &previous))
+            return(-1);
+        if (previous.bank_size != bank_size) {
+            fprintf(stderr, "error: --previous-layout: made with a bank size of %ld, not %ld\n",
+                    previous.bank_size, bank_size);
+            return(-1);
+        }
+        have_previous = 1;
+    }
+    if (strlen(string_table_label))
+        sprintf(far_label, "%.255s", string_table_label);
+    else
+        sprintf(far_label, "%.243sStringTable", string_label_prefix);
+
+    if (trace_filename && !trace_open(trace_filename))
+        return(-1);
+
+    if (charmap_filename) {
+        if (verbose)
+            fprintf(stdout, "reading character map\n");
+        trace_begin("read character map");
+        if (!charmap_parse(charmap_filename, charmap, sequences)) {
+            fprintf(stderr, "error: failed to parse character map `%s'\n",
+                    charmap_filename);
+            return(-1);
+        }
+        trace_end("read character map");
+    }
+
+    if (input_filename) {
+        input = fopen(input_filename, (input_format == INPUT_TEXT) ? "rt" : "rb");
+        if (!input) {
+            fprintf(stderr, "error: failed to open `%s' for reading\n",
+                    input_filename);
+            return(-1);
+        }
+    } else if (serve_requests) {
+        fprintf(stderr, "error: --serve: the strings must be read from a file\n");
+        return(-1);
+    } else {
+        input = stdin;
+    }
+
+    if (sample_count
+        && (!input_filename || (input_format != INPUT_TEXT) || search_pattern
+            || index_output_filename || serve_requests || baseline_filename)) {
+        fprintf(stderr, "error: --sample: the strings must be lines of text read from a file, "
+                "and --search, --index-output, --serve and --compare need them all\n");
+        return(-1);
+    }
+    if (sample_count && (use_buckets || use_templates)) {
+        fprintf(stderr, "error: --sample: --buckets and --templates weigh table bytes "
+                "against the data of all strings\n");
+        return(-1);
+    }
+
+    /* Read strings to encode. */
+    if (verbose)
+        fprintf(stdout, "reading strings\n");
+    read_start = clock();
+    trace_begin("read strings");
+    if (input_format == INPUT_RECORDS) {
+        if (!read_records(input, &strings, frequencies, &char_count, &string_count)) {
+            fprintf(stderr, "error: `%s': record cut short\n",
+                    input_filename ? input_filename : "stdin");
+            destroy_string_list(strings);
+            fclose(input);
+            return(-1);
+        }
+    } else if (input_format == INPUT_PO) {
+        if (!import_po(input, input_filename ? input_filename : "stdin", ignore_case,
+                       &strings, frequencies, &char_count, &string_count)) {
+            destroy_string_list(strings);
+            fclose(input);
+            return(-1);
+        }
+    } else if (input_format == INPUT_CSV) {
+        if (!import_csv(input, input_filename ? input_filename : "stdin", ignore_case,
+                        &strings, frequencies, &char_count, &string_count)) {
+            destroy_string_list(strings);
+            fclose(input);
+            return(-1);
+        }
+    } else if (sample_count) {
+        if (!sample_strings(input, sample_count, ignore_case, &sample, &strings,
+                            frequencies, &char_count, &string_count)
+            || !string_count) {
+            fprintf(stderr, "error: --sample: no strings drawn from `%s'\n", input_filename);
+            destroy_string_list(strings);
+            fclose(input);
+            return(-1);
+        }
+        if (verbose) {
+            fprintf(stdout, "  drawn: %d strings, %d characters\n",
+                    string_count, char_count);
+        }
+    } else {
+        strings = read_strings(input, ignore_case, frequencies, &char_count, &string_count);
+    }
+    fclose(input);
+    trace_end("read strings");
+    if (verbose && ((input_format == INPUT_PO) || (input_format == INPUT_CSV))) {
+        double read_time = (double)(clock() - read_start) / CLOCKS_PER_SEC;
+        fprintf(stdout, "  messages: %d, %d characters, read at %.1f MB/s\n",
+                string_count, char_count,
+                read_time > 0 ? char_count / read_time / 1e6 : 0.0);
+    }
+
+    if (append_byte != -1)
+        frequencies[append_byte] += string_count;
+
+    /* Only the 65816 table has room for values wider than a byte. */
+    if (cpu != CPU_65816) {
+        int i;
+        for (i=0; i<256; i++) {
+            if ((frequencies[i] > 0) && (charmap[i] > 0xFF)) {
+                fprintf(stderr, "error: character map value $%.4X does not fit in a byte\n",
+                        charmap[i]);
+                return(-1);
+            }
+        }
+    }
+
+    if (dictionary_filename) {
+        if (verbose)
+            fprintf(stdout, "reading dictionary\n");
+        trace_begin("read dictionary");
+        if (!dictionary_read(dictionary_filename, ignore_case, &dictionary)) {
+            fprintf(stderr, "error: failed to read dictionary `%s'\n",
+                    dictionary_filename);
+            return(-1);
+        }
+        trace_end("read dictionary");
+    }
+    user_tokens = dictionary.count;
+
+    if (use_templates) {
+        int templates;
+        if (cpu == CPU_65816) {
+            fprintf(stderr, "error: --templates: not supported for the 65816\n");
+            return(-1);
+        }
+        if (verbose)
+            fprintf(stdout, "extracting templates\n");
+        trace_begin("extract templates");
+        templates = template_extract(strings, sequences, &dictionary);
+        trace_end("extract templates");
+        if (verbose) {
+            fprintf(stdout, "  templates: %d (%d tokens)\n", templates,
+                    dictionary.count - user_tokens);
+        }
+    }
+
+    /* If a character is mapped to a byte sequence, or tokens are used,
+       every leaf of the decoder table holds a sequence. */
+    {
+        int i;
+        for (i=0; i<256; i++) {
+            if ((frequencies[i] > 0) && sequences[i].length)
+                char_sequences = 1;
+        }
+        if (char_sequences)
+            leaf_sequences = sequences;
+        if (dictionary.count)
+            leaf_sequences = sequences;
+    }
+    if (leaf_sequences) {
+        int i, j, k;
+        if (cpu == CPU_65816) {
+            fprintf(stderr, "error: byte sequences in the character map and dictionaries are "
+                    "not supported for the 65816\n");
+            return(-1);
+        }
+        for (i=0; i<256; i++) {
+            if (!sequences[i].length) {
+                sequences[i].length = 1;
+                sequences[i].bytes[0] = (unsigned char)charmap[i];
+            }
+        }
+        /* A token is replaced by the sequences of its characters. */
+        for (i=0; i<dictionary.count; i++) {
+            charmap_sequence_t *seq = &sequences[256 + i];
+            seq->length = 0;
+            for (j=0; j<dictionary.lengths[i]; j++) {
+                const charmap_sequence_t *chr = &sequences[dictionary.tokens[i][j]];
+                if (seq->length + chr->length > CHARMAP_MAX_SEQUENCE) {
+                    fprintf(stderr, "error: token `%.*s' is longer than %d bytes\n",
+                            dictionary.lengths[i], dictionary.tokens[i], CHARMAP_MAX_SEQUENCE);
+                    return(-1);
+                }
+                for (k=0; k<chr->length; k++)
+                    seq->bytes[seq->length++] = chr->bytes[k];
+            }
+        }
+    }
+
+    /* Split the strings into characters and tokens. */
+    if (verbose)
+        fprintf(stdout, "parsing strings\n");
+    trace_begin("parse strings");
+    {
+        int rounds = parse_strings(strings, dictionary.count ? &dictionary : NULL,
+                                   parse_method, append_byte, leaf_sequences);
+        parse_count_symbols(strings, frequencies);
+        if (verbose && dictionary.count) {
+            int i;
+            int used = 0;
+            for (i=256; i<HUFFMAN_MAX_SYMBOLS; i++) {
+                if (frequencies[i] > 0)
+                    used++;
+            }
+            if (parse_method == PARSE_OPTIMAL)
+                fprintf(stdout, "  parse rounds: %d\n", rounds);
+            fprintf(stdout, "  tokens used: %d of %d\n", used, dictionary.count);
+        }
+    }
+
+    if (dictionary.count > user_tokens) {
+        /* Measure what the templates save by parsing without them. If they
+           do not pay for their table entries, they are dropped. */
+        dictionary_t without;
+        string_list_t *str;
+        int **parsed = (int **)malloc(string_count * sizeof(int *));
+        int *parsed_length = (int *)malloc(string_count * sizeof(int));
+        long with_size = parse_estimate_size(strings, sequences);
+        long without_size;
+        int i;
+        for (i = 0, str = strings; str != NULL; str = str->next, i++) {
+            parsed[i] = str->symbols;
+            parsed_length[i] = str->length;
+            str->symbols = 0;
+        }
+        dictionary_head(&dictionary, user_tokens, &without);
+        parse_strings(strings, user_tokens ? &without : NULL,
+                      parse_method, append_byte, leaf_sequences);
+        without_size = parse_estimate_size(strings, sequences);
+        if (verbose) {
+            fprintf(stdout, "  template saving: %ld bytes (%ld without templates, %ld with)\n",
+                    without_size - with_size, without_size, with_size);
+        }
+        if (with_size < without_size) {
+            for (i = 0, str = strings; str != NULL; str = str->next, i++) {
+                free(str->symbols);
+                str->symbols = parsed[i];
+                str->length = parsed_length[i];
+            }
+        } else {
+            if (verbose)
+                fprintf(stdout, "  templates do not pay off; not using them\n");
+            for (i = 0; i < string_count; i++)
+                free(parsed[i]);
+            dictionary_truncate(&dictionary, user_tokens);
+            if (!dictionary.count && !char_sequences) {
+                /* Back to plain characters */
+                for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++)
+                    sequences[i].length = 0;
+                leaf_sequences = NULL;
+            }
+        }
+        free(parsed);
+        free(parsed_length);
+        parse_count_symbols(strings, frequencies);
+    }
+    if (sample_count)
+        sample_count_symbols(&sample, frequencies);
+    trace_end("parse strings");
+
+    if (leaf_sequences) {
+        /* Characters that are mapped to the same sequence share a leaf. */
+        int i, j;
+        for (i=0; i<256; i++) {
+            if (frequencies[i] == 0)
+                continue;
+            for (j=0; j<i; j++) {
+                if ((frequencies[j] > 0)
+                    && (sequences[j].length == sequences[i].length)
+                    && !memcmp(sequences[j].bytes, sequences[i].bytes, sequences[i].length)) {
+                    break;
+                }
+            }
+            if (j < i) {
+                frequencies[j] += frequencies[i];
+                frequencies[i] = 0;
+                shared_leaf[i] = j;
+                shared_leaf_count++;
+            }
+        }
+    }
+
+    if ((cpu != CPU_6502) && (decoder_kind == DECODER_CODE)) {
+        fprintf(stderr, "error: --emit-decoder=code: only supported for the 6502\n");
+        return(-1);
+    }
+    if ((decoder_kind == DECODER_CODE) && !decoder_output_filename)
+        decoder_output_filename = "huffpuff.dec.asm";
+
+    if ((input_format == INPUT_RECORDS) && ignore_case) {
+        fprintf(stderr, "error: --ignore-case: not supported with binary records\n");
+        return(-1);
+    }
+
+    if (encoder_output_filename && (cpu != CPU_6502)) {
+        fprintf(stderr, "error: --encoder-output: only supported for the 6502\n");
+        return(-1);
+    }
+
+    if ((codec == CODEC_FIXED)
+        && ((cpu == CPU_65816) || leaf_sequences || use_buckets
+            || (decoder_kind != DECODER_TABLE) || (table_format != TABLE_AUTO))) {
+        fprintf(stderr, "error: --codec=fixed: not supported for the 65816, with byte "
+                "sequences, dictionaries, buckets, --emit-decoder or --table-format\n");
+        return(-1);
+    }
+
+    if ((codec == CODEC_CM)
+        && ((cpu != CPU_6502) || leaf_sequences || use_buckets
+            || (decoder_kind != DECODER_TABLE) || (table_format != TABLE_AUTO)
+            || encoder_output_filename || search_pattern || index_output_filename
+            || serve_requests)) {
+        fprintf(stderr, "error: --codec=cm: only supported for the 6502, and not with byte "
+                "sequences, dictionaries, buckets, --emit-decoder, --table-format, "
+                "--encoder-output, --search, --index-output or --serve\n");
+        return(-1);
+    }
+
+    if (root_bits
+        && ((cpu == CPU_65816) || (codec != CODEC_HUFFMAN)
+            || (decoder_kind != DECODER_TABLE) || (output_format == OUTPUT_C))) {
+        fprintf(stderr, "error: --root-lookup: not supported for the 65816, with --codec, "
+                "--emit-decoder=code or --output-format=c\n");
+        return(-1);
+    }
+
+    if ((output_format == OUTPUT_C)
+        && ((codec != CODEC_HUFFMAN) || leaf_sequences || use_buckets
+            || (decoder_kind != DECODER_TABLE) || (optimize == OPTIMIZE_SPEED)
+            || bank_size || object_output_filename)) {
+        fprintf(stderr, "error: --output-format=c: not supported with --codec, byte "
+                "sequences, dictionaries, buckets, --emit-decoder, --optimize=speed, "
+                "--bank-size or --object-output\n");
+        return(-1);
     }
 
-    if (charmap_filename) {
-        if (verbose)
-            fprintf(stdout, "reading character map\n");
-        if (!charmap_parse(charmap_filename, charmap)) {
-            fprintf(stderr, "error: failed to parse character map `%s'\n",
-                    charmap_filename);
-            return(-1);
+    if ((optimize == OPTIMIZE_SPEED) && decoder_given) {
+        fprintf(stderr, "error: --optimize=speed: chooses the codec, table format and "
+                "decoder itself; drop --codec, --table-format, --emit-decoder and "
+                "--root-lookup\n");
+        return(-1);
+    }
+    if ((rom_budget != -1) && (optimize != OPTIMIZE_SPEED)) {
+        fprintf(stderr, "error: --rom-budget: only used with --optimize=speed\n");
+        return(-1);
+    }
+
+    if ((cpu == CPU_65816) && (table_format != TABLE_AUTO)) {
+        fprintf(stderr, "error: --table-format: not supported for the 65816\n");
+        return(-1);
+    }
+
+    if (use_buckets && ((cpu == CPU_65816) || leaf_sequences)) {
+        fprintf(stderr, "error: --buckets: not supported for the 65816, with byte sequences "
+                "or with a dictionary\n");
+        return(-1);
+    }
+
+    if (have_previous) {
+        int missing = layout_missing_symbol(&previous, frequencies);
+        if (missing != -1) {
+            fprintf(stderr, "huffpuff: warning: --previous-layout: symbol $%.2X is new, so "
+                    "the code changes and every string moves\n", missing);
+            layout_free(&previous);
+            have_previous = 0;
         }
     }
 
-    if (input_filename) {
-        input = fopen(input_filename, "rt");
-        if (!input) {
-            fprintf(stderr, "error: failed to open `%s' for reading\n",
-                    input_filename);
-            return(-1);
+    trace_begin("build tree");
+    if (have_previous) {
+        /* Keep the previous code, so that unchanged strings keep their bytes */
+        int i;
+        if (verbose)
+            fprintf(stdout, "building the Huffman tree of the previous layout\n");
+        root = layout_build_tree(&previous, code_nodes);
+        symbol_count = previous.leaf_count;
+        for (i=0; i<HUFFMAN_MAX_SYMBOLS; i++) {
+            if (shared_leaf[i] != i)
+                code_nodes[i] = code_nodes[shared_leaf[i]];
+        }
+    } else if (use_buckets) {
+        /* Group rare characters into buckets and build the tree. */
+        if (verbose)
+            fprintf(stdout, "choosing buckets\n");
+        root = bucket_build_tree(frequencies, strings, charmap, cpu, table_format,
+                                 decoder_kind, code_nodes, &symbol_count);
+        if (verbose) {
+            int i;
+            int bucketed = 0;
+            for (i=0; i<256; i++) {
+                if (code_nodes[i] && code_nodes[i]->bucket
+                    && code_nodes[i]->bucket->extra_bits)
+                    bucketed++;
+            }
+            fprintf(stdout, "  number of leaves: %d\n", symbol_count);
+            fprintf(stdout, "  characters in buckets: %d\n", bucketed);
         }
     } else {
-        input = stdin;
-    }
+        /* Create Huffman leaf nodes. */
+        if (verbose)
+            fprintf(stdout, "creating Huffman leaf nodes\n");
+        symbol_count = 0;
+        {
+            int i;
+            for (i=0; i<HUFFMAN_MAX_SYMBOLS; i++) {
+                if (frequencies[i] > 0) {
+                    huffman_node_t *node;
+                    node = huffman_create_node(
+                        /*symbol=*/i, /*weight=*/frequencies[i],
+                        /*left=*/NULL, /*right=*/NULL);
+                    leaf_nodes[symbol_count++] = node;
+                    code_nodes[i] = node;
+                }
+            }
+            for (i=0; i<HUFFMAN_MAX_SYMBOLS; i++) {
+                if (shared_leaf[i] != i)
+                    code_nodes[i] = code_nodes[shared_leaf[i]];
+            }
+        }
+        if (verbose) {
+            fprintf(stdout, "  number of symbols: %d\n", symbol_count);
+            if (shared_leaf_count)
+                fprintf(stdout, "  characters sharing a leaf: %d\n", shared_leaf_count);
+        }
 
-    /* Read strings to encode. */
-    if (verbose)
-        fprintf(stdout, "reading strings\n");
-    strings = read_strings(input, ignore_case, frequencies, &char_count, &string_count);
-    fclose(input);
+        /* Build the Huffman tree. */
+        if (verbose)
+            fprintf(stdout, "Building the Huffman tree\n");
+        root = huffman_build_tree(leaf_nodes, symbol_count);
+    }
 
-    /* Create Huffman leaf nodes. */
-    if (verbose)
-        fprintf(stdout, "creating Huffman leaf nodes\n");
-    symbol_count = 0;
+    /* Determine the code of every symbol; the index of a character
+       in its bucket follows the code of the bucket. */
     {
         int i;
-        if (append_byte != -1)
-            frequencies[append_byte] += string_count;
-        for (i=0; i<256; i++) {
-            if (frequencies[i] > 0) {
-                huffman_node_t *node;
-                node = huffman_create_node(
-                    /*symbol=*/i, /*weight=*/frequencies[i],
-                    /*left=*/NULL, /*right=*/NULL);
-                leaf_nodes[symbol_count++] = node;
-                code_nodes[i] = node;
-            } else {
-                code_nodes[i] = 0;
+        for (i=0; i<HUFFMAN_MAX_SYMBOLS; i++) {
+            const huffman_node_t *node = code_nodes[i];
+            if (!node)
+                continue;
+            codes[i] = node->code;
+            if (node->bucket) {
+                int j;
+                for (j=0; node->bucket->symbols[j] != i; j++)
+                    ;
+                codes[i].code = (codes[i].code << node->bucket->extra_bits) | j;
+                codes[i].length += node->bucket->extra_bits;
             }
         }
     }
-    if (verbose)
-        fprintf(stdout, "  number of symbols: %d\n", symbol_count);
 
-    /* Build the Huffman tree. */
-    if (verbose)
-        fprintf(stdout, "Building the Huffman tree\n");
-    root = huffman_build_tree(leaf_nodes, symbol_count);
+    trace_end("build tree");
+
+    if (root_bits && !huffman_root_positions(root, root_bits, root_positions)) {
+        fprintf(stderr, "error: --root-lookup: a code is shorter than %d bits\n", root_bits);
+        /* Cleanup */
+        huffman_delete_node(root);
+        destroy_string_list(strings);
+        return(-1);
+    }
+
+    if ((output_format == OUTPUT_C) && (cgen_code_length(root) > CGEN_MAX_CODE_LENGTH)) {
+        fprintf(stderr, "error: --output-format=c: codes are longer than %d bits\n",
+                CGEN_MAX_CODE_LENGTH);
+        /* Cleanup */
+        huffman_delete_node(root);
+        destroy_string_list(strings);
+        return(-1);
+    }
 
     /* Huffman-encode strings. */
     if (verbose)
         fprintf(stdout, "encoding strings\n");
-    encoded_size = encode_strings(strings, code_nodes, append_byte);
+    trace_begin("encode strings");
+    encoded_size = encode_strings(strings, codes);
+    trace_end("encode strings");
+
+    if (optimize == OPTIMIZE_SPEED) {
+        /* Find the fastest decoder that fits the ROM budget */
+        int format;
+        if (verbose)
+            fprintf(stdout, "measuring decoders\n");
+        trace_begin("choose decoder");
+        if (!optimize_speed(strings, root, charmap, leaf_sequences, cpu,
+                            (cpu != CPU_65816) && !leaf_sequences && !use_buckets,
+                            (cpu == CPU_6502) && !leaf_sequences && !use_buckets
+                            && !encoder_output_filename && !search_pattern
+                            && !index_output_filename && !serve_requests,
+                            frequencies, shared_leaf, codes, encoded_size, rom_budget,
+                            sample_count ? &sample : NULL, only, only_count,
+                            finalists, &finalist_count,
+                            &codec, &format, &decoder_kind, &root_bits)) {
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        if (sample_count) {
+            /* Run again on all strings, measuring only the finalists; the
+               trace stays open and goes on */
+            char **exact_args = (char **)malloc((argc + 1) * sizeof(char *));
+            int exact_count = 0;
+            int status;
+            int i;
+            for (i = 0; i < argc; i++) {
+                if (strncmp("--sample=", args[i], 9) && strncmp("--trace=", args[i], 8))
+                    exact_args[exact_count++] = args[i];
+            }
+            exact_args[exact_count] = NULL;
+            trace_end("choose decoder");
+            /* Cleanup */
+            sample_free(&sample);
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            dictionary_free(&dictionary);
+            if (verbose)
+                fprintf(stdout, "reading all strings, for the finalists\n");
+            status = run(exact_count, exact_args, finalists, finalist_count);
+            free(exact_args);
+            return status;
+        }
+        if (cpu != CPU_65816)
+            table_format = format;
+        if ((decoder_kind == DECODER_CODE) && !decoder_output_filename)
+            decoder_output_filename = "huffpuff.dec.asm";
+        trace_end("choose decoder");
+    }
+
+    if (codec == CODEC_FIXED) {
+        /* Code the strings again with a fixed-width code, and compare */
+        int table_size = huffman_table_image(root, charmap, leaf_sequences,
+                                             cpu, TABLE_REL8, 0, 0);
+        if (table_size < 0) {
+            table_size = huffman_table_image(root, charmap, leaf_sequences,
+                                             cpu, TABLE_ABS16, 0, 0);
+        }
+        fixed_assign_codes(frequencies, &fixed, codes);
+        if (verbose) {
+            int fixed_size = encode_strings(strings, codes);
+            fprintf(stdout, "  fixed-width code: %d symbols, %d bits per symbol\n",
+                    fixed.count, fixed.width);
+            fprintf(stdout, "  fixed-width size: %d bytes (table %d, data %d)\n",
+                    fixed.count + fixed_size, fixed.count, fixed_size);
+            fprintf(stdout, "  Huffman size: %d bytes (table %d, data %d)\n",
+                    table_size + encoded_size, table_size, encoded_size);
+        }
+        encoded_size = encode_strings(strings, codes);
+    }
+
+    if (codec == CODEC_CM) {
+        /* Code the strings again with the context-mixing coder, and compare */
+        int huffman_size = encoded_size;
+        int table_size = huffman_table_image(root, charmap, NULL, cpu, TABLE_REL8, 0, 0);
+        if (table_size < 0)
+            table_size = huffman_table_image(root, charmap, NULL, cpu, TABLE_ABS16, 0, 0);
+        if (verbose)
+            fprintf(stdout, "building context-mixing model\n");
+        trace_begin("build model");
+        if (!cm_build_model(root, strings, shared_leaf, &cm)) {
+            fprintf(stderr, "error: --codec=cm: needs 2 to %d different characters\n",
+                    CM_MAX_LEAVES);
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        trace_end("build model");
+        trace_begin("encode strings");
+        encoded_size = cm_encode_strings(strings, &cm);
+        trace_end("encode strings");
+        if (verbose) {
+            int cm_table_size = m65cm_table_size(&cm);
+            fprintf(stdout, "  model: %d nodes, %d counters, hash shift %d\n",
+                    cm.node_count, CM_COUNTERS, cm.hash_shift);
+            fprintf(stdout, "  context-mixing size: %d bytes (table %d, data %d), "
+                    "%.2f bits per character\n", cm_table_size + encoded_size,
+                    cm_table_size, encoded_size, 8.0 * encoded_size / char_count);
+            fprintf(stdout, "  Huffman size: %d bytes (table %d, data %d), "
+                    "%.2f bits per character\n", table_size + huffman_size,
+                    table_size, huffman_size, 8.0 * huffman_size / char_count);
+        }
+    }
 
     /* Sanity check */
     if (verbose)
         fprintf(stdout, "verifying output integrity\n");
-    if (!verify_data_integrity(strings, root)) {
+    trace_begin("verify");
+    if (!verify_data_integrity(strings, root, (codec == CODEC_FIXED) ? &fixed : NULL,
+                               (codec == CODEC_CM) ? &cm : NULL, shared_leaf)) {
         assert(0);
         /* Cleanup */
         huffman_delete_node(root);
         destroy_string_list(strings);
         return(-1);
     }
+    trace_end("verify");
 
-    /* Prepare output */
-    if (!table_output_filename) {
-        table_output_filename = "huffpuff.tab.asm";
+    if (verbose && (input_format == INPUT_RECORDS)) {
+        double encode_rate, decode_rate;
+        measure_throughput(strings, codes, root, (codec == CODEC_FIXED) ? &fixed : NULL,
+                           (codec == CODEC_CM) ? &cm : NULL, shared_leaf, char_count,
+                           &encode_rate, &decode_rate);
+        fprintf(stdout, "  records: %d, %d bytes\n", string_count, char_count);
+        fprintf(stdout, "  encoding throughput: %.1f MB/s\n", encode_rate);
+        fprintf(stdout, "  decoding and checking throughput: %.1f MB/s\n", decode_rate);
+    }
+
+    if (search_pattern || index_output_filename) {
+        /* Index the strings as they will be printed */
+        search_index_t index;
+        int map[256];
+        int i;
+        trace_begin("search");
+        if (verbose)
+            fprintf(stdout, "indexing strings\n");
+        for (i = 0; i < 256; i++)
+            map[i] = shared_leaf[i];
+        search_build(strings, map, &index);
+        if (verbose)
+            fprintf(stdout, "  trigrams: %d\n", index.trigram_count);
+        if (index_output_filename) {
+            FILE *index_output = fopen(index_output_filename, "wt");
+            if (!index_output) {
+                fprintf(stderr, "error: failed to open `%s' for writing\n",
+                        index_output_filename);
+                return(-1);
+            }
+            search_write(index_output, &index);
+            fclose(index_output);
+        }
+        if (search_pattern) {
+            string_list_t **by_number;
+            string_list_t *str;
+            int len = strlen(search_pattern);
+            unsigned char *pattern = (unsigned char *)malloc(len + 1);
+            int *ids = (int *)malloc((index.string_count + 1) * sizeof(int));
+            const fixed_code_t *fixed_code = (codec == CODEC_FIXED) ? &fixed : NULL;
+            int candidates;
+            int matches;
+            by_number = (string_list_t **)malloc((index.string_count + 1) * sizeof(string_list_t *));
+            for (i = 0, str = strings; str != NULL; str = str->next, i++)
+                by_number[i] = str;
+            for (i = 0; i < len; i++) {
+                int c = (unsigned char)search_pattern[i];
+                if (ignore_case && (c >= 'A') && (c <= 'Z'))
+                    c += 0x20;
+                pattern[i] = (unsigned char)map[c];
+            }
+            if (verbose)
+                fprintf(stdout, "searching strings\n");
+            matches = search_strings(by_number, index.string_count, &index, pattern, len,
+                                     root, fixed_code, &dictionary, map, append_byte,
+                                     ids, &candidates);
+            if (verbose) {
+                /* Time the search against decoding every string */
+                int *all_ids = (int *)malloc((index.string_count + 1) * sizeof(int));
+                int all_candidates;
+                double indexed, full;
+                long runs;
+                clock_t start = clock();
+                for (runs = 0; (runs == 0) || (clock() - start < CLOCKS_PER_SEC / 10); runs++) {
+                    search_strings(by_number, index.string_count, &index, pattern, len,
+                                   root, fixed_code, &dictionary, map, append_byte,
+                                   all_ids, &all_candidates);
+                }
+                indexed = 1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs;
+                start = clock();
+                for (runs = 0; (runs == 0) || (clock() - start < CLOCKS_PER_SEC / 10); runs++) {
+                    search_strings(by_number, index.string_count, NULL, pattern, len,
+                                   root, fixed_code, &dictionary, map, append_byte,
+                                   all_ids, &all_candidates);
+                }
+                full = 1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs;
+                fprintf(stdout, "  candidates: %d of %d strings, matches: %d\n",
+                        candidates, index.string_count, matches);
+                fprintf(stdout, "  indexed search: %.3f ms per query\n", indexed);
+                fprintf(stdout, "  full decode search: %.3f ms per query\n", full);
+                free(all_ids);
+            }
+            for (i = 0; i < matches; i++)
+                fprintf(stdout, "%d\n", ids[i]);
+            free(by_number);
+            free(ids);
+            free(pattern);
+        }
+        search_free(&index);
+        trace_end("search");
+    }
+
+    trace_begin("run decoder");
+    /* The decoders are always built, for their size; they are only run on
+       the strings when their speed is reported or checked, or when one of
+       them is written */
+    run_strings = (verbose || decoder_output_filename || stats_output_filename
+                   || baseline_filename || (optimize == OPTIMIZE_SPEED)) ? strings : NULL;
+    if (codec == CODEC_CM) {
+        /* Run the generated context-mixing decoder on the built-in CPU core */
+        int code_size;
+        double cycles;
+        if (verbose)
+            fprintf(stdout, "running generated 6502 context-mixing decoder\n");
+        if (!m65cm_validate(&cm, charmap, run_strings, &code_size, &cycles)) {
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        rom_table_size = m65cm_table_size(&cm);
+        rom_decoder_size = code_size;
+        decode_cycles = cycles;
+        if (verbose) {
+            fprintf(stdout, "  decoder size: %d bytes, and %d bytes of RAM\n",
+                    code_size, CM_COUNTERS);
+            fprintf(stdout, "  decoding time: %.1f cycles per character\n", cycles);
+        }
+    } else if (codec == CODEC_FIXED) {
+        /* Run the generated fixed-width decoder on the built-in CPU core */
+        int code_size;
+        double cycles;
+        int ok;
+        if (verbose)
+            fprintf(stdout, "running generated %s fixed-width decoder\n", cpu_names[cpu]);
+        if ((cpu == CPU_SM83) || (cpu == CPU_Z80))
+            ok = z80dec_validate(cpu, root, charmap, NULL, TABLE_REL8, 0, &fixed,
+                                 run_strings, &code_size, &cycles);
+        else
+            ok = m65dec_validate(cpu, root, charmap, NULL, TABLE_REL8, DECODER_TABLE, 0,
+                                 &fixed, run_strings, &code_size, &cycles);
+        if (!ok) {
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        rom_table_size = fixed.count;
+        rom_decoder_size = code_size;
+        decode_cycles = cycles;
+        if (verbose) {
+            fprintf(stdout, "  decoder size: %d bytes\n", code_size);
+            fprintf(stdout, "  decoding time: %.1f %s per character\n", cycles,
+                    (cpu == CPU_Z80) ? "T-states" : "cycles");
+        }
+    } else {
+        /* Run the generated decoder on the built-in CPU core. For the 8-bit
+           CPUs, rel8 is used when its offsets reach every node; only if
+           they do not are the other formats built, and the one that takes
+           the least space (table and decoder), then the least time, wins.
+           With --verbose, every format is built and reported. */
+        const char *cycle_name = (cpu == CPU_Z80) ? "T-states" : "cycles";
+        int best_total = -1;
+        double best_cycles = 0;
+        int best_code_size = 0;
+        int best_table_size = 0;
+        int format;
+        if (verbose)
+            fprintf(stdout, "running generated %s decoder\n", cpu_names[cpu]);
+        for (format = TABLE_REL8; format <= TABLE_ABS16; format++) {
+            int table_size;
+            int code_size;
+            double cycles;
+            int ok;
+            if ((table_format != TABLE_AUTO) && (format != table_format))
+                continue;
+            if ((chosen_format == TABLE_REL8) && (best_total != -1) && !verbose)
+                break;
+            if (cpu == CPU_65816) {
+                /* The 65816 has a single 16-bit table format */
+                if (format != TABLE_REL8)
+                    continue;
+                table_size = huffman_table_image16(root, charmap,
+                                                   m65dec_record_size(root, charmap), 0);
+            } else {
+                table_size = huffman_table_image(root, charmap, leaf_sequences,
+                                                 cpu, format, 0, 0);
+            }
+            if ((table_size < 0) && (table_format == TABLE_AUTO)) {
+                if (verbose) {
+                    fprintf(stdout, "  table format %s: offsets do not fit\n",
+                            table_format_names[format]);
+                }
+                continue;
+            }
+            if ((cpu == CPU_SM83) || (cpu == CPU_Z80))
+                ok = z80dec_validate(cpu, root, charmap, leaf_sequences, format,
+                                     root_bits, NULL, run_strings, &code_size, &cycles);
+            else
+                ok = m65dec_validate(cpu, root, charmap, leaf_sequences, format,
+                                     DECODER_TABLE, root_bits, NULL, run_strings,
+                                     &code_size, &cycles);
+            if (!ok) {
+                /* Cleanup */
+                huffman_delete_node(root);
+                destroy_string_list(strings);
+                return(-1);
+            }
+            if (verbose && (cpu != CPU_65816)) {
+                fprintf(stdout, "  table format %s: %d bytes, decoder %d bytes, "
+                        "%.1f %s per character\n", table_format_names[format],
+                        table_size, code_size, cycles, cycle_name);
+            }
+            if ((best_total == -1)
+                || ((chosen_format != TABLE_REL8)
+                    && ((table_size + code_size < best_total)
+                        || ((table_size + code_size == best_total) && (cycles < best_cycles))))) {
+                best_total = table_size + code_size;
+                best_cycles = cycles;
+                best_code_size = code_size;
+                best_table_size = table_size;
+                chosen_format = format;
+            }
+        }
+        if (best_total == -1) {
+            fprintf(stderr, "error: decoder table does not fit any %s table format\n",
+                    cpu_names[cpu]);
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        if ((chosen_format != TABLE_REL8) && (table_format == TABLE_AUTO)) {
+            fprintf(stderr, "huffpuff: warning: one-byte child offsets do not reach every "
+                    "node; using the %s table format (see --decoder-output)\n",
+                    table_format_names[chosen_format]);
+        }
+        if (verbose) {
+            if (cpu != CPU_65816) {
+                fprintf(stdout, "  chosen table format: %s\n",
+                        table_format_names[chosen_format]);
+            }
+            fprintf(stdout, "  decoder size: %d bytes\n", best_code_size);
+            if (cpu == CPU_65816) {
+                fprintf(stdout, "  table record size: %d bytes\n",
+                        m65dec_record_size(root, charmap));
+            }
+            fprintf(stdout, "  decoding time: %.1f %s per character\n", best_cycles,
+                    cycle_name);
+        }
+        rom_table_size = best_table_size;
+        rom_decoder_size = best_code_size;
+        decode_cycles = best_cycles;
+        if (decoder_kind == DECODER_CODE) {
+            int code_size;
+            double cycles;
+            if (verbose)
+                fprintf(stdout, "running generated tree-as-code 6502 decoder\n");
+            if (!m65dec_validate(cpu, root, charmap, leaf_sequences, chosen_format,
+                                 DECODER_CODE, 0, NULL, run_strings, &code_size, &cycles)) {
+                /* Cleanup */
+                huffman_delete_node(root);
+                destroy_string_list(strings);
+                return(-1);
+            }
+            rom_table_size = 0;
+            rom_decoder_size = code_size;
+            decode_cycles = cycles;
+            if (verbose) {
+                fprintf(stdout, "  tree-as-code decoder: %d bytes, %.1f cycles per character\n",
+                        code_size, cycles);
+                fprintf(stdout, "  table-walk decoder: %d bytes (table %d, decoder %d), "
+                        "%.1f cycles per character\n", best_table_size + best_code_size,
+                        best_table_size, best_code_size, best_cycles);
+            }
+        }
     }
-    table_output = fopen(table_output_filename, "wt");
-    if (!table_output) {
-        fprintf(stderr, "error: failed to open `%s' for writing\n",
-                table_output_filename);
+
+    trace_end("run decoder");
+
+    if (sample_count) {
+        /* Scale the sample up to the whole file; nothing is written */
+        double strings_total, strings_margin;
+        double chars_total, chars_margin;
+        double data_total, data_margin;
+        sample_estimate(&sample, SAMPLE_STRINGS, &strings_total, &strings_margin);
+        sample_estimate(&sample, SAMPLE_CHARACTERS, &chars_total, &chars_margin);
+        sample_estimate(&sample, SAMPLE_DATA_BYTES, &data_total, &data_margin);
+        fprintf(stdout, "estimate from %d draws of %ld bytes (95%% confidence):\n",
+                sample.count, sample.file_size);
+        fprintf(stdout, "  strings: %.0f +/- %.0f\n", strings_total, strings_margin);
+        fprintf(stdout, "  characters: %.0f +/- %.0f\n", chars_total, chars_margin);
+        fprintf(stdout, "  data: %.0f +/- %.0f bytes\n", data_total, data_margin);
+        fprintf(stdout, "  table: %d bytes, decoder: %d bytes\n",
+                rom_table_size, rom_decoder_size);
+        fprintf(stdout, "  total: %.0f..%.0f bytes\n",
+                rom_table_size + rom_decoder_size + data_total - data_margin
+                + (generate_string_table ? pointer_size * (strings_total - strings_margin) : 0),
+                rom_table_size + rom_decoder_size + data_total + data_margin
+                + (generate_string_table ? pointer_size * (strings_total + strings_margin) : 0));
+        if (stats_output_filename) {
+            stats_t current;
+            FILE *stats_output = fopen(stats_output_filename, "wt");
+            if (!stats_output) {
+                fprintf(stderr, "error: failed to open `%s' for writing\n",
+                        stats_output_filename);
+                return(-1);
+            }
+            stats_init(&current);
+            stats_add(&current, "table_bytes", STATS_COST, rom_table_size);
+            stats_add(&current, "data_bytes", STATS_COST, data_total);
+            stats_add(&current, "data_bytes_margin", STATS_COST, data_margin);
+            stats_add(&current, "pointer_bytes", STATS_COST,
+                      generate_string_table ? pointer_size * strings_total : 0);
+            stats_add(&current, "decoder_bytes", STATS_COST, rom_decoder_size);
+            stats_add(&current, "decode_cycles", STATS_COST, decode_cycles);
+            stats_write(stats_output, &current);
+            fclose(stats_output);
+        }
         /* Cleanup */
+        sample_free(&sample);
         huffman_delete_node(root);
         destroy_string_list(strings);
-        return(-1);
+        dictionary_free(&dictionary);
+        return 0;
+    }
+
+    if (use_layout) {
+        /* Keep the unchanged strings where they were, and fill the slack */
+        int kept;
+        if (!layout_place(have_previous ? &previous : 0, strings, bank_size,
+                          first_bank, &layout, &kept)) {
+            fprintf(stderr, "error: --bank-size: an encoded string takes more than %ld bytes\n",
+                    bank_size);
+            return(-1);
+        }
+        layout_set_code(&layout, root);
+        if (verbose && have_previous) {
+            fprintf(stdout, "  layout: %d strings kept their place, %d were placed anew; "
+                    "%ld bytes differ\n", kept, string_count - kept,
+                    layout_changed_bytes(&previous, &layout));
+        }
     }
 
-    if (!data_output_filename) {
-        data_output_filename = "huffpuff.dat.asm";
+    if (bank_size) {
+        /* Lay the strings out in banks */
+        banks = (int *)malloc(string_count * sizeof(int));
+        bank_offsets = (int *)malloc(string_count * sizeof(int));
+        if (use_layout) {
+            int i;
+            bank_count = 0;
+            for (i = 0; i < string_count; i++) {
+                banks[i] = layout.strings[i].bank;
+                bank_offsets[i] = (int)layout.strings[i].offset;
+                if (banks[i] - first_bank + 1 > bank_count)
+                    bank_count = banks[i] - first_bank + 1;
+            }
+        } else {
+            bank_count = assign_banks(strings, bank_size, first_bank, banks, bank_offsets);
+        }
+        if (!bank_count) {
+            fprintf(stderr, "error: --bank-size: an encoded string takes more than %ld bytes\n",
+                    bank_size);
+            return(-1);
+        }
+        if (first_bank + bank_count > 256) {
+            fprintf(stderr, "error: --bank-size: banks %d to %d do not fit a byte\n",
+                    first_bank, first_bank + bank_count - 1);
+            return(-1);
+        }
+        if (verbose) {
+            fprintf(stdout, "  banks: %d of %ld bytes, from bank %d\n",
+                    bank_count, bank_size, first_bank);
+        }
+        if (generate_string_table) {
+            if (verbose) {
+                fprintf(stdout, "  far pointer table: %d bytes in %d sub-table%s\n",
+                        3 * string_count, (string_count + 255) / 256,
+                        (string_count > 256) ? "s" : "");
+            }
+            if (cpu == CPU_6502) {
+                /* Check the lookup, with the banks mapped at $8000 */
+                int *addresses = (int *)malloc(string_count * sizeof(int));
+                int code_size;
+                double cycles;
+                int i;
+                for (i = 0; i < string_count; i++)
+                    addresses[i] = (0x8000 + bank_offsets[i]) & 0xFFFF;
+                if (!m65dec_validate_lookup(string_count, addresses, banks,
+                                            &code_size, &cycles)) {
+                    return(-1);
+                }
+                free(addresses);
+                if (verbose) {
+                    fprintf(stdout, "  lookup: %d bytes, %.1f cycles per string\n",
+                            code_size, cycles);
+                }
+            }
+        }
     }
-    data_output = fopen(data_output_filename, "wt");
-    if (!data_output) {
-        fprintf(stderr, "error: failed to open `%s' for writing\n",
-                data_output_filename);
+
+    /* Prepare output */
+    trace_begin("write output");
+    db = (cpu == CPU_SM83) ? "db" : ".db";
+    dw = (cpu == CPU_SM83) ? "dw" : ".dw";
+    if (decoder_output_filename && !strlen(table_label))
+        table_label = "huff_table";
+    if (scenes_filename && !glyph_read_scenes(scenes_filename, string_count,
+                                              &scenes, &scene_count)) {
         /* Cleanup */
         huffman_delete_node(root);
         destroy_string_list(strings);
         return(-1);
     }
-    fprintf(data_output, "; Huffman-encoded string data automatically generated by huffpuff.\n");
+    /* With an object file, the assembler text is only written if asked for */
+    if (!table_output_filename && !object_output_filename) {
+        table_output_filename = (output_format == OUTPUT_C) ? "huffpuff.tab.h" : "huffpuff.tab.asm";
+    }
+    if (table_output_filename) {
+        table_output = fopen(table_output_filename, "wt");
+        if (!table_output) {
+            fprintf(stderr, "error: failed to open `%s' for writing\n",
+                    table_output_filename);
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+    }
+
+    if (!data_output_filename && !object_output_filename) {
+        data_output_filename = (output_format == OUTPUT_C) ? "huffpuff.dat.h" : "huffpuff.dat.asm";
+    }
+    if (data_output_filename) {
+        data_output = fopen(data_output_filename, "wt");
+        if (!data_output) {
+            fprintf(stderr, "error: failed to open `%s' for writing\n",
+                    data_output_filename);
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        if (output_format == OUTPUT_C)
+            fprintf(data_output, "/* Huffman-encoded string data automatically generated by huffpuff. */\n");
+        else
+            fprintf(data_output, "; Huffman-encoded string data automatically generated by huffpuff.\n");
+    }
 
     /* Print the Huffman codes in code length order. */
-    if (verbose)
-        fprintf(stdout, "writing Huffman decoder table\n");
-    fprintf(table_output, "; Huffman decoder table automatically generated by huffpuff.\n");
-    if (table_label && strlen(table_label))
-        fprintf(table_output, "%s:\n", table_label);
-    write_huffman_codes(table_output, root, charmap, node_label_prefix);
+    if (table_output) {
+        if (verbose)
+            fprintf(stdout, "writing Huffman decoder table\n");
+        if (output_format == OUTPUT_C) {
+            fprintf(table_output, "/* Huffman decoder table automatically generated by huffpuff. */\n");
+        } else {
+            fprintf(table_output, "; Huffman decoder table automatically generated by huffpuff.\n");
+            if (table_label && strlen(table_label))
+                fprintf(table_output, "%s:\n", table_label);
+        }
+        if (output_format == OUTPUT_C) {
+            cgen_write_table(table_output, strlen(table_label) ? table_label : "huff_table",
+                             root, charmap);
+        } else if (codec == CODEC_CM) {
+            unsigned char *image = (unsigned char *)malloc(m65cm_table_size(&cm));
+            m65cm_table_image(&cm, charmap, image);
+            write_chunk(table_output, NULL, "counter start values",
+                        image, CM_COUNTERS, 16, db);
+            write_chunk(table_output, NULL, "left children",
+                        image + CM_COUNTERS, cm.node_count, 16, db);
+            write_chunk(table_output, NULL, "right children",
+                        image + CM_COUNTERS + cm.node_count, cm.node_count, 16, db);
+            write_chunk(table_output, NULL, "leaf values",
+                        image + CM_COUNTERS + 2 * cm.node_count, cm.leaf_count, 16, db);
+            free(image);
+        } else if (codec == CODEC_FIXED) {
+            unsigned char values[HUFFMAN_MAX_SYMBOLS];
+            int i;
+            for (i = 0; i < fixed.count; ++i)
+                values[i] = (unsigned char)charmap[fixed.symbols[i]];
+            write_chunk(table_output, NULL, "fixed-width code values",
+                        values, fixed.count, 16, db);
+        } else if (labels) {
+            write_huffman_codes(table_output, root, charmap, leaf_sequences,
+                                node_label_prefix, cpu, chosen_format);
+        } else {
+            /* One label for the table; child pointers are plain numbers */
+            char base[256];
+            unsigned char *image;
+            unsigned char *moved = 0;
+            int image_size;
+            if (strlen(table_label)) {
+                sprintf(base, "%.255s", table_label);
+            } else {
+                sprintf(base, "%.247snode_0_0", node_label_prefix);
+                fprintf(table_output, "%s:\n", base);
+            }
+            image = decoder_table_image(root, charmap, leaf_sequences,
+                                        cpu, chosen_format, 0, &image_size);
+            if ((cpu != CPU_65816) && (chosen_format == TABLE_ABS16)) {
+                moved = decoder_table_image(root, charmap, leaf_sequences,
+                                            cpu, chosen_format, 0x100, &image_size);
+            }
+            write_table_image(table_output, image, moved, image_size, base, cpu);
+            free(image);
+            free(moved);
+        }
+
+        fclose(table_output);
+    }
 
-    fclose(table_output);
+    if (decoder_output_filename) {
+        /* Write the generated decoder */
+        asm_buffer_t decoder;
+        decoder_output = fopen(decoder_output_filename, "wt");
+        if (!decoder_output) {
+            fprintf(stderr, "error: failed to open `%s' for writing\n",
+                    decoder_output_filename);
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        if (verbose)
+            fprintf(stdout, "writing Huffman decoder\n");
+        asm_init(&decoder, 0);
+        if (output_format == OUTPUT_C) {
+            fprintf(decoder_output, "/* Huffman decoder automatically generated by huffpuff. */\n");
+            cgen_write_decoder(decoder_output, decoder_label, root, charmap);
+        } else if (codec == CODEC_CM) {
+            m65cm_generate(&decoder, decoder_label, table_label, &cm);
+        } else if ((codec == CODEC_FIXED) && ((cpu == CPU_SM83) || (cpu == CPU_Z80))) {
+            z80dec_generate_fixed(&decoder, cpu, decoder_label, table_label, fixed.width);
+        } else if (codec == CODEC_FIXED) {
+            m65dec_generate_fixed(&decoder, decoder_label, table_label, fixed.width);
+        } else if (decoder_kind == DECODER_CODE) {
+            m65dec_generate_code(&decoder, decoder_label, root, charmap, leaf_sequences);
+        } else {
+            if (root_bits) {
+                /* The nodes that the lookup leads to, in the chosen layout */
+                huffman_table_image(root, charmap, leaf_sequences, cpu, chosen_format, 0, 0);
+                huffman_root_positions(root, root_bits, root_positions);
+            }
+            if ((cpu == CPU_SM83) || (cpu == CPU_Z80)) {
+                z80dec_generate(&decoder, cpu, decoder_label, table_label,
+                                huffman_leaf_format(root, leaf_sequences), chosen_format,
+                                root_bits, root_positions);
+            } else {
+                m65dec_generate(&decoder, cpu, decoder_label, table_label,
+                                (cpu == CPU_65816) ? m65dec_record_size(root, charmap) : 2,
+                                huffman_leaf_format(root, leaf_sequences), chosen_format,
+                                root_bits, root_positions);
+            }
+        }
+        if (banks && generate_string_table && (cpu == CPU_6502)) {
+            char lookup_label[256];
+            sprintf(lookup_label, "%s_lookup", decoder_label);
+            m65dec_generate_lookup(&decoder, lookup_label, decoder_label,
+                                   far_label, string_count);
+        }
+        asm_write(&decoder, decoder_output);
+        asm_free(&decoder);
+        fclose(decoder_output);
+    }
 
-    if (generate_string_table) {
-        /* Print string pointer table */
+    if (encoder_output_filename) {
+        /* Generate an encoder for text that is entered at run time */
+        FILE *encoder_output;
+        asm_buffer_t encoder;
+        m65enc_table_t enc_table;
+        string_list_t *chars = NULL;
+        string_list_t **nextp = &chars;
+        string_list_t *str;
+        int values[256];
+        int uncoded = 0;
+        int code_size;
+        double cycles;
         int i;
-        string_list_t *lst;
+        for (i = 0; i < 256; i++) {
+            if (!leaf_sequences)
+                values[i] = charmap[i];
+            else
+                values[i] = (sequences[i].length == 1) ? sequences[i].bytes[0] : -1;
+        }
+        if (!m65enc_build_table(values, codes, &enc_table)) {
+            fprintf(stderr, "error: --encoder-output: codes longer than %d bits\n",
+                    M65ENC_MAX_CODE);
+            return(-1);
+        }
+        /* Check the encoder on the strings, spelled out in characters */
+        for (str = strings; str != NULL; str = str->next) {
+            string_list_t *lst;
+            int len = str->text_length;
+            for (i = 0; i < len; i++) {
+                int v = values[str->text[i]];
+                if ((v < 0) || (enc_table.symbols[v] == -1))
+                    break;
+            }
+            if (i < len) {
+                uncoded++;
+                continue;
+            }
+            lst = (string_list_t *)malloc(sizeof(string_list_t));
+            lst->text = (unsigned char *)malloc(len + 1);
+            lst->text_length = len;
+            memcpy(lst->text, str->text, len + 1);
+            lst->symbols = (int *)malloc((len + 1) * sizeof(int));
+            lst->length = 0;
+            for (i = 0; i < len; i++)
+                lst->symbols[lst->length++] = enc_table.symbols[values[str->text[i]]];
+            if (append_byte != -1)
+                lst->symbols[lst->length++] = append_byte;
+            lst->id = 0;
+            lst->huff_data = 0;
+            lst->huff_size = 0;
+            lst->next = NULL;
+            *nextp = lst;
+            nextp = &(lst->next);
+        }
+        encode_strings(chars, codes);
         if (verbose)
-            fprintf(stdout, "writing string pointer table\n");
-        if (string_table_label && strlen(string_table_label))
-            fprintf(data_output, "%s:\n", string_table_label);
-        for (i = 0, lst = strings; lst != 0; lst = lst->next, ++i) {
-            fprintf(data_output, ".dw %sString%d\n",
-                    string_label_prefix, i);
+            fprintf(stdout, "running generated 6502 encoder\n");
+        if (!m65enc_validate(&enc_table, values, chars, &code_size, &cycles)) {
+            /* Cleanup */
+            destroy_string_list(chars);
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        destroy_string_list(chars);
+        if (verbose) {
+            fprintf(stdout, "  encoder size: %d bytes, with tables for %d values\n",
+                    code_size, enc_table.count);
+            fprintf(stdout, "  encoding time: %.1f cycles per character\n", cycles);
+            if (uncoded)
+                fprintf(stdout, "  strings with characters that have no code: %d\n", uncoded);
+        }
+        encoder_output = fopen(encoder_output_filename, "wt");
+        if (!encoder_output) {
+            fprintf(stderr, "error: failed to open `%s' for writing\n",
+                    encoder_output_filename);
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
         }
+        if (verbose)
+            fprintf(stdout, "writing Huffman encoder\n");
+        asm_init(&encoder, 0);
+        m65enc_generate(&encoder, encoder_label, &enc_table);
+        asm_write(&encoder, encoder_output);
+        asm_free(&encoder);
+        fclose(encoder_output);
+    }
+
+    if ((output_format == OUTPUT_C) && data_output) {
+        /* The strings and the pointer table as C arrays */
+        if (verbose)
+            fprintf(stdout, "writing encoded string data\n");
+        cgen_write_strings(data_output, string_label_prefix,
+                           generate_string_table ? far_label : 0, strings, labels);
+        fclose(data_output);
+        data_output = 0;
+    }
+
+    if (generate_string_table && data_output && banks) {
+        if (verbose)
+            fprintf(stdout, "writing string pointer table\n");
+        write_far_pointers(data_output, far_label, string_label_prefix,
+                           banks, labels ? 0 : bank_offsets, string_count, cpu);
+    } else if (generate_string_table && data_output && !use_layout) {
+        if (verbose)
+            fprintf(stdout, "writing string pointer table\n");
+        write_string_table(data_output, strings, string_table_label,
+                           string_label_prefix, dw, labels, 0);
     }
 
     /* Write the Huffman-encoded strings. */
-    if (verbose)
-        fprintf(stdout, "writing encoded string data\n");
-    write_huffman_strings(data_output, strings, string_label_prefix);
+    if (data_output) {
+        if (verbose)
+            fprintf(stdout, "writing encoded string data\n");
+        write_huffman_strings(data_output, strings, string_label_prefix, db,
+                              input_format, banks, bank_directive, labels,
+                              use_layout ? &layout : 0);
+
+        if (generate_string_table && !banks && use_layout) {
+            /* After the strings, so that adding strings does not move them */
+            if (verbose)
+                fprintf(stdout, "writing string pointer table\n");
+            write_string_table(data_output, strings, string_table_label,
+                               string_label_prefix, dw, labels, &layout);
+        }
+        fclose(data_output);
+    }
+
+    if (layout_output_filename && !layout_write(layout_output_filename, &layout)) {
+        /* Cleanup */
+        huffman_delete_node(root);
+        destroy_string_list(strings);
+        return(-1);
+    }
+
+    if (object_output_filename) {
+        /* Write the table, the strings and the pointers as o65 modules */
+        FILE *object_output = fopen(object_output_filename, "wb");
+        unsigned char *image;
+        unsigned char *moved = 0;
+        int image_size;
+        if (!object_output) {
+            fprintf(stderr, "error: failed to open `%s' for writing\n",
+                    object_output_filename);
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        if (verbose)
+            fprintf(stdout, "writing object file\n");
+        if (codec == CODEC_CM) {
+            image_size = m65cm_table_size(&cm);
+            image = (unsigned char *)malloc(image_size);
+            m65cm_table_image(&cm, charmap, image);
+        } else if (codec == CODEC_FIXED) {
+            int i;
+            image_size = fixed.count;
+            image = (unsigned char *)malloc(image_size);
+            for (i = 0; i < fixed.count; ++i)
+                image[i] = (unsigned char)charmap[fixed.symbols[i]];
+        } else {
+            image = decoder_table_image(root, charmap, leaf_sequences,
+                                        cpu, chosen_format, 0, &image_size);
+            if ((cpu != CPU_65816) && (chosen_format == TABLE_ABS16)) {
+                /* The child pointers are the bytes that move with the table */
+                moved = decoder_table_image(root, charmap, leaf_sequences,
+                                            cpu, chosen_format, 0x100, &image_size);
+            }
+        }
+        write_object_file(object_output, cpu, image, moved, image_size,
+                          (table_label && strlen(table_label)) ? table_label : "huff_table",
+                          strings, string_label_prefix,
+                          generate_string_table ? far_label : 0, banks, string_count);
+        fclose(object_output);
+        free(image);
+        free(moved);
+    }
 
-    fclose(data_output);
+    if (glyph_output_filename) {
+        /* Write the glyphs that every string and scene needs */
+        FILE *glyph_output = fopen(glyph_output_filename, "wt");
+        glyph_table_t glyphs;
+        if (!glyph_output) {
+            fprintf(stderr, "error: failed to open `%s' for writing\n",
+                    glyph_output_filename);
+            /* Cleanup */
+            huffman_delete_node(root);
+            destroy_string_list(strings);
+            return(-1);
+        }
+        if (verbose)
+            fprintf(stdout, "writing glyph sets\n");
+        glyph_collect(strings, charmap, sequences, &glyphs);
+        glyph_write(glyph_output, &glyphs, scenes, scene_count, string_label_prefix,
+                    labels, output_format, cpu);
+        if (verbose) {
+            fprintf(stdout, "  glyphs: %d (%d bytes per set)\n",
+                    glyphs.count, glyphs.set_size);
+        }
+        glyph_free(&glyphs);
+        fclose(glyph_output);
+        free(scenes);
+    }
+    trace_end("write output");
 
     if (verbose)
         fprintf(stdout, "compressed size: %d%%\n", (encoded_size*100) / char_count);
 
+    if (stats_output_filename || baseline_filename) {
+        /* Record or check the sizes and speeds */
+        stats_t current;
+        double encode_rate, decode_rate;
+        if (verbose)
+            fprintf(stdout, "measuring throughput\n");
+        trace_begin("measure throughput");
+        measure_throughput(strings, codes, root, (codec == CODEC_FIXED) ? &fixed : NULL,
+                           (codec == CODEC_CM) ? &cm : NULL, shared_leaf, char_count,
+                           &encode_rate, &decode_rate);
+        stats_init(&current);
+        stats_add(&current, "table_bytes", STATS_COST, rom_table_size);
+        stats_add(&current, "data_bytes", STATS_COST, encoded_size);
+        stats_add(&current, "pointer_bytes", STATS_COST,
+                  generate_string_table ? pointer_size * string_count : 0);
+        stats_add(&current, "decoder_bytes", STATS_COST, rom_decoder_size);
+        stats_add(&current, "decode_cycles", STATS_COST, decode_cycles);
+        stats_add(&current, "encode_mb_per_s", STATS_RATE, encode_rate);
+        stats_add(&current, "decode_mb_per_s", STATS_RATE, decode_rate);
+        trace_end("measure throughput");
+        if (stats_output_filename) {
+            FILE *stats_output = fopen(stats_output_filename, "wt");
+            if (!stats_output) {
+                fprintf(stderr, "error: failed to open `%s' for writing\n",
+                        stats_output_filename);
+                return(-1);
+            }
+            stats_write(stats_output, &current);
+            fclose(stats_output);
+        }
+        if (baseline_filename) {
+            stats_t baseline;
+            int worse;
+            if (!stats_read(baseline_filename, &baseline))
+                return(-1);
+            fprintf(stdout, "comparing with `%s'\n", baseline_filename);
+            worse = stats_compare(&baseline, &current, tolerance, stdout);
+            fflush(stdout);
+            if (worse) {
+                fprintf(stderr, "error: --compare: %d measurement%s worse than `%s'\n",
+                        worse, (worse == 1) ? " is" : "s are", baseline_filename);
+                return(-1);
+            }
+        }
+    }
+
+    if (serve_requests) {
+        int map[256];
+        int i;
+        for (i = 0; i < 256; i++)
+            map[i] = shared_leaf[i];
+        trace_begin("serve");
+        serve(stdin, stdout, strings, string_count, root,
+              (codec == CODEC_FIXED) ? &fixed : NULL, codes, &dictionary, map,
+              append_byte, ignore_case);
+        trace_end("serve");
+    }
+
     /* Cleanup */
     huffman_delete_node(root);
     destroy_string_list(strings);
+    dictionary_free(&dictionary);
+    free(banks);
+    free(bank_offsets);
+    layout_free(&previous);
+    layout_free(&layout);
 
     return 0;
 }
+
+/**
+ * Program entrypoint.
+ */
+int main(int argc, char **argv)
+{
+    return run(argc, argv, NULL, 0);
+}
@@ -18,12 +18,32 @@
 #ifndef HUFFPUFF_H
 #define HUFFPUFF_H
 
+#include <stdio.h>
+#include "charmap.h"
+
 /* A Huffman code */
 struct huffman_code {
     int code;
     int length;
 };
 
+/* Maximum number of symbols: the characters, plus dictionary tokens */
+#define HUFFMAN_MAX_SYMBOLS 512
+
+/* Maximum number of extra bits that follow the code of a bucket */
+#define HUFFMAN_MAX_EXTRA_BITS 7
+
+/* Maximum number of bits that a root lookup table in front of the
+   decoder table takes at once */
+#define HUFFMAN_MAX_ROOT_BITS 7
+
+/* A group of characters that share a leaf. The index of a character in
+   the group follows the code of the leaf as extra bits. */
+struct huffman_bucket {
+    int extra_bits;
+    int symbols[1 << HUFFMAN_MAX_EXTRA_BITS];
+};
+
 /* A Huffman node */
 struct huffman_node {
     int symbol;
@@ -31,12 +51,81 @@ struct huffman_node {
     struct huffman_node *left;
     struct huffman_node *right;
     struct huffman_code code;
+    int position;   /* offset of the node in the decoder table */
+    struct huffman_bucket *bucket;  /* set if the leaf is a bucket */
 };
 
 typedef struct huffman_node huffman_node_t;
 
+/* Leaf formats of the 8-bit decoder tables */
+#define LEAF_VALUE    0     /* $00, value */
+#define LEAF_SEQUENCE 1     /* $00, length, bytes */
+#define LEAF_BUCKET   2     /* $00, sentinel, values */
+
+/* Formats of the interior nodes of the 8-bit decoder tables */
+#define TABLE_REL8  0       /* one-byte child offsets; leaves start with $00 */
+#define TABLE_REL16 1       /* two-byte child offsets, high byte first; leaves start with $80 */
+#define TABLE_ABS16 2       /* child addresses, high byte first; leaves start with $00 */
+#define TABLE_AUTO  -1      /* rel8 if it fits, else the smaller of the others */
+
+/* Codecs */
+#define CODEC_HUFFMAN 0
+#define CODEC_FIXED   1     /* every symbol takes the same number of bits */
+#define CODEC_CM      2     /* context-mixing arithmetic coding */
+
+/* Optimisation goals */
+#define OPTIMIZE_SIZE  0    /* the least ROM */
+#define OPTIMIZE_SPEED 1    /* the fastest decoder that fits the ROM budget */
+
+/* Input formats */
+#define INPUT_TEXT    0     /* lines of text */
+#define INPUT_RECORDS 1     /* binary records, each with a 16-bit length */
+#define INPUT_PO      2     /* gettext .po messages */
+#define INPUT_CSV     3     /* CSV rows of ID and text */
+
+/* The end-of-string token of text input */
+#define STRING_SEPARATOR 0x0A
+
+/* Output formats */
+#define OUTPUT_ASM 0        /* assembler source */
+#define OUTPUT_C   1        /* C headers, for ports to a host CPU */
+
+/* Kinds of generated decoders */
+#define DECODER_TABLE 0     /* walks the decoder table */
+#define DECODER_CODE  1     /* the tree as code (6502 only) */
+
 huffman_node_t *huffman_create_node(int, int, huffman_node_t *, huffman_node_t *);
 void huffman_delete_node(huffman_node_t *);
 huffman_node_t *huffman_build_tree(huffman_node_t **, int);
+int huffman_leaf_format(const huffman_node_t *, const charmap_sequence_t *);
+int huffman_table_layout(huffman_node_t *, const charmap_sequence_t *, int, int,
+                         huffman_node_t **, int *);
+int huffman_root_positions(const huffman_node_t *, int, int *);
+int huffman_table_image(huffman_node_t *, const unsigned short *,
+                        const charmap_sequence_t *, int, int, int, unsigned char *);
+int huffman_table_image16(huffman_node_t *, const unsigned short *, int,
+                          unsigned char *);
+
+/* A linked list of text strings. */
+struct string_list {
+    struct string_list *next;
+    unsigned char *text;
+    int text_length;    /* number of characters; the text may contain NULs */
+    char *id;       /* name of the string, or NULL */
+    int *symbols;   /* the parsed string, including the appended byte */
+    int length;     /* number of symbols */
+    unsigned char *huff_data;
+    int huff_size;
+};
+
+typedef struct string_list string_list_t;
+
+int read_string(FILE *, int, unsigned char **, int *);
+
+/* Supported target CPUs. */
+#define CPU_6502 0
+#define CPU_SM83 1
+#define CPU_Z80  2
+#define CPU_65816 3
 
 #endif /* HUFFPUFF_H */
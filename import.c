@@ -0,0 +1,560 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the readers of localisation files.
+ *
+ * A gettext .po file gives one string per message: its translation, or
+ * the untranslated text if there is no translation or it is marked fuzzy.
+ * Every plural form is a string of its own. The header entry (the one
+ * with an empty msgid) is skipped. The ID of a string is its msgid,
+ * preceded by its msgctxt and a |, and followed by [n] for plural form n.
+ *
+ * A CSV file gives one string per row: the second field, with the first
+ * field as its ID, or the only field of a row that has one. Fields may be
+ * quoted with ", and a quoted field may contain commas, newlines and ""
+ * for a quote. Rows that start with # are comments. A first row of exactly
+ * the two fields id and text, in any case, is a header and is skipped.
+ *
+ * Both readers take the file in big blocks and parse it byte by byte.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "import.h"
+
+/* Size of the blocks the input is read in */
+#define BLOCK_SIZE 65536
+
+/* Maximum number of plural forms of a message */
+#define PO_MAX_FORMS 8
+
+/* Input read in blocks */
+struct reader {
+    FILE *in;
+    unsigned char *block;
+    int pos;
+    int length;
+    int line;
+};
+
+/* A byte string that grows as needed */
+struct buffer {
+    unsigned char *data;
+    int length;
+    int size;
+};
+
+/* Where the strings go */
+struct sink {
+    string_list_t **nextp;
+    int ignore_case;
+    int *freq;
+    int *total_length;
+    int *string_count;
+};
+
+/**
+ * Returns the next byte of the input, or EOF.
+ */
+static int next_byte(struct reader *r)
+{
+    if (r->pos == r->length) {
+        r->length = fread(r->block, 1, BLOCK_SIZE, r->in);
+        r->pos = 0;
+        if (r->length <= 0) {
+            r->length = 0;
+            return EOF;
+        }
+    }
+    return r->block[r->pos++];
+}
+
+/**
+ * Returns the next byte of the input without taking it, or EOF.
+ */
+static int peek_byte(struct reader *r)
+{
+    int c = next_byte(r);
+    if (c != EOF)
+        r->pos--;
+    return c;
+}
+
+/**
+ * Appends a byte to a buffer.
+ */
+static void append(struct buffer *b, int c)
+{
+    if (b->length + 1 >= b->size) {
+        b->size = b->size ? 2 * b->size : 64;
+        b->data = (unsigned char *)realloc(b->data, b->size);
+    }
+    b->data[b->length++] = (unsigned char)c;
+}
+
+/**
+ * Appends the contents of a buffer to another.
+ */
+static void append_buffer(struct buffer *b, const struct buffer *other)
+{
+    int i;
+    for (i = 0; i < other->length; i++)
+        append(b, other->data[i]);
+}
+
+/**
+ * Appends a string to a buffer.
+ */
+static void append_string(struct buffer *b, const char *s)
+{
+    while (*s)
+        append(b, (unsigned char)*s++);
+}
+
+/**
+ * Tells whether a buffer holds a word, ignoring case.
+ */
+static int is_word(const struct buffer *b, const char *word)
+{
+    int i;
+    for (i = 0; i < b->length; i++) {
+        if (!word[i] || (tolower(b->data[i]) != word[i]))
+            return 0;
+    }
+    return !word[i];
+}
+
+/**
+ * Adds a string to the list.
+ * @param sink The list
+ * @param text Characters of the string
+ * @param id ID of the string, or NULL
+ */
+static void add_string(struct sink *sink, const struct buffer *text,
+                       const struct buffer *id)
+{
+    string_list_t *lst;
+    int i;
+    if (text->length == 0)
+        return;
+    lst = (string_list_t *)malloc(sizeof(string_list_t));
+    lst->text = (unsigned char *)malloc(text->length + 1);
+    lst->text_length = text->length;
+    for (i = 0; i < text->length; i++) {
+        int c = text->data[i];
+        if (sink->ignore_case && (c >= 'A') && (c <= 'Z'))
+            c += 0x20;
+        lst->text[i] = (unsigned char)c;
+        sink->freq[c]++;
+    }
+    lst->text[text->length] = 0;
+    lst->id = 0;
+    if (id && id->length) {
+        lst->id = (char *)malloc(id->length + 1);
+        memcpy(lst->id, id->data, id->length);
+        lst->id[id->length] = 0;
+    }
+    lst->symbols = 0;
+    lst->length = 0;
+    lst->huff_data = 0;
+    lst->huff_size = 0;
+    lst->next = NULL;
+    *sink->nextp = lst;
+    sink->nextp = &(lst->next);
+    if (sink->total_length)
+        *sink->total_length += text->length;
+    if (sink->string_count)
+        *sink->string_count += 1;
+}
+
+/**
+ * Prepares the reader and the list.
+ */
+static void start(struct reader *r, struct sink *sink, FILE *in, int ignore_case,
+                  string_list_t **head, int *freq, int *total_length, int *string_count)
+{
+    int i;
+    r->in = in;
+    r->block = (unsigned char *)malloc(BLOCK_SIZE);
+    r->pos = r->length = 0;
+    r->line = 1;
+    *head = NULL;
+    sink->nextp = head;
+    sink->ignore_case = ignore_case;
+    sink->freq = freq;
+    sink->total_length = total_length;
+    sink->string_count = string_count;
+    for (i = 0; i < 256; i++)
+        freq[i] = 0;
+    if (total_length)
+        *total_length = 0;
+    if (string_count)
+        *string_count = 0;
+}
+
+/**
+ * Reads the rest of a line.
+ * @param r The input
+ * @param line Where to store the line, without the line break
+ * @return 0 at the end of the input, 1 if OK
+ */
+static int read_line(struct reader *r, struct buffer *line)
+{
+    int c;
+    line->length = 0;
+    if (peek_byte(r) == EOF)
+        return 0;
+    while (((c = next_byte(r)) != EOF) && (c != '\n'))
+        append(line, c);
+    if ((line->length > 0) && (line->data[line->length-1] == '\r'))
+        line->length--;
+    return 1;
+}
+
+/**
+ * Reads a C-quoted string of a .po file and appends it to a buffer.
+ * @param p Position of the opening quote
+ * @param end End of the line
+ * @param out Buffer to append to
+ * @return 0 if the string is bad, 1 if OK
+ */
+static int unquote(const unsigned char *p, const unsigned char *end,
+                   struct buffer *out)
+{
+    if ((p == end) || (*p != '"'))
+        return 0;
+    for (p++; (p < end) && (*p != '"'); p++) {
+        int c = *p;
+        if ((c == '\\') && (p + 1 < end)) {
+            c = *++p;
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'a': c = '\a'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'v': c = '\v'; break;
+                case 'x': {
+                    int v = 0;
+                    while ((p + 1 < end) && isxdigit(p[1])) {
+                        p++;
+                        v = (v << 4) | (isdigit(*p) ? *p - '0' : (tolower(*p) - 'a' + 10));
+                    }
+                    c = v & 0xFF;
+                    break;
+                }
+                default:
+                    if ((c >= '0') && (c <= '7')) {
+                        int v = c - '0';
+                        int n;
+                        for (n = 1; (n < 3) && (p + 1 < end) && (p[1] >= '0') && (p[1] <= '7'); n++)
+                            v = (v << 3) | (*++p - '0');
+                        c = v & 0xFF;
+                    }
+                    /* \" \\ \' \? stand for the character itself */
+                    break;
+            }
+        }
+        append(out, c);
+    }
+    if (p == end)
+        return 0;
+    /* Nothing but white space may follow */
+    for (p++; p < end; p++) {
+        if ((*p != ' ') && (*p != '\t'))
+            return 0;
+    }
+    return 1;
+}
+
+/* A message of a .po file */
+struct message {
+    struct buffer context;
+    struct buffer id;
+    struct buffer id_plural;
+    struct buffer forms[PO_MAX_FORMS];
+    int form_count;
+    int has_context;
+    int has_id;
+    int fuzzy;
+};
+
+/**
+ * Adds the strings of a message to the list, and empties the message.
+ */
+static void add_message(struct sink *sink, struct message *msg, struct buffer *name)
+{
+    int n;
+    if (msg->has_id && (msg->id.length || msg->has_context)) {
+        for (n = 0; n < msg->form_count; n++) {
+            const struct buffer *text = &msg->forms[n];
+            if (!text->length || msg->fuzzy)
+                text = (n > 0) && msg->id_plural.length ? &msg->id_plural : &msg->id;
+            name->length = 0;
+            if (msg->has_context) {
+                append_buffer(name, &msg->context);
+                append(name, '|');
+            }
+            append_buffer(name, &msg->id);
+            if (msg->id_plural.length) {
+                char index[16];
+                sprintf(index, "[%d]", n);
+                append_string(name, index);
+            }
+            add_string(sink, text, name);
+        }
+    }
+    msg->context.length = msg->id.length = msg->id_plural.length = 0;
+    for (n = 0; n < PO_MAX_FORMS; n++)
+        msg->forms[n].length = 0;
+    msg->form_count = 0;
+    msg->has_context = msg->has_id = msg->fuzzy = 0;
+}
+
+/**
+ * Reads the messages of a gettext .po file.
+ * @param in File to read from
+ * @param filename Name of the file, for error messages
+ * @param ignore_case Convert characters to lower-case
+ * @param head Where to store the list of strings
+ * @param freq Where to store computed frequencies
+ * @param total_length If not NULL, the total number of characters is stored here
+ * @param string_count If not NULL, the number of strings is stored here
+ * @return 0 if fail, 1 if OK
+ */
+int import_po(FILE *in, const char *filename, int ignore_case, string_list_t **head,
+              int *freq, int *total_length, int *string_count)
+{
+    struct reader r;
+    struct sink sink;
+    struct message msg;
+    struct buffer line = { 0, 0, 0 };
+    struct buffer name = { 0, 0, 0 };
+    struct buffer *field = NULL;    /* where continuation lines go */
+    int lineno = 0;
+    int ok = 1;
+    int n;
+
+    start(&r, &sink, in, ignore_case, head, freq, total_length, string_count);
+    memset(&msg, 0, sizeof(msg));
+    while (ok && read_line(&r, &line)) {
+        const unsigned char *p = line.data;
+        const unsigned char *end = line.data + line.length;
+        lineno++;
+        while ((p < end) && ((*p == ' ') || (*p == '\t')))
+            p++;
+        if (p == end) {
+            /* A blank line ends the message */
+            add_message(&sink, &msg, &name);
+            field = NULL;
+            continue;
+        }
+        if (*p == '#') {
+            if (msg.form_count) {
+                add_message(&sink, &msg, &name);
+                field = NULL;
+            }
+            if ((p + 1 < end) && (p[1] == ',')) {
+                const unsigned char *q;
+                for (q = p; q + 5 <= end; q++) {
+                    if (!memcmp(q, "fuzzy", 5))
+                        msg.fuzzy = 1;
+                }
+            }
+            continue;
+        }
+        if (*p == '"') {
+            if (!field) {
+                fprintf(stderr, "error: %s:%d: string without a keyword\n", filename, lineno);
+                ok = 0;
+            } else if (!unquote(p, end, field)) {
+                fprintf(stderr, "error: %s:%d: bad string\n", filename, lineno);
+                ok = 0;
+            }
+            continue;
+        }
+        /* A keyword, then a string */
+        if (((end - p > 7) && !memcmp(p, "msgctxt", 7))
+            || ((end - p > 5) && !memcmp(p, "msgid", 5) && (p[5] == ' ' || p[5] == '\t'))) {
+            /* Starts the next message */
+            if (msg.form_count)
+                add_message(&sink, &msg, &name);
+        }
+        if ((end - p > 7) && !memcmp(p, "msgctxt", 7)) {
+            field = &msg.context;
+            msg.has_context = 1;
+            p += 7;
+        } else if ((end - p > 12) && !memcmp(p, "msgid_plural", 12)) {
+            field = &msg.id_plural;
+            p += 12;
+        } else if ((end - p > 5) && !memcmp(p, "msgid", 5)) {
+            field = &msg.id;
+            msg.has_id = 1;
+            p += 5;
+        } else if ((end - p > 6) && !memcmp(p, "msgstr", 6)) {
+            n = 0;
+            p += 6;
+            if (*p == '[') {
+                for (p++; (p < end) && (*p >= '0') && (*p <= '9'); p++)
+                    n = 10 * n + (*p - '0');
+                if ((p == end) || (*p != ']') || (n >= PO_MAX_FORMS)) {
+                    fprintf(stderr, "error: %s:%d: bad plural form\n", filename, lineno);
+                    ok = 0;
+                    continue;
+                }
+                p++;
+            }
+            field = &msg.forms[n];
+            if (n + 1 > msg.form_count)
+                msg.form_count = n + 1;
+        } else {
+            fprintf(stderr, "error: %s:%d: unknown keyword\n", filename, lineno);
+            ok = 0;
+            continue;
+        }
+        while ((p < end) && ((*p == ' ') || (*p == '\t')))
+            p++;
+        if (!unquote(p, end, field)) {
+            fprintf(stderr, "error: %s:%d: bad string\n", filename, lineno);
+            ok = 0;
+        }
+    }
+    if (ok)
+        add_message(&sink, &msg, &name);
+
+    free(line.data);
+    free(name.data);
+    free(msg.context.data);
+    free(msg.id.data);
+    free(msg.id_plural.data);
+    for (n = 0; n < PO_MAX_FORMS; n++)
+        free(msg.forms[n].data);
+    free(r.block);
+    return ok;
+}
+
+/**
+ * Reads the rows of a CSV file.
+ * @param in File to read from
+ * @param filename Name of the file, for error messages
+ * @param ignore_case Convert characters to lower-case
+ * @param head Where to store the list of strings
+ * @param freq Where to store computed frequencies
+ * @param total_length If not NULL, the total number of characters is stored here
+ * @param string_count If not NULL, the number of strings is stored here
+ * @return 0 if fail, 1 if OK
+ */
+int import_csv(FILE *in, const char *filename, int ignore_case, string_list_t **head,
+               int *freq, int *total_length, int *string_count)
+{
+    struct reader r;
+    struct sink sink;
+    struct buffer fields[2] = { { 0, 0, 0 }, { 0, 0, 0 } };
+    int field = 0;
+    int row = 1;
+    int row_start = 1;
+    int first_row = 1;
+    int ok = 1;
+    int c;
+
+    start(&r, &sink, in, ignore_case, head, freq, total_length, string_count);
+    for (;;) {
+        c = next_byte(&r);
+        if (row_start && (c == '#')) {
+            /* A comment row */
+            while (((c = next_byte(&r)) != EOF) && (c != '\n'))
+                ;
+            row++;
+            if (c == EOF)
+                break;
+            continue;
+        }
+        row_start = 0;
+        if (c == '"') {
+            /* A quoted field */
+            int quote_row = row;
+            for (;;) {
+                c = next_byte(&r);
+                if (c == EOF) {
+                    fprintf(stderr, "error: %s:%d: quoted field does not end\n",
+                            filename, quote_row);
+                    ok = 0;
+                    break;
+                }
+                if (c == '"') {
+                    if (peek_byte(&r) != '"')
+                        break;
+                    c = next_byte(&r);
+                }
+                if (c == '\n')
+                    row++;
+                if (field < 2)
+                    append(&fields[field], c);
+            }
+            if (!ok)
+                break;
+            c = next_byte(&r);
+            if ((c != ',') && (c != '\n') && (c != '\r') && (c != EOF)) {
+                fprintf(stderr, "error: %s:%d: text after a quoted field\n", filename, row);
+                ok = 0;
+                break;
+            }
+        } else {
+            while ((c != ',') && (c != '\n') && (c != EOF)) {
+                if ((field < 2) && (c != '\r'))
+                    append(&fields[field], c);
+                c = next_byte(&r);
+            }
+        }
+        if (c == '\r') {
+            /* Only a line break may follow */
+            c = next_byte(&r);
+            if ((c != '\n') && (c != EOF)) {
+                fprintf(stderr, "error: %s:%d: text after a quoted field\n", filename, row);
+                ok = 0;
+                break;
+            }
+        }
+        if (c == ',') {
+            field++;
+            continue;
+        }
+        /* End of the row */
+        if (first_row && (field == 1) && is_word(&fields[0], "id")
+            && is_word(&fields[1], "text")) {
+            /* The header row */
+        } else if (field == 0) {
+            add_string(&sink, &fields[0], NULL);
+        } else {
+            add_string(&sink, &fields[1], &fields[0]);
+        }
+        first_row = 0;
+        fields[0].length = fields[1].length = 0;
+        field = 0;
+        row++;
+        row_start = 1;
+        if (c == EOF)
+            break;
+    }
+
+    free(fields[0].data);
+    free(fields[1].data);
+    free(r.block);
+    return ok;
+}
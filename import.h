@@ -0,0 +1,27 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stdio.h>
+#include "huffpuff.h"
+
+int import_po(FILE *, const char *, int, string_list_t **, int *, int *, int *);
+int import_csv(FILE *, const char *, int, string_list_t **, int *, int *, int *);
+
+#endif  /* !IMPORT_H */
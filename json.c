@@ -0,0 +1,264 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains a small reader and writer of the JSON that --serve
+ * speaks. Requests are single-line objects whose values are strings,
+ * numbers, true, false or null; nested objects and arrays are not
+ * accepted. Strings are byte strings: \u escapes must be below 0100.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+
+/**
+ * Skips white space.
+ */
+static const char *skip_space(const char *p)
+{
+    while ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n'))
+        p++;
+    return p;
+}
+
+/**
+ * Returns the value of a hex digit, or -1.
+ */
+static int hex_digit(int c)
+{
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Reads a string.
+ * @param p Position of the opening quote
+ * @param str Where to store the unescaped string (NUL-terminated)
+ * @param len Where to store its length
+ * @return Position after the closing quote, or NULL if the string is bad
+ */
+static const char *parse_string(const char *p, char **str, int *len)
+{
+    const char *q;
+    char *out;
+    int n = 0;
+    /* The unescaped string is never longer than the escaped one */
+    for (q = p + 1; *q && (*q != '"'); q++) {
+        if ((*q == '\\') && q[1])
+            q++;
+    }
+    if (*q != '"')
+        return NULL;
+    out = (char *)malloc(q - p);
+    for (p++; *p != '"'; p++) {
+        int c = (unsigned char)*p;
+        if (c == '\\') {
+            p++;
+            switch (*p) {
+                case '"': c = '"'; break;
+                case '\\': c = '\\'; break;
+                case '/': c = '/'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'u': {
+                    int i;
+                    c = 0;
+                    for (i = 1; i <= 4; i++) {
+                        int d = hex_digit(p[i]);
+                        if (d == -1) {
+                            free(out);
+                            return NULL;
+                        }
+                        c = (c << 4) | d;
+                    }
+                    if (c > 0xFF) {
+                        free(out);
+                        return NULL;
+                    }
+                    p += 4;
+                    break;
+                }
+                default:
+                    free(out);
+                    return NULL;
+            }
+        }
+        out[n++] = (char)c;
+    }
+    out[n] = '\0';
+    *str = out;
+    *len = n;
+    return p + 1;
+}
+
+/**
+ * Parses a flat JSON object.
+ * @param text The object
+ * @param obj Where to store its members
+ * @return 0 if fail, 1 if OK
+ */
+int json_parse(const char *text, json_object_t *obj)
+{
+    const char *p = skip_space(text);
+    obj->count = 0;
+    if (*p++ != '{')
+        return 0;
+    p = skip_space(p);
+    if (*p == '}')
+        return (*skip_space(p + 1) == '\0');
+    for (;;) {
+        int i = obj->count;
+        int key_len;
+        if ((i == JSON_MAX_MEMBERS) || (*p != '"'))
+            break;
+        p = parse_string(p, &obj->keys[i], &key_len);
+        if (!p)
+            break;
+        p = skip_space(p);
+        if (*p++ != ':') {
+            free(obj->keys[i]);
+            break;
+        }
+        p = skip_space(p);
+        if (*p == '"') {
+            p = parse_string(p, &obj->values[i], &obj->lengths[i]);
+            if (!p) {
+                free(obj->keys[i]);
+                break;
+            }
+            obj->is_string[i] = 1;
+        } else {
+            const char *start = p;
+            while (*p && (*p != ',') && (*p != '}') && (*p != ' ') && (*p != '\t'))
+                p++;
+            if ((p == start) || (*start == '{') || (*start == '[')) {
+                free(obj->keys[i]);
+                break;
+            }
+            obj->values[i] = (char *)malloc(p - start + 1);
+            memcpy(obj->values[i], start, p - start);
+            obj->values[i][p - start] = '\0';
+            obj->lengths[i] = p - start;
+            obj->is_string[i] = 0;
+        }
+        obj->count++;
+        p = skip_space(p);
+        if (*p == ',') {
+            p = skip_space(p + 1);
+            continue;
+        }
+        if (*p == '}')
+            return (*skip_space(p + 1) == '\0');
+        break;
+    }
+    json_free(obj);
+    return 0;
+}
+
+/**
+ * Frees the members of an object.
+ * @param obj The object
+ */
+void json_free(json_object_t *obj)
+{
+    int i;
+    for (i = 0; i < obj->count; i++) {
+        free(obj->keys[i]);
+        free(obj->values[i]);
+    }
+    obj->count = 0;
+}
+
+/**
+ * Finds a member of an object.
+ * @return Index of the member, or -1
+ */
+static int find_member(const json_object_t *obj, const char *key)
+{
+    int i;
+    for (i = 0; i < obj->count; i++) {
+        if (!strcmp(obj->keys[i], key))
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Gets a string member of an object.
+ * @param obj The object
+ * @param key Name of the member
+ * @param len Where to store the length of the string, or NULL
+ * @return The string, or NULL if there is no such string member
+ */
+const char *json_get_string(const json_object_t *obj, const char *key, int *len)
+{
+    int i = find_member(obj, key);
+    if ((i == -1) || !obj->is_string[i])
+        return NULL;
+    if (len)
+        *len = obj->lengths[i];
+    return obj->values[i];
+}
+
+/**
+ * Gets an integer member of an object.
+ * @param obj The object
+ * @param key Name of the member
+ * @param value Where to store the value
+ * @return 0 if there is no such integer member, 1 if OK
+ */
+int json_get_int(const json_object_t *obj, const char *key, long *value)
+{
+    char *end;
+    int i = find_member(obj, key);
+    if ((i == -1) || obj->is_string[i])
+        return 0;
+    *value = strtol(obj->values[i], &end, 10);
+    return (*end == '\0');
+}
+
+/**
+ * Writes a string with JSON escapes.
+ * @param out File to write to
+ * @param str The string
+ * @param len Length of the string
+ */
+void json_write_string(FILE *out, const unsigned char *str, int len)
+{
+    int i;
+    fputc('"', out);
+    for (i = 0; i < len; i++) {
+        int c = str[i];
+        if ((c == '"') || (c == '\\'))
+            fprintf(out, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", out);
+        else if ((c < 0x20) || (c >= 0x7F))
+            fprintf(out, "\\u%.4x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
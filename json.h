@@ -0,0 +1,43 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdio.h>
+
+/* Maximum number of members of an object */
+#define JSON_MAX_MEMBERS 16
+
+/* A flat JSON object whose values are strings, numbers or literals */
+struct json_object {
+    int count;
+    char *keys[JSON_MAX_MEMBERS];
+    char *values[JSON_MAX_MEMBERS];     /* strings unescaped; others as written */
+    int lengths[JSON_MAX_MEMBERS];
+    int is_string[JSON_MAX_MEMBERS];
+};
+
+typedef struct json_object json_object_t;
+
+int json_parse(const char *, json_object_t *);
+void json_free(json_object_t *);
+const char *json_get_string(const json_object_t *, const char *, int *);
+int json_get_int(const json_object_t *, const char *, long *);
+void json_write_string(FILE *, const unsigned char *, int);
+
+#endif  /* !JSON_H */
@@ -0,0 +1,699 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the string layout, which lets a rebuild keep the
+ * strings where the previous build put them.
+ *
+ * A layout records the Huffman code, where every string lives (its bank
+ * and its offset in the bank) and the bytes of every bank. A rebuild with
+ * the same code encodes the unchanged strings to the same bytes, and they
+ * keep their places.
+ *
+ * Strings are matched by their ID, or by their text if they have none, so
+ * that inserting or removing a string does not move the others. A string
+ * whose key is new takes the place of an old string that lost its key
+ * between the same neighbours, as it is most likely an edit of it; if it
+ * still fits there, it is rewritten in place. The space of the strings that changed or went away
+ * becomes slack, which keeps its old bytes. A changed string goes to the
+ * slack that fits it best, or else to the end of its bank, the end of the
+ * last bank or a new bank. Banks never shrink, so that nothing that
+ * follows them moves.
+ *
+ * A layout file is text: a line for the bank size, a line for every leaf
+ * of the code (symbol, code length, code, weight), a line for every string
+ * (number, bank, offset, size, and key in hex or - if it is empty) and, for
+ * every bank, a line with its number and size followed by its bytes in hex.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "layout.h"
+
+/* Bytes per line of hex in a layout file */
+#define BYTES_PER_LINE 32
+
+/* A run of free bytes in a bank */
+struct gap {
+    int bank;       /* index in the bank array */
+    long start;
+    long size;
+};
+
+/**
+ * Empties a layout.
+ */
+void layout_init(layout_t *l)
+{
+    memset(l, 0, sizeof(*l));
+}
+
+/**
+ * Frees the memory of a layout.
+ */
+void layout_free(layout_t *l)
+{
+    int i;
+    for (i = 0; i < l->string_count; i++)
+        free(l->strings[i].key);
+    for (i = 0; i < l->bank_count; i++)
+        free(l->banks[i].bytes);
+    free(l->banks);
+    free(l->strings);
+    layout_init(l);
+}
+
+/**
+ * Records the code of a tree in a layout.
+ * @param l The layout
+ * @param node Root of Huffman tree
+ */
+void layout_set_code(layout_t *l, const huffman_node_t *node)
+{
+    if (node->symbol != -1) {
+        layout_leaf_t *leaf = &l->leaves[l->leaf_count++];
+        leaf->symbol = node->symbol;
+        leaf->code = node->code;
+        leaf->weight = node->weight;
+        return;
+    }
+    layout_set_code(l, node->left);
+    layout_set_code(l, node->right);
+}
+
+/**
+ * Checks whether the code of a layout has a leaf for every symbol.
+ * @param l The layout
+ * @param freq Symbol frequencies
+ * @return The first symbol without a leaf, or -1 if there is none
+ */
+int layout_missing_symbol(const layout_t *l, const int *freq)
+{
+    int i, j;
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        if (freq[i] <= 0)
+            continue;
+        for (j = 0; (j < l->leaf_count) && (l->leaves[j].symbol != i); j++)
+            ;
+        if (j == l->leaf_count)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Builds the tree of the code of a layout.
+ * @param l The layout
+ * @param leaves Where to store the leaf of every symbol
+ * @return Root of the tree
+ */
+huffman_node_t *layout_build_tree(const layout_t *l, huffman_node_t **leaves)
+{
+    huffman_node_t *root = 0;
+    int i;
+    for (i = 0; i < l->leaf_count; i++) {
+        const layout_leaf_t *leaf = &l->leaves[i];
+        huffman_node_t **p = &root;
+        int depth;
+        for (depth = 0; depth < leaf->code.length; depth++) {
+            if (!*p) {
+                *p = huffman_create_node(-1, 0, 0, 0);
+                (*p)->code.code = leaf->code.code >> (leaf->code.length - depth);
+                (*p)->code.length = depth;
+            }
+            (*p)->weight += leaf->weight;
+            if ((leaf->code.code >> (leaf->code.length - depth - 1)) & 1)
+                p = &(*p)->right;
+            else
+                p = &(*p)->left;
+        }
+        *p = huffman_create_node(leaf->symbol, leaf->weight, 0, 0);
+        (*p)->code = leaf->code;
+        leaves[leaf->symbol] = *p;
+    }
+    return root;
+}
+
+/**
+ * Finds the bank with a given number.
+ * @return Its index, or -1 if there is none
+ */
+static int find_bank(const layout_t *l, int number)
+{
+    int i;
+    for (i = 0; i < l->bank_count; i++) {
+        if (l->banks[i].number == number)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Adds an empty bank to a layout.
+ * @return Its index
+ */
+static int add_bank(layout_t *l, int number)
+{
+    layout_bank_t *bank;
+    l->banks = (layout_bank_t *)realloc(l->banks, (l->bank_count + 1) * sizeof(layout_bank_t));
+    bank = &l->banks[l->bank_count];
+    bank->number = number;
+    bank->size = 0;
+    bank->bytes = 0;
+    return l->bank_count++;
+}
+
+/**
+ * Puts a string at an offset in a bank, growing the bank if needed.
+ */
+static void put_string(layout_t *l, int index, int bank, long offset,
+                       const string_list_t *str)
+{
+    layout_bank_t *b = &l->banks[bank];
+    if (offset + str->huff_size > b->size) {
+        b->bytes = (unsigned char *)realloc(b->bytes, offset + str->huff_size);
+        b->size = offset + str->huff_size;
+    }
+    memcpy(&b->bytes[offset], str->huff_data, str->huff_size);
+    l->strings[index].bank = b->number;
+    l->strings[index].offset = offset;
+    l->strings[index].size = str->huff_size;
+}
+
+/**
+ * Stores the key of a string: its ID, or else its text.
+ */
+static void set_key(layout_string_t *s, const string_list_t *str)
+{
+    const unsigned char *key = str->id ? (const unsigned char *)str->id : str->text;
+    s->key_length = str->id ? (int)strlen(str->id) : str->text_length;
+    s->key = (unsigned char *)malloc(s->key_length + 1);
+    memcpy(s->key, key, s->key_length);
+}
+
+/* A string of a layout, to sort by key */
+struct keyed {
+    const layout_string_t *string;
+    int index;
+};
+
+/**
+ * Orders strings by key, then by number.
+ */
+static int compare_keyed(const void *a, const void *b)
+{
+    const struct keyed *p = (const struct keyed *)a;
+    const struct keyed *q = (const struct keyed *)b;
+    int length = p->string->key_length;
+    int c;
+    if (q->string->key_length < length)
+        length = q->string->key_length;
+    c = memcmp(p->string->key, q->string->key, length);
+    if (c == 0)
+        c = p->string->key_length - q->string->key_length;
+    if (c == 0)
+        c = p->index - q->index;
+    return c;
+}
+
+/**
+ * Sorts the strings of a layout by key.
+ * @return Array of the strings, to be freed by the caller
+ */
+static struct keyed *sort_keys(const layout_t *l)
+{
+    struct keyed *k = (struct keyed *)malloc((l->string_count + 1) * sizeof(struct keyed));
+    int i;
+    for (i = 0; i < l->string_count; i++) {
+        k[i].string = &l->strings[i];
+        k[i].index = i;
+    }
+    qsort(k, l->string_count, sizeof(struct keyed), compare_keyed);
+    return k;
+}
+
+/**
+ * Finds the string of a previous layout that every string of a new one
+ * comes from. Strings with the same key are matched, in order if a key
+ * occurs more than once. Then a string that is left over is matched with
+ * the old string that follows the old string of its predecessor, if that
+ * one is left over too.
+ * @param prev The previous layout
+ * @param next The new layout; only the keys are used
+ * @return For every new string, the number of its old string or -1; to be
+ *         freed by the caller
+ */
+static int *match_strings(const layout_t *prev, const layout_t *next)
+{
+    struct keyed *old_keys = sort_keys(prev);
+    struct keyed *new_keys = sort_keys(next);
+    int *match = (int *)malloc((next->string_count + 1) * sizeof(int));
+    char *taken = (char *)calloc(prev->string_count + 1, 1);
+    int following = 0;
+    int i, j;
+    for (i = 0; i < next->string_count; i++)
+        match[i] = -1;
+    for (i = j = 0; (i < prev->string_count) && (j < next->string_count); ) {
+        struct keyed p = old_keys[i];
+        struct keyed q = new_keys[j];
+        int c;
+        /* Compare the keys only */
+        p.index = q.index = 0;
+        c = compare_keyed(&p, &q);
+        if (c < 0) {
+            i++;
+        } else if (c > 0) {
+            j++;
+        } else {
+            match[new_keys[j].index] = old_keys[i].index;
+            taken[old_keys[i].index] = 1;
+            i++;
+            j++;
+        }
+    }
+    for (i = 0; i < next->string_count; i++) {
+        if (match[i] != -1) {
+            following = match[i] + 1;
+        } else if ((following < prev->string_count) && !taken[following]) {
+            match[i] = following;
+            taken[following++] = 1;
+        }
+    }
+    free(old_keys);
+    free(new_keys);
+    free(taken);
+    return match;
+}
+
+/* A string waiting to be placed */
+struct pending {
+    const string_list_t *string;
+    int index;
+};
+
+/**
+ * Orders pending strings by decreasing size, then by number.
+ */
+static int compare_pending(const void *a, const void *b)
+{
+    const struct pending *p = (const struct pending *)a;
+    const struct pending *q = (const struct pending *)b;
+    if (p->string->huff_size != q->string->huff_size)
+        return q->string->huff_size - p->string->huff_size;
+    return p->index - q->index;
+}
+
+/**
+ * Places the encoded strings, keeping the unchanged strings of a previous
+ * layout where they were.
+ * @param prev The previous layout, or NULL to place the strings in order
+ * @param head Encoded strings
+ * @param bank_size Size of a bank, or 0 for a single unbounded bank
+ * @param first_bank Number of the first bank
+ * @param next Where to store the layout
+ * @param kept Where to store the number of strings that kept their place
+ * @return 0 if a string does not fit a bank, 1 if OK
+ */
+int layout_place(const layout_t *prev, const string_list_t *head, long bank_size,
+                 int first_bank, layout_t *next, int *kept)
+{
+    const string_list_t *str;
+    unsigned char **used;
+    struct gap *gaps = 0;
+    int gap_count = 0;
+    struct pending *order;
+    int *match = 0;
+    int old_banks;
+    int count = 0;
+    int i, j, k;
+
+    for (str = head; str != NULL; str = str->next)
+        count++;
+    next->bank_size = bank_size;
+    next->string_count = count;
+    next->strings = (layout_string_t *)malloc((count + 1) * sizeof(layout_string_t));
+    for (i = 0, str = head; str != NULL; str = str->next, i++) {
+        next->strings[i].bank = -1;
+        set_key(&next->strings[i], str);
+    }
+    if (prev)
+        match = match_strings(prev, next);
+    *kept = 0;
+
+    /* Start from the banks of the previous layout */
+    for (i = 0; prev && (i < prev->bank_count); i++) {
+        layout_bank_t *b;
+        k = add_bank(next, prev->banks[i].number);
+        b = &next->banks[k];
+        b->size = prev->banks[i].size;
+        b->bytes = (unsigned char *)malloc(b->size + 1);
+        memcpy(b->bytes, prev->banks[i].bytes, b->size);
+    }
+    old_banks = next->bank_count;
+    used = (unsigned char **)malloc((old_banks + 1) * sizeof(unsigned char *));
+    for (i = 0; i < old_banks; i++)
+        used[i] = (unsigned char *)calloc(next->banks[i].size + 1, 1);
+
+    /* Unchanged strings stay where they were */
+    for (i = 0, str = head; str != NULL; str = str->next, i++) {
+        const layout_string_t *old;
+        int bank;
+        if (!prev || (match[i] == -1))
+            continue;
+        old = &prev->strings[match[i]];
+        bank = find_bank(next, old->bank);
+        if ((old->size == str->huff_size) && (bank != -1)
+            && !memcmp(&next->banks[bank].bytes[old->offset], str->huff_data, old->size)) {
+            next->strings[i].bank = old->bank;
+            next->strings[i].offset = old->offset;
+            next->strings[i].size = old->size;
+            memset(&used[bank][old->offset], 1, old->size);
+            (*kept)++;
+        }
+    }
+
+    /* The rest of the old banks is slack */
+    for (i = 0; i < old_banks; i++) {
+        long start = -1;
+        for (j = 0; j <= next->banks[i].size; j++) {
+            int is_free = (j < next->banks[i].size) && !used[i][j];
+            if (is_free && (start == -1))
+                start = j;
+            if (!is_free && (start != -1)) {
+                gaps = (struct gap *)realloc(gaps, (gap_count + 1) * sizeof(struct gap));
+                gaps[gap_count].bank = i;
+                gaps[gap_count].start = start;
+                gaps[gap_count].size = j - start;
+                gap_count++;
+                start = -1;
+            }
+        }
+    }
+
+    /* A changed string that still fits its old place stays there */
+    for (i = 0, str = head; prev && (str != NULL); str = str->next, i++) {
+        const layout_string_t *old;
+        int bank;
+        if ((next->strings[i].bank != -1) || (match[i] == -1))
+            continue;
+        old = &prev->strings[match[i]];
+        bank = find_bank(next, old->bank);
+        for (j = 0; j < gap_count; j++) {
+            struct gap *g = &gaps[j];
+            if ((g->bank == bank) && (g->start <= old->offset)
+                && (old->offset + str->huff_size <= g->start + g->size)) {
+                /* Split the slack around the string */
+                long end = g->start + g->size;
+                g->size = old->offset - g->start;
+                gaps = (struct gap *)realloc(gaps, (gap_count + 1) * sizeof(struct gap));
+                gaps[gap_count].bank = bank;
+                gaps[gap_count].start = old->offset + str->huff_size;
+                gaps[gap_count].size = end - gaps[gap_count].start;
+                gap_count++;
+                put_string(next, i, bank, old->offset, str);
+                (*kept)++;
+                break;
+            }
+        }
+    }
+
+    /* The others go to the slack that fits them best, or at the end; the
+       largest first, as they are the hardest to fit */
+    order = (struct pending *)malloc((count + 1) * sizeof(struct pending));
+    for (i = 0, str = head; str != NULL; str = str->next, i++) {
+        order[i].string = str;
+        order[i].index = i;
+    }
+    if (prev)
+        qsort(order, count, sizeof(struct pending), compare_pending);
+    for (k = 0; k < count; k++) {
+        int best = -1;
+        int bank = -1;
+        str = order[k].string;
+        i = order[k].index;
+        if (next->strings[i].bank != -1)
+            continue;
+        if (bank_size && (str->huff_size > bank_size)) {
+            free(match);
+            free(order);
+            free(gaps);
+            for (j = 0; j < old_banks; j++)
+                free(used[j]);
+            free(used);
+            return 0;
+        }
+        for (j = 0; j < gap_count; j++) {
+            if ((gaps[j].size >= str->huff_size)
+                && ((best == -1) || (gaps[j].size < gaps[best].size)))
+                best = j;
+        }
+        if (best != -1) {
+            put_string(next, i, gaps[best].bank, gaps[best].start, str);
+            gaps[best].start += str->huff_size;
+            gaps[best].size -= str->huff_size;
+            continue;
+        }
+        /* The end of its old bank, or of the last bank */
+        if (prev && (match[i] != -1))
+            bank = find_bank(next, prev->strings[match[i]].bank);
+        if ((bank != -1) && bank_size && (next->banks[bank].size + str->huff_size > bank_size))
+            bank = -1;
+        if (bank == -1)
+            bank = next->bank_count - 1;
+        if ((bank != -1) && bank_size && (next->banks[bank].size + str->huff_size > bank_size))
+            bank = -1;
+        if (bank == -1) {
+            int number = first_bank;
+            for (j = 0; j < next->bank_count; j++) {
+                if (next->banks[j].number >= number)
+                    number = next->banks[j].number + 1;
+            }
+            bank = add_bank(next, bank_size ? number : 0);
+        }
+        put_string(next, i, bank, next->banks[bank].size, str);
+    }
+
+    free(match);
+    free(order);
+    free(gaps);
+    for (i = 0; i < old_banks; i++)
+        free(used[i]);
+    free(used);
+    return 1;
+}
+
+/**
+ * Counts the bytes of the banks of a layout that differ from a previous
+ * layout; bytes that are new count as different.
+ */
+long layout_changed_bytes(const layout_t *prev, const layout_t *next)
+{
+    long changed = 0;
+    int i;
+    long j;
+    for (i = 0; i < next->bank_count; i++) {
+        const layout_bank_t *b = &next->banks[i];
+        int k = find_bank(prev, b->number);
+        for (j = 0; j < b->size; j++) {
+            if ((k == -1) || (j >= prev->banks[k].size) || (prev->banks[k].bytes[j] != b->bytes[j]))
+                changed++;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Writes a layout to a file.
+ * @param filename Name of the file
+ * @param l The layout
+ * @return 0 if the file cannot be written, 1 if OK
+ */
+int layout_write(const char *filename, const layout_t *l)
+{
+    FILE *out = fopen(filename, "wt");
+    int i;
+    long j;
+    if (!out) {
+        fprintf(stderr, "error: failed to open `%s' for writing\n", filename);
+        return 0;
+    }
+    fprintf(out, "# huffpuff string layout\n");
+    fprintf(out, "bank-size %ld\n", l->bank_size);
+    for (i = 0; i < l->leaf_count; i++) {
+        fprintf(out, "leaf %d %d %d %d\n", l->leaves[i].symbol, l->leaves[i].code.length,
+                l->leaves[i].code.code, l->leaves[i].weight);
+    }
+    for (i = 0; i < l->string_count; i++) {
+        const layout_string_t *s = &l->strings[i];
+        fprintf(out, "string %d %d %ld %d ", i, s->bank, s->offset, s->size);
+        for (j = 0; j < s->key_length; j++)
+            fprintf(out, "%.2X", s->key[j]);
+        fprintf(out, "%s\n", s->key_length ? "" : "-");
+    }
+    for (i = 0; i < l->bank_count; i++) {
+        fprintf(out, "bank %d %ld\n", l->banks[i].number, l->banks[i].size);
+        for (j = 0; j < l->banks[i].size; j++) {
+            fprintf(out, "%.2X", l->banks[i].bytes[j]);
+            if (((j % BYTES_PER_LINE) == BYTES_PER_LINE - 1) || (j == l->banks[i].size - 1))
+                fprintf(out, "\n");
+        }
+    }
+    fclose(out);
+    return 1;
+}
+
+/**
+ * Reads a line of any length from a file.
+ * @param in File to read from
+ * @param line The line buffer, grown as needed
+ * @param size Size of the line buffer
+ * @return 0 at the end of the file, 1 if OK
+ */
+static int read_line(FILE *in, char **line, int *size)
+{
+    int length = 0;
+    for (;;) {
+        if (length + 2 > *size) {
+            *size = *size * 2 + 256;
+            *line = (char *)realloc(*line, *size);
+        }
+        if (!fgets(*line + length, *size - length, in))
+            return length > 0;
+        length += strlen(*line + length);
+        if ((*line)[length - 1] == '\n')
+            return 1;
+    }
+}
+
+/**
+ * Reads the key of a string, in hex or - if it is empty.
+ * @return 0 if it is bad, 1 if OK
+ */
+static int read_key(const char *p, layout_string_t *s)
+{
+    int length = 0;
+    s->key = (unsigned char *)malloc(strlen(p) / 2 + 1);
+    s->key_length = 0;
+    if (p[0] == '-')
+        return (p[1] == '\n') || !p[1];
+    while ((p[length] != '\n') && p[length])
+        length++;
+    if ((length == 0) || (length % 2))
+        return 0;
+    for ( ; s->key_length < length / 2; p += 2) {
+        unsigned int byte;
+        if (sscanf(p, "%2X", &byte) != 1)
+            return 0;
+        s->key[s->key_length++] = (unsigned char)byte;
+    }
+    return 1;
+}
+
+/**
+ * Reads a layout from a file.
+ * @param filename Name of the file
+ * @param l Where to store the layout
+ * @return 0 if the file is bad, 1 if OK
+ */
+int layout_read(const char *filename, layout_t *l)
+{
+    FILE *in = fopen(filename, "rt");
+    char *line = 0;
+    int line_size = 0;
+    int lineno = 0;
+    layout_bank_t *bank = 0;
+    long filled = 0;
+    int i;
+    layout_init(l);
+    if (!in) {
+        fprintf(stderr, "error: failed to open `%s' for reading\n", filename);
+        return 0;
+    }
+    while (read_line(in, &line, &line_size)) {
+        layout_leaf_t leaf;
+        layout_string_t s;
+        int index;
+        long size;
+        int used;
+        int ok = 1;
+        lineno++;
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+        if (!strncmp(line, "bank-size ", 10)) {
+            ok = (sscanf(line + 10, "%ld", &l->bank_size) == 1);
+        } else if (!strncmp(line, "leaf ", 5)) {
+            ok = (sscanf(line + 5, "%d %d %d %d", &leaf.symbol, &leaf.code.length,
+                         &leaf.code.code, &leaf.weight) == 4)
+                && (leaf.symbol >= 0) && (leaf.symbol < HUFFMAN_MAX_SYMBOLS)
+                && (l->leaf_count < HUFFMAN_MAX_SYMBOLS);
+            if (ok)
+                l->leaves[l->leaf_count++] = leaf;
+        } else if (!strncmp(line, "string ", 7)) {
+            ok = (sscanf(line + 7, "%d %d %ld %d %n", &index, &s.bank, &s.offset, &s.size,
+                         &used) == 4)
+                && (index == l->string_count) && (s.offset >= 0) && (s.size >= 0);
+            if (ok) {
+                ok = read_key(line + 7 + used, &s);
+                l->strings = (layout_string_t *)realloc(l->strings,
+                                                        (index + 1) * sizeof(layout_string_t));
+                l->strings[l->string_count++] = s;
+            }
+        } else if (!strncmp(line, "bank ", 5)) {
+            ok = (sscanf(line + 5, "%d %ld", &index, &size) == 2) && (size >= 0)
+                && (!bank || (filled == bank->size));
+            if (ok) {
+                int k = add_bank(l, index);
+                bank = &l->banks[k];
+                bank->size = size;
+                bank->bytes = (unsigned char *)malloc(size + 1);
+                filled = 0;
+            }
+        } else {
+            /* Bytes of the last bank */
+            char *p;
+            for (p = line; ok && (p[0] != '\n') && p[0]; p += 2) {
+                unsigned int byte;
+                ok = bank && (filled < bank->size) && (sscanf(p, "%2X", &byte) == 1);
+                if (ok)
+                    bank->bytes[filled++] = (unsigned char)byte;
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "error: %s:%d: bad layout line\n", filename, lineno);
+            fclose(in);
+            free(line);
+            layout_free(l);
+            return 0;
+        }
+    }
+    fclose(in);
+    free(line);
+    if (bank && (filled != bank->size)) {
+        fprintf(stderr, "error: %s: bank %d is cut short\n", filename, bank->number);
+        layout_free(l);
+        return 0;
+    }
+    for (i = 0; i < l->string_count; i++) {
+        const layout_string_t *s = &l->strings[i];
+        int k = find_bank(l, s->bank);
+        if ((k == -1) || (s->offset + s->size > l->banks[k].size)) {
+            fprintf(stderr, "error: %s: string %d is outside its bank\n", filename, i);
+            layout_free(l);
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,74 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "huffpuff.h"
+
+/* A leaf of the recorded code */
+struct layout_leaf {
+    int symbol;
+    struct huffman_code code;
+    int weight;
+};
+
+typedef struct layout_leaf layout_leaf_t;
+
+/* Where a string lives */
+struct layout_string {
+    int bank;       /* number of the bank */
+    long offset;    /* in the bank */
+    int size;
+    unsigned char *key;     /* ID of the string, or else its text */
+    int key_length;
+};
+
+typedef struct layout_string layout_string_t;
+
+/* The bytes of a bank, strings and slack */
+struct layout_bank {
+    int number;
+    long size;
+    unsigned char *bytes;
+};
+
+typedef struct layout_bank layout_bank_t;
+
+struct layout {
+    long bank_size;     /* 0 for a single unbounded bank */
+    int leaf_count;
+    layout_leaf_t leaves[HUFFMAN_MAX_SYMBOLS];
+    int string_count;
+    layout_string_t *strings;
+    int bank_count;
+    layout_bank_t *banks;
+};
+
+typedef struct layout layout_t;
+
+void layout_init(layout_t *);
+void layout_free(layout_t *);
+void layout_set_code(layout_t *, const huffman_node_t *);
+int layout_missing_symbol(const layout_t *, const int *);
+huffman_node_t *layout_build_tree(const layout_t *, huffman_node_t **);
+int layout_place(const layout_t *, const string_list_t *, long, int, layout_t *, int *);
+long layout_changed_bytes(const layout_t *, const layout_t *);
+int layout_write(const char *, const layout_t *);
+int layout_read(const char *, layout_t *);
+
+#endif  /* !LAYOUT_H */
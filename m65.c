@@ -0,0 +1,960 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains an instruction-level 6502/65816 core that is used to
+ * run and time the generated 6502 and 65816 code.
+ *
+ * In 65816 mode the core implements the native and emulation modes with
+ * 8- and 16-bit registers, and counts cycles the way the WDC datasheet
+ * does (extra cycles for 16-bit memory accesses, a nonzero low byte of D,
+ * indexing across pages and taken branches). In 6502 mode only the NMOS
+ * instruction set is accepted. Decimal mode, interrupts and the block move
+ * instructions are not implemented, and every memory access takes one
+ * cycle (no wait states).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "m65.h"
+
+enum {
+    OP_ADC, OP_AND, OP_ASL, OP_BCC, OP_BCS, OP_BEQ, OP_BIT, OP_BMI, OP_BNE,
+    OP_BPL, OP_BRA, OP_BRK, OP_BRL, OP_BVC, OP_BVS, OP_CLC, OP_CLD, OP_CLI,
+    OP_CLV, OP_CMP, OP_COP, OP_CPX, OP_CPY, OP_DEA, OP_DEC, OP_DEX, OP_DEY,
+    OP_EOR, OP_INA, OP_INC, OP_INX, OP_INY, OP_JML, OP_JMP, OP_JSL, OP_JSR,
+    OP_LDA, OP_LDX, OP_LDY, OP_LSR, OP_MVN, OP_MVP, OP_NOP, OP_ORA, OP_PEA,
+    OP_PEI, OP_PER, OP_PHA, OP_PHB, OP_PHD, OP_PHK, OP_PHP, OP_PHX, OP_PHY,
+    OP_PLA, OP_PLB, OP_PLD, OP_PLP, OP_PLX, OP_PLY, OP_REP, OP_ROL, OP_ROR,
+    OP_RTI, OP_RTL, OP_RTS, OP_SBC, OP_SEC, OP_SED, OP_SEI, OP_SEP, OP_STA,
+    OP_STP, OP_STX, OP_STY, OP_STZ, OP_TAX, OP_TAY, OP_TCD, OP_TCS, OP_TDC,
+    OP_TRB, OP_TSB, OP_TSC, OP_TSX, OP_TXA, OP_TXS, OP_TXY, OP_TYA, OP_TYX,
+    OP_WAI, OP_WDM, OP_XBA, OP_XCE
+};
+
+enum {
+    AM_IMP, AM_ACC, AM_IMM, AM_IMMX, AM_IMM8, AM_DP, AM_DPX, AM_DPY,
+    AM_DPI, AM_DPXI, AM_DPIY, AM_DPIL, AM_DPILY, AM_ABS, AM_ABSX, AM_ABSY,
+    AM_IND, AM_ABSXI, AM_ABSIL, AM_LONG, AM_LONGX, AM_SR, AM_SRIY,
+    AM_REL, AM_RELL, AM_BLK
+};
+
+/* An entry of the opcode table */
+struct opcode {
+    unsigned char op;
+    unsigned char mode;
+    unsigned char cycles;   /* with 8-bit registers */
+    unsigned char nmos;     /* part of the NMOS 6502 instruction set? */
+};
+
+static const struct opcode opcodes[256] = {
+    { OP_BRK, AM_IMP, 7, 1 },
+    { OP_ORA, AM_DPXI, 6, 1 },
+    { OP_COP, AM_IMM8, 7, 0 },
+    { OP_ORA, AM_SR, 4, 0 },
+    { OP_TSB, AM_DP, 5, 0 },
+    { OP_ORA, AM_DP, 3, 1 },
+    { OP_ASL, AM_DP, 5, 1 },
+    { OP_ORA, AM_DPIL, 6, 0 },
+    { OP_PHP, AM_IMP, 3, 1 },
+    { OP_ORA, AM_IMM, 2, 1 },
+    { OP_ASL, AM_ACC, 2, 1 },
+    { OP_PHD, AM_IMP, 4, 0 },
+    { OP_TSB, AM_ABS, 6, 0 },
+    { OP_ORA, AM_ABS, 4, 1 },
+    { OP_ASL, AM_ABS, 6, 1 },
+    { OP_ORA, AM_LONG, 5, 0 },
+    { OP_BPL, AM_REL, 2, 1 },
+    { OP_ORA, AM_DPIY, 5, 1 },
+    { OP_ORA, AM_DPI, 5, 0 },
+    { OP_ORA, AM_SRIY, 7, 0 },
+    { OP_TRB, AM_DP, 5, 0 },
+    { OP_ORA, AM_DPX, 4, 1 },
+    { OP_ASL, AM_DPX, 6, 1 },
+    { OP_ORA, AM_DPILY, 6, 0 },
+    { OP_CLC, AM_IMP, 2, 1 },
+    { OP_ORA, AM_ABSY, 4, 1 },
+    { OP_INA, AM_ACC, 2, 0 },
+    { OP_TCS, AM_IMP, 2, 0 },
+    { OP_TRB, AM_ABS, 6, 0 },
+    { OP_ORA, AM_ABSX, 4, 1 },
+    { OP_ASL, AM_ABSX, 7, 1 },
+    { OP_ORA, AM_LONGX, 5, 0 },
+    { OP_JSR, AM_ABS, 6, 1 },
+    { OP_AND, AM_DPXI, 6, 1 },
+    { OP_JSL, AM_LONG, 8, 0 },
+    { OP_AND, AM_SR, 4, 0 },
+    { OP_BIT, AM_DP, 3, 1 },
+    { OP_AND, AM_DP, 3, 1 },
+    { OP_ROL, AM_DP, 5, 1 },
+    { OP_AND, AM_DPIL, 6, 0 },
+    { OP_PLP, AM_IMP, 4, 1 },
+    { OP_AND, AM_IMM, 2, 1 },
+    { OP_ROL, AM_ACC, 2, 1 },
+    { OP_PLD, AM_IMP, 5, 0 },
+    { OP_BIT, AM_ABS, 4, 1 },
+    { OP_AND, AM_ABS, 4, 1 },
+    { OP_ROL, AM_ABS, 6, 1 },
+    { OP_AND, AM_LONG, 5, 0 },
+    { OP_BMI, AM_REL, 2, 1 },
+    { OP_AND, AM_DPIY, 5, 1 },
+    { OP_AND, AM_DPI, 5, 0 },
+    { OP_AND, AM_SRIY, 7, 0 },
+    { OP_BIT, AM_DPX, 4, 0 },
+    { OP_AND, AM_DPX, 4, 1 },
+    { OP_ROL, AM_DPX, 6, 1 },
+    { OP_AND, AM_DPILY, 6, 0 },
+    { OP_SEC, AM_IMP, 2, 1 },
+    { OP_AND, AM_ABSY, 4, 1 },
+    { OP_DEA, AM_ACC, 2, 0 },
+    { OP_TSC, AM_IMP, 2, 0 },
+    { OP_BIT, AM_ABSX, 4, 0 },
+    { OP_AND, AM_ABSX, 4, 1 },
+    { OP_ROL, AM_ABSX, 7, 1 },
+    { OP_AND, AM_LONGX, 5, 0 },
+    { OP_RTI, AM_IMP, 6, 1 },
+    { OP_EOR, AM_DPXI, 6, 1 },
+    { OP_WDM, AM_IMM8, 2, 0 },
+    { OP_EOR, AM_SR, 4, 0 },
+    { OP_MVP, AM_BLK, 7, 0 },
+    { OP_EOR, AM_DP, 3, 1 },
+    { OP_LSR, AM_DP, 5, 1 },
+    { OP_EOR, AM_DPIL, 6, 0 },
+    { OP_PHA, AM_IMP, 3, 1 },
+    { OP_EOR, AM_IMM, 2, 1 },
+    { OP_LSR, AM_ACC, 2, 1 },
+    { OP_PHK, AM_IMP, 3, 0 },
+    { OP_JMP, AM_ABS, 3, 1 },
+    { OP_EOR, AM_ABS, 4, 1 },
+    { OP_LSR, AM_ABS, 6, 1 },
+    { OP_EOR, AM_LONG, 5, 0 },
+    { OP_BVC, AM_REL, 2, 1 },
+    { OP_EOR, AM_DPIY, 5, 1 },
+    { OP_EOR, AM_DPI, 5, 0 },
+    { OP_EOR, AM_SRIY, 7, 0 },
+    { OP_MVN, AM_BLK, 7, 0 },
+    { OP_EOR, AM_DPX, 4, 1 },
+    { OP_LSR, AM_DPX, 6, 1 },
+    { OP_EOR, AM_DPILY, 6, 0 },
+    { OP_CLI, AM_IMP, 2, 1 },
+    { OP_EOR, AM_ABSY, 4, 1 },
+    { OP_PHY, AM_IMP, 3, 0 },
+    { OP_TCD, AM_IMP, 2, 0 },
+    { OP_JML, AM_LONG, 4, 0 },
+    { OP_EOR, AM_ABSX, 4, 1 },
+    { OP_LSR, AM_ABSX, 7, 1 },
+    { OP_EOR, AM_LONGX, 5, 0 },
+    { OP_RTS, AM_IMP, 6, 1 },
+    { OP_ADC, AM_DPXI, 6, 1 },
+    { OP_PER, AM_RELL, 6, 0 },
+    { OP_ADC, AM_SR, 4, 0 },
+    { OP_STZ, AM_DP, 3, 0 },
+    { OP_ADC, AM_DP, 3, 1 },
+    { OP_ROR, AM_DP, 5, 1 },
+    { OP_ADC, AM_DPIL, 6, 0 },
+    { OP_PLA, AM_IMP, 4, 1 },
+    { OP_ADC, AM_IMM, 2, 1 },
+    { OP_ROR, AM_ACC, 2, 1 },
+    { OP_RTL, AM_IMP, 6, 0 },
+    { OP_JMP, AM_IND, 5, 1 },
+    { OP_ADC, AM_ABS, 4, 1 },
+    { OP_ROR, AM_ABS, 6, 1 },
+    { OP_ADC, AM_LONG, 5, 0 },
+    { OP_BVS, AM_REL, 2, 1 },
+    { OP_ADC, AM_DPIY, 5, 1 },
+    { OP_ADC, AM_DPI, 5, 0 },
+    { OP_ADC, AM_SRIY, 7, 0 },
+    { OP_STZ, AM_DPX, 4, 0 },
+    { OP_ADC, AM_DPX, 4, 1 },
+    { OP_ROR, AM_DPX, 6, 1 },
+    { OP_ADC, AM_DPILY, 6, 0 },
+    { OP_SEI, AM_IMP, 2, 1 },
+    { OP_ADC, AM_ABSY, 4, 1 },
+    { OP_PLY, AM_IMP, 4, 0 },
+    { OP_TDC, AM_IMP, 2, 0 },
+    { OP_JMP, AM_ABSXI, 6, 0 },
+    { OP_ADC, AM_ABSX, 4, 1 },
+    { OP_ROR, AM_ABSX, 7, 1 },
+    { OP_ADC, AM_LONGX, 5, 0 },
+    { OP_BRA, AM_REL, 2, 0 },
+    { OP_STA, AM_DPXI, 6, 1 },
+    { OP_BRL, AM_RELL, 4, 0 },
+    { OP_STA, AM_SR, 4, 0 },
+    { OP_STY, AM_DP, 3, 1 },
+    { OP_STA, AM_DP, 3, 1 },
+    { OP_STX, AM_DP, 3, 1 },
+    { OP_STA, AM_DPIL, 6, 0 },
+    { OP_DEY, AM_IMP, 2, 1 },
+    { OP_BIT, AM_IMM, 2, 0 },
+    { OP_TXA, AM_IMP, 2, 1 },
+    { OP_PHB, AM_IMP, 3, 0 },
+    { OP_STY, AM_ABS, 4, 1 },
+    { OP_STA, AM_ABS, 4, 1 },
+    { OP_STX, AM_ABS, 4, 1 },
+    { OP_STA, AM_LONG, 5, 0 },
+    { OP_BCC, AM_REL, 2, 1 },
+    { OP_STA, AM_DPIY, 6, 1 },
+    { OP_STA, AM_DPI, 5, 0 },
+    { OP_STA, AM_SRIY, 7, 0 },
+    { OP_STY, AM_DPX, 4, 1 },
+    { OP_STA, AM_DPX, 4, 1 },
+    { OP_STX, AM_DPY, 4, 1 },
+    { OP_STA, AM_DPILY, 6, 0 },
+    { OP_TYA, AM_IMP, 2, 1 },
+    { OP_STA, AM_ABSY, 5, 1 },
+    { OP_TXS, AM_IMP, 2, 1 },
+    { OP_TXY, AM_IMP, 2, 0 },
+    { OP_STZ, AM_ABS, 4, 0 },
+    { OP_STA, AM_ABSX, 5, 1 },
+    { OP_STZ, AM_ABSX, 5, 0 },
+    { OP_STA, AM_LONGX, 5, 0 },
+    { OP_LDY, AM_IMMX, 2, 1 },
+    { OP_LDA, AM_DPXI, 6, 1 },
+    { OP_LDX, AM_IMMX, 2, 1 },
+    { OP_LDA, AM_SR, 4, 0 },
+    { OP_LDY, AM_DP, 3, 1 },
+    { OP_LDA, AM_DP, 3, 1 },
+    { OP_LDX, AM_DP, 3, 1 },
+    { OP_LDA, AM_DPIL, 6, 0 },
+    { OP_TAY, AM_IMP, 2, 1 },
+    { OP_LDA, AM_IMM, 2, 1 },
+    { OP_TAX, AM_IMP, 2, 1 },
+    { OP_PLB, AM_IMP, 4, 0 },
+    { OP_LDY, AM_ABS, 4, 1 },
+    { OP_LDA, AM_ABS, 4, 1 },
+    { OP_LDX, AM_ABS, 4, 1 },
+    { OP_LDA, AM_LONG, 5, 0 },
+    { OP_BCS, AM_REL, 2, 1 },
+    { OP_LDA, AM_DPIY, 5, 1 },
+    { OP_LDA, AM_DPI, 5, 0 },
+    { OP_LDA, AM_SRIY, 7, 0 },
+    { OP_LDY, AM_DPX, 4, 1 },
+    { OP_LDA, AM_DPX, 4, 1 },
+    { OP_LDX, AM_DPY, 4, 1 },
+    { OP_LDA, AM_DPILY, 6, 0 },
+    { OP_CLV, AM_IMP, 2, 1 },
+    { OP_LDA, AM_ABSY, 4, 1 },
+    { OP_TSX, AM_IMP, 2, 1 },
+    { OP_TYX, AM_IMP, 2, 0 },
+    { OP_LDY, AM_ABSX, 4, 1 },
+    { OP_LDA, AM_ABSX, 4, 1 },
+    { OP_LDX, AM_ABSY, 4, 1 },
+    { OP_LDA, AM_LONGX, 5, 0 },
+    { OP_CPY, AM_IMMX, 2, 1 },
+    { OP_CMP, AM_DPXI, 6, 1 },
+    { OP_REP, AM_IMM8, 3, 0 },
+    { OP_CMP, AM_SR, 4, 0 },
+    { OP_CPY, AM_DP, 3, 1 },
+    { OP_CMP, AM_DP, 3, 1 },
+    { OP_DEC, AM_DP, 5, 1 },
+    { OP_CMP, AM_DPIL, 6, 0 },
+    { OP_INY, AM_IMP, 2, 1 },
+    { OP_CMP, AM_IMM, 2, 1 },
+    { OP_DEX, AM_IMP, 2, 1 },
+    { OP_WAI, AM_IMP, 3, 0 },
+    { OP_CPY, AM_ABS, 4, 1 },
+    { OP_CMP, AM_ABS, 4, 1 },
+    { OP_DEC, AM_ABS, 6, 1 },
+    { OP_CMP, AM_LONG, 5, 0 },
+    { OP_BNE, AM_REL, 2, 1 },
+    { OP_CMP, AM_DPIY, 5, 1 },
+    { OP_CMP, AM_DPI, 5, 0 },
+    { OP_CMP, AM_SRIY, 7, 0 },
+    { OP_PEI, AM_DP, 6, 0 },
+    { OP_CMP, AM_DPX, 4, 1 },
+    { OP_DEC, AM_DPX, 6, 1 },
+    { OP_CMP, AM_DPILY, 6, 0 },
+    { OP_CLD, AM_IMP, 2, 1 },
+    { OP_CMP, AM_ABSY, 4, 1 },
+    { OP_PHX, AM_IMP, 3, 0 },
+    { OP_STP, AM_IMP, 3, 0 },
+    { OP_JML, AM_ABSIL, 6, 0 },
+    { OP_CMP, AM_ABSX, 4, 1 },
+    { OP_DEC, AM_ABSX, 7, 1 },
+    { OP_CMP, AM_LONGX, 5, 0 },
+    { OP_CPX, AM_IMMX, 2, 1 },
+    { OP_SBC, AM_DPXI, 6, 1 },
+    { OP_SEP, AM_IMM8, 3, 0 },
+    { OP_SBC, AM_SR, 4, 0 },
+    { OP_CPX, AM_DP, 3, 1 },
+    { OP_SBC, AM_DP, 3, 1 },
+    { OP_INC, AM_DP, 5, 1 },
+    { OP_SBC, AM_DPIL, 6, 0 },
+    { OP_INX, AM_IMP, 2, 1 },
+    { OP_SBC, AM_IMM, 2, 1 },
+    { OP_NOP, AM_IMP, 2, 1 },
+    { OP_XBA, AM_IMP, 3, 0 },
+    { OP_CPX, AM_ABS, 4, 1 },
+    { OP_SBC, AM_ABS, 4, 1 },
+    { OP_INC, AM_ABS, 6, 1 },
+    { OP_SBC, AM_LONG, 5, 0 },
+    { OP_BEQ, AM_REL, 2, 1 },
+    { OP_SBC, AM_DPIY, 5, 1 },
+    { OP_SBC, AM_DPI, 5, 0 },
+    { OP_SBC, AM_SRIY, 7, 0 },
+    { OP_PEA, AM_ABS, 5, 0 },
+    { OP_SBC, AM_DPX, 4, 1 },
+    { OP_INC, AM_DPX, 6, 1 },
+    { OP_SBC, AM_DPILY, 6, 0 },
+    { OP_SED, AM_IMP, 2, 1 },
+    { OP_SBC, AM_ABSY, 4, 1 },
+    { OP_PLX, AM_IMP, 4, 0 },
+    { OP_XCE, AM_IMP, 2, 0 },
+    { OP_JSR, AM_ABSXI, 8, 0 },
+    { OP_SBC, AM_ABSX, 4, 1 },
+    { OP_INC, AM_ABSX, 7, 1 },
+    { OP_SBC, AM_LONGX, 5, 0 },
+};
+
+/**
+ * Initializes a CPU. The CPU starts out in emulation mode.
+ * @param cpu The CPU
+ * @param nmos Nonzero for a 6502 with 64K of memory, zero for a 65816
+ * with 16M of memory
+ */
+void m65_init(m65_t *cpu, int nmos)
+{
+    unsigned long size = nmos ? 0x10000 : 0x1000000;
+    memset(cpu, 0, sizeof(m65_t));
+    cpu->nmos = nmos;
+    cpu->e = 1;
+    cpu->s = 0x01FF;
+    cpu->p = M65_M | M65_X | M65_I;
+    cpu->mem = (unsigned char *)calloc(size, 1);
+    cpu->mem_mask = size - 1;
+}
+
+/**
+ * Frees the memory of a CPU.
+ * @param cpu The CPU
+ */
+void m65_free(m65_t *cpu)
+{
+    free(cpu->mem);
+    cpu->mem = 0;
+}
+
+/**
+ * Switches a 65816 to native mode.
+ * @param cpu The CPU
+ * @param m16 Nonzero for a 16-bit accumulator
+ * @param x16 Nonzero for 16-bit index registers
+ */
+void m65_native(m65_t *cpu, int m16, int x16)
+{
+    cpu->e = 0;
+    cpu->p &= ~(M65_M | M65_X);
+    if (!m16)
+        cpu->p |= M65_M;
+    if (!x16) {
+        cpu->p |= M65_X;
+        cpu->x &= 0xFF;
+        cpu->y &= 0xFF;
+    }
+}
+
+#define M8(cpu) ((cpu)->e || ((cpu)->p & M65_M))
+#define X8(cpu) ((cpu)->e || ((cpu)->p & M65_X))
+
+static unsigned char rd(m65_t *cpu, unsigned long addr)
+{
+    return cpu->mem[addr & cpu->mem_mask];
+}
+
+static void wr(m65_t *cpu, unsigned long addr, unsigned char value)
+{
+    cpu->mem[addr & cpu->mem_mask] = value;
+}
+
+static unsigned rd16(m65_t *cpu, unsigned long addr)
+{
+    return rd(cpu, addr) | (rd(cpu, addr + 1) << 8);
+}
+
+/* Reads a 16-bit pointer from bank 0, wrapping within the page in emulation mode */
+static unsigned rd_dp16(m65_t *cpu, unsigned addr)
+{
+    unsigned hi = addr + 1;
+    if (cpu->e && !(cpu->d & 0xFF))
+        hi = (addr & 0xFF00) | ((addr + 1) & 0xFF);
+    return rd(cpu, addr & 0xFFFF) | (rd(cpu, hi & 0xFFFF) << 8);
+}
+
+static unsigned char fetch(m65_t *cpu)
+{
+    unsigned char b = rd(cpu, ((unsigned long)cpu->pbr << 16) | cpu->pc);
+    cpu->pc++;
+    return b;
+}
+
+static unsigned fetch16(m65_t *cpu)
+{
+    unsigned lo = fetch(cpu);
+    return lo | (fetch(cpu) << 8);
+}
+
+static void push8(m65_t *cpu, unsigned char value)
+{
+    wr(cpu, cpu->s, value);
+    if (cpu->e)
+        cpu->s = 0x0100 | ((cpu->s - 1) & 0xFF);
+    else
+        cpu->s--;
+}
+
+static unsigned char pull8(m65_t *cpu)
+{
+    if (cpu->e)
+        cpu->s = 0x0100 | ((cpu->s + 1) & 0xFF);
+    else
+        cpu->s++;
+    return rd(cpu, cpu->s);
+}
+
+static void push16(m65_t *cpu, unsigned value)
+{
+    push8(cpu, value >> 8);
+    push8(cpu, value & 0xFF);
+}
+
+static unsigned pull16(m65_t *cpu)
+{
+    unsigned lo = pull8(cpu);
+    return lo | (pull8(cpu) << 8);
+}
+
+static void set_nz(m65_t *cpu, unsigned value, int wide)
+{
+    cpu->p &= ~(M65_N | M65_Z);
+    if (wide) {
+        value &= 0xFFFF;
+        if (value & 0x8000) cpu->p |= M65_N;
+    } else {
+        value &= 0xFF;
+        if (value & 0x80) cpu->p |= M65_N;
+    }
+    if (!value) cpu->p |= M65_Z;
+}
+
+static void set_p(m65_t *cpu, unsigned char p)
+{
+    if (cpu->e)
+        p |= M65_M | M65_X;
+    cpu->p = p;
+    if (p & M65_X) {
+        cpu->x &= 0xFF;
+        cpu->y &= 0xFF;
+    }
+}
+
+/* Returns the width-adjusted value of A, X or Y */
+#define REG_A(cpu)      (M8(cpu) ? ((cpu)->a & 0xFF) : (cpu)->a)
+#define SET_A(cpu, v)   ((cpu)->a = M8(cpu) ? (((cpu)->a & 0xFF00) | ((v) & 0xFF)) : ((v) & 0xFFFF))
+#define SET_XY(cpu, r, v) ((r) = X8(cpu) ? ((v) & 0xFF) : ((v) & 0xFFFF))
+
+/**
+ * Computes the effective address of an operand.
+ * @param cpu The CPU
+ * @param mode Addressing mode
+ * @param extra Incremented by the number of extra cycles
+ * @param is_store Whether the instruction writes (or modifies) memory
+ * @return The 24-bit effective address
+ */
+static unsigned long effective_address(m65_t *cpu, int mode, int *extra,
+                                       int is_store)
+{
+    unsigned long base;
+    unsigned long addr;
+    unsigned ptr;
+    unsigned char dp;
+    unsigned long dbr = (unsigned long)cpu->dbr << 16;
+    switch (mode) {
+        case AM_DP:
+        case AM_DPX:
+        case AM_DPY:
+        case AM_DPI:
+        case AM_DPXI:
+        case AM_DPIY:
+        case AM_DPIL:
+        case AM_DPILY:
+        dp = fetch(cpu);
+        if (cpu->d & 0xFF)
+            (*extra)++;
+        if ((mode == AM_DPX) || (mode == AM_DPY) || (mode == AM_DPXI)) {
+            unsigned idx = (mode == AM_DPY) ? cpu->y : cpu->x;
+            if (cpu->e && !(cpu->d & 0xFF))
+                ptr = cpu->d | ((dp + idx) & 0xFF);
+            else
+                ptr = (cpu->d + dp + idx) & 0xFFFF;
+        } else {
+            ptr = (cpu->d + dp) & 0xFFFF;
+        }
+        switch (mode) {
+            case AM_DP: case AM_DPX: case AM_DPY:
+            return ptr;
+            case AM_DPI: case AM_DPXI:
+            return dbr | rd_dp16(cpu, ptr);
+            case AM_DPIY:
+            base = dbr | rd_dp16(cpu, ptr);
+            addr = base + cpu->y;
+            if (!is_store && (!X8(cpu) || ((base ^ addr) & 0xFF00)))
+                (*extra)++;
+            return addr;
+            case AM_DPIL:
+            return rd16(cpu, ptr) | ((unsigned long)rd(cpu, (ptr + 2) & 0xFFFF) << 16);
+            default:
+            base = rd16(cpu, ptr) | ((unsigned long)rd(cpu, (ptr + 2) & 0xFFFF) << 16);
+            return base + cpu->y;
+        }
+
+        case AM_ABS:
+        return dbr | fetch16(cpu);
+
+        case AM_ABSX:
+        case AM_ABSY:
+        base = dbr | fetch16(cpu);
+        addr = base + ((mode == AM_ABSX) ? cpu->x : cpu->y);
+        if (!is_store && (!X8(cpu) || ((base ^ addr) & 0xFF00)))
+            (*extra)++;
+        return addr;
+
+        case AM_LONG:
+        addr = fetch16(cpu);
+        return addr | ((unsigned long)fetch(cpu) << 16);
+
+        case AM_LONGX:
+        addr = fetch16(cpu);
+        addr |= (unsigned long)fetch(cpu) << 16;
+        return addr + cpu->x;
+
+        case AM_SR:
+        return (cpu->s + fetch(cpu)) & 0xFFFF;
+
+        case AM_SRIY:
+        ptr = (cpu->s + fetch(cpu)) & 0xFFFF;
+        return (dbr | rd16(cpu, ptr)) + cpu->y;
+    }
+    return 0;
+}
+
+/* Reads an operand of the given width */
+static unsigned read_operand(m65_t *cpu, int mode, int wide, int *extra)
+{
+    unsigned long addr;
+    if ((mode == AM_IMM) || (mode == AM_IMMX))
+        return wide ? fetch16(cpu) : fetch(cpu);
+    addr = effective_address(cpu, mode, extra, 0);
+    return wide ? rd16(cpu, addr) : rd(cpu, addr);
+}
+
+static void compare(m65_t *cpu, unsigned reg, unsigned value, int wide)
+{
+    unsigned mask = wide ? 0xFFFF : 0xFF;
+    unsigned r = (reg & mask) - (value & mask);
+    if ((reg & mask) >= (value & mask))
+        cpu->p |= M65_C;
+    else
+        cpu->p &= ~M65_C;
+    set_nz(cpu, r, wide);
+}
+
+static unsigned shift(m65_t *cpu, int op, unsigned value, int wide)
+{
+    unsigned msb = wide ? 0x8000 : 0x80;
+    unsigned mask = wide ? 0xFFFF : 0xFF;
+    unsigned c = cpu->p & M65_C;
+    unsigned result;
+    switch (op) {
+        case OP_ASL:
+        c = (value & msb) ? 1 : 0;
+        result = value << 1;
+        break;
+        case OP_ROL:
+        result = (value << 1) | c;
+        c = (value & msb) ? 1 : 0;
+        break;
+        case OP_LSR:
+        c = value & 1;
+        result = value >> 1;
+        break;
+        default: /* ROR */
+        result = (value >> 1) | (c ? msb : 0);
+        c = value & 1;
+        break;
+    }
+    cpu->p = (cpu->p & ~M65_C) | (c ? M65_C : 0);
+    result &= mask;
+    set_nz(cpu, result, wide);
+    return result;
+}
+
+static void add(m65_t *cpu, unsigned value, int wide)
+{
+    unsigned mask = wide ? 0xFFFF : 0xFF;
+    unsigned msb = wide ? 0x8000 : 0x80;
+    unsigned a = REG_A(cpu);
+    unsigned long sum = a + (value & mask) + (cpu->p & M65_C);
+    cpu->p &= ~(M65_C | M65_V);
+    if (sum > mask)
+        cpu->p |= M65_C;
+    if (~(a ^ value) & (a ^ sum) & msb)
+        cpu->p |= M65_V;
+    SET_A(cpu, sum);
+    set_nz(cpu, sum, wide);
+}
+
+static void branch(m65_t *cpu, int taken, int *extra)
+{
+    signed char d = (signed char)fetch(cpu);
+    if (taken) {
+        unsigned target = (cpu->pc + d) & 0xFFFF;
+        (*extra)++;
+        if (cpu->e && ((target ^ cpu->pc) & 0xFF00))
+            (*extra)++;
+        cpu->pc = target;
+    }
+}
+
+/**
+ * Executes one instruction.
+ * @param cpu The CPU
+ * @return 0 if the instruction is not supported, 1 if OK
+ */
+int m65_step(m65_t *cpu)
+{
+    const struct opcode *o;
+    int extra = 0;
+    int m16, x16;
+    unsigned value;
+    unsigned long addr;
+    o = &opcodes[fetch(cpu)];
+    if (cpu->nmos && !o->nmos)
+        return 0;
+    m16 = !M8(cpu);
+    x16 = !X8(cpu);
+    switch (o->op) {
+        /* Loads, stores and arithmetic on the accumulator */
+        case OP_LDA:
+        value = read_operand(cpu, o->mode, m16, &extra);
+        SET_A(cpu, value);
+        set_nz(cpu, value, m16);
+        extra += m16;
+        break;
+        case OP_LDX:
+        value = read_operand(cpu, o->mode, x16, &extra);
+        SET_XY(cpu, cpu->x, value);
+        set_nz(cpu, value, x16);
+        extra += x16;
+        break;
+        case OP_LDY:
+        value = read_operand(cpu, o->mode, x16, &extra);
+        SET_XY(cpu, cpu->y, value);
+        set_nz(cpu, value, x16);
+        extra += x16;
+        break;
+        case OP_STA:
+        case OP_STZ:
+        addr = effective_address(cpu, o->mode, &extra, 1);
+        value = (o->op == OP_STA) ? cpu->a : 0;
+        wr(cpu, addr, value & 0xFF);
+        if (m16)
+            wr(cpu, addr + 1, value >> 8);
+        extra += m16;
+        break;
+        case OP_STX:
+        case OP_STY:
+        addr = effective_address(cpu, o->mode, &extra, 1);
+        value = (o->op == OP_STX) ? cpu->x : cpu->y;
+        wr(cpu, addr, value & 0xFF);
+        if (x16)
+            wr(cpu, addr + 1, value >> 8);
+        extra += x16;
+        break;
+        case OP_ADC:
+        add(cpu, read_operand(cpu, o->mode, m16, &extra), m16);
+        extra += m16;
+        break;
+        case OP_SBC:
+        add(cpu, ~read_operand(cpu, o->mode, m16, &extra), m16);
+        extra += m16;
+        break;
+        case OP_AND:
+        case OP_ORA:
+        case OP_EOR:
+        value = read_operand(cpu, o->mode, m16, &extra);
+        if (o->op == OP_AND)
+            value &= REG_A(cpu);
+        else if (o->op == OP_ORA)
+            value |= REG_A(cpu);
+        else
+            value ^= REG_A(cpu);
+        SET_A(cpu, value);
+        set_nz(cpu, value, m16);
+        extra += m16;
+        break;
+        case OP_CMP:
+        compare(cpu, REG_A(cpu), read_operand(cpu, o->mode, m16, &extra), m16);
+        extra += m16;
+        break;
+        case OP_CPX:
+        compare(cpu, cpu->x, read_operand(cpu, o->mode, x16, &extra), x16);
+        extra += x16;
+        break;
+        case OP_CPY:
+        compare(cpu, cpu->y, read_operand(cpu, o->mode, x16, &extra), x16);
+        extra += x16;
+        break;
+        case OP_BIT:
+        value = read_operand(cpu, o->mode, m16, &extra);
+        if (o->mode != AM_IMM) {
+            unsigned msb = m16 ? 0x8000 : 0x80;
+            cpu->p &= ~(M65_N | M65_V);
+            if (value & msb) cpu->p |= M65_N;
+            if (value & (msb >> 1)) cpu->p |= M65_V;
+        }
+        if (value & REG_A(cpu))
+            cpu->p &= ~M65_Z;
+        else
+            cpu->p |= M65_Z;
+        extra += m16;
+        break;
+
+        /* Read-modify-write */
+        case OP_ASL:
+        case OP_LSR:
+        case OP_ROL:
+        case OP_ROR:
+        case OP_INC:
+        case OP_DEC:
+        case OP_TSB:
+        case OP_TRB:
+        if (o->mode == AM_ACC) {
+            value = REG_A(cpu);
+        } else {
+            addr = effective_address(cpu, o->mode, &extra, 1);
+            value = m16 ? rd16(cpu, addr) : rd(cpu, addr);
+            extra += 2 * m16;
+        }
+        switch (o->op) {
+            case OP_INC: value++; set_nz(cpu, value, m16); break;
+            case OP_DEC: value--; set_nz(cpu, value, m16); break;
+            case OP_TSB:
+            case OP_TRB:
+            if (value & REG_A(cpu))
+                cpu->p &= ~M65_Z;
+            else
+                cpu->p |= M65_Z;
+            if (o->op == OP_TSB)
+                value |= REG_A(cpu);
+            else
+                value &= ~REG_A(cpu);
+            break;
+            default: value = shift(cpu, o->op, value, m16); break;
+        }
+        if (o->mode == AM_ACC) {
+            SET_A(cpu, value);
+        } else {
+            wr(cpu, addr, value & 0xFF);
+            if (m16)
+                wr(cpu, addr + 1, (value >> 8) & 0xFF);
+        }
+        break;
+        case OP_INA:
+        SET_A(cpu, REG_A(cpu) + 1);
+        set_nz(cpu, cpu->a, m16);
+        break;
+        case OP_DEA:
+        SET_A(cpu, REG_A(cpu) - 1);
+        set_nz(cpu, cpu->a, m16);
+        break;
+
+        /* Index registers and transfers */
+        case OP_INX: SET_XY(cpu, cpu->x, cpu->x + 1); set_nz(cpu, cpu->x, x16); break;
+        case OP_INY: SET_XY(cpu, cpu->y, cpu->y + 1); set_nz(cpu, cpu->y, x16); break;
+        case OP_DEX: SET_XY(cpu, cpu->x, cpu->x - 1); set_nz(cpu, cpu->x, x16); break;
+        case OP_DEY: SET_XY(cpu, cpu->y, cpu->y - 1); set_nz(cpu, cpu->y, x16); break;
+        case OP_TAX: SET_XY(cpu, cpu->x, cpu->a); set_nz(cpu, cpu->x, x16); break;
+        case OP_TAY: SET_XY(cpu, cpu->y, cpu->a); set_nz(cpu, cpu->y, x16); break;
+        case OP_TXY: SET_XY(cpu, cpu->y, cpu->x); set_nz(cpu, cpu->y, x16); break;
+        case OP_TYX: SET_XY(cpu, cpu->x, cpu->y); set_nz(cpu, cpu->x, x16); break;
+        case OP_TSX: SET_XY(cpu, cpu->x, cpu->s); set_nz(cpu, cpu->x, x16); break;
+        case OP_TXA: SET_A(cpu, cpu->x); set_nz(cpu, cpu->a, m16); break;
+        case OP_TYA: SET_A(cpu, cpu->y); set_nz(cpu, cpu->a, m16); break;
+        case OP_TXS:
+        cpu->s = cpu->e ? (0x0100 | (cpu->x & 0xFF)) : cpu->x;
+        break;
+        case OP_TCS:
+        cpu->s = cpu->e ? (0x0100 | (cpu->a & 0xFF)) : cpu->a;
+        break;
+        case OP_TSC: cpu->a = cpu->s; set_nz(cpu, cpu->a, 1); break;
+        case OP_TCD: cpu->d = cpu->a; set_nz(cpu, cpu->d, 1); break;
+        case OP_TDC: cpu->a = cpu->d; set_nz(cpu, cpu->a, 1); break;
+        case OP_XBA:
+        cpu->a = (cpu->a >> 8) | ((cpu->a & 0xFF) << 8);
+        set_nz(cpu, cpu->a, 0);
+        break;
+
+        /* Flags */
+        case OP_CLC: cpu->p &= ~M65_C; break;
+        case OP_SEC: cpu->p |= M65_C; break;
+        case OP_CLI: cpu->p &= ~M65_I; break;
+        case OP_SEI: cpu->p |= M65_I; break;
+        case OP_CLD: cpu->p &= ~M65_D; break;
+        case OP_SED: cpu->p |= M65_D; break;
+        case OP_CLV: cpu->p &= ~M65_V; break;
+        case OP_REP: set_p(cpu, cpu->p & ~fetch(cpu)); break;
+        case OP_SEP: set_p(cpu, cpu->p | fetch(cpu)); break;
+        case OP_XCE: {
+            int c = cpu->p & M65_C;
+            cpu->p = (cpu->p & ~M65_C) | (cpu->e ? M65_C : 0);
+            cpu->e = c ? 1 : 0;
+            if (cpu->e) {
+                set_p(cpu, cpu->p);
+                cpu->s = 0x0100 | (cpu->s & 0xFF);
+            }
+        }   break;
+
+        /* Stack */
+        case OP_PHA:
+        if (m16) push16(cpu, cpu->a); else push8(cpu, cpu->a & 0xFF);
+        extra += m16;
+        break;
+        case OP_PLA:
+        value = m16 ? pull16(cpu) : pull8(cpu);
+        SET_A(cpu, value);
+        set_nz(cpu, value, m16);
+        extra += m16;
+        break;
+        case OP_PHX:
+        case OP_PHY:
+        value = (o->op == OP_PHX) ? cpu->x : cpu->y;
+        if (x16) push16(cpu, value); else push8(cpu, value);
+        extra += x16;
+        break;
+        case OP_PLX:
+        case OP_PLY:
+        value = x16 ? pull16(cpu) : pull8(cpu);
+        if (o->op == OP_PLX)
+            SET_XY(cpu, cpu->x, value);
+        else
+            SET_XY(cpu, cpu->y, value);
+        set_nz(cpu, value, x16);
+        extra += x16;
+        break;
+        case OP_PHP: push8(cpu, cpu->p | (cpu->e ? 0x30 : 0)); break;
+        case OP_PLP: set_p(cpu, pull8(cpu)); break;
+        case OP_PHB: push8(cpu, cpu->dbr); break;
+        case OP_PLB: cpu->dbr = pull8(cpu); set_nz(cpu, cpu->dbr, 0); break;
+        case OP_PHK: push8(cpu, cpu->pbr); break;
+        case OP_PHD: push16(cpu, cpu->d); break;
+        case OP_PLD: cpu->d = pull16(cpu); set_nz(cpu, cpu->d, 1); break;
+        case OP_PEA: push16(cpu, fetch16(cpu)); break;
+        case OP_PEI:
+        addr = effective_address(cpu, AM_DP, &extra, 0);
+        push16(cpu, rd16(cpu, addr));
+        break;
+        case OP_PER:
+        value = fetch16(cpu);
+        push16(cpu, (cpu->pc + value) & 0xFFFF);
+        break;
+
+        /* Control flow */
+        case OP_BPL: branch(cpu, !(cpu->p & M65_N), &extra); break;
+        case OP_BMI: branch(cpu, (cpu->p & M65_N) != 0, &extra); break;
+        case OP_BVC: branch(cpu, !(cpu->p & M65_V), &extra); break;
+        case OP_BVS: branch(cpu, (cpu->p & M65_V) != 0, &extra); break;
+        case OP_BCC: branch(cpu, !(cpu->p & M65_C), &extra); break;
+        case OP_BCS: branch(cpu, (cpu->p & M65_C) != 0, &extra); break;
+        case OP_BNE: branch(cpu, !(cpu->p & M65_Z), &extra); break;
+        case OP_BEQ: branch(cpu, (cpu->p & M65_Z) != 0, &extra); break;
+        case OP_BRA: branch(cpu, 1, &extra); break;
+        case OP_BRL:
+        value = fetch16(cpu);
+        cpu->pc = (cpu->pc + value) & 0xFFFF;
+        break;
+        case OP_JMP:
+        value = fetch16(cpu);
+        if (o->mode == AM_IND)
+            value = rd16(cpu, value);
+        else if (o->mode == AM_ABSXI)
+            value = rd16(cpu, ((unsigned long)cpu->pbr << 16) | ((value + cpu->x) & 0xFFFF));
+        cpu->pc = value;
+        break;
+        case OP_JML:
+        if (o->mode == AM_LONG) {
+            value = fetch16(cpu);
+            cpu->pbr = fetch(cpu);
+            cpu->pc = value;
+        } else {
+            value = fetch16(cpu);
+            cpu->pc = rd16(cpu, value);
+            cpu->pbr = rd(cpu, (value + 2) & 0xFFFF);
+        }
+        break;
+        case OP_JSR:
+        value = fetch16(cpu);
+        push16(cpu, (cpu->pc - 1) & 0xFFFF);
+        if (o->mode == AM_ABSXI)
+            value = rd16(cpu, ((unsigned long)cpu->pbr << 16) | ((value + cpu->x) & 0xFFFF));
+        cpu->pc = value;
+        break;
+        case OP_JSL:
+        value = fetch16(cpu);
+        push8(cpu, cpu->pbr);
+        cpu->pbr = fetch(cpu);
+        push16(cpu, (cpu->pc - 1) & 0xFFFF);
+        cpu->pc = value;
+        break;
+        case OP_RTS:
+        cpu->pc = (pull16(cpu) + 1) & 0xFFFF;
+        break;
+        case OP_RTL:
+        cpu->pc = (pull16(cpu) + 1) & 0xFFFF;
+        cpu->pbr = pull8(cpu);
+        break;
+        case OP_NOP:
+        break;
+
+        default:
+        /* BRK, COP, RTI, WAI, STP, WDM, MVN, MVP */
+        return 0;
+    }
+    cpu->cycles += o->cycles + extra;
+    return 1;
+}
+
+/**
+ * Calls a subroutine (as if by JSR) and runs it until it returns.
+ * @param cpu The CPU
+ * @param addr 24-bit address of the subroutine
+ * @param max_cycles Give up after this many cycles
+ * @return 0 if the subroutine did not return properly, 1 if OK
+ */
+int m65_call(m65_t *cpu, unsigned long addr, unsigned long max_cycles)
+{
+    unsigned short s = cpu->s;
+    unsigned long limit = cpu->cycles + max_cycles;
+    /* Return to address 0 of the bank, which is never executed */
+    push16(cpu, 0xFFFF);
+    cpu->pbr = (addr >> 16) & 0xFF;
+    cpu->pc = addr & 0xFFFF;
+    cpu->cycles += 6;
+    while ((cpu->pc != 0x0000) || (cpu->s != s)) {
+        if (!m65_step(cpu) || (cpu->cycles > limit))
+            return 0;
+    }
+    return 1;
+}
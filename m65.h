@@ -0,0 +1,57 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef M65_H
+#define M65_H
+
+/* Processor status flags */
+#define M65_C 0x01
+#define M65_Z 0x02
+#define M65_I 0x04
+#define M65_D 0x08
+#define M65_X 0x10
+#define M65_M 0x20
+#define M65_V 0x40
+#define M65_N 0x80
+
+/* State of a 6502 or 65816 CPU. */
+struct m65 {
+    unsigned short a;   /* full 16-bit accumulator (B:A) */
+    unsigned short x;
+    unsigned short y;
+    unsigned short s;
+    unsigned short d;
+    unsigned short pc;
+    unsigned char p;
+    unsigned char dbr;
+    unsigned char pbr;
+    int e;              /* emulation mode flag */
+    int nmos;           /* nonzero: only the NMOS 6502 instruction set */
+    unsigned long cycles;
+    unsigned char *mem;
+    unsigned long mem_mask;
+};
+
+typedef struct m65 m65_t;
+
+void m65_init(m65_t *, int);
+void m65_free(m65_t *);
+void m65_native(m65_t *, int, int);
+int m65_step(m65_t *);
+int m65_call(m65_t *, unsigned long, unsigned long);
+
+#endif  /* !M65_H */
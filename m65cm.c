@@ -0,0 +1,406 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the 6502 decoder generator for the context-mixing
+ * codec (see cm.c).
+ *
+ * The decoder has two entry points: <label>_init starts a string, copying
+ * the counters from the table to RAM and reading the first three bytes of
+ * encoded data, and <label> decodes one character. The bounds and the
+ * value of the arithmetic decoder are 24-bit zero page variables, stored
+ * low byte first. The split between the branches is the range times the
+ * counter, shifted right by 8, which is worked out with eight shifts and
+ * adds.
+ *
+ * The counter of a node is at (<label>_cp),y: the pointer holds the page
+ * chosen by the previous leaf, and Y is the node exclusive-ored with the
+ * low byte of the hash. The table holds the start values of the counters,
+ * then the left children of the nodes, the right children and the
+ * characters of the leaves.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "m65cm.h"
+#include "m65.h"
+
+/* Where the validation harness puts things */
+#define ZP_ADDRESS      0x0010
+#define MODEL_ADDRESS   0x0400
+#define CODE_ADDRESS    0x8000
+#define TABLE_ADDRESS   0x1000
+#define DATA_ADDRESS    0xA000
+#define DATA_LIMIT      0xFFF0
+
+/**
+ * Returns the size of the decoder table of a model.
+ */
+int m65cm_table_size(const cm_model_t *model)
+{
+    return CM_COUNTERS + 2 * model->node_count + model->leaf_count;
+}
+
+/**
+ * Stores the decoder table of a model.
+ * @param model The model
+ * @param charmap Character map
+ * @param out Where to store the table; m65cm_table_size() bytes
+ */
+void m65cm_table_image(const cm_model_t *model, const unsigned short *charmap,
+                       unsigned char *out)
+{
+    int i;
+    memcpy(out, model->counters, CM_COUNTERS);
+    out += CM_COUNTERS;
+    memcpy(out, model->children[0], model->node_count);
+    out += model->node_count;
+    memcpy(out, model->children[1], model->node_count);
+    out += model->node_count;
+    for (i = 0; i < model->leaf_count; i++)
+        out[i] = (unsigned char)charmap[model->leaf_symbols[i]];
+}
+
+/**
+ * Generates the 6502 decoder of a model.
+ * @param a Where to generate the code
+ * @param label Name of the decoder routine
+ * @param table_label Name of the decoder table
+ * @param model The model
+ */
+void m65cm_generate(asm_buffer_t *a, const char *label, const char *table_label,
+                    const cm_model_t *model)
+{
+    char encoding[32];
+    int right = CM_COUNTERS + model->node_count;
+    int chars = CM_COUNTERS + 2 * model->node_count;
+    int i;
+    asm_scope(a, label);
+    asm_text(a, "; Context-mixing decoder automatically generated by huffpuff.");
+    asm_text(a, "; The following zero page variables must be defined:");
+    asm_text(a, ";   %s_ptr (2 bytes): address of the next byte of encoded string data", label);
+    asm_text(a, ";   %s_x1, %s_x2, %s_x, %s_r (3 bytes each)", label, label, label, label);
+    asm_text(a, ";   %s_t (4 bytes), %s_cp (2 bytes)", label, label);
+    asm_text(a, ";   %s_m, %s_node, %s_h (1 byte each)", label, label, label);
+    asm_text(a, "; and %s_model (%d bytes of RAM).", label, CM_COUNTERS);
+    asm_text(a, "; Call %s_init with %s_ptr set to the string, then %s once per character.",
+             label, label, label);
+    asm_text(a, "; out: A = decoded character");
+    asm_text(a, "; destroys X, Y");
+    asm_label(a, "%s", label);
+    asm_emit(a, "A9 00", "lda #0");
+    asm_emit(a, "85 <.node", "sta .node");
+    asm_label(a, ".walk");
+    /* Y = counter of the node */
+    asm_emit(a, "45 <.h", "eor .h");
+    asm_emit(a, "A8", "tay");
+    asm_emit(a, "B1 <.cp", "lda (.cp),y");
+    asm_emit(a, "85 <.m", "sta .m");
+    /* r = x2 - x1 */
+    asm_emit(a, "38", "sec");
+    for (i = 0; i < 3; i++) {
+        const char *offset = i ? ((i == 1) ? "+1" : "+2") : "";
+        sprintf(encoding, "A5 <.x2%s", offset);
+        asm_emit(a, encoding, "lda .x2%s", offset);
+        sprintf(encoding, "E5 <.x1%s", offset);
+        asm_emit(a, encoding, "sbc .x1%s", offset);
+        sprintf(encoding, "85 <.r%s", offset);
+        asm_emit(a, encoding, "sta .r%s", offset);
+    }
+    /* A:t+2:t+1:t = r * counter */
+    asm_emit(a, "A9 00", "lda #0");
+    asm_emit(a, "85 <.t+1", "sta .t+1");
+    asm_emit(a, "85 <.t+2", "sta .t+2");
+    asm_emit(a, "A2 08", "ldx #8");
+    asm_label(a, ".mul");
+    asm_emit(a, "46 <.m", "lsr .m");
+    asm_emit(a, "90 @.shift", "bcc .shift");
+    asm_emit(a, "48", "pha");
+    asm_emit(a, "18", "clc");
+    asm_emit(a, "A5 <.t+1", "lda .t+1");
+    asm_emit(a, "65 <.r", "adc .r");
+    asm_emit(a, "85 <.t+1", "sta .t+1");
+    asm_emit(a, "A5 <.t+2", "lda .t+2");
+    asm_emit(a, "65 <.r+1", "adc .r+1");
+    asm_emit(a, "85 <.t+2", "sta .t+2");
+    asm_emit(a, "68", "pla");
+    asm_emit(a, "65 <.r+2", "adc .r+2");
+    asm_label(a, ".shift");
+    asm_emit(a, "6A", "ror a");
+    asm_emit(a, "66 <.t+2", "ror .t+2");
+    asm_emit(a, "66 <.t+1", "ror .t+1");
+    asm_emit(a, "66 <.t", "ror .t");
+    asm_emit(a, "CA", "dex");
+    asm_emit(a, "D0 @.mul", "bne .mul");
+    asm_emit(a, "85 <.t+3", "sta .t+3");
+    /* r = x1 + (r * counter >> 8), the split */
+    asm_emit(a, "18", "clc");
+    for (i = 0; i < 3; i++) {
+        const char *offset = i ? ((i == 1) ? "+1" : "+2") : "";
+        sprintf(encoding, "A5 <.x1%s", offset);
+        asm_emit(a, encoding, "lda .x1%s", offset);
+        sprintf(encoding, "65 <.t+%d", i + 1);
+        asm_emit(a, encoding, "adc .t+%d", i + 1);
+        sprintf(encoding, "85 <.r%s", offset);
+        asm_emit(a, encoding, "sta .r%s", offset);
+    }
+    /* Right branch if x <= split */
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "A5 <.r", "lda .r");
+    asm_emit(a, "E5 <.x", "sbc .x");
+    asm_emit(a, "A5 <.r+1", "lda .r+1");
+    asm_emit(a, "E5 <.x+1", "sbc .x+1");
+    asm_emit(a, "A5 <.r+2", "lda .r+2");
+    asm_emit(a, "E5 <.x+2", "sbc .x+2");
+    asm_emit(a, "90 @.left", "bcc .left");
+    /* x2 = split; the counter moves up */
+    asm_emit(a, "A5 <.r", "lda .r");
+    asm_emit(a, "85 <.x2", "sta .x2");
+    asm_emit(a, "A5 <.r+1", "lda .r+1");
+    asm_emit(a, "85 <.x2+1", "sta .x2+1");
+    asm_emit(a, "A5 <.r+2", "lda .r+2");
+    asm_emit(a, "85 <.x2+2", "sta .x2+2");
+    asm_emit(a, "A9 00", "lda #0");
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "F1 <.cp", "sbc (.cp),y");
+    asm_emit(a, "4A", "lsr a");
+    asm_emit(a, "4A", "lsr a");
+    asm_emit(a, "4A", "lsr a");
+    asm_emit(a, "4A", "lsr a");
+    asm_emit(a, "18", "clc");
+    asm_emit(a, "71 <.cp", "adc (.cp),y");
+    asm_emit(a, "91 <.cp", "sta (.cp),y");
+    asm_emit(a, "A6 <.node", "ldx .node");
+    sprintf(encoding, "BD !TABLE+%d", right);
+    asm_emit(a, encoding, "lda %s+%d,x", table_label, right);
+    asm_emit(a, "4C !.next", "jmp .next");
+    asm_label(a, ".left");
+    /* x1 = split + 1; the counter moves down */
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "A5 <.r", "lda .r");
+    asm_emit(a, "69 00", "adc #0");
+    asm_emit(a, "85 <.x1", "sta .x1");
+    asm_emit(a, "A5 <.r+1", "lda .r+1");
+    asm_emit(a, "69 00", "adc #0");
+    asm_emit(a, "85 <.x1+1", "sta .x1+1");
+    asm_emit(a, "A5 <.r+2", "lda .r+2");
+    asm_emit(a, "69 00", "adc #0");
+    asm_emit(a, "85 <.x1+2", "sta .x1+2");
+    asm_emit(a, "B1 <.cp", "lda (.cp),y");
+    asm_emit(a, "4A", "lsr a");
+    asm_emit(a, "4A", "lsr a");
+    asm_emit(a, "4A", "lsr a");
+    asm_emit(a, "4A", "lsr a");
+    asm_emit(a, "85 <.m", "sta .m");
+    asm_emit(a, "B1 <.cp", "lda (.cp),y");
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "E5 <.m", "sbc .m");
+    asm_emit(a, "91 <.cp", "sta (.cp),y");
+    asm_emit(a, "A6 <.node", "ldx .node");
+    sprintf(encoding, "BD !TABLE+%d", CM_COUNTERS);
+    asm_emit(a, encoding, "lda %s+%d,x", table_label, CM_COUNTERS);
+    asm_label(a, ".next");
+    asm_emit(a, "85 <.node", "sta .node");
+    /* Shift out the top bytes while they are equal */
+    asm_label(a, ".norm");
+    asm_emit(a, "A5 <.x1+2", "lda .x1+2");
+    asm_emit(a, "C5 <.x2+2", "cmp .x2+2");
+    asm_emit(a, "D0 @.normed", "bne .normed");
+    asm_emit(a, "A5 <.x1+1", "lda .x1+1");
+    asm_emit(a, "85 <.x1+2", "sta .x1+2");
+    asm_emit(a, "A5 <.x1", "lda .x1");
+    asm_emit(a, "85 <.x1+1", "sta .x1+1");
+    asm_emit(a, "A5 <.x2+1", "lda .x2+1");
+    asm_emit(a, "85 <.x2+2", "sta .x2+2");
+    asm_emit(a, "A5 <.x2", "lda .x2");
+    asm_emit(a, "85 <.x2+1", "sta .x2+1");
+    asm_emit(a, "A5 <.x+1", "lda .x+1");
+    asm_emit(a, "85 <.x+2", "sta .x+2");
+    asm_emit(a, "A5 <.x", "lda .x");
+    asm_emit(a, "85 <.x+1", "sta .x+1");
+    asm_emit(a, "A0 00", "ldy #0");
+    asm_emit(a, "84 <.x1", "sty .x1");
+    asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+    asm_emit(a, "85 <.x", "sta .x");
+    asm_emit(a, "88", "dey");
+    asm_emit(a, "84 <.x2", "sty .x2");
+    asm_emit(a, "E6 <.ptr", "inc .ptr");
+    asm_emit(a, "D0 @.norm", "bne .norm");
+    asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+    asm_emit(a, "4C !.norm", "jmp .norm");
+    asm_label(a, ".normed");
+    asm_emit(a, "A5 <.node", "lda .node");
+    asm_emit(a, "30 @.leaf", "bmi .leaf");
+    asm_emit(a, "4C !.walk", "jmp .walk");
+    asm_label(a, ".leaf");
+    /* The leaf is the context of the next character */
+    asm_emit(a, "29 7F", "and #$7F");
+    asm_emit(a, "AA", "tax");
+    sprintf(encoding, "BD !TABLE+%d", chars);
+    asm_emit(a, encoding, "lda %s+%d,x", table_label, chars);
+    asm_emit(a, "48", "pha");
+    asm_emit(a, "8A", "txa");
+    asm_emit(a, "20 !.context", "jsr .context");
+    asm_emit(a, "68", "pla");
+    asm_emit(a, "60", "rts");
+
+    asm_label(a, "%s_init", label);
+    /* Copy the counters to RAM */
+    asm_emit(a, "A0 00", "ldy #0");
+    asm_label(a, ".copy");
+    asm_emit(a, "B9 !TABLE", "lda %s,y", table_label);
+    asm_emit(a, "99 !.model", "sta .model,y");
+    asm_emit(a, "B9 !TABLE+256", "lda %s+256,y", table_label);
+    asm_emit(a, "99 !.model+256", "sta .model+256,y");
+    asm_emit(a, "C8", "iny");
+    asm_emit(a, "D0 @.copy", "bne .copy");
+    /* x1 = 0, x2 = $FFFFFF */
+    asm_emit(a, "84 <.x1", "sty .x1");
+    asm_emit(a, "84 <.x1+1", "sty .x1+1");
+    asm_emit(a, "84 <.x1+2", "sty .x1+2");
+    asm_emit(a, "88", "dey");
+    asm_emit(a, "84 <.x2", "sty .x2");
+    asm_emit(a, "84 <.x2+1", "sty .x2+1");
+    asm_emit(a, "84 <.x2+2", "sty .x2+2");
+    /* x = the first three bytes, high byte first */
+    asm_emit(a, "A0 00", "ldy #0");
+    asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+    asm_emit(a, "85 <.x+2", "sta .x+2");
+    asm_emit(a, "C8", "iny");
+    asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+    asm_emit(a, "85 <.x+1", "sta .x+1");
+    asm_emit(a, "C8", "iny");
+    asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+    asm_emit(a, "85 <.x", "sta .x");
+    asm_emit(a, "A5 <.ptr", "lda .ptr");
+    asm_emit(a, "18", "clc");
+    asm_emit(a, "69 03", "adc #3");
+    asm_emit(a, "85 <.ptr", "sta .ptr");
+    asm_emit(a, "90 @.started", "bcc .started");
+    asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+    asm_label(a, ".started");
+    asm_emit(a, "A9 00", "lda #0");
+    /* Point .cp and .h at the counters after leaf A */
+    asm_label(a, ".context");
+    asm_emit(a, "85 <.h", "sta .h");
+    asm_emit(a, "A9 00", "lda #0");
+    for (i = 0; i < model->hash_shift; i++) {
+        asm_emit(a, "06 <.h", "asl .h");
+        asm_emit(a, "2A", "rol a");
+    }
+    asm_emit(a, "29 01", "and #1");
+    asm_emit(a, "18", "clc");
+    asm_emit(a, "69 >.model", "adc #>.model");
+    asm_emit(a, "85 <.cp+1", "sta .cp+1");
+    asm_emit(a, "A9 <.model", "lda #<.model");
+    asm_emit(a, "85 <.cp", "sta .cp");
+    asm_emit(a, "60", "rts");
+}
+
+/**
+ * Runs the generated decoder on every string and checks the result.
+ * @param model The model
+ * @param charmap Character map
+ * @param head Encoded strings
+ * @param code_size Where to store the size of the decoder
+ * @param cycles_per_char Where to store the average decoding time,
+ *        including the start of the strings
+ * @return 0 if fail, 1 if OK
+ */
+int m65cm_validate(const cm_model_t *model, const unsigned short *charmap,
+                   const string_list_t *head, int *code_size, double *cycles_per_char)
+{
+    asm_buffer_t a;
+    m65_t m;
+    const string_list_t *str;
+    unsigned long total_cycles = 0;
+    unsigned long char_count = 0;
+    int init;
+    int ok = 1;
+
+    asm_init(&a, CODE_ADDRESS);
+    m65cm_generate(&a, "huff_decode", "huff_table", model);
+    asm_define(&a, "TABLE", TABLE_ADDRESS);
+    asm_define(&a, "huff_decode_model", MODEL_ADDRESS);
+    asm_define(&a, "huff_decode_ptr", ZP_ADDRESS);
+    asm_define(&a, "huff_decode_x1", ZP_ADDRESS + 2);
+    asm_define(&a, "huff_decode_x2", ZP_ADDRESS + 5);
+    asm_define(&a, "huff_decode_x", ZP_ADDRESS + 8);
+    asm_define(&a, "huff_decode_r", ZP_ADDRESS + 11);
+    asm_define(&a, "huff_decode_t", ZP_ADDRESS + 14);
+    asm_define(&a, "huff_decode_cp", ZP_ADDRESS + 18);
+    asm_define(&a, "huff_decode_m", ZP_ADDRESS + 20);
+    asm_define(&a, "huff_decode_node", ZP_ADDRESS + 21);
+    asm_define(&a, "huff_decode_h", ZP_ADDRESS + 22);
+    if (!asm_link(&a) || !asm_lookup(&a, "huff_decode_init", &init)) {
+        asm_free(&a);
+        return 0;
+    }
+    *code_size = a.size;
+    if (CODE_ADDRESS + a.size > DATA_ADDRESS) {
+        fprintf(stderr, "error: generated 6502 decoder too large for the test harness\n");
+        asm_free(&a);
+        return 0;
+    }
+
+    m65_init(&m, 1);
+    memcpy(&m.mem[CODE_ADDRESS], a.code, a.size);
+    m65cm_table_image(model, charmap, &m.mem[TABLE_ADDRESS]);
+
+    for (str = head; ok && (str != NULL); str = str->next) {
+        unsigned long start;
+        int i;
+        if (DATA_ADDRESS + str->huff_size + 1 > DATA_LIMIT) {
+            fprintf(stderr, "error: encoded string too large for the 6502 test harness\n");
+            ok = 0;
+            break;
+        }
+        /* The bytes after the string are left from the strings before */
+        memcpy(&m.mem[DATA_ADDRESS], str->huff_data, str->huff_size);
+        m.mem[ZP_ADDRESS] = DATA_ADDRESS & 0xFF;
+        m.mem[ZP_ADDRESS + 1] = DATA_ADDRESS >> 8;
+        start = m.cycles;
+        if (!m65_call(&m, init, 100000)) {
+            fprintf(stderr, "*** fatal error: generated 6502 decoder crashed at $%.4X\n", m.pc);
+            ok = 0;
+            break;
+        }
+        for (i = 0; i < str->length; ++i) {
+            int c = str->symbols[i];
+            unsigned result;
+            if (!m65_call(&m, CODE_ADDRESS, 100000)) {
+                fprintf(stderr, "*** fatal error: generated 6502 decoder crashed at $%.4X\n", m.pc);
+                ok = 0;
+                break;
+            }
+            result = m.a & 0xFF;
+            if (result != charmap[c]) {
+                fprintf(stderr, "*** fatal error: generated 6502 decoder returned $%.2X, expected $%.2X\n",
+                        result, charmap[c]);
+                fprintf(stderr, "    original: %s\n", str->text);
+                ok = 0;
+                break;
+            }
+        }
+        total_cycles += m.cycles - start;
+        char_count += str->length;
+    }
+    *cycles_per_char = char_count ? (double)total_cycles / char_count : 0;
+    m65_free(&m);
+    asm_free(&a);
+    return ok;
+}
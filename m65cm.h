@@ -0,0 +1,31 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef M65CM_H
+#define M65CM_H
+
+#include "asmgen.h"
+#include "huffpuff.h"
+#include "cm.h"
+
+int m65cm_table_size(const cm_model_t *);
+void m65cm_table_image(const cm_model_t *, const unsigned short *, unsigned char *);
+void m65cm_generate(asm_buffer_t *, const char *, const char *, const cm_model_t *);
+int m65cm_validate(const cm_model_t *, const unsigned short *,
+                   const string_list_t *, int *, double *);
+
+#endif  /* !M65CM_H */
@@ -0,0 +1,934 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the 6502 and 65816 decoder generators.
+ *
+ * The 6502 decoder walks the standard decoder table through a zero page
+ * pointer. Big tables may need two-byte child offsets or addresses (see
+ * TABLE_REL16 and TABLE_ABS16), which are stored high byte first so that
+ * the first byte of a node still tells whether it is a leaf. The bit buffer is a zero page byte with a sentinel bit: a new
+ * byte is shifted in with carry set, and the buffer is empty once the
+ * sentinel has been shifted out (i.e. the buffer becomes 0). When the
+ * leaves hold byte sequences, the 6502 decoder copies the sequence through
+ * a zero page output pointer. A bucket leaf holds a sentinel bit, and the
+ * extra bits are rotated into it until the sentinel is shifted out.
+ *
+ * With a root lookup, the 6502 decoder first rotates a fixed number of
+ * bits into a sentinel bit in A, no more than the shortest code has, and
+ * looks up the address of the node that they lead to in a table of words
+ * after the routine. The walk goes on from there, so the table itself is
+ * unchanged.
+ *
+ * The tree-as-code 6502 decoder has no table: every interior node of the
+ * tree becomes a shift of the bit buffer and a branch, and every leaf
+ * loads its character. The child that is taken more often follows its
+ * parent, so that the branch is usually not taken; the other child is
+ * reached with a branch, or with a branch around a JMP when it is out of
+ * range. Refilling the bit buffer, copying byte sequences and reading the
+ * extra bits of buckets are done by shared subroutines.
+ *
+ * The fixed-width decoder rotates the bits of a symbol into a sentinel bit
+ * (like the extra bits of a bucket) and looks the result up in a table of
+ * character values.
+ *
+ * The far pointer lookup reads the address and bank of a string from
+ * three byte arrays with Y as the index. Up to 256 strings, the arrays
+ * are read with absolute indexed loads; beyond that, X selects a 256-entry
+ * sub-table, whose page is added to the high byte of a zero page pointer.
+ *
+ * The 65816 decoder runs with 16-bit registers and uses a table made for
+ * 16-bit loads. Both children of a node are stored next to each other, so
+ * a node record holds a single word: the table index of the left child
+ * (the right child follows it). A leaf has bit 15 set; in 2-byte records
+ * the leaf value is in bits 0-14, in 4-byte records (used when a value
+ * needs all 16 bits) it is in the second word. The bit buffer is 16 bits
+ * wide and is refilled two bytes at a time.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "m65dec.h"
+#include "m65.h"
+
+/* Where the validation harness puts things */
+#define ZP_ADDRESS         0x0010
+#define CODE_ADDRESS       0x8000
+#define TABLE_ADDRESS_6502 0x1000
+#define DATA_ADDRESS_6502  0xA000
+#define DATA_LIMIT_6502    0xFFF0
+#define TABLE_ADDRESS_65816 0x010000
+#define DATA_ADDRESS_65816  0x018000
+#define DATA_LIMIT_65816    0x01FFF0
+#define OUT_ADDRESS_6502    0x0200
+#define LOOKUP_ADDRESS_6502 0x2000
+#define LOOKUP_MAX_STRINGS  8192    /* that fit between the table and the code */
+
+/**
+ * Determines the size of the 65816 decoder table records.
+ * @param root Root of Huffman tree
+ * @param charmap Character map
+ * @return 2, or 4 if a leaf value needs all 16 bits
+ */
+int m65dec_record_size(huffman_node_t *root, const unsigned short *charmap)
+{
+    if (root == 0)
+        return 2;
+    if (root->symbol != -1)
+        return (charmap[root->symbol] & 0x8000) ? 4 : 2;
+    if (m65dec_record_size(root->left, charmap) == 4)
+        return 4;
+    return m65dec_record_size(root->right, charmap);
+}
+
+/**
+ * Generates the 6502 decoder routine.
+ */
+static void generate_6502(asm_buffer_t *a, const char *label,
+                          const char *table_label, int leaf_format, int format,
+                          int root_bits, const int *root_positions)
+{
+    char encoding[32];
+    int i;
+    asm_text(a, "; Huffman decoder automatically generated by huffpuff.");
+    asm_text(a, "; The following zero page variables must be defined:");
+    asm_text(a, ";   %s_ptr (2 bytes): address of the next byte of encoded string data", label);
+    asm_text(a, ";   %s_bits (1 byte): bit buffer; set to 0 before decoding the first character of a string", label);
+    asm_text(a, ";   %s_tree (2 bytes): used internally", label);
+    if (format == TABLE_ABS16)
+        asm_text(a, "; The decoder table must not be in zero page.");
+    if (leaf_format == LEAF_SEQUENCE) {
+        asm_text(a, ";   %s_out (2 bytes): where to store the decoded bytes", label);
+        asm_text(a, "; out: the bytes of the decoded character are stored, and %s_out is", label);
+        asm_text(a, ";      advanced past them; Y = number of bytes");
+        asm_text(a, "; destroys A, X");
+    } else {
+        asm_text(a, "; out: A = decoded character");
+        asm_text(a, "; destroys Y");
+    }
+    asm_label(a, "%s", label);
+    if (root_bits) {
+        /* Rotate the first bits into a sentinel bit, and look up the node
+           that they lead to */
+        sprintf(encoding, "A9 %.2X", 0x100 >> root_bits);
+        asm_emit(a, encoding, "lda #$%.2X", 0x100 >> root_bits);
+        asm_label(a, ".root");
+        asm_emit(a, "06 <.bits", "asl .bits");
+        asm_emit(a, "D0 @.root_bit", "bne .root_bit");
+        asm_emit(a, "48", "pha");
+        asm_emit(a, "A0 00", "ldy #0");
+        asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+        asm_emit(a, "E6 <.ptr", "inc .ptr");
+        asm_emit(a, "D0 @.root_refilled", "bne .root_refilled");
+        asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+        asm_label(a, ".root_refilled");
+        asm_emit(a, "38", "sec");
+        asm_emit(a, "2A", "rol a");
+        asm_emit(a, "85 <.bits", "sta .bits");
+        asm_emit(a, "68", "pla");
+        asm_label(a, ".root_bit");
+        asm_emit(a, "2A", "rol a");
+        asm_emit(a, "90 @.root", "bcc .root");
+        asm_emit(a, "0A", "asl a");
+        asm_emit(a, "A8", "tay");
+        asm_emit(a, "B9 !.root_table", "lda .root_table,y");
+        asm_emit(a, "85 <.tree", "sta .tree");
+        asm_emit(a, "B9 !.root_table+1", "lda .root_table+1,y");
+        asm_emit(a, "85 <.tree+1", "sta .tree+1");
+    } else {
+        asm_emit(a, "A9 <TABLE", "lda #<%s", table_label);
+        asm_emit(a, "85 <.tree", "sta .tree");
+        asm_emit(a, "A9 >TABLE", "lda #>%s", table_label);
+        asm_emit(a, "85 <.tree+1", "sta .tree+1");
+    }
+    asm_label(a, ".walk");
+    asm_emit(a, "A0 00", "ldy #0");
+    asm_emit(a, "B1 <.tree", "lda (.tree),y");
+    if (format == TABLE_REL16)
+        asm_emit(a, "30 @.leaf", "bmi .leaf");
+    else
+        asm_emit(a, "F0 @.leaf", "beq .leaf");
+    asm_emit(a, "06 <.bits", "asl .bits");
+    asm_emit(a, "D0 @.bit", "bne .bit");
+    /* Buffer empty; shift in the next byte */
+    asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+    asm_emit(a, "E6 <.ptr", "inc .ptr");
+    asm_emit(a, "D0 @.refilled", "bne .refilled");
+    asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+    asm_label(a, ".refilled");
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "2A", "rol a");
+    asm_emit(a, "85 <.bits", "sta .bits");
+    asm_label(a, ".bit");
+    asm_emit(a, "90 @.left", "bcc .left");
+    if (format == TABLE_REL8) {
+        asm_emit(a, "C8", "iny");
+        asm_label(a, ".left");
+        asm_emit(a, "B1 <.tree", "lda (.tree),y");
+        asm_emit(a, "18", "clc");
+        asm_emit(a, "65 <.tree", "adc .tree");
+        asm_emit(a, "85 <.tree", "sta .tree");
+        asm_emit(a, "90 @.walk", "bcc .walk");
+        asm_emit(a, "E6 <.tree+1", "inc .tree+1");
+        asm_emit(a, "B0 @.walk", "bcs .walk");
+    } else {
+        /* The pointer is high byte first */
+        asm_emit(a, "A0 02", "ldy #2");
+        asm_label(a, ".left");
+        asm_emit(a, "C8", "iny");
+        asm_emit(a, "B1 <.tree", "lda (.tree),y");
+        if (format == TABLE_REL16) {
+            asm_emit(a, "18", "clc");
+            asm_emit(a, "65 <.tree", "adc .tree");
+            asm_emit(a, "AA", "tax");
+            asm_emit(a, "88", "dey");
+            asm_emit(a, "B1 <.tree", "lda (.tree),y");
+            asm_emit(a, "65 <.tree+1", "adc .tree+1");
+            asm_emit(a, "86 <.tree", "stx .tree");
+            asm_emit(a, "85 <.tree+1", "sta .tree+1");
+            asm_emit(a, "4C !.walk", "jmp .walk");
+        } else {
+            /* The table is not in zero page, so the high byte is never 0 */
+            asm_emit(a, "AA", "tax");
+            asm_emit(a, "88", "dey");
+            asm_emit(a, "B1 <.tree", "lda (.tree),y");
+            asm_emit(a, "86 <.tree", "stx .tree");
+            asm_emit(a, "85 <.tree+1", "sta .tree+1");
+            asm_emit(a, "D0 @.walk", "bne .walk");
+        }
+    }
+    asm_label(a, ".leaf");
+    asm_emit(a, "C8", "iny");
+    asm_emit(a, "B1 <.tree", "lda (.tree),y");
+    if (leaf_format == LEAF_BUCKET) {
+        /* A = sentinel, or 0 if the leaf has a single character */
+        asm_emit(a, "F0 @.value", "beq .value");
+        asm_label(a, ".extra");
+        asm_emit(a, "06 <.bits", "asl .bits");
+        asm_emit(a, "D0 @.extra_bit", "bne .extra_bit");
+        asm_emit(a, "48", "pha");
+        asm_emit(a, "A0 00", "ldy #0");
+        asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+        asm_emit(a, "E6 <.ptr", "inc .ptr");
+        asm_emit(a, "D0 @.extra_refilled", "bne .extra_refilled");
+        asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+        asm_label(a, ".extra_refilled");
+        asm_emit(a, "38", "sec");
+        asm_emit(a, "2A", "rol a");
+        asm_emit(a, "85 <.bits", "sta .bits");
+        asm_emit(a, "68", "pla");
+        asm_label(a, ".extra_bit");
+        asm_emit(a, "2A", "rol a");
+        asm_emit(a, "90 @.extra", "bcc .extra");
+        asm_label(a, ".value");
+        asm_emit(a, "18", "clc");
+        asm_emit(a, "69 02", "adc #2");
+        asm_emit(a, "A8", "tay");
+        asm_emit(a, "B1 <.tree", "lda (.tree),y");
+    } else if (leaf_format == LEAF_SEQUENCE) {
+        /* A = length; the sequence follows it */
+        asm_emit(a, "AA", "tax");
+        asm_emit(a, "A5 <.tree", "lda .tree");
+        asm_emit(a, "18", "clc");
+        asm_emit(a, "69 02", "adc #2");
+        asm_emit(a, "85 <.tree", "sta .tree");
+        asm_emit(a, "90 @.copy0", "bcc .copy0");
+        asm_emit(a, "E6 <.tree+1", "inc .tree+1");
+        asm_label(a, ".copy0");
+        asm_emit(a, "A0 00", "ldy #0");
+        asm_label(a, ".copy");
+        asm_emit(a, "B1 <.tree", "lda (.tree),y");
+        asm_emit(a, "91 <.out", "sta (.out),y");
+        asm_emit(a, "C8", "iny");
+        asm_emit(a, "CA", "dex");
+        asm_emit(a, "D0 @.copy", "bne .copy");
+        asm_emit(a, "98", "tya");
+        asm_emit(a, "18", "clc");
+        asm_emit(a, "65 <.out", "adc .out");
+        asm_emit(a, "85 <.out", "sta .out");
+        asm_emit(a, "90 @.done", "bcc .done");
+        asm_emit(a, "E6 <.out+1", "inc .out+1");
+        asm_label(a, ".done");
+    }
+    asm_emit(a, "60", "rts");
+    if (root_bits) {
+        /* The address of the node that every value of the first bits leads to */
+        asm_label(a, ".root_table");
+        for (i = 0; i < (1 << root_bits); ++i) {
+            sprintf(encoding, "!TABLE+%d", root_positions[i]);
+            asm_emit(a, encoding, ".dw %s+%d", table_label, root_positions[i]);
+        }
+    }
+}
+
+/* A node of the tree-as-code decoder */
+struct code_node {
+    huffman_node_t *node;
+    int next;           /* index of the child that follows the node */
+    int far;            /* index of the child that is branched to */
+    int far_bit;        /* the bit that leads to the far child */
+    int long_branch;    /* 1 if the far child is out of branch range */
+    int address;
+};
+
+/**
+ * Orders the nodes of the tree-as-code decoder depth-first, the child
+ * with the larger weight first.
+ * @return Index of the node
+ */
+static int code_order(huffman_node_t *node, struct code_node *nodes, int *count)
+{
+    int index = (*count)++;
+    nodes[index].node = node;
+    nodes[index].long_branch = 0;
+    if (node->symbol == -1) {
+        int far_bit = (node->right->weight > node->left->weight);
+        nodes[index].far_bit = !far_bit;
+        nodes[index].next = code_order(far_bit ? node->right : node->left, nodes, count);
+        nodes[index].far = code_order(far_bit ? node->left : node->right, nodes, count);
+    }
+    return index;
+}
+
+/**
+ * Returns the size of the code of a node of the tree-as-code decoder.
+ */
+static int code_node_size(const struct code_node *n,
+                          const charmap_sequence_t *sequences)
+{
+    const huffman_node_t *node = n->node;
+    if (node->symbol == -1)
+        return 2 + 2 + 3 + (n->long_branch ? 5 : 2);
+    if (sequences)
+        return 7 + 1 + sequences[node->symbol].length;
+    if (node->bucket && node->bucket->extra_bits)
+        return 7 + 1 + (1 << node->bucket->extra_bits);
+    return 3;
+}
+
+/**
+ * Generates the code of a node of the tree-as-code decoder.
+ */
+static void generate_code_node(asm_buffer_t *a, const struct code_node *nodes, int index,
+                               const unsigned short *charmap,
+                               const charmap_sequence_t *sequences)
+{
+    const struct code_node *n = &nodes[index];
+    const huffman_node_t *node = n->node;
+    char encoding[1024];
+    char text[1024];
+    char name[64];
+    int i;
+    if (index != 0)
+        asm_label(a, ".node_%d_%d", node->code.code, node->code.length);
+    if (node->symbol == -1) {
+        const huffman_node_t *far = nodes[n->far].node;
+        asm_emit(a, "06 <.bits", "asl .bits");
+        sprintf(name, ".bit_%d_%d", node->code.code, node->code.length);
+        sprintf(encoding, "D0 @%s", name);
+        asm_emit(a, encoding, "bne %s", name);
+        asm_emit(a, "20 !.refill", "jsr .refill");
+        asm_label(a, "%s", name);
+        sprintf(name, ".node_%d_%d", far->code.code, far->code.length);
+        if (!n->long_branch) {
+            sprintf(encoding, "%s @%s", n->far_bit ? "B0" : "90", name);
+            asm_emit(a, encoding, "%s %s", n->far_bit ? "bcs" : "bcc", name);
+        } else {
+            /* Branch around a jump */
+            char skip[64];
+            sprintf(skip, ".near_%d_%d", node->code.code, node->code.length);
+            sprintf(encoding, "%s @%s", n->far_bit ? "90" : "B0", skip);
+            asm_emit(a, encoding, "%s %s", n->far_bit ? "bcc" : "bcs", skip);
+            sprintf(encoding, "4C !%s", name);
+            asm_emit(a, encoding, "jmp %s", name);
+            asm_label(a, "%s", skip);
+        }
+        return;
+    }
+    if (sequences || (node->bucket && node->bucket->extra_bits)) {
+        /* Point the shared routine to the data that follows */
+        const char *routine = sequences ? ".copy" : ".extra";
+        sprintf(name, ".data_%d_%d", node->code.code, node->code.length);
+        sprintf(encoding, "A9 <%s", name);
+        asm_emit(a, encoding, "lda #<%s", name);
+        sprintf(encoding, "A2 >%s", name);
+        asm_emit(a, encoding, "ldx #>%s", name);
+        sprintf(encoding, "4C !%s", routine);
+        asm_emit(a, encoding, "jmp %s", routine);
+        asm_label(a, "%s", name);
+        if (sequences) {
+            const charmap_sequence_t *seq = &sequences[node->symbol];
+            sprintf(encoding, "%.2X", seq->length);
+            sprintf(text, ".db $%.2X", seq->length);
+            for (i = 0; i < seq->length; ++i) {
+                sprintf(&encoding[strlen(encoding)], " %.2X", seq->bytes[i]);
+                sprintf(&text[strlen(text)], ", $%.2X", seq->bytes[i]);
+            }
+        } else {
+            const struct huffman_bucket *bucket = node->bucket;
+            sprintf(encoding, "%.2X", (0x100 >> bucket->extra_bits) & 0xFF);
+            sprintf(text, ".db $%.2X", (0x100 >> bucket->extra_bits) & 0xFF);
+            for (i = 0; i < (1 << bucket->extra_bits); ++i) {
+                sprintf(&encoding[strlen(encoding)], " %.2X", charmap[bucket->symbols[i]] & 0xFF);
+                sprintf(&text[strlen(text)], ", $%.2X", charmap[bucket->symbols[i]] & 0xFF);
+            }
+        }
+        asm_emit(a, encoding, "%s", text);
+        return;
+    }
+    i = charmap[node->bucket ? node->bucket->symbols[0] : node->symbol] & 0xFF;
+    sprintf(encoding, "A9 %.2X", i);
+    asm_emit(a, encoding, "lda #$%.2X", i);
+    asm_emit(a, "60", "rts");
+}
+
+/**
+ * Generates the tree-as-code 6502 decoder routine.
+ */
+static void generate_6502_code(asm_buffer_t *a, const char *label, huffman_node_t *root,
+                               const unsigned short *charmap,
+                               const charmap_sequence_t *sequences, int leaf_format)
+{
+    struct code_node *nodes;
+    int count = 0;
+    int changed;
+    int i;
+    nodes = (struct code_node *)malloc(2 * HUFFMAN_MAX_SYMBOLS * sizeof(struct code_node));
+    code_order(root, nodes, &count);
+    /* Use long branches where the far child is out of range, until no
+       more branches grow */
+    do {
+        int address = 0;
+        changed = 0;
+        for (i = 0; i < count; ++i) {
+            nodes[i].address = address;
+            address += code_node_size(&nodes[i], sequences);
+        }
+        for (i = 0; i < count; ++i) {
+            if ((nodes[i].node->symbol == -1) && !nodes[i].long_branch
+                && (nodes[nodes[i].far].address
+                    - (nodes[i].address + code_node_size(&nodes[i], sequences)) > 127)) {
+                nodes[i].long_branch = 1;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    asm_text(a, "; Huffman decoder automatically generated by huffpuff.");
+    asm_text(a, "; The Huffman tree is part of the code; no decoder table is needed.");
+    asm_text(a, "; The following zero page variables must be defined:");
+    asm_text(a, ";   %s_ptr (2 bytes): address of the next byte of encoded string data", label);
+    asm_text(a, ";   %s_bits (1 byte): bit buffer; set to 0 before decoding the first character of a string", label);
+    if (leaf_format != LEAF_VALUE)
+        asm_text(a, ";   %s_tree (2 bytes): used internally", label);
+    if (leaf_format == LEAF_SEQUENCE) {
+        asm_text(a, ";   %s_out (2 bytes): where to store the decoded bytes", label);
+        asm_text(a, "; out: the bytes of the decoded character are stored, and %s_out is", label);
+        asm_text(a, ";      advanced past them; Y = number of bytes");
+        asm_text(a, "; destroys A, X");
+    } else {
+        asm_text(a, "; out: A = decoded character");
+        asm_text(a, (leaf_format == LEAF_BUCKET) ? "; destroys X, Y" : "; destroys Y");
+    }
+    asm_label(a, "%s", label);
+    for (i = 0; i < count; ++i)
+        generate_code_node(a, nodes, i, charmap, sequences);
+    free(nodes);
+
+    /* Buffer empty; shift in the next byte. Out: carry = next bit */
+    asm_label(a, ".refill");
+    asm_emit(a, "A0 00", "ldy #0");
+    asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+    asm_emit(a, "E6 <.ptr", "inc .ptr");
+    asm_emit(a, "D0 @.refilled", "bne .refilled");
+    asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+    asm_label(a, ".refilled");
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "2A", "rol a");
+    asm_emit(a, "85 <.bits", "sta .bits");
+    asm_emit(a, "60", "rts");
+    if (leaf_format == LEAF_SEQUENCE) {
+        /* A, X = address of the length and bytes of the sequence */
+        asm_label(a, ".copy");
+        asm_emit(a, "85 <.tree", "sta .tree");
+        asm_emit(a, "86 <.tree+1", "stx .tree+1");
+        asm_emit(a, "A0 00", "ldy #0");
+        asm_emit(a, "B1 <.tree", "lda (.tree),y");
+        asm_emit(a, "AA", "tax");
+        asm_label(a, ".copy_byte");
+        asm_emit(a, "C8", "iny");
+        asm_emit(a, "B1 <.tree", "lda (.tree),y");
+        asm_emit(a, "88", "dey");
+        asm_emit(a, "91 <.out", "sta (.out),y");
+        asm_emit(a, "C8", "iny");
+        asm_emit(a, "CA", "dex");
+        asm_emit(a, "D0 @.copy_byte", "bne .copy_byte");
+        asm_emit(a, "98", "tya");
+        asm_emit(a, "18", "clc");
+        asm_emit(a, "65 <.out", "adc .out");
+        asm_emit(a, "85 <.out", "sta .out");
+        asm_emit(a, "90 @.done", "bcc .done");
+        asm_emit(a, "E6 <.out+1", "inc .out+1");
+        asm_label(a, ".done");
+        asm_emit(a, "60", "rts");
+    } else if (leaf_format == LEAF_BUCKET) {
+        /* A, X = address of the sentinel and values of the bucket */
+        asm_label(a, ".extra");
+        asm_emit(a, "85 <.tree", "sta .tree");
+        asm_emit(a, "86 <.tree+1", "stx .tree+1");
+        asm_emit(a, "A0 00", "ldy #0");
+        asm_emit(a, "B1 <.tree", "lda (.tree),y");
+        asm_label(a, ".extra_next");
+        asm_emit(a, "06 <.bits", "asl .bits");
+        asm_emit(a, "D0 @.extra_bit", "bne .extra_bit");
+        asm_emit(a, "48", "pha");
+        asm_emit(a, "20 !.refill", "jsr .refill");
+        asm_emit(a, "68", "pla");
+        asm_label(a, ".extra_bit");
+        asm_emit(a, "2A", "rol a");
+        asm_emit(a, "90 @.extra_next", "bcc .extra_next");
+        asm_emit(a, "A8", "tay");
+        asm_emit(a, "C8", "iny");
+        asm_emit(a, "B1 <.tree", "lda (.tree),y");
+        asm_emit(a, "60", "rts");
+    }
+}
+
+/**
+ * Generates the 65816 decoder routine.
+ */
+static void generate_65816(asm_buffer_t *a, const char *label,
+                           const char *table_label, int record_size)
+{
+    asm_text(a, "; Huffman decoder automatically generated by huffpuff.");
+    asm_text(a, "; Call in native mode with 16-bit A, X and Y. The data bank register must");
+    asm_text(a, "; point to the bank of the decoder table and the encoded string data.");
+    asm_text(a, "; The following direct page variables must be defined:");
+    asm_text(a, ";   %s_ptr (2 bytes): address of the next encoded string data word", label);
+    asm_text(a, ";   %s_bits (2 bytes): bit buffer; set to 0 before decoding the first character of a string", label);
+    asm_text(a, "; out: A = decoded character (16 bits)");
+    asm_text(a, "; destroys X, Y");
+    asm_text(a, ".ACCU 16");
+    asm_text(a, ".INDEX 16");
+    asm_label(a, "%s", label);
+    asm_emit(a, "A2 00 00", "ldx #$0000");
+    asm_label(a, ".walk");
+    asm_emit(a, "BD !TABLE", "lda %s,x", table_label);
+    asm_emit(a, "30 @.leaf", "bmi .leaf");
+    asm_emit(a, "06 <.bits", "asl .bits");
+    asm_emit(a, "F0 @.refill", "beq .refill");
+    asm_label(a, ".bit");
+    asm_emit(a, "90 @.left", "bcc .left");
+    /* Carry is set, so this skips record_size bytes */
+    if (record_size == 4)
+        asm_emit(a, "69 03 00", "adc #$0003");
+    else
+        asm_emit(a, "69 01 00", "adc #$0001");
+    asm_label(a, ".left");
+    asm_emit(a, "AA", "tax");
+    asm_emit(a, "80 @.walk", "bra .walk");
+    /* Buffer empty; shift in the next two bytes */
+    asm_label(a, ".refill");
+    asm_emit(a, "A8", "tay");
+    asm_emit(a, "B2 <.ptr", "lda (.ptr)");
+    asm_emit(a, "EB", "xba");
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "2A", "rol a");
+    asm_emit(a, "85 <.bits", "sta .bits");
+    asm_emit(a, "E6 <.ptr", "inc .ptr");
+    asm_emit(a, "E6 <.ptr", "inc .ptr");
+    asm_emit(a, "98", "tya");
+    asm_emit(a, "80 @.bit", "bra .bit");
+    asm_label(a, ".leaf");
+    if (record_size == 4) {
+        asm_emit(a, "BD !TABLE+2", "lda %s+2,x", table_label);
+    } else {
+        asm_emit(a, "29 FF 7F", "and #$7FFF");
+    }
+    asm_emit(a, "60", "rts");
+}
+
+/**
+ * Generates a decoder routine.
+ * @param a Buffer to generate code into
+ * @param cpu CPU_6502 or CPU_65816
+ * @param label Name of the routine
+ * @param table_label Name of the decoder table
+ * @param record_size Size of 65816 table records (see m65dec_record_size())
+ * @param leaf_format Format of the table leaves (6502 only; LEAF_VALUE etc.)
+ * @param format Format of the interior nodes (6502 only; TABLE_REL8 etc.)
+ * @param root_bits Number of bits that the root lookup table takes at once
+ *        (6502 only), or 0 for none
+ * @param root_positions Table offset of the node that every value of those
+ *        bits leads to (see huffman_root_positions())
+ */
+void m65dec_generate(asm_buffer_t *a, int cpu, const char *label,
+                     const char *table_label, int record_size, int leaf_format,
+                     int format, int root_bits, const int *root_positions)
+{
+    asm_scope(a, label);
+    if (cpu == CPU_65816)
+        generate_65816(a, label, table_label, record_size);
+    else
+        generate_6502(a, label, table_label, leaf_format, format, root_bits,
+                      root_positions);
+}
+
+/**
+ * Generates the tree-as-code 6502 decoder routine.
+ * @param a Buffer to generate code into
+ * @param label Name of the routine
+ * @param root Root of Huffman tree
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters, or NULL
+ */
+void m65dec_generate_code(asm_buffer_t *a, const char *label, huffman_node_t *root,
+                          const unsigned short *charmap,
+                          const charmap_sequence_t *sequences)
+{
+    asm_scope(a, label);
+    generate_6502_code(a, label, root, charmap, sequences,
+                       huffman_leaf_format(root, sequences));
+}
+
+/**
+ * Generates the fixed-width 6502 decoder routine.
+ * @param a Buffer to generate code into
+ * @param label Name of the routine
+ * @param table_label Name of the table of character values
+ * @param width Bits per symbol (1-8)
+ */
+void m65dec_generate_fixed(asm_buffer_t *a, const char *label,
+                           const char *table_label, int width)
+{
+    char encoding[16];
+    int sentinel = (0x100 >> width) & 0xFF;
+    asm_scope(a, label);
+    asm_text(a, "; Fixed-width decoder automatically generated by huffpuff.");
+    asm_text(a, "; Every character is coded in %d bits.", width);
+    asm_text(a, "; The following zero page variables must be defined:");
+    asm_text(a, ";   %s_ptr (2 bytes): address of the next byte of encoded string data", label);
+    asm_text(a, ";   %s_bits (1 byte): bit buffer; set to 0 before decoding the first character of a string", label);
+    asm_text(a, "; out: A = decoded character");
+    asm_text(a, "; destroys X, Y");
+    asm_label(a, "%s", label);
+    sprintf(encoding, "A9 %.2X", sentinel);
+    asm_emit(a, encoding, "lda #$%.2X", sentinel);
+    asm_label(a, ".next");
+    asm_emit(a, "06 <.bits", "asl .bits");
+    asm_emit(a, "D0 @.bit", "bne .bit");
+    /* Buffer empty; shift in the next byte */
+    asm_emit(a, "AA", "tax");
+    asm_emit(a, "A0 00", "ldy #0");
+    asm_emit(a, "B1 <.ptr", "lda (.ptr),y");
+    asm_emit(a, "E6 <.ptr", "inc .ptr");
+    asm_emit(a, "D0 @.refilled", "bne .refilled");
+    asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+    asm_label(a, ".refilled");
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "2A", "rol a");
+    asm_emit(a, "85 <.bits", "sta .bits");
+    asm_emit(a, "8A", "txa");
+    asm_label(a, ".bit");
+    asm_emit(a, "2A", "rol a");
+    asm_emit(a, "90 @.next", "bcc .next");
+    asm_emit(a, "AA", "tax");
+    asm_emit(a, "BD !TABLE", "lda %s,x", table_label);
+    asm_emit(a, "60", "rts");
+}
+
+/**
+ * Runs the generated decoder on every string and checks the result.
+ * @param cpu CPU_6502 or CPU_65816
+ * @param root Root of Huffman tree
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters, or NULL
+ * @param format Format of the interior nodes (6502 only; TABLE_REL8 etc.)
+ * @param decoder DECODER_TABLE, or DECODER_CODE for the tree-as-code 6502 decoder
+ * @param root_bits Number of bits that the root lookup table of the 6502
+ *        table-walk decoder takes at once, or 0 for none
+ * @param fixed The fixed-width code of the strings, or NULL if they are Huffman-coded
+ * @param head Encoded strings
+ * @param code_size Where to store the size of the decoder
+ * @param cycles_per_char Where to store the average decoding time
+ * @return 0 if fail, 1 if OK
+ */
+int m65dec_validate(int cpu, huffman_node_t *root, const unsigned short *charmap,
+                    const charmap_sequence_t *sequences, int format, int decoder,
+                    int root_bits, const fixed_code_t *fixed,
+                    const string_list_t *head, int *code_size, double *cycles_per_char)
+{
+    asm_buffer_t a;
+    int root_positions[1 << HUFFMAN_MAX_ROOT_BITS];
+    m65_t m;
+    const string_list_t *str;
+    unsigned long total_cycles = 0;
+    unsigned long char_count = 0;
+    unsigned long table_address;
+    unsigned long data_address;
+    unsigned long data_limit;
+    int record_size = 2;
+    int table_size;
+    int ok = 1;
+    const char *name = (cpu == CPU_65816) ? "65816" : "6502";
+
+    if (root == 0)
+        return 1;
+    if (cpu == CPU_65816) {
+        table_address = TABLE_ADDRESS_65816;
+        data_address = DATA_ADDRESS_65816;
+        data_limit = DATA_LIMIT_65816;
+        record_size = m65dec_record_size(root, charmap);
+        table_size = huffman_table_image16(root, charmap, record_size, 0);
+    } else {
+        table_address = TABLE_ADDRESS_6502;
+        data_address = DATA_ADDRESS_6502;
+        data_limit = DATA_LIMIT_6502;
+        table_size = huffman_table_image(root, charmap, sequences, cpu, format,
+                                         table_address, 0);
+    }
+    if (fixed)
+        table_size = fixed->count;
+    else if (decoder == DECODER_CODE)
+        table_size = 0;
+    if ((table_size < 0) || (table_address + table_size > data_address)) {
+        fprintf(stderr, "error: decoder table does not fit the %s table format\n", name);
+        return 0;
+    }
+    if (root_bits && !huffman_root_positions(root, root_bits, root_positions)) {
+        fprintf(stderr, "error: a code is shorter than the %d bits of the root lookup\n",
+                root_bits);
+        return 0;
+    }
+
+    asm_init(&a, CODE_ADDRESS);
+    if (fixed) {
+        m65dec_generate_fixed(&a, "huff_decode", "huff_table", fixed->width);
+    } else if (decoder == DECODER_CODE) {
+        m65dec_generate_code(&a, "huff_decode", root, charmap, sequences);
+    } else {
+        m65dec_generate(&a, cpu, "huff_decode", "huff_table", record_size,
+                        huffman_leaf_format(root, sequences), format, root_bits,
+                        root_positions);
+    }
+    asm_define(&a, "TABLE", table_address & 0xFFFF);
+    asm_define(&a, "huff_table", table_address & 0xFFFF);
+    asm_define(&a, "huff_decode_ptr", ZP_ADDRESS);
+    asm_define(&a, "huff_decode_bits", ZP_ADDRESS + 2);
+    asm_define(&a, "huff_decode_tree", ZP_ADDRESS + 4);
+    asm_define(&a, "huff_decode_out", ZP_ADDRESS + 6);
+    if (!asm_link(&a)) {
+        asm_free(&a);
+        return 0;
+    }
+    *code_size = a.size;
+    if (CODE_ADDRESS + a.size > (DATA_ADDRESS_6502 & 0xFFFF)) {
+        fprintf(stderr, "error: generated %s decoder too large for the test harness\n", name);
+        asm_free(&a);
+        return 0;
+    }
+
+    m65_init(&m, cpu != CPU_65816);
+    memcpy(&m.mem[CODE_ADDRESS], a.code, a.size);
+    if (cpu == CPU_65816) {
+        huffman_table_image16(root, charmap, record_size, &m.mem[table_address]);
+        m65_native(&m, 1, 1);
+        m.s = 0x1FFF;
+        m.dbr = table_address >> 16;
+    } else if (fixed) {
+        int i;
+        for (i = 0; i < fixed->count; ++i)
+            m.mem[table_address + i] = (unsigned char)charmap[fixed->symbols[i]];
+    } else if (decoder == DECODER_TABLE) {
+        huffman_table_image(root, charmap, sequences, cpu, format,
+                            table_address, &m.mem[table_address]);
+    }
+
+    for (str = head; ok && (str != NULL); str = str->next) {
+        int i;
+        if (data_address + str->huff_size + 1 > data_limit) {
+            fprintf(stderr, "error: encoded string too large for the %s test harness\n", name);
+            ok = 0;
+            break;
+        }
+        memcpy(&m.mem[data_address], str->huff_data, str->huff_size);
+        m.mem[ZP_ADDRESS] = data_address & 0xFF;
+        m.mem[ZP_ADDRESS + 1] = (data_address >> 8) & 0xFF;
+        m.mem[ZP_ADDRESS + 2] = 0;
+        m.mem[ZP_ADDRESS + 3] = 0;
+        for (i = 0; i < str->length; ++i) {
+            int c = str->symbols[i];
+            unsigned long start;
+            unsigned result;
+            m.mem[ZP_ADDRESS + 6] = OUT_ADDRESS_6502 & 0xFF;
+            m.mem[ZP_ADDRESS + 7] = OUT_ADDRESS_6502 >> 8;
+            memset(&m.mem[OUT_ADDRESS_6502], 0, CHARMAP_MAX_SEQUENCE);
+            start = m.cycles;
+            if (!m65_call(&m, CODE_ADDRESS, 100000)) {
+                fprintf(stderr, "*** fatal error: generated %s decoder crashed at $%.4X\n",
+                        name, m.pc);
+                ok = 0;
+                break;
+            }
+            result = (cpu == CPU_65816) ? m.a : (m.a & 0xFF);
+            if (sequences) {
+                /* Check the copied bytes and the updated output pointer */
+                const charmap_sequence_t *seq = &sequences[c];
+                int end = OUT_ADDRESS_6502 + seq->length;
+                if (memcmp(&m.mem[OUT_ADDRESS_6502], seq->bytes, seq->length)
+                    || (m.mem[ZP_ADDRESS + 6] != (end & 0xFF))
+                    || (m.mem[ZP_ADDRESS + 7] != (end >> 8))) {
+                    fprintf(stderr, "*** fatal error: generated %s decoder output wrong byte sequence\n",
+                            name);
+                    fprintf(stderr, "    original: %s\n", str->text);
+                    ok = 0;
+                    break;
+                }
+            } else if (result != charmap[c]) {
+                fprintf(stderr, "*** fatal error: generated %s decoder returned $%.2X, expected $%.2X\n",
+                        name, result, charmap[c]);
+                fprintf(stderr, "    original: %s\n", str->text);
+                ok = 0;
+                break;
+            }
+            total_cycles += m.cycles - start;
+            char_count++;
+        }
+    }
+    *cycles_per_char = char_count ? (double)total_cycles / char_count : 0;
+    m65_free(&m);
+    asm_free(&a);
+    return ok;
+}
+
+/**
+ * Generates the 6502 routine that looks up the far pointer of a string.
+ * @param a Where to generate the code
+ * @param label Name of the routine
+ * @param decoder_label Name of the decoder, whose string pointer is set
+ * @param table_label Name of the far pointer table; its arrays are
+ *        <table_label>_lo, _hi and _bank
+ * @param count Number of strings
+ */
+void m65dec_generate_lookup(asm_buffer_t *a, const char *label, const char *decoder_label,
+                            const char *table_label, int count)
+{
+    static const char *parts[3] = { "lo", "hi", "bank" };
+    int i;
+    asm_scope(a, label);
+    asm_text(a, "; Far pointer lookup automatically generated by huffpuff.");
+    if (count > 256) {
+        asm_text(a, "; The following zero page variable must be defined:");
+        asm_text(a, ";   %s_tp (2 bytes): pointer into the far pointer table", label);
+        asm_text(a, "; in: X = string number / 256, Y = string number %% 256");
+    } else {
+        asm_text(a, "; in: Y = string number");
+    }
+    asm_text(a, "; out: %s_ptr = address of the string, A = its bank", decoder_label);
+    asm_text(a, "; preserves X, Y");
+    asm_label(a, "%s", label);
+    for (i = 0; i < 3; i++) {
+        char encoding[16];
+        if (count > 256) {
+            /* Point .tp at the sub-table */
+            asm_emit(a, "8A", "txa");
+            asm_emit(a, "18", "clc");
+            sprintf(encoding, "69 >%s", (i == 0) ? "LO" : (i == 1) ? "HI" : "BANK");
+            asm_emit(a, encoding, "adc #>%s_%s", table_label, parts[i]);
+            asm_emit(a, "85 <.tp+1", "sta .tp+1");
+            sprintf(encoding, "A9 <%s", (i == 0) ? "LO" : (i == 1) ? "HI" : "BANK");
+            asm_emit(a, encoding, "lda #<%s_%s", table_label, parts[i]);
+            asm_emit(a, "85 <.tp", "sta .tp");
+            asm_emit(a, "B1 <.tp", "lda (.tp),y");
+        } else {
+            sprintf(encoding, "B9 !%s", (i == 0) ? "LO" : (i == 1) ? "HI" : "BANK");
+            asm_emit(a, encoding, "lda %s_%s,y", table_label, parts[i]);
+        }
+        if (i == 0)
+            asm_emit(a, "85 <PTR", "sta %s_ptr", decoder_label);
+        else if (i == 1)
+            asm_emit(a, "85 <PTR+1", "sta %s_ptr+1", decoder_label);
+    }
+    asm_emit(a, "60", "rts");
+}
+
+/**
+ * Runs the generated far pointer lookup for every string and checks the
+ * result. Only the first LOOKUP_MAX_STRINGS strings are looked up; the
+ * code is the same for all sub-tables.
+ * @param count Number of strings
+ * @param addresses Address of every string
+ * @param banks Bank of every string
+ * @param code_size Where to store the size of the routine
+ * @param cycles_per_lookup Where to store the average time of a lookup,
+ *        with the JSR
+ * @return 0 if fail, 1 if OK
+ */
+int m65dec_validate_lookup(int count, const int *addresses, const int *banks,
+                           int *code_size, double *cycles_per_lookup)
+{
+    asm_buffer_t a;
+    m65_t m;
+    unsigned long total_cycles = 0;
+    int tested = (count < LOOKUP_MAX_STRINGS) ? count : LOOKUP_MAX_STRINGS;
+    int i;
+    int ok = 1;
+
+    asm_init(&a, CODE_ADDRESS);
+    m65dec_generate_lookup(&a, "huff_lookup", "huff_decode", "huff_strings", count);
+    asm_define(&a, "LO", LOOKUP_ADDRESS_6502);
+    asm_define(&a, "HI", LOOKUP_ADDRESS_6502 + tested);
+    asm_define(&a, "BANK", LOOKUP_ADDRESS_6502 + 2 * tested);
+    asm_define(&a, "PTR", ZP_ADDRESS);
+    asm_define(&a, "huff_lookup_tp", ZP_ADDRESS + 2);
+    if (!asm_link(&a)) {
+        asm_free(&a);
+        return 0;
+    }
+    *code_size = a.size;
+
+    m65_init(&m, 1);
+    memcpy(&m.mem[CODE_ADDRESS], a.code, a.size);
+    for (i = 0; i < tested; i++) {
+        m.mem[LOOKUP_ADDRESS_6502 + i] = addresses[i] & 0xFF;
+        m.mem[LOOKUP_ADDRESS_6502 + tested + i] = (addresses[i] >> 8) & 0xFF;
+        m.mem[LOOKUP_ADDRESS_6502 + 2 * tested + i] = banks[i] & 0xFF;
+    }
+    for (i = 0; ok && (i < tested); i++) {
+        unsigned long start = m.cycles;
+        m.x = i >> 8;
+        m.y = i & 0xFF;
+        if (!m65_call(&m, CODE_ADDRESS, 1000)) {
+            fprintf(stderr, "*** fatal error: generated 6502 lookup crashed at $%.4X\n", m.pc);
+            ok = 0;
+            break;
+        }
+        if (((m.a & 0xFF) != (banks[i] & 0xFF))
+            || (m.mem[ZP_ADDRESS] != (addresses[i] & 0xFF))
+            || (m.mem[ZP_ADDRESS + 1] != ((addresses[i] >> 8) & 0xFF))) {
+            fprintf(stderr, "*** fatal error: generated 6502 lookup returned $%.2X:%.2X%.2X "
+                    "for string %d, expected $%.2X:%.4X\n", m.a & 0xFF, m.mem[ZP_ADDRESS + 1],
+                    m.mem[ZP_ADDRESS], i, banks[i] & 0xFF, addresses[i] & 0xFFFF);
+            ok = 0;
+        }
+        total_cycles += m.cycles - start;
+    }
+    *cycles_per_lookup = tested ? (double)total_cycles / tested : 0;
+    m65_free(&m);
+    asm_free(&a);
+    return ok;
+}
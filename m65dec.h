@@ -0,0 +1,38 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef M65DEC_H
+#define M65DEC_H
+
+#include "asmgen.h"
+#include "huffpuff.h"
+#include "fixed.h"
+
+int m65dec_record_size(huffman_node_t *, const unsigned short *);
+void m65dec_generate(asm_buffer_t *, int, const char *, const char *, int, int, int,
+                     int, const int *);
+void m65dec_generate_code(asm_buffer_t *, const char *, huffman_node_t *,
+                          const unsigned short *, const charmap_sequence_t *);
+void m65dec_generate_fixed(asm_buffer_t *, const char *, const char *, int);
+void m65dec_generate_lookup(asm_buffer_t *, const char *, const char *, const char *, int);
+int m65dec_validate_lookup(int, const int *, const int *, int *, double *);
+int m65dec_validate(int, huffman_node_t *, const unsigned short *,
+                    const charmap_sequence_t *, int, int, int, const fixed_code_t *,
+                    const string_list_t *,
+                    int *, double *);
+
+#endif  /* !M65DEC_H */
@@ -0,0 +1,309 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the 6502 encoder generator.
+ *
+ * The encoder lets a game compress text that the player enters, so that it
+ * can be stored in little save memory and decoded by the generated decoder.
+ * Its tables give the length and the left-aligned code of every character
+ * value in the range of the values that have a code; the codes are split
+ * into one table per byte, so that they can be indexed with X. The bits
+ * are shifted into a zero page bit buffer with a sentinel bit, like the
+ * decoder's: when the sentinel is shifted out, the buffer holds a full
+ * byte, which is stored through a zero page pointer.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "m65enc.h"
+#include "m65.h"
+
+/* Where the validation harness puts things */
+#define ZP_ADDRESS          0x0010
+#define CODE_ADDRESS        0x8000
+#define OUT_ADDRESS         0x1000
+#define OUT_LIMIT           0x7FF0
+
+/**
+ * Builds the encoder table.
+ * @param values Value of every character, or -1 if it cannot be encoded
+ * @param codes Code of every symbol (length 0: no code)
+ * @param table Where to store the table
+ * @return 0 if a code is longer than M65ENC_MAX_CODE bits, 1 if OK
+ */
+int m65enc_build_table(const int *values, const struct huffman_code *codes,
+                       m65enc_table_t *table)
+{
+    int last = -1;
+    int max_length = 0;
+    int c, v, i;
+    for (v = 0; v < 256; v++)
+        table->symbols[v] = -1;
+    for (c = 0; c < 256; c++) {
+        v = values[c];
+        if ((v < 0) || (codes[c].length == 0) || (table->symbols[v] != -1))
+            continue;
+        if (codes[c].length > M65ENC_MAX_CODE)
+            return 0;
+        table->symbols[v] = c;
+        if (codes[c].length > max_length)
+            max_length = codes[c].length;
+    }
+    table->first = 0;
+    while ((table->first < 256) && (table->symbols[table->first] == -1))
+        table->first++;
+    for (v = 0; v < 256; v++) {
+        if (table->symbols[v] != -1)
+            last = v;
+    }
+    table->count = (last >= table->first) ? last - table->first + 1 : 0;
+    table->code_bytes = (max_length + 7) / 8;
+    for (i = 0; i < table->count; i++) {
+        const struct huffman_code *code;
+        unsigned long bits;
+        int j;
+        c = table->symbols[table->first + i];
+        if (c == -1) {
+            table->lengths[i] = 0;
+            memset(table->codes[i], 0, sizeof(table->codes[i]));
+            continue;
+        }
+        code = &codes[c];
+        table->lengths[i] = (unsigned char)code->length;
+        bits = (unsigned long)code->code << (M65ENC_MAX_CODE - code->length);
+        for (j = 0; j < (M65ENC_MAX_CODE + 7) / 8; j++)
+            table->codes[i][j] = (bits >> (M65ENC_MAX_CODE - 8 * (j + 1))) & 0xFF;
+    }
+    return 1;
+}
+
+/**
+ * Emits a table of bytes as data.
+ */
+static void emit_bytes(asm_buffer_t *a, const unsigned char *bytes, int count,
+                       int stride)
+{
+    char encoding[16 * 3 + 1];
+    char text[16 * 4 + 8];
+    int i, j;
+    for (i = 0; i < count; i += 16) {
+        int n = (count - i < 16) ? count - i : 16;
+        encoding[0] = '\0';
+        strcpy(text, ".db ");
+        for (j = 0; j < n; j++) {
+            sprintf(encoding + strlen(encoding), "%s%.2X", j ? " " : "",
+                    bytes[(i + j) * stride]);
+            sprintf(text + strlen(text), "%s$%.2X", j ? "," : "", bytes[(i + j) * stride]);
+        }
+        asm_emit(a, encoding, "%s", text);
+    }
+}
+
+/**
+ * Returns the name of a byte of the zero page work area.
+ */
+static const char *code_byte(int i, char *name)
+{
+    if (i == 0)
+        strcpy(name, ".code");
+    else
+        sprintf(name, ".code+%d", i);
+    return name;
+}
+
+/**
+ * Generates the 6502 encoder and its tables.
+ * @param a Buffer to generate into
+ * @param label Name of the encoder; its flush routine is label_flush
+ * @param table The encoder table
+ */
+void m65enc_generate(asm_buffer_t *a, const char *label, const m65enc_table_t *table)
+{
+    char encoding[64];
+    char name[32];
+    int i;
+    asm_scope(a, label);
+    asm_text(a, "; Huffman encoder automatically generated by huffpuff.");
+    asm_text(a, "; The following zero page variables must be defined:");
+    asm_text(a, ";   %s_ptr (2 bytes): address of the next byte of encoded string data", label);
+    asm_text(a, ";   %s_bits (1 byte): bit buffer; set to 1 before encoding the first character of a string", label);
+    asm_text(a, ";   %s_code (%d byte%s): work area", label, table->code_bytes,
+             (table->code_bytes == 1) ? "" : "s");
+    asm_text(a, "; Call %s_flush after the last character to store the remaining bits.", label);
+    asm_text(a, "; in:  A = character value");
+    asm_text(a, "; out: carry clear if the character was encoded, set if it has no code");
+    asm_text(a, "; destroys A, X, Y");
+    asm_label(a, "%s", label);
+    if (table->first > 0) {
+        asm_emit(a, "38", "sec");
+        sprintf(encoding, "E9 %.2X", table->first);
+        asm_emit(a, encoding, "sbc #$%.2X", table->first);
+    }
+    if (table->count < 256) {
+        /* Values outside the table wrap around to above its end */
+        sprintf(encoding, "C9 %.2X", table->count);
+        asm_emit(a, encoding, "cmp #$%.2X", table->count);
+        asm_emit(a, "B0 @.fail", "bcs .fail");
+    }
+    asm_emit(a, "AA", "tax");
+    asm_emit(a, "BD !.lengths", "lda .lengths,x");
+    asm_emit(a, "F0 @.fail", "beq .fail");
+    asm_emit(a, "A8", "tay");
+    for (i = 0; i < table->code_bytes; i++) {
+        sprintf(encoding, "BD !.code%d", i);
+        asm_emit(a, encoding, "lda .code%d,x", i);
+        sprintf(encoding, "85 <%s", code_byte(i, name));
+        asm_emit(a, encoding, "sta %s", name);
+    }
+    asm_label(a, ".loop");
+    /* Shift the next bit of the code into the bit buffer */
+    for (i = table->code_bytes - 1; i >= 0; i--) {
+        sprintf(encoding, "%s <%s", (i == table->code_bytes - 1) ? "06" : "26",
+                code_byte(i, name));
+        asm_emit(a, encoding, "%s %s", (i == table->code_bytes - 1) ? "asl" : "rol", name);
+    }
+    asm_emit(a, "26 <.bits", "rol .bits");
+    asm_emit(a, "90 @.next", "bcc .next");
+    /* The sentinel was shifted out; store the full byte */
+    asm_emit(a, "A5 <.bits", "lda .bits");
+    asm_emit(a, "A2 00", "ldx #0");
+    asm_emit(a, "81 <.ptr", "sta (.ptr,x)");
+    asm_emit(a, "E6 <.ptr", "inc .ptr");
+    asm_emit(a, "D0 @.stored", "bne .stored");
+    asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+    asm_label(a, ".stored");
+    asm_emit(a, "A9 01", "lda #$01");
+    asm_emit(a, "85 <.bits", "sta .bits");
+    asm_label(a, ".next");
+    asm_emit(a, "88", "dey");
+    asm_emit(a, "D0 @.loop", "bne .loop");
+    asm_emit(a, "18", "clc");
+    asm_emit(a, "60", "rts");
+    asm_label(a, ".fail");
+    asm_emit(a, "38", "sec");
+    asm_emit(a, "60", "rts");
+
+    asm_text(a, "; Stores the bits that are left in the bit buffer, padded with zeros.");
+    asm_text(a, "; destroys A, X");
+    asm_label(a, "%s_flush", label);
+    asm_emit(a, "A5 <.bits", "lda .bits");
+    asm_emit(a, "C9 01", "cmp #$01");
+    asm_emit(a, "F0 @.flushed", "beq .flushed");
+    asm_label(a, ".pad");
+    asm_emit(a, "0A", "asl a");
+    asm_emit(a, "90 @.pad", "bcc .pad");
+    asm_emit(a, "A2 00", "ldx #0");
+    asm_emit(a, "81 <.ptr", "sta (.ptr,x)");
+    asm_emit(a, "E6 <.ptr", "inc .ptr");
+    asm_emit(a, "D0 @.reset", "bne .reset");
+    asm_emit(a, "E6 <.ptr+1", "inc .ptr+1");
+    asm_label(a, ".reset");
+    asm_emit(a, "A9 01", "lda #$01");
+    asm_emit(a, "85 <.bits", "sta .bits");
+    asm_label(a, ".flushed");
+    asm_emit(a, "60", "rts");
+
+    asm_text(a, "; Code length of every value from $%.2X on (0: no code)", table->first);
+    asm_label(a, ".lengths");
+    emit_bytes(a, table->lengths, table->count, 1);
+    for (i = 0; i < table->code_bytes; i++) {
+        asm_text(a, "; Byte %d of every left-aligned code", i);
+        asm_label(a, ".code%d", i);
+        emit_bytes(a, &table->codes[0][i], table->count, sizeof(table->codes[0]));
+    }
+}
+
+/**
+ * Runs the generated encoder on every string and checks the result.
+ * @param table The encoder table
+ * @param values Value of every character
+ * @param head Strings of characters, encoded by encode_strings()
+ * @param code_size Where to store the size of the encoder and its tables
+ * @param cycles_per_char Where to store the average encoding time
+ * @return 0 if fail, 1 if OK
+ */
+int m65enc_validate(const m65enc_table_t *table, const int *values,
+                    const string_list_t *head, int *code_size, double *cycles_per_char)
+{
+    asm_buffer_t a;
+    m65_t m;
+    const string_list_t *str;
+    unsigned long total_cycles = 0;
+    unsigned long char_count = 0;
+    int flush;
+    int ok = 1;
+
+    asm_init(&a, CODE_ADDRESS);
+    m65enc_generate(&a, "huff_encode", table);
+    asm_define(&a, "huff_encode_ptr", ZP_ADDRESS);
+    asm_define(&a, "huff_encode_bits", ZP_ADDRESS + 2);
+    asm_define(&a, "huff_encode_code", ZP_ADDRESS + 3);
+    if (!asm_link(&a) || !asm_lookup(&a, "huff_encode_flush", &flush)) {
+        asm_free(&a);
+        return 0;
+    }
+    *code_size = a.size;
+
+    m65_init(&m, 1);
+    memcpy(&m.mem[CODE_ADDRESS], a.code, a.size);
+    for (str = head; ok && (str != NULL); str = str->next) {
+        int end = OUT_ADDRESS + str->huff_size;
+        int i;
+        if (end > OUT_LIMIT) {
+            fprintf(stderr, "error: encoded string too large for the 6502 test harness\n");
+            ok = 0;
+            break;
+        }
+        memset(&m.mem[OUT_ADDRESS], 0xFF, str->huff_size + 1);
+        m.mem[ZP_ADDRESS] = OUT_ADDRESS & 0xFF;
+        m.mem[ZP_ADDRESS + 1] = OUT_ADDRESS >> 8;
+        m.mem[ZP_ADDRESS + 2] = 1;
+        for (i = 0; i <= str->length; ++i) {
+            unsigned long start = m.cycles;
+            if (i < str->length)
+                m.a = values[str->symbols[i]];
+            if (!m65_call(&m, (i < str->length) ? CODE_ADDRESS : flush, 100000)) {
+                fprintf(stderr, "*** fatal error: generated 6502 encoder crashed at $%.4X\n",
+                        m.pc);
+                ok = 0;
+                break;
+            }
+            if (i == str->length)
+                break;
+            if (m.p & M65_C) {
+                fprintf(stderr, "*** fatal error: generated 6502 encoder rejected $%.2X\n",
+                        values[str->symbols[i]]);
+                ok = 0;
+                break;
+            }
+            total_cycles += m.cycles - start;
+            char_count++;
+        }
+        if (ok && (memcmp(&m.mem[OUT_ADDRESS], str->huff_data, str->huff_size)
+                   || (m.mem[ZP_ADDRESS] != (end & 0xFF))
+                   || (m.mem[ZP_ADDRESS + 1] != (end >> 8)))) {
+            fprintf(stderr, "*** fatal error: generated 6502 encoder output wrong data\n");
+            fprintf(stderr, "    original: %s\n", str->text);
+            ok = 0;
+        }
+    }
+    *cycles_per_char = char_count ? (double)total_cycles / char_count : 0;
+    m65_free(&m);
+    asm_free(&a);
+    return ok;
+}
@@ -0,0 +1,44 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef M65ENC_H
+#define M65ENC_H
+
+#include "asmgen.h"
+#include "huffpuff.h"
+
+/* Longest code the 6502 encoder handles */
+#define M65ENC_MAX_CODE 24
+
+/* The encoder table: the code of every character value in a range */
+struct m65enc_table {
+    int first;                  /* first value in the table */
+    int count;                  /* number of values */
+    int code_bytes;             /* bytes per code, left-aligned */
+    int symbols[256];           /* character coded for each value, or -1 */
+    unsigned char lengths[256];
+    unsigned char codes[256][(M65ENC_MAX_CODE + 7) / 8];
+};
+
+typedef struct m65enc_table m65enc_table_t;
+
+int m65enc_build_table(const int *, const struct huffman_code *, m65enc_table_t *);
+void m65enc_generate(asm_buffer_t *, const char *, const m65enc_table_t *);
+int m65enc_validate(const m65enc_table_t *, const int *, const string_list_t *,
+                    int *, double *);
+
+#endif  /* !M65ENC_H */
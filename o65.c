@@ -0,0 +1,240 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the o65 object file writer.
+ *
+ * o65 is the relocatable object format of the xa assembler and of
+ * several 6502 linkers and loaders. A file holds one module, or a chain
+ * of modules in which every module but the last has the chain bit of its
+ * mode set. huffpuff puts each part of its output (the decoder table,
+ * the string data, the string pointer table) in a module of its own,
+ * whose bytes are the text segment, so that each can be linked to an
+ * address of its own. Labels are exported as global symbols; references
+ * to the labels of another module are undefined symbols, which the
+ * relocation entries name.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "o65.h"
+#include "huffpuff.h"
+
+/* Mode bits */
+#define MODE_65816  0x8000
+#define MODE_OBJECT 0x1000
+#define MODE_CHAIN  0x0400
+
+/* Segment IDs */
+#define SEG_UNDEFINED 0
+#define SEG_TEXT      2
+
+/* Header option types */
+#define OPTION_FILENAME  0
+#define OPTION_ASSEMBLER 2
+
+/**
+ * Initializes a module.
+ * @param m The module
+ * @param name Name of the module, stored as its file name option
+ */
+void o65_init(o65_module_t *m, const char *name)
+{
+    memset(m, 0, sizeof(*m));
+    m->name = (char *)malloc(strlen(name) + 1);
+    strcpy(m->name, name);
+}
+
+/**
+ * Frees the memory of a module.
+ */
+void o65_free(o65_module_t *m)
+{
+    int i;
+    for (i = 0; i < m->undefined_count; i++)
+        free(m->undefined[i]);
+    for (i = 0; i < m->export_count; i++)
+        free(m->exports[i].name);
+    free(m->undefined);
+    free(m->exports);
+    free(m->relocs);
+    free(m->text);
+    free(m->name);
+}
+
+/**
+ * Appends bytes to the text segment of a module.
+ */
+void o65_bytes(o65_module_t *m, const unsigned char *buf, int size)
+{
+    if (m->size + size > m->max_size) {
+        while (m->size + size > m->max_size)
+            m->max_size = m->max_size ? 2 * m->max_size : 256;
+        m->text = (unsigned char *)realloc(m->text, m->max_size);
+    }
+    memcpy(&m->text[m->size], buf, size);
+    m->size += size;
+}
+
+/**
+ * Adds an undefined symbol: a label of another module.
+ * @param m The module
+ * @param name Name of the symbol
+ * @return Index of the symbol, for o65_reloc()
+ */
+int o65_import(o65_module_t *m, const char *name)
+{
+    if ((m->undefined_count & 255) == 0) {
+        m->undefined = (char **)realloc(m->undefined,
+                                        (m->undefined_count + 256) * sizeof(char *));
+    }
+    m->undefined[m->undefined_count] = (char *)malloc(strlen(name) + 1);
+    strcpy(m->undefined[m->undefined_count], name);
+    return m->undefined_count++;
+}
+
+/**
+ * Adds a relocation entry. Entries must be added in order of offset.
+ * @param m The module
+ * @param offset Where the relocated byte or word is
+ * @param type O65_WORD, O65_HIGH or O65_LOW
+ * @param symbol Index of the undefined symbol whose address is stored, or
+ *        -1 for an address in the module itself
+ * @param low For O65_HIGH: the low byte of the address
+ */
+void o65_reloc(o65_module_t *m, int offset, int type, int symbol, int low)
+{
+    struct o65_reloc *r;
+    if ((m->reloc_count & 255) == 0) {
+        m->relocs = (struct o65_reloc *)realloc(m->relocs,
+                                                (m->reloc_count + 256) * sizeof(struct o65_reloc));
+    }
+    r = &m->relocs[m->reloc_count++];
+    r->offset = offset;
+    r->type = type;
+    r->symbol = symbol;
+    r->low = low;
+}
+
+/**
+ * Exports a symbol of a module.
+ * @param m The module
+ * @param name Name of the symbol
+ * @param value Offset of the symbol in the module
+ */
+void o65_export(o65_module_t *m, const char *name, int value)
+{
+    struct o65_symbol *s;
+    if ((m->export_count & 255) == 0) {
+        m->exports = (struct o65_symbol *)realloc(m->exports,
+                                                  (m->export_count + 256) * sizeof(struct o65_symbol));
+    }
+    s = &m->exports[m->export_count++];
+    s->name = (char *)malloc(strlen(name) + 1);
+    strcpy(s->name, name);
+    s->value = value;
+}
+
+static void put_word(FILE *out, int value)
+{
+    fputc(value & 0xFF, out);
+    fputc((value >> 8) & 0xFF, out);
+}
+
+static void put_option(FILE *out, int type, const char *text)
+{
+    fputc((int)strlen(text) + 3, out);
+    fputc(type, out);
+    fputs(text, out);
+    fputc(0, out);
+}
+
+/**
+ * Writes the relocation table of a segment.
+ */
+static void put_relocs(FILE *out, const o65_module_t *m)
+{
+    int previous = -1;
+    int i;
+    for (i = 0; i < m->reloc_count; i++) {
+        const struct o65_reloc *r = &m->relocs[i];
+        int distance = r->offset - previous;
+        while (distance > 254) {
+            fputc(255, out);
+            distance -= 254;
+        }
+        fputc(distance, out);
+        fputc(r->type | ((r->symbol >= 0) ? SEG_UNDEFINED : SEG_TEXT), out);
+        if (r->symbol >= 0)
+            put_word(out, r->symbol);
+        if (r->type == O65_HIGH)
+            fputc(r->low, out);
+        previous = r->offset;
+    }
+    fputc(0, out);
+}
+
+/**
+ * Writes modules as a chain of o65 object files.
+ * @param out File to write to
+ * @param modules The modules
+ * @param count Number of modules
+ * @param cpu Target CPU (CPU_6502 or CPU_65816)
+ */
+void o65_write(FILE *out, o65_module_t *modules, int count, int cpu)
+{
+    int i, j;
+    for (i = 0; i < count; i++) {
+        const o65_module_t *m = &modules[i];
+        int mode = MODE_OBJECT;
+        if (cpu == CPU_65816)
+            mode |= MODE_65816;
+        if (i < count - 1)
+            mode |= MODE_CHAIN;
+        /* Header; every segment is based at 0 */
+        fputc(0x01, out);
+        fputc(0x00, out);
+        fputs("o65", out);
+        fputc(0, out);
+        put_word(out, mode);
+        put_word(out, 0);
+        put_word(out, m->size);
+        for (j = 0; j < 7; j++)
+            put_word(out, 0);
+        put_option(out, OPTION_FILENAME, m->name);
+        put_option(out, OPTION_ASSEMBLER, "huffpuff");
+        fputc(0, out);
+        /* Text segment; the data segment is empty */
+        fwrite(m->text, 1, m->size, out);
+        /* Undefined symbols */
+        put_word(out, m->undefined_count);
+        for (j = 0; j < m->undefined_count; j++) {
+            fputs(m->undefined[j], out);
+            fputc(0, out);
+        }
+        /* Relocation of the text segment, and of the empty data segment */
+        put_relocs(out, m);
+        fputc(0, out);
+        /* Exported symbols */
+        put_word(out, m->export_count);
+        for (j = 0; j < m->export_count; j++) {
+            fputs(m->exports[j].name, out);
+            fputc(0, out);
+            fputc(SEG_TEXT, out);
+            put_word(out, m->exports[j].value);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef O65_H
+#define O65_H
+
+#include <stdio.h>
+
+/* Kinds of relocation */
+#define O65_WORD 0x80   /* a little-endian address */
+#define O65_HIGH 0x40   /* the high byte of an address */
+#define O65_LOW  0x20   /* the low byte of an address */
+
+/* A relocated byte or word of a module */
+struct o65_reloc {
+    int offset;
+    int type;           /* O65_WORD, O65_HIGH or O65_LOW */
+    int symbol;         /* index of the undefined symbol, or -1 for the module itself */
+    int low;            /* for O65_HIGH: low byte of the address */
+};
+
+/* A symbol exported by a module */
+struct o65_symbol {
+    char *name;
+    int value;          /* offset in the module */
+};
+
+/* One relocatable module; its bytes are in the text segment */
+struct o65_module {
+    char *name;
+    unsigned char *text;
+    int size;
+    int max_size;
+    struct o65_reloc *relocs;
+    int reloc_count;
+    char **undefined;
+    int undefined_count;
+    struct o65_symbol *exports;
+    int export_count;
+};
+
+typedef struct o65_module o65_module_t;
+
+void o65_init(o65_module_t *, const char *);
+void o65_free(o65_module_t *);
+void o65_bytes(o65_module_t *, const unsigned char *, int);
+int o65_import(o65_module_t *, const char *);
+void o65_reloc(o65_module_t *, int, int, int, int);
+void o65_export(o65_module_t *, const char *, int);
+void o65_write(FILE *, o65_module_t *, int, int);
+
+#endif  /* !O65_H */
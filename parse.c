@@ -0,0 +1,553 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the dictionary and the parsers that turn strings
+ * into symbols.
+ *
+ * Without a dictionary, every character is a symbol. With a dictionary,
+ * a string may also be split into tokens (symbols 256 and up). The greedy
+ * parser takes the longest token at every position. The optimal parser
+ * finds the split of each string that has the shortest encoding, using
+ * the code lengths of a Huffman tree built from the previous parse as
+ * costs; since the tree changes with the parse, parsing and rebuilding
+ * the tree are repeated until the total size stops shrinking. The strings
+ * are parsed in parallel.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "parse.h"
+#include "trace.h"
+
+/* Give up the optimal parse after this many rounds */
+#define MAX_ITERATIONS 16
+
+/* Maximum number of parser threads */
+#define MAX_THREADS 16
+
+/**
+ * Empties a dictionary.
+ * @param dict The dictionary
+ */
+void dictionary_init(dictionary_t *dict)
+{
+    int i;
+    dict->count = 0;
+    for (i = 0; i < 256; i++)
+        dict->first[i] = -1;
+}
+
+/**
+ * Adds a token to a dictionary, unless it is already there.
+ * @param dict The dictionary
+ * @param tok Characters of the token
+ * @param len Number of characters (at least 2)
+ * @return 0 if the dictionary is full, 1 if OK
+ */
+int dictionary_add(dictionary_t *dict, const unsigned char *tok, int len)
+{
+    int i;
+    for (i = 0; i < dict->count; i++) {
+        if ((dict->lengths[i] == len) && !memcmp(dict->tokens[i], tok, len))
+            return 1;
+    }
+    if (dict->count == PARSE_MAX_TOKENS)
+        return 0;
+    i = dict->count++;
+    dict->tokens[i] = (unsigned char *)malloc(len);
+    memcpy(dict->tokens[i], tok, len);
+    dict->lengths[i] = len;
+    dict->next[i] = dict->first[tok[0]];
+    dict->first[tok[0]] = i;
+    return 1;
+}
+
+/**
+ * Removes the tokens that were added last.
+ * @param dict The dictionary
+ * @param count Number of tokens to keep
+ */
+void dictionary_truncate(dictionary_t *dict, int count)
+{
+    int i;
+    while (dict->count > count) {
+        i = --dict->count;
+        free(dict->tokens[i]);
+    }
+    /* Relink the remaining tokens */
+    for (i = 0; i < 256; i++)
+        dict->first[i] = -1;
+    for (i = 0; i < count; i++) {
+        dict->next[i] = dict->first[dict->tokens[i][0]];
+        dict->first[dict->tokens[i][0]] = i;
+    }
+}
+
+/**
+ * Makes a dictionary of the first tokens of another one. The tokens are
+ * shared, so only the other dictionary is freed.
+ * @param src Dictionary to take the tokens from
+ * @param count Number of tokens to take
+ * @param dst Where to store the new dictionary
+ */
+void dictionary_head(const dictionary_t *src, int count, dictionary_t *dst)
+{
+    int i;
+    dictionary_init(dst);
+    for (i = 0; i < count; i++) {
+        dst->tokens[i] = src->tokens[i];
+        dst->lengths[i] = src->lengths[i];
+        dst->next[i] = dst->first[src->tokens[i][0]];
+        dst->first[src->tokens[i][0]] = i;
+    }
+    dst->count = count;
+}
+
+/**
+ * Reads a dictionary from file.
+ * The file contains one token per line. Empty lines and lines that start
+ * with # are ignored (use \# to start a token with #).
+ * @param filename Name of the dictionary file
+ * @param ignore_case Convert tokens to lower-case
+ * @param dict Where to store the dictionary
+ * @return 0 if fail, 1 if OK
+ */
+int dictionary_read(const char *filename, int ignore_case, dictionary_t *dict)
+{
+    FILE *fp;
+    char line[1024];
+    int lineno = 0;
+    int i;
+    dictionary_init(dict);
+    fp = fopen(filename, "rt");
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned char *tok = (unsigned char *)line;
+        int len;
+        lineno++;
+        len = strlen(line);
+        while ((len > 0) && ((line[len-1] == '\n') || (line[len-1] == '\r')))
+            line[--len] = '\0';
+        if ((len == 0) || (line[0] == '#'))
+            continue;
+        if ((line[0] == '\\') && (line[1] == '#')) {
+            tok++;
+            len--;
+        }
+        if (len < 2) {
+            fprintf(stderr, "error: %s:%d: a token must have at least two characters\n",
+                    filename, lineno);
+            fclose(fp);
+            return 0;
+        }
+        if (ignore_case) {
+            for (i = 0; i < len; i++) {
+                if ((tok[i] >= 'A') && (tok[i] <= 'Z'))
+                    tok[i] += 0x20;
+            }
+        }
+        if (!dictionary_add(dict, tok, len)) {
+            fprintf(stderr, "error: %s:%d: too many tokens (at most %d)\n",
+                    filename, lineno, PARSE_MAX_TOKENS);
+            fclose(fp);
+            return 0;
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+/**
+ * Frees the tokens of a dictionary.
+ * @param dict The dictionary
+ */
+void dictionary_free(dictionary_t *dict)
+{
+    int i;
+    for (i = 0; i < dict->count; i++)
+        free(dict->tokens[i]);
+    dict->count = 0;
+}
+
+/**
+ * Counts how often every symbol occurs in the parsed strings.
+ * @param head Strings
+ * @param freq Where to store the HUFFMAN_MAX_SYMBOLS counts
+ */
+void parse_count_symbols(const string_list_t *head, int *freq)
+{
+    const string_list_t *str;
+    int i;
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++)
+        freq[i] = 0;
+    for (str = head; str != NULL; str = str->next) {
+        for (i = 0; i < str->length; i++)
+            freq[str->symbols[i]]++;
+    }
+}
+
+/**
+ * Checks whether a token occurs at a position of a string.
+ */
+static int token_matches(const dictionary_t *dict, int t,
+                         const unsigned char *text, int remaining)
+{
+    return (dict->lengths[t] <= remaining)
+        && !memcmp(dict->tokens[t], text, dict->lengths[t]);
+}
+
+/**
+ * Returns the number of characters that a symbol stands for.
+ */
+static int symbol_length(const dictionary_t *dict, int symbol)
+{
+    return (symbol < 256) ? 1 : dict->lengths[symbol - 256];
+}
+
+/**
+ * Parses a string by always taking the longest token.
+ * @param str String to parse
+ * @param dict Dictionary, or NULL
+ * @param append_byte Byte appended to the string, or -1
+ */
+static void parse_greedy(string_list_t *str, const dictionary_t *dict,
+                         int append_byte)
+{
+    int n = str->text_length;
+    int i;
+    str->symbols = (int *)malloc((n + 1) * sizeof(int));
+    str->length = 0;
+    for (i = 0; i < n; ) {
+        int best = -1;
+        int t;
+        for (t = dict ? dict->first[str->text[i]] : -1; t != -1; t = dict->next[t]) {
+            if (token_matches(dict, t, &str->text[i], n - i)
+                && ((best == -1) || (dict->lengths[t] > dict->lengths[best]))) {
+                best = t;
+            }
+        }
+        if (best != -1) {
+            str->symbols[str->length++] = 256 + best;
+            i += dict->lengths[best];
+        } else {
+            str->symbols[str->length++] = str->text[i++];
+        }
+    }
+    if (append_byte != -1)
+        str->symbols[str->length++] = append_byte;
+}
+
+/**
+ * Parses a string into the symbols that give the shortest encoding.
+ * This is a shortest path search over the positions of the string, where
+ * a character or token is an edge whose cost is its code length.
+ * @param str String to parse
+ * @param dict Dictionary
+ * @param lengths Code length of every symbol
+ * @param append_byte Byte appended to the string, or -1
+ * @param cost Work buffer with room for the string length + 1 entries
+ * @param choice Work buffer with room for the string length + 1 entries
+ */
+static void parse_optimal(string_list_t *str, const dictionary_t *dict,
+                          const int *lengths, int append_byte,
+                          long *cost, int *choice)
+{
+    int n = str->text_length;
+    int count;
+    int i;
+    cost[0] = 0;
+    for (i = 1; i <= n; i++)
+        cost[i] = -1;
+    for (i = 0; i < n; i++) {
+        int t;
+        /* The character itself */
+        long c = cost[i] + lengths[str->text[i]];
+        if ((cost[i+1] < 0) || (c < cost[i+1])) {
+            cost[i+1] = c;
+            choice[i+1] = str->text[i];
+        }
+        /* Tokens that start here */
+        for (t = dict->first[str->text[i]]; t != -1; t = dict->next[t]) {
+            int j = i + dict->lengths[t];
+            if (!token_matches(dict, t, &str->text[i], n - i))
+                continue;
+            c = cost[i] + lengths[256 + t];
+            if ((cost[j] < 0) || (c < cost[j])) {
+                cost[j] = c;
+                choice[j] = 256 + t;
+            }
+        }
+    }
+    /* Trace back the path to count the symbols, then store them */
+    count = 0;
+    for (i = n; i > 0; i -= symbol_length(dict, choice[i]))
+        count++;
+    str->length = count;
+    str->symbols = (int *)malloc((count + 1) * sizeof(int));
+    for (i = n; i > 0; i -= symbol_length(dict, choice[i]))
+        str->symbols[--count] = choice[i];
+    if (append_byte != -1)
+        str->symbols[str->length++] = append_byte;
+}
+
+/**
+ * Parses one string into the symbols that are cheapest with the given
+ * code lengths.
+ * @param str String to parse
+ * @param dict Dictionary
+ * @param lengths Code length of every symbol
+ * @param append_byte Byte appended to the string, or -1
+ */
+void parse_string(string_list_t *str, const dictionary_t *dict,
+                  const int *lengths, int append_byte)
+{
+    int n = str->text_length;
+    long *cost = (long *)malloc((n + 1) * sizeof(long));
+    int *choice = (int *)malloc((n + 1) * sizeof(int));
+    parse_optimal(str, dict, lengths, append_byte, cost, choice);
+    free(cost);
+    free(choice);
+}
+
+/* The work of one parser thread */
+struct parse_job {
+    string_list_t **strings;
+    int count;
+    int first;
+    int step;
+    int tid;    /* in the trace */
+    const dictionary_t *dict;
+    const int *lengths;
+    int append_byte;
+};
+
+/**
+ * Parses every step'th string, starting with the first'th.
+ */
+static void *parse_thread(void *arg)
+{
+    struct parse_job *job = (struct parse_job *)arg;
+    long *cost = 0;
+    int *choice = 0;
+    int max_len = -1;
+    int parsed = 0;
+    double start = trace_now();
+    int i;
+    for (i = job->first; i < job->count; i += job->step, parsed++) {
+        string_list_t *str = job->strings[i];
+        int len = str->text_length;
+        if (len > max_len) {
+            max_len = len;
+            cost = (long *)realloc(cost, (len + 1) * sizeof(long));
+            choice = (int *)realloc(choice, (len + 1) * sizeof(int));
+        }
+        parse_optimal(str, job->dict, job->lengths, job->append_byte, cost, choice);
+    }
+    trace_span("parse batch", job->tid, start, "strings", parsed);
+    free(cost);
+    free(choice);
+    return NULL;
+}
+
+/**
+ * Computes the code length of every symbol from a Huffman tree built for
+ * the given frequencies. Unused symbols get a code one bit longer than the
+ * longest code.
+ * @param freq Symbol frequencies
+ * @param lengths Where to store the HUFFMAN_MAX_SYMBOLS code lengths
+ */
+static void code_lengths(const int *freq, int *lengths)
+{
+    huffman_node_t *leaves[HUFFMAN_MAX_SYMBOLS];
+    huffman_node_t *nodes[HUFFMAN_MAX_SYMBOLS];
+    huffman_node_t *root;
+    int count = 0;
+    int longest = 0;
+    double start = trace_now();
+    int i;
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        nodes[i] = 0;
+        if (freq[i] > 0) {
+            nodes[i] = huffman_create_node(
+                /*symbol=*/i, /*weight=*/freq[i],
+                /*left=*/NULL, /*right=*/NULL);
+            leaves[count++] = nodes[i];
+        }
+    }
+    root = huffman_build_tree(leaves, count);
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        if (nodes[i]) {
+            /* A tree with a single leaf still needs one bit */
+            lengths[i] = nodes[i]->code.length ? nodes[i]->code.length : 1;
+            if (lengths[i] > longest)
+                longest = lengths[i];
+        }
+    }
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        if (!nodes[i])
+            lengths[i] = longest + 1;
+    }
+    huffman_delete_node(root);
+    trace_span("code length tree", TRACE_MAIN_THREAD, start, "symbols", count);
+}
+
+/**
+ * Estimates the size of the decoder table and the encoded strings.
+ * @param head Parsed strings
+ * @param sequences Byte sequences of the symbols
+ * @return Size in bytes
+ */
+long parse_estimate_size(const string_list_t *head,
+                         const charmap_sequence_t *sequences)
+{
+    const string_list_t *str;
+    int freq[HUFFMAN_MAX_SYMBOLS];
+    int lengths[HUFFMAN_MAX_SYMBOLS];
+    long size = 0;
+    int i;
+    parse_count_symbols(head, freq);
+    code_lengths(freq, lengths);
+    /* Every leaf and its parent node */
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        if (freq[i] > 0)
+            size += 2 + 2 + sequences[i].length;
+    }
+    for (str = head; str != NULL; str = str->next) {
+        long bits = 0;
+        for (i = 0; i < str->length; i++)
+            bits += lengths[str->symbols[i]];
+        size += (bits + 7) / 8;
+    }
+    return size;
+}
+
+/**
+ * Parses all strings in parallel with the optimal parser.
+ */
+static void parse_all_optimal(string_list_t **strings, int count,
+                              const dictionary_t *dict, const int *lengths,
+                              int append_byte)
+{
+    pthread_t threads[MAX_THREADS];
+    struct parse_job jobs[MAX_THREADS];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = (cpus < 1) ? 1 : (cpus > MAX_THREADS) ? MAX_THREADS : (int)cpus;
+    int started;
+    int i;
+    if (thread_count > count)
+        thread_count = count;
+    for (i = 0; i < thread_count; i++) {
+        jobs[i].strings = strings;
+        jobs[i].count = count;
+        jobs[i].first = i;
+        jobs[i].step = thread_count;
+        jobs[i].tid = TRACE_MAIN_THREAD;
+        jobs[i].dict = dict;
+        jobs[i].lengths = lengths;
+        jobs[i].append_byte = append_byte;
+    }
+    for (started = 1; started < thread_count; started++) {
+        char name[32];
+        jobs[started].tid = TRACE_MAIN_THREAD + started;
+        if (pthread_create(&threads[started], NULL, parse_thread, &jobs[started])) {
+            jobs[started].tid = TRACE_MAIN_THREAD;
+            break;
+        }
+        sprintf(name, "parser %d", started);
+        trace_thread_name(TRACE_MAIN_THREAD + started, name);
+    }
+    /* The caller does its own share, and that of any thread that could not
+       be started; the jobs keep their stride, so every string is parsed once */
+    parse_thread(&jobs[0]);
+    for (i = started; i < thread_count; i++)
+        parse_thread(&jobs[i]);
+    for (i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+/**
+ * Parses strings into symbols.
+ * @param head Strings to parse
+ * @param dict Dictionary, or NULL to use only characters
+ * @param method PARSE_GREEDY or PARSE_OPTIMAL
+ * @param append_byte Byte appended to every string, or -1
+ * @param sequences Byte sequences of the symbols (used by PARSE_OPTIMAL)
+ * @return Number of parse rounds
+ */
+int parse_strings(string_list_t *head, const dictionary_t *dict, int method,
+                  int append_byte, const charmap_sequence_t *sequences)
+{
+    string_list_t **strings;
+    string_list_t *str;
+    int **previous;
+    int *previous_length;
+    long best_size;
+    int count = 0;
+    int rounds;
+    int i;
+
+    /* Start with the greedy parse */
+    for (str = head; str != NULL; str = str->next) {
+        parse_greedy(str, dict, append_byte);
+        count++;
+    }
+    if ((method != PARSE_OPTIMAL) || !dict || (count == 0))
+        return 1;
+
+    strings = (string_list_t **)malloc(count * sizeof(string_list_t *));
+    previous = (int **)malloc(count * sizeof(int *));
+    previous_length = (int *)malloc(count * sizeof(int));
+    for (i = 0, str = head; str != NULL; str = str->next, i++)
+        strings[i] = str;
+    best_size = parse_estimate_size(head, sequences);
+    for (rounds = 1; rounds <= MAX_ITERATIONS; rounds++) {
+        int freq[HUFFMAN_MAX_SYMBOLS];
+        int lengths[HUFFMAN_MAX_SYMBOLS];
+        long size;
+        double start = trace_now();
+        /* Re-estimate the code lengths from the current parse */
+        parse_count_symbols(head, freq);
+        code_lengths(freq, lengths);
+        for (i = 0; i < count; i++) {
+            previous[i] = strings[i]->symbols;
+            previous_length[i] = strings[i]->length;
+        }
+        parse_all_optimal(strings, count, dict, lengths, append_byte);
+        size = parse_estimate_size(head, sequences);
+        trace_span("parse round", TRACE_MAIN_THREAD, start, "round", rounds);
+        if (size >= best_size) {
+            /* No improvement; keep the previous parse */
+            for (i = 0; i < count; i++) {
+                free(strings[i]->symbols);
+                strings[i]->symbols = previous[i];
+                strings[i]->length = previous_length[i];
+            }
+            break;
+        }
+        best_size = size;
+        for (i = 0; i < count; i++)
+            free(previous[i]);
+    }
+    free(strings);
+    free(previous);
+    free(previous_length);
+    return (rounds > MAX_ITERATIONS) ? MAX_ITERATIONS : rounds;
+}
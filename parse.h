@@ -0,0 +1,53 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARSE_H
+#define PARSE_H
+
+#include "huffpuff.h"
+
+/* Maximum number of dictionary tokens; token i is symbol 256+i */
+#define PARSE_MAX_TOKENS (HUFFMAN_MAX_SYMBOLS - 256)
+
+/* Parse methods */
+#define PARSE_GREEDY  0
+#define PARSE_OPTIMAL 1
+
+/* A dictionary of tokens that may replace runs of characters */
+struct dictionary {
+    int count;
+    unsigned char *tokens[PARSE_MAX_TOKENS];
+    int lengths[PARSE_MAX_TOKENS];
+    int first[256];                 /* first token that starts with a character, or -1 */
+    int next[PARSE_MAX_TOKENS];     /* next token that starts with the same character */
+};
+
+typedef struct dictionary dictionary_t;
+
+void dictionary_init(dictionary_t *);
+int dictionary_add(dictionary_t *, const unsigned char *, int);
+void dictionary_truncate(dictionary_t *, int);
+void dictionary_head(const dictionary_t *, int, dictionary_t *);
+int dictionary_read(const char *, int, dictionary_t *);
+void dictionary_free(dictionary_t *);
+int parse_strings(string_list_t *, const dictionary_t *, int, int,
+                  const charmap_sequence_t *);
+void parse_string(string_list_t *, const dictionary_t *, const int *, int);
+void parse_count_symbols(const string_list_t *, int *);
+long parse_estimate_size(const string_list_t *, const charmap_sequence_t *);
+
+#endif  /* !PARSE_H */
@@ -0,0 +1,246 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the sampling estimator, which predicts the sizes of
+ * the output for a big text file from a few of its strings.
+ *
+ * Strings are drawn at random byte offsets of the file, so the chance of
+ * a string to be drawn is its share of the bytes of the file. Every draw
+ * then stands for file size / record size strings; the mean of those
+ * scaled values is an unbiased estimate of the total, and their spread
+ * gives its confidence interval. Only the drawn strings are read, so the
+ * time does not grow with the size of the file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sample.h"
+
+/* How many bytes are read at a time when looking for the start of a string */
+#define SCAN_BLOCK 4096
+
+/* Seed of the random offsets, so that runs can be compared */
+#define SAMPLE_SEED 0x2F6B3A91UL
+
+/* Two-sided 95% point of the normal distribution */
+#define Z_95 1.96
+
+/**
+ * Returns the next number of a linear congruential generator.
+ */
+static unsigned long next_random(unsigned long *state)
+{
+    *state = (*state * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+    return *state >> 8;
+}
+
+static int compare_offsets(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Finds the start of the string that holds a byte: the byte after the
+ * last separator before it that is not escaped with a backslash.
+ */
+static long string_start(FILE *in, long offset)
+{
+    unsigned char block[SCAN_BLOCK];
+    long end = offset;
+    while (end > 0) {
+        long start = (end > SCAN_BLOCK) ? end - SCAN_BLOCK : 0;
+        int n;
+        int i;
+        fseek(in, start, SEEK_SET);
+        n = fread(block, 1, end - start, in);
+        for (i = n - 1; i >= 0; i--) {
+            int before;
+            if (block[i] != STRING_SEPARATOR)
+                continue;
+            if (i > 0) {
+                before = block[i - 1];
+            } else if (start > 0) {
+                fseek(in, start - 1, SEEK_SET);
+                before = fgetc(in);
+            } else {
+                before = -1;
+            }
+            if (before != '\\')
+                return start + i + 1;
+        }
+        end = start;
+    }
+    return 0;
+}
+
+/**
+ * Reads the strings at random offsets of a file and computes the
+ * frequencies of their characters.
+ * @param in File to read from; it must be seekable
+ * @param count Number of draws
+ * @param ignore_case Nonzero to convert characters to lower-case
+ * @param s Where to store the sample
+ * @param head Where to store the list of drawn strings
+ * @param freq Where to store computed frequencies
+ * @param total_length Where to store the number of characters drawn
+ * @param string_count Where to store the number of strings drawn
+ * @return 0 if the file cannot be sampled, 1 if OK
+ */
+int sample_strings(FILE *in, int count, int ignore_case, sample_t *s,
+                   string_list_t **head, int *freq, int *total_length,
+                   int *string_count)
+{
+    string_list_t **nextp = head;
+    unsigned long state = SAMPLE_SEED;
+    unsigned char *buf;
+    int max_len = 64;
+    int i, j;
+
+    *head = NULL;
+    *total_length = 0;
+    *string_count = 0;
+    for (i = 0; i < 256; i++)
+        freq[i] = 0;
+    if ((fseek(in, 0, SEEK_END) != 0) || ((s->file_size = ftell(in)) <= 0))
+        return 0;
+
+    /* Draw the offsets, and visit them in file order */
+    s->count = count;
+    s->bytes = (long *)malloc(count * sizeof(long));
+    s->drawn = (string_list_t **)malloc(count * sizeof(string_list_t *));
+    for (i = 0; i < count; i++) {
+        double u = next_random(&state) / 16777216.0;
+        u = (u + next_random(&state)) / 16777216.0;
+        s->bytes[i] = (long)(u * s->file_size);
+    }
+    qsort(s->bytes, count, sizeof(long), compare_offsets);
+
+    buf = (unsigned char *)malloc(max_len);
+    for (i = 0; i < count; i++) {
+        long start = string_start(in, s->bytes[i]);
+        int len;
+        fseek(in, start, SEEK_SET);
+        len = read_string(in, ignore_case, &buf, &max_len);
+        s->bytes[i] = ftell(in) - start;
+        s->drawn[i] = NULL;
+        if (len > 0) {
+            string_list_t *lst = (string_list_t *)malloc(sizeof(string_list_t));
+            lst->text = (unsigned char *)malloc(len + 1);
+            lst->text_length = len;
+            lst->symbols = 0;
+            lst->length = 0;
+            lst->id = 0;
+            lst->huff_data = 0;
+            lst->huff_size = 0;
+            memcpy(lst->text, buf, len);
+            lst->text[len] = 0;
+            lst->next = NULL;
+            *nextp = lst;
+            nextp = &(lst->next);
+            for (j = 0; j < len; j++)
+                freq[buf[j]]++;
+            *total_length += len;
+            *string_count += 1;
+            s->drawn[i] = lst;
+        }
+    }
+    free(buf);
+    return 1;
+}
+
+/**
+ * Counts the symbols of the drawn strings, weighted so that the counts
+ * estimate those of the whole file. Long strings are drawn more often
+ * than short ones; without the weights, their characters would get
+ * codes that are too short.
+ * @param s The sample; its strings must be parsed
+ * @param freq Where to store the counts; a symbol that was drawn counts 1 at least
+ */
+void sample_count_symbols(const sample_t *s, int *freq)
+{
+    static double weighted[HUFFMAN_MAX_SYMBOLS];
+    double mean_bytes = 0;
+    int i, j;
+    for (i = 0; i < s->count; i++)
+        mean_bytes += (double)s->bytes[i] / s->count;
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++)
+        weighted[i] = 0;
+    for (i = 0; i < s->count; i++) {
+        const string_list_t *str = s->drawn[i];
+        if (!str)
+            continue;
+        for (j = 0; j < str->length; j++)
+            weighted[str->symbols[j]] += mean_bytes / s->bytes[i];
+    }
+    for (i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        freq[i] = (int)(weighted[i] + 0.5);
+        if ((weighted[i] > 0) && (freq[i] == 0))
+            freq[i] = 1;
+    }
+}
+
+/**
+ * Estimates a total of the whole file from the sample.
+ * @param s The sample; for SAMPLE_DATA_BYTES, its strings must be encoded
+ * @param what SAMPLE_STRINGS, SAMPLE_CHARACTERS or SAMPLE_DATA_BYTES
+ * @param estimate Where to store the estimate
+ * @param margin Where to store the half width of its 95% confidence interval
+ */
+void sample_estimate(const sample_t *s, int what, double *estimate, double *margin)
+{
+    double sum = 0;
+    double sum_squares = 0;
+    double mean;
+    int i;
+    for (i = 0; i < s->count; i++) {
+        const string_list_t *str = s->drawn[i];
+        double y = 0;
+        double z;
+        if (str) {
+            if (what == SAMPLE_STRINGS)
+                y = 1;
+            else if (what == SAMPLE_CHARACTERS)
+                y = str->text_length;
+            else
+                y = str->huff_size;
+        }
+        /* The draw stands for file_size / bytes strings like it */
+        z = (double)s->file_size * y / s->bytes[i];
+        sum += z;
+        sum_squares += z * z;
+    }
+    mean = sum / s->count;
+    *estimate = mean;
+    *margin = 0;
+    if (s->count > 1) {
+        double variance = (sum_squares - sum * mean) / (s->count - 1);
+        if (variance > 0)
+            *margin = Z_95 * sqrt(variance / s->count);
+    }
+}
+
+/**
+ * Frees the arrays of a sample; the strings are kept.
+ */
+void sample_free(sample_t *s)
+{
+    free(s->bytes);
+    free(s->drawn);
+}
@@ -0,0 +1,44 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdio.h>
+#include "huffpuff.h"
+
+/* Quantities that can be estimated from a sample */
+#define SAMPLE_STRINGS    0
+#define SAMPLE_CHARACTERS 1
+#define SAMPLE_DATA_BYTES 2     /* encoded string data */
+
+/* Strings drawn at random byte offsets of a file */
+struct sample {
+    long file_size;
+    int count;                  /* number of draws */
+    long *bytes;                /* size of the record in the file, for every draw */
+    string_list_t **drawn;      /* string of every draw, or NULL if it is empty */
+};
+
+typedef struct sample sample_t;
+
+int sample_strings(FILE *, int, int, sample_t *, string_list_t **, int *, int *, int *);
+void sample_count_symbols(const sample_t *, int *);
+void sample_estimate(const sample_t *, int, double *, double *);
+void sample_free(sample_t *);
+
+#endif  /* !SAMPLE_H */
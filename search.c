@@ -0,0 +1,220 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the substring search index.
+ *
+ * For every trigram of characters, the index lists the numbers of the
+ * strings that contain it. A string that contains a pattern contains all
+ * of the pattern's trigrams, so intersecting their postings gives a short
+ * list of candidates; only those have to be decoded to confirm the match.
+ * Characters are mapped through the same table as the decoder leaves, so
+ * the search sees the strings as they will be printed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "search.h"
+
+/* A trigram of a string */
+struct posting {
+    unsigned long trigram;
+    int id;
+};
+
+static int compare_postings(const void *a, const void *b)
+{
+    const struct posting *pa = (const struct posting *)a;
+    const struct posting *pb = (const struct posting *)b;
+    if (pa->trigram != pb->trigram)
+        return (pa->trigram < pb->trigram) ? -1 : 1;
+    return pa->id - pb->id;
+}
+
+/**
+ * Returns the trigram at a position of a string.
+ * @param text Position in the string
+ * @param map Character that every character is printed as, or NULL
+ */
+static unsigned long trigram_at(const unsigned char *text, const int *map)
+{
+    if (!map)
+        return ((unsigned long)text[0] << 16) | ((unsigned long)text[1] << 8) | text[2];
+    return ((unsigned long)map[text[0]] << 16)
+           | ((unsigned long)map[text[1]] << 8) | map[text[2]];
+}
+
+/**
+ * Builds the index of a list of strings.
+ * @param head Strings
+ * @param map Character that every character is printed as
+ * @param index Where to store the index
+ */
+void search_build(const string_list_t *head, const int *map, search_index_t *index)
+{
+    const string_list_t *str;
+    struct posting *postings;
+    long count = 0;
+    long i, n;
+    int id;
+
+    for (str = head; str != NULL; str = str->next) {
+        int len = str->text_length;
+        if (len >= 3)
+            count += len - 2;
+    }
+    postings = (struct posting *)malloc((count + 1) * sizeof(struct posting));
+    count = 0;
+    for (id = 0, str = head; str != NULL; str = str->next, id++) {
+        int len = str->text_length;
+        int j;
+        for (j = 0; j + 3 <= len; j++) {
+            postings[count].trigram = trigram_at(&str->text[j], map);
+            postings[count].id = id;
+            count++;
+        }
+    }
+    index->string_count = id;
+    qsort(postings, count, sizeof(struct posting), compare_postings);
+
+    /* Drop the repeats of a trigram in the same string */
+    for (i = 0, n = 0; i < count; i++) {
+        if ((n > 0) && (postings[n-1].trigram == postings[i].trigram)
+            && (postings[n-1].id == postings[i].id)) {
+            continue;
+        }
+        postings[n++] = postings[i];
+    }
+
+    index->ids = (int *)malloc((n + 1) * sizeof(int));
+    index->trigrams = (unsigned long *)malloc((n + 1) * sizeof(unsigned long));
+    index->starts = (int *)malloc((n + 1) * sizeof(int));
+    index->trigram_count = 0;
+    for (i = 0; i < n; i++) {
+        if ((i == 0) || (postings[i].trigram != postings[i-1].trigram)) {
+            index->trigrams[index->trigram_count] = postings[i].trigram;
+            index->starts[index->trigram_count++] = i;
+        }
+        index->ids[i] = postings[i].id;
+    }
+    index->starts[index->trigram_count] = n;
+    free(postings);
+}
+
+/**
+ * Frees an index.
+ * @param index The index
+ */
+void search_free(search_index_t *index)
+{
+    free(index->trigrams);
+    free(index->starts);
+    free(index->ids);
+}
+
+/**
+ * Finds the postings of a trigram.
+ * @return Number of the trigram, or -1 if no string contains it
+ */
+static int find_trigram(const search_index_t *index, unsigned long trigram)
+{
+    int lo = 0;
+    int hi = index->trigram_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (index->trigrams[mid] == trigram)
+            return mid;
+        if (index->trigrams[mid] < trigram)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+/**
+ * Finds the strings that may contain a pattern.
+ * @param index The index
+ * @param pattern The pattern, with characters already mapped
+ * @param len Length of the pattern
+ * @param ids Where to store the candidates (room for all strings)
+ * @return Number of candidates
+ */
+int search_candidates(const search_index_t *index, const unsigned char *pattern,
+                      int len, int *ids)
+{
+    int count;
+    int shortest = -1;
+    int i, j, k;
+
+    if (len < 3) {
+        /* Too short to use the index; every string is a candidate */
+        for (i = 0; i < index->string_count; i++)
+            ids[i] = i;
+        return index->string_count;
+    }
+    /* Start with the trigram that has the fewest strings */
+    for (i = 0; i + 3 <= len; i++) {
+        int t = find_trigram(index, trigram_at(&pattern[i], NULL));
+        if (t == -1)
+            return 0;
+        if ((shortest == -1) || (index->starts[t+1] - index->starts[t]
+                                 < index->starts[shortest+1] - index->starts[shortest])) {
+            shortest = t;
+        }
+    }
+    count = 0;
+    for (k = index->starts[shortest]; k < index->starts[shortest+1]; k++)
+        ids[count++] = index->ids[k];
+
+    /* Keep the strings that have the other trigrams too */
+    for (i = 0; (i + 3 <= len) && (count > 0); i++) {
+        int t = find_trigram(index, trigram_at(&pattern[i], NULL));
+        int kept = 0;
+        if (t == shortest)
+            continue;
+        k = index->starts[t];
+        for (j = 0; j < count; j++) {
+            while ((k < index->starts[t+1]) && (index->ids[k] < ids[j]))
+                k++;
+            if (k == index->starts[t+1])
+                break;
+            if (index->ids[k] == ids[j])
+                ids[kept++] = ids[j];
+        }
+        count = kept;
+    }
+    return count;
+}
+
+/**
+ * Writes an index as text. Every line holds a trigram as six hex digits,
+ * followed by the numbers of the strings that contain it.
+ * @param out File to write to
+ * @param index The index
+ */
+void search_write(FILE *out, const search_index_t *index)
+{
+    int i, k;
+    fprintf(out, "# Trigram index automatically generated by huffpuff.\n");
+    fprintf(out, "# %d strings, %d trigrams\n", index->string_count, index->trigram_count);
+    for (i = 0; i < index->trigram_count; i++) {
+        fprintf(out, "%.6lX", index->trigrams[i]);
+        for (k = index->starts[i]; k < index->starts[i+1]; k++)
+            fprintf(out, " %d", index->ids[k]);
+        fprintf(out, "\n");
+    }
+}
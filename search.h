@@ -0,0 +1,40 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdio.h>
+#include "huffpuff.h"
+
+/* A trigram index: for every trigram, the strings that contain it */
+struct search_index {
+    int string_count;
+    int trigram_count;
+    unsigned long *trigrams;    /* sorted */
+    int *starts;                /* postings of trigram i: ids[starts[i]] .. ids[starts[i+1]-1] */
+    int *ids;                   /* string numbers, ascending per trigram */
+};
+
+typedef struct search_index search_index_t;
+
+void search_build(const string_list_t *, const int *, search_index_t *);
+void search_free(search_index_t *);
+int search_candidates(const search_index_t *, const unsigned char *, int, int *);
+void search_write(FILE *, const search_index_t *);
+
+#endif  /* !SEARCH_H */
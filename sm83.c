@@ -0,0 +1,574 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains a small SM83 (Game Boy CPU) core that is used to run
+ * and time the generated SM83/Z80 decoders. It implements the instructions
+ * that the two CPUs have in common, plus the SM83-only (HL+)/(HL-) loads
+ * and LDH. When the z80 member is set, the core uses Z80 encodings for the
+ * opcodes where the two CPUs differ, and Z80 T-state timing. Of the Z80's
+ * prefixed instructions, only the ED-prefixed 16-bit memory loads and LDIR
+ * are implemented. The Z80 S and
+ * P/V flags are not modelled.
+ */
+
+#include <string.h>
+#include "sm83.h"
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+/**
+ * Resets a CPU.
+ * @param cpu The CPU
+ * @param z80 Nonzero to use Z80 instruction set and timing
+ */
+void sm83_reset(sm83_t *cpu, int z80)
+{
+    memset(cpu, 0, sizeof(sm83_t));
+    cpu->z80 = z80;
+    cpu->sp = 0xFFFE;
+}
+
+static unsigned char fetch(sm83_t *cpu)
+{
+    return cpu->mem[cpu->pc++];
+}
+
+static unsigned short fetch16(sm83_t *cpu)
+{
+    unsigned short lo = fetch(cpu);
+    return lo | (fetch(cpu) << 8);
+}
+
+static unsigned short hl(const sm83_t *cpu)
+{
+    return (cpu->h << 8) | cpu->l;
+}
+
+static void set_hl(sm83_t *cpu, unsigned short value)
+{
+    cpu->h = value >> 8;
+    cpu->l = value & 0xFF;
+}
+
+static unsigned short get_rr(const sm83_t *cpu, int index)
+{
+    switch (index) {
+        case 0: return (cpu->b << 8) | cpu->c;
+        case 1: return (cpu->d << 8) | cpu->e;
+        case 2: return hl(cpu);
+    }
+    return cpu->sp;
+}
+
+static void set_rr(sm83_t *cpu, int index, unsigned short value)
+{
+    switch (index) {
+        case 0: cpu->b = value >> 8; cpu->c = value & 0xFF; break;
+        case 1: cpu->d = value >> 8; cpu->e = value & 0xFF; break;
+        case 2: set_hl(cpu, value); break;
+        default: cpu->sp = value; break;
+    }
+}
+
+/* Register index: 0=B, 1=C, 2=D, 3=E, 4=H, 5=L, 6=(HL), 7=A */
+static unsigned char get_r(const sm83_t *cpu, int index)
+{
+    switch (index) {
+        case 0: return cpu->b;
+        case 1: return cpu->c;
+        case 2: return cpu->d;
+        case 3: return cpu->e;
+        case 4: return cpu->h;
+        case 5: return cpu->l;
+        case 6: return cpu->mem[hl(cpu)];
+    }
+    return cpu->a;
+}
+
+static void set_r(sm83_t *cpu, int index, unsigned char value)
+{
+    switch (index) {
+        case 0: cpu->b = value; break;
+        case 1: cpu->c = value; break;
+        case 2: cpu->d = value; break;
+        case 3: cpu->e = value; break;
+        case 4: cpu->h = value; break;
+        case 5: cpu->l = value; break;
+        case 6: cpu->mem[hl(cpu)] = value; break;
+        default: cpu->a = value; break;
+    }
+}
+
+static void push(sm83_t *cpu, unsigned short value)
+{
+    cpu->mem[--cpu->sp] = value >> 8;
+    cpu->mem[--cpu->sp] = value & 0xFF;
+}
+
+static unsigned short pop(sm83_t *cpu)
+{
+    unsigned short lo = cpu->mem[cpu->sp++];
+    return lo | (cpu->mem[cpu->sp++] << 8);
+}
+
+/* Evaluates condition 0=NZ, 1=Z, 2=NC, 3=C. */
+static int condition(const sm83_t *cpu, int cc)
+{
+    switch (cc) {
+        case 0: return !(cpu->f & FLAG_Z);
+        case 1: return (cpu->f & FLAG_Z) != 0;
+        case 2: return !(cpu->f & FLAG_C);
+    }
+    return (cpu->f & FLAG_C) != 0;
+}
+
+/* Performs ALU operation op (ADD ADC SUB SBC AND XOR OR CP) on A. */
+static void alu(sm83_t *cpu, int op, unsigned char value)
+{
+    int a = cpu->a;
+    int carry = (cpu->f & FLAG_C) ? 1 : 0;
+    int result;
+    unsigned char f = 0;
+    switch (op) {
+        case 0: case 1:
+        if (op == 0)
+            carry = 0;
+        result = a + value + carry;
+        if (((a & 0xF) + (value & 0xF) + carry) > 0xF) f |= FLAG_H;
+        if (result > 0xFF) f |= FLAG_C;
+        break;
+        case 2: case 3: case 7:
+        if (op != 3)
+            carry = 0;
+        result = a - value - carry;
+        f |= FLAG_N;
+        if (((a & 0xF) - (value & 0xF) - carry) < 0) f |= FLAG_H;
+        if (result < 0) f |= FLAG_C;
+        break;
+        case 4:
+        result = a & value;
+        f |= FLAG_H;
+        break;
+        case 5:
+        result = a ^ value;
+        break;
+        default:
+        result = a | value;
+        break;
+    }
+    if (!(result & 0xFF)) f |= FLAG_Z;
+    cpu->f = f;
+    if (op != 7)
+        cpu->a = result & 0xFF;
+}
+
+/* Performs CB-prefixed rotate/shift operation op on value. */
+static unsigned char shift(sm83_t *cpu, int op, unsigned char value)
+{
+    int carry_in = (cpu->f & FLAG_C) ? 1 : 0;
+    int carry_out;
+    unsigned char result;
+    switch (op) {
+        case 0: carry_out = value >> 7; result = (value << 1) | carry_out; break;       /* RLC */
+        case 1: carry_out = value & 1; result = (value >> 1) | (carry_out << 7); break; /* RRC */
+        case 2: carry_out = value >> 7; result = (value << 1) | carry_in; break;        /* RL */
+        case 3: carry_out = value & 1; result = (value >> 1) | (carry_in << 7); break;  /* RR */
+        case 4: carry_out = value >> 7; result = value << 1; break;                     /* SLA */
+        case 5: carry_out = value & 1; result = (value >> 1) | (value & 0x80); break;   /* SRA */
+        case 6:
+        if (cpu->z80) {
+            carry_out = value >> 7; result = (value << 1) | 1;                          /* SLL */
+        } else {
+            carry_out = 0; result = (value << 4) | (value >> 4);                        /* SWAP */
+        }
+        break;
+        default: carry_out = value & 1; result = value >> 1; break;                     /* SRL */
+    }
+    cpu->f = (result ? 0 : FLAG_Z) | (carry_out ? FLAG_C : 0);
+    return result;
+}
+
+/* Timing of an instruction; first is SM83 T-cycles, second Z80 T-states. */
+#define CYCLES(sm, z) (cpu->cycles += cpu->z80 ? (z) : (sm))
+
+/**
+ * Executes one instruction.
+ * @param cpu The CPU
+ * @return 0 if the instruction is not supported, 1 if OK
+ */
+int sm83_step(sm83_t *cpu)
+{
+    unsigned char op = fetch(cpu);
+    int r = (op >> 3) & 7;
+    int s = op & 7;
+    if ((op >= 0x40) && (op < 0x80)) {
+        /* LD r,r' */
+        if (op == 0x76)
+            return 0;
+        set_r(cpu, r, get_r(cpu, s));
+        if ((r == 6) || (s == 6)) CYCLES(8, 7); else CYCLES(4, 4);
+        return 1;
+    }
+    if ((op >= 0x80) && (op < 0xC0)) {
+        /* ALU A,r */
+        alu(cpu, r, get_r(cpu, s));
+        if (s == 6) CYCLES(8, 7); else CYCLES(4, 4);
+        return 1;
+    }
+    switch (op) {
+        case 0x00:
+        CYCLES(4, 4);
+        break;
+
+        case 0x01: case 0x11: case 0x21: case 0x31:
+        set_rr(cpu, op >> 4, fetch16(cpu));
+        CYCLES(12, 10);
+        break;
+
+        case 0x02: case 0x12:
+        cpu->mem[get_rr(cpu, op >> 4)] = cpu->a;
+        CYCLES(8, 7);
+        break;
+
+        case 0x0A: case 0x1A:
+        cpu->a = cpu->mem[get_rr(cpu, op >> 4)];
+        CYCLES(8, 7);
+        break;
+
+        case 0x03: case 0x13: case 0x23: case 0x33:
+        set_rr(cpu, op >> 4, get_rr(cpu, op >> 4) + 1);
+        CYCLES(8, 6);
+        break;
+
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+        set_rr(cpu, op >> 4, get_rr(cpu, op >> 4) - 1);
+        CYCLES(8, 6);
+        break;
+
+        case 0x04: case 0x0C: case 0x14: case 0x1C:
+        case 0x24: case 0x2C: case 0x34: case 0x3C: {
+            unsigned char v = get_r(cpu, r) + 1;
+            set_r(cpu, r, v);
+            cpu->f = (cpu->f & FLAG_C) | (v ? 0 : FLAG_Z) | ((v & 0xF) ? 0 : FLAG_H);
+            if (r == 6) CYCLES(12, 11); else CYCLES(4, 4);
+        }   break;
+
+        case 0x05: case 0x0D: case 0x15: case 0x1D:
+        case 0x25: case 0x2D: case 0x35: case 0x3D: {
+            unsigned char v = get_r(cpu, r) - 1;
+            set_r(cpu, r, v);
+            cpu->f = (cpu->f & FLAG_C) | FLAG_N | (v ? 0 : FLAG_Z)
+                   | (((v & 0xF) == 0xF) ? FLAG_H : 0);
+            if (r == 6) CYCLES(12, 11); else CYCLES(4, 4);
+        }   break;
+
+        case 0x06: case 0x0E: case 0x16: case 0x1E:
+        case 0x26: case 0x2E: case 0x36: case 0x3E:
+        set_r(cpu, r, fetch(cpu));
+        if (r == 6) CYCLES(12, 10); else CYCLES(8, 7);
+        break;
+
+        case 0x07: case 0x0F: case 0x17: case 0x1F: {
+            /* RLCA, RRCA, RLA, RRA; Z is always cleared */
+            unsigned char z = cpu->f & FLAG_Z;
+            cpu->a = shift(cpu, r, cpu->a);
+            cpu->f = (cpu->f & FLAG_C) | (cpu->z80 ? z : 0);
+            CYCLES(4, 4);
+        }   break;
+
+        case 0x09: case 0x19: case 0x29: case 0x39: {
+            unsigned long sum = hl(cpu) + get_rr(cpu, op >> 4);
+            cpu->f = (cpu->f & FLAG_Z) | ((sum > 0xFFFF) ? FLAG_C : 0);
+            set_hl(cpu, sum & 0xFFFF);
+            CYCLES(8, 11);
+        }   break;
+
+        case 0x10:
+        if (!cpu->z80)
+            return 0;
+        /* DJNZ */
+        {
+            signed char d = (signed char)fetch(cpu);
+            if (--cpu->b) {
+                cpu->pc += d;
+                cpu->cycles += 13;
+            } else {
+                cpu->cycles += 8;
+            }
+        }
+        break;
+
+        case 0x18: {
+            signed char d = (signed char)fetch(cpu);
+            cpu->pc += d;
+            CYCLES(12, 12);
+        }   break;
+
+        case 0x20: case 0x28: case 0x30: case 0x38: {
+            signed char d = (signed char)fetch(cpu);
+            if (condition(cpu, r - 4)) {
+                cpu->pc += d;
+                CYCLES(12, 12);
+            } else {
+                CYCLES(8, 7);
+            }
+        }   break;
+
+        case 0x22: case 0x2A: case 0x32: case 0x3A:
+        if (cpu->z80) {
+            unsigned short addr = fetch16(cpu);
+            switch (op) {
+                case 0x22:
+                cpu->mem[addr] = cpu->l;
+                cpu->mem[(addr + 1) & 0xFFFF] = cpu->h;
+                CYCLES(0, 16);
+                break;
+                case 0x2A:
+                cpu->l = cpu->mem[addr];
+                cpu->h = cpu->mem[(addr + 1) & 0xFFFF];
+                CYCLES(0, 16);
+                break;
+                case 0x32:
+                cpu->mem[addr] = cpu->a;
+                CYCLES(0, 13);
+                break;
+                default:
+                cpu->a = cpu->mem[addr];
+                CYCLES(0, 13);
+                break;
+            }
+        } else {
+            unsigned short addr = hl(cpu);
+            if (op & 0x08)
+                cpu->a = cpu->mem[addr];
+            else
+                cpu->mem[addr] = cpu->a;
+            set_hl(cpu, (op & 0x10) ? addr - 1 : addr + 1);
+            CYCLES(8, 0);
+        }
+        break;
+
+        case 0x2F:
+        cpu->a = ~cpu->a;
+        cpu->f |= FLAG_N | FLAG_H;
+        CYCLES(4, 4);
+        break;
+
+        case 0x37:
+        cpu->f = (cpu->f & FLAG_Z) | FLAG_C;
+        CYCLES(4, 4);
+        break;
+
+        case 0x3F:
+        cpu->f = (cpu->f & (FLAG_Z | FLAG_C)) ^ FLAG_C;
+        CYCLES(4, 4);
+        break;
+
+        case 0xC0: case 0xC8: case 0xD0: case 0xD8:
+        if (condition(cpu, r)) {
+            cpu->pc = pop(cpu);
+            CYCLES(20, 11);
+        } else {
+            CYCLES(8, 5);
+        }
+        break;
+
+        case 0xC9:
+        cpu->pc = pop(cpu);
+        CYCLES(16, 10);
+        break;
+
+        case 0xC1: case 0xD1: case 0xE1: case 0xF1: {
+            unsigned short v = pop(cpu);
+            if (op == 0xF1) {
+                cpu->a = v >> 8;
+                cpu->f = v & 0xF0;
+            } else {
+                set_rr(cpu, (op >> 4) & 3, v);
+            }
+            CYCLES(12, 10);
+        }   break;
+
+        case 0xC5: case 0xD5: case 0xE5: case 0xF5:
+        if (op == 0xF5)
+            push(cpu, (cpu->a << 8) | cpu->f);
+        else
+            push(cpu, get_rr(cpu, (op >> 4) & 3));
+        CYCLES(16, 11);
+        break;
+
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA: {
+            unsigned short addr = fetch16(cpu);
+            if (condition(cpu, r)) {
+                cpu->pc = addr;
+                CYCLES(16, 10);
+            } else {
+                CYCLES(12, 10);
+            }
+        }   break;
+
+        case 0xC3:
+        cpu->pc = fetch16(cpu);
+        CYCLES(16, 10);
+        break;
+
+        case 0xC4: case 0xCC: case 0xD4: case 0xDC: {
+            unsigned short addr = fetch16(cpu);
+            if (condition(cpu, r)) {
+                push(cpu, cpu->pc);
+                cpu->pc = addr;
+                CYCLES(24, 17);
+            } else {
+                CYCLES(12, 10);
+            }
+        }   break;
+
+        case 0xCD: {
+            unsigned short addr = fetch16(cpu);
+            push(cpu, cpu->pc);
+            cpu->pc = addr;
+            CYCLES(24, 17);
+        }   break;
+
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE:
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+        alu(cpu, r, fetch(cpu));
+        CYCLES(8, 7);
+        break;
+
+        case 0xCB: {
+            unsigned char op2 = fetch(cpu);
+            int reg = op2 & 7;
+            int n = (op2 >> 3) & 7;
+            unsigned char v = get_r(cpu, reg);
+            switch (op2 >> 6) {
+                case 0:
+                set_r(cpu, reg, shift(cpu, n, v));
+                break;
+                case 1:
+                cpu->f = (cpu->f & FLAG_C) | FLAG_H | ((v & (1 << n)) ? 0 : FLAG_Z);
+                if (reg == 6) {
+                    CYCLES(12, 12);
+                    return 1;
+                }
+                break;
+                case 2:
+                set_r(cpu, reg, v & ~(1 << n));
+                break;
+                default:
+                set_r(cpu, reg, v | (1 << n));
+                break;
+            }
+            if (reg == 6) CYCLES(16, 15); else CYCLES(8, 8);
+        }   break;
+
+        case 0xED: {
+            /* Z80 only: LD (nn),rr / LD rr,(nn) and LDIR */
+            unsigned char op2;
+            if (!cpu->z80)
+                return 0;
+            op2 = fetch(cpu);
+            if ((op2 & 0xC7) == 0x43) {
+                unsigned short addr = fetch16(cpu);
+                int rr = (op2 >> 4) & 3;
+                if (op2 & 0x08) {
+                    set_rr(cpu, rr, cpu->mem[addr] | (cpu->mem[(addr + 1) & 0xFFFF] << 8));
+                } else {
+                    unsigned short v = get_rr(cpu, rr);
+                    cpu->mem[addr] = v & 0xFF;
+                    cpu->mem[(addr + 1) & 0xFFFF] = v >> 8;
+                }
+                CYCLES(0, 20);
+            } else if (op2 == 0xB0) {
+                unsigned short bc = get_rr(cpu, 0);
+                unsigned short de = get_rr(cpu, 1);
+                unsigned short src = hl(cpu);
+                do {
+                    cpu->mem[de++] = cpu->mem[src++];
+                    CYCLES(0, 21);
+                } while (--bc != 0);
+                /* The last iteration does not repeat */
+                cpu->cycles -= 5;
+                set_rr(cpu, 0, bc);
+                set_rr(cpu, 1, de);
+                set_hl(cpu, src);
+                cpu->f &= ~(FLAG_N | FLAG_H);
+            } else {
+                return 0;
+            }
+        }   break;
+
+        case 0xE9:
+        cpu->pc = hl(cpu);
+        CYCLES(4, 4);
+        break;
+
+        case 0xF9:
+        cpu->sp = hl(cpu);
+        CYCLES(8, 6);
+        break;
+
+        case 0xE0: case 0xF0: case 0xE2: case 0xF2: case 0xEA: case 0xFA: {
+            unsigned short addr;
+            if (cpu->z80)
+                return 0;
+            if (op & 0x08) {
+                addr = fetch16(cpu);
+                CYCLES(16, 0);
+            } else if (op & 0x02) {
+                addr = 0xFF00 | cpu->c;
+                CYCLES(8, 0);
+            } else {
+                addr = 0xFF00 | fetch(cpu);
+                CYCLES(12, 0);
+            }
+            if (op & 0x10)
+                cpu->a = cpu->mem[addr];
+            else
+                cpu->mem[addr] = cpu->a;
+        }   break;
+
+        default:
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Calls a subroutine and runs it until it returns.
+ * @param cpu The CPU
+ * @param addr Address of the subroutine
+ * @param max_cycles Give up after this many cycles
+ * @return 0 if the subroutine did not return properly, 1 if OK
+ */
+int sm83_call(sm83_t *cpu, int addr, unsigned long max_cycles)
+{
+    unsigned short sp = cpu->sp;
+    unsigned long limit = cpu->cycles + max_cycles;
+    /* Return to address 0, which is never executed */
+    push(cpu, 0x0000);
+    cpu->pc = addr;
+    CYCLES(24, 17);
+    while ((cpu->pc != 0x0000) || (cpu->sp != sp)) {
+        if (!sm83_step(cpu) || (cpu->cycles > limit))
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,37 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SM83_H
+#define SM83_H
+
+/* State of an SM83 (Game Boy) or Z80 CPU with a flat 64K memory. */
+struct sm83 {
+    unsigned char a, f, b, c, d, e, h, l;
+    unsigned short sp;
+    unsigned short pc;
+    unsigned long cycles;
+    int z80;    /* nonzero: Z80 instruction set and timing */
+    unsigned char mem[65536];
+};
+
+typedef struct sm83 sm83_t;
+
+void sm83_reset(sm83_t *, int);
+int sm83_step(sm83_t *);
+int sm83_call(sm83_t *, int, unsigned long);
+
+#endif  /* !SM83_H */
@@ -0,0 +1,143 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the measurements that --stats-output records and
+ * --compare checks against a recorded baseline. A baseline is a text file
+ * with one measurement per line, a name and a number; lines that start
+ * with # are comments.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+/**
+ * Empties a set of measurements.
+ */
+void stats_init(stats_t *st)
+{
+    st->count = 0;
+}
+
+/**
+ * Adds a measurement.
+ * @param st Measurements
+ * @param name Name of the measurement
+ * @param kind STATS_COST or STATS_RATE
+ * @param value The measured value
+ */
+void stats_add(stats_t *st, const char *name, int kind, double value)
+{
+    if (st->count == STATS_MAX_ENTRIES)
+        return;
+    snprintf(st->names[st->count], STATS_MAX_NAME, "%s", name);
+    st->kinds[st->count] = kind;
+    st->values[st->count] = value;
+    st->count++;
+}
+
+/**
+ * Writes measurements in the baseline format.
+ */
+void stats_write(FILE *out, const stats_t *st)
+{
+    int i;
+    fprintf(out, "# huffpuff measurements; sizes in bytes, decoding in cycles per character,\n"
+                 "# host throughput in MB/s\n");
+    for (i = 0; i < st->count; i++) {
+        if (st->kinds[i] == STATS_RATE)
+            fprintf(out, "%s %.1f\n", st->names[i], st->values[i]);
+        else
+            fprintf(out, "%s %.10g\n", st->names[i], st->values[i]);
+    }
+}
+
+/**
+ * Reads measurements from a baseline file. Their kinds are not recorded;
+ * stats_compare() takes them from the current measurements.
+ * @param filename Name of the baseline file
+ * @param st Where to store the measurements
+ * @return 0 if fail, 1 if OK
+ */
+int stats_read(const char *filename, stats_t *st)
+{
+    FILE *in = fopen(filename, "rt");
+    char line[256];
+    int lineno = 0;
+    if (!in) {
+        fprintf(stderr, "error: failed to open `%s' for reading\n", filename);
+        return 0;
+    }
+    stats_init(st);
+    while (fgets(line, sizeof(line), in)) {
+        char name[STATS_MAX_NAME];
+        double value;
+        char *p = line;
+        lineno++;
+        while ((*p == ' ') || (*p == '\t'))
+            p++;
+        if ((*p == '#') || (*p == '\n') || (*p == '\r') || !*p)
+            continue;
+        if (sscanf(p, "%31s %lf", name, &value) != 2) {
+            fprintf(stderr, "error: %s:%d: expected a name and a number\n", filename, lineno);
+            fclose(in);
+            return 0;
+        }
+        stats_add(st, name, STATS_COST, value);
+    }
+    fclose(in);
+    return 1;
+}
+
+/**
+ * Compares measurements against a baseline, and reports each of them.
+ * @param baseline Recorded measurements
+ * @param current Measurements of this run
+ * @param tolerance Fraction by which a rate may drop
+ * @param out File to write the report to
+ * @return Number of measurements that got worse
+ */
+int stats_compare(const stats_t *baseline, const stats_t *current,
+                  double tolerance, FILE *out)
+{
+    int worse = 0;
+    int i, j;
+    for (i = 0; i < current->count; i++) {
+        double now = current->values[i];
+        double then;
+        int bad;
+        for (j = 0; j < baseline->count; j++) {
+            if (!strcmp(baseline->names[j], current->names[i]))
+                break;
+        }
+        if (j == baseline->count) {
+            fprintf(out, "  %-20s %12.1f (not in baseline)\n", current->names[i], now);
+            continue;
+        }
+        then = baseline->values[j];
+        if (current->kinds[i] == STATS_RATE)
+            bad = now < then * (1.0 - tolerance);
+        else
+            bad = now > then + 1e-6;
+        fprintf(out, "  %-20s %12.1f -> %12.1f", current->names[i], then, now);
+        if ((then != 0) && ((now - then > 1e-6) || (then - now > 1e-6)))
+            fprintf(out, " (%+.1f%%)", 100.0 * (now - then) / then);
+        fprintf(out, "%s\n", bad ? "  WORSE" : "");
+        worse += bad;
+    }
+    return worse;
+}
@@ -0,0 +1,49 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/* Maximum number of measurements */
+#define STATS_MAX_ENTRIES 16
+
+/* Maximum length of the name of a measurement */
+#define STATS_MAX_NAME 32
+
+/* Kinds of measurements */
+#define STATS_COST 0    /* sizes and emulated cycles; must not grow at all */
+#define STATS_RATE 1    /* host throughput; may drop by the tolerance */
+
+/* Measurements of one run */
+struct stats {
+    int count;
+    char names[STATS_MAX_ENTRIES][STATS_MAX_NAME];
+    int kinds[STATS_MAX_ENTRIES];
+    double values[STATS_MAX_ENTRIES];
+};
+
+typedef struct stats stats_t;
+
+void stats_init(stats_t *);
+void stats_add(stats_t *, const char *, int, double);
+void stats_write(FILE *, const stats_t *);
+int stats_read(const char *, stats_t *);
+int stats_compare(const stats_t *, const stats_t *, double, FILE *);
+
+#endif  /* !STATS_H */
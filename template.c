@@ -0,0 +1,364 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the extraction of string templates.
+ *
+ * Strings that differ only in a slot, like "You got a Potion!" and
+ * "You got an Ether!", are factored into a template: the text before the
+ * slot and the text after it become dictionary tokens, so that each string
+ * is coded as the token that opens its template, the characters of its
+ * filler and the token that closes the template.
+ *
+ * Near-duplicate strings are found with MinHash signatures of their
+ * character trigrams and locality-sensitive hashing: the signatures are
+ * cut into bands, and strings with an equal band land in the same bucket.
+ * A string joins the cluster of the first string in its bucket if the two
+ * share a prefix or suffix and their edit distance is at most half the
+ * longer length. The template of a cluster is the prefix and suffix that
+ * all its strings have in common. The templates that save the most are
+ * added to the dictionary, as long as it has room.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "template.h"
+
+/* Signature layout: TEMPLATE_BANDS bands of TEMPLATE_ROWS hashes each */
+#define TEMPLATE_BANDS 16
+#define TEMPLATE_ROWS 2
+#define TEMPLATE_HASHES (TEMPLATE_BANDS * TEMPLATE_ROWS)
+
+/* Length of the shingles that are hashed */
+#define TEMPLATE_SHINGLE 3
+
+/* Minimum number of characters of the text before or after the slot */
+#define TEMPLATE_MIN_PART 3
+
+/* A string in a bucket of one band */
+struct bucket_entry {
+    unsigned long key;
+    int string;
+};
+
+/* A candidate template */
+struct template {
+    const unsigned char *text;  /* a string of the cluster */
+    int length;                 /* length of that string */
+    int prefix;                 /* characters before the slot */
+    int suffix;                 /* characters after the slot */
+    long saving;
+};
+
+/**
+ * Scrambles the bits of a 32-bit value.
+ */
+static unsigned long mix(unsigned long h)
+{
+    h &= 0xFFFFFFFFUL;
+    h ^= h >> 16;
+    h = (h * 0x45D9F3BUL) & 0xFFFFFFFFUL;
+    h ^= h >> 16;
+    h = (h * 0x45D9F3BUL) & 0xFFFFFFFFUL;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * Computes the MinHash signature of a string.
+ * @param text The string
+ * @param len Length of the string (at least TEMPLATE_SHINGLE)
+ * @param sig Where to store the TEMPLATE_HASHES values
+ */
+static void minhash(const unsigned char *text, int len, unsigned long *sig)
+{
+    int i, k;
+    for (k = 0; k < TEMPLATE_HASHES; k++)
+        sig[k] = 0xFFFFFFFFUL;
+    for (i = 0; i + TEMPLATE_SHINGLE <= len; i++) {
+        unsigned long shingle = ((unsigned long)text[i] << 16)
+                                | ((unsigned long)text[i+1] << 8) | text[i+2];
+        for (k = 0; k < TEMPLATE_HASHES; k++) {
+            unsigned long h = mix(shingle + 0x9E3779B9UL * (k + 1));
+            if (h < sig[k])
+                sig[k] = h;
+        }
+    }
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct bucket_entry *ea = (const struct bucket_entry *)a;
+    const struct bucket_entry *eb = (const struct bucket_entry *)b;
+    if (ea->key != eb->key)
+        return (ea->key < eb->key) ? -1 : 1;
+    return ea->string - eb->string;
+}
+
+static int compare_templates(const void *a, const void *b)
+{
+    const struct template *ta = (const struct template *)a;
+    const struct template *tb = (const struct template *)b;
+    if (ta->saving != tb->saving)
+        return (ta->saving > tb->saving) ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Returns the root of a string's cluster.
+ */
+static int find(int *parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/**
+ * Returns the number of leading characters two strings have in common.
+ */
+static int common_prefix(const unsigned char *a, int la,
+                         const unsigned char *b, int lb)
+{
+    int n = 0;
+    while ((n < la) && (n < lb) && (a[n] == b[n]))
+        n++;
+    return n;
+}
+
+/**
+ * Returns the number of trailing characters two strings have in common.
+ */
+static int common_suffix(const unsigned char *a, int la,
+                         const unsigned char *b, int lb)
+{
+    int n = 0;
+    while ((n < la) && (n < lb) && (a[la-1-n] == b[lb-1-n]))
+        n++;
+    return n;
+}
+
+/**
+ * Computes the edit distance of two strings, up to a limit.
+ * @return The distance, or limit + 1 if it is larger than limit
+ */
+static int edit_distance(const unsigned char *a, int la,
+                         const unsigned char *b, int lb, int limit)
+{
+    int *row;
+    int i, j;
+    int result;
+    if (abs(la - lb) > limit)
+        return limit + 1;
+    row = (int *)malloc((lb + 1) * sizeof(int));
+    for (j = 0; j <= lb; j++)
+        row[j] = j;
+    for (i = 1; i <= la; i++) {
+        int diagonal = row[0];
+        row[0] = i;
+        for (j = 1; j <= lb; j++) {
+            int best = diagonal + ((a[i-1] == b[j-1]) ? 0 : 1);
+            diagonal = row[j];
+            if (row[j] + 1 < best)
+                best = row[j] + 1;
+            if (row[j-1] + 1 < best)
+                best = row[j-1] + 1;
+            row[j] = best;
+        }
+    }
+    result = row[lb];
+    free(row);
+    return (result > limit) ? limit + 1 : result;
+}
+
+/**
+ * Checks whether two strings are near-duplicates that fit one template.
+ */
+static int similar(const unsigned char *a, int la,
+                   const unsigned char *b, int lb)
+{
+    int prefix = common_prefix(a, la, b, lb);
+    int suffix = common_suffix(a + prefix, la - prefix, b + prefix, lb - prefix);
+    int limit = ((la > lb) ? la : lb) / 2;
+    if ((prefix < TEMPLATE_MIN_PART) && (suffix < TEMPLATE_MIN_PART))
+        return 0;
+    return edit_distance(a + prefix, la - prefix - suffix,
+                         b + prefix, lb - prefix - suffix, limit) <= limit;
+}
+
+/**
+ * Returns the number of bytes that characters of a string are mapped to.
+ */
+static int byte_length(const unsigned char *text, int len,
+                       const charmap_sequence_t *sequences)
+{
+    int bytes = 0;
+    int i;
+    for (i = 0; i < len; i++)
+        bytes += sequences[text[i]].length ? sequences[text[i]].length : 1;
+    return bytes;
+}
+
+/**
+ * Finds templates in strings and adds their parts to a dictionary.
+ * @param head Strings
+ * @param sequences Byte sequences of the characters (length 0: one byte)
+ * @param dict Dictionary to add the tokens to
+ * @return Number of templates added
+ */
+int template_extract(const string_list_t *head, const charmap_sequence_t *sequences,
+                     dictionary_t *dict)
+{
+    const string_list_t *str;
+    const unsigned char **texts;
+    int *lengths;
+    int *parent;
+    int *members;
+    int *shortest;
+    unsigned long *sigs;
+    struct bucket_entry *entries;
+    struct template *templates;
+    int entry_count = 0;
+    int template_count = 0;
+    int added = 0;
+    int count = 0;
+    int band, i, j;
+
+    for (str = head; str != NULL; str = str->next)
+        count++;
+    if (count < 2)
+        return 0;
+    texts = (const unsigned char **)malloc(count * sizeof(const unsigned char *));
+    lengths = (int *)malloc(count * sizeof(int));
+    parent = (int *)malloc(count * sizeof(int));
+    sigs = (unsigned long *)malloc(count * TEMPLATE_HASHES * sizeof(unsigned long));
+    entries = (struct bucket_entry *)malloc(count * sizeof(struct bucket_entry));
+    for (i = 0, str = head; str != NULL; str = str->next, i++) {
+        texts[i] = str->text;
+        lengths[i] = str->text_length;
+        parent[i] = i;
+        if (lengths[i] >= TEMPLATE_SHINGLE)
+            minhash(texts[i], lengths[i], &sigs[i * TEMPLATE_HASHES]);
+    }
+
+    /* Join the near-duplicates in the buckets of every band */
+    for (band = 0; band < TEMPLATE_BANDS; band++) {
+        entry_count = 0;
+        for (i = 0; i < count; i++) {
+            unsigned long key = band + 1;
+            if (lengths[i] < TEMPLATE_SHINGLE)
+                continue;
+            for (j = 0; j < TEMPLATE_ROWS; j++)
+                key = mix(key * 0x01000193UL ^ sigs[i * TEMPLATE_HASHES + band * TEMPLATE_ROWS + j]);
+            entries[entry_count].key = key;
+            entries[entry_count].string = i;
+            entry_count++;
+        }
+        qsort(entries, entry_count, sizeof(struct bucket_entry), compare_entries);
+        for (i = 0; i < entry_count; i = j) {
+            int first = entries[i].string;
+            for (j = i + 1; (j < entry_count) && (entries[j].key == entries[i].key); j++) {
+                int other = entries[j].string;
+                int a = find(parent, first);
+                int b = find(parent, other);
+                if ((a != b) && similar(texts[first], lengths[first],
+                                        texts[other], lengths[other])) {
+                    parent[b] = a;
+                }
+            }
+        }
+    }
+
+    /* Find the common prefix and suffix of every cluster */
+    templates = (struct template *)malloc(count * sizeof(struct template));
+    members = (int *)malloc(count * sizeof(int));
+    shortest = (int *)malloc(count * sizeof(int));
+    for (i = 0; i < count; i++) {
+        templates[i].text = texts[i];
+        templates[i].length = templates[i].prefix = templates[i].suffix = lengths[i];
+        shortest[i] = lengths[i];
+        members[i] = 0;
+    }
+    for (i = 0; i < count; i++) {
+        int root = find(parent, i);
+        struct template *t = &templates[root];
+        int n;
+        members[root]++;
+        n = common_prefix(t->text, t->length, texts[i], lengths[i]);
+        if (n < t->prefix)
+            t->prefix = n;
+        n = common_suffix(t->text, t->length, texts[i], lengths[i]);
+        if (n < t->suffix)
+            t->suffix = n;
+        if (lengths[i] < shortest[root])
+            shortest[root] = lengths[i];
+    }
+    for (i = 0; i < count; i++) {
+        struct template *t = &templates[i];
+        if ((find(parent, i) != i) || (members[i] < 2))
+            continue;
+        /* The parts must not overlap in any string */
+        if (t->prefix + t->suffix > shortest[i])
+            t->suffix = shortest[i] - t->prefix;
+        /* Tokens are limited to the length of a byte sequence */
+        while (byte_length(t->text, t->prefix, sequences) > CHARMAP_MAX_SEQUENCE)
+            t->prefix--;
+        while (byte_length(t->text + t->length - t->suffix, t->suffix, sequences)
+               > CHARMAP_MAX_SEQUENCE) {
+            t->suffix--;
+        }
+        if (t->prefix < TEMPLATE_MIN_PART)
+            t->prefix = 0;
+        if (t->suffix < TEMPLATE_MIN_PART)
+            t->suffix = 0;
+        /* Every part saves all but one of its characters in every string,
+           and costs its bytes in the decoder table */
+        t->saving = 0;
+        if (t->prefix)
+            t->saving += (long)members[i] * (t->prefix - 1) - t->prefix;
+        if (t->suffix)
+            t->saving += (long)members[i] * (t->suffix - 1) - t->suffix;
+        if (t->saving > 0)
+            templates[template_count++] = *t;
+    }
+
+    /* Add the best templates to the dictionary */
+    qsort(templates, template_count, sizeof(struct template), compare_templates);
+    for (i = 0; i < template_count; i++) {
+        const struct template *t = &templates[i];
+        if (dict->count + ((t->prefix > 0) ? 1 : 0) + ((t->suffix > 0) ? 1 : 0)
+            > PARSE_MAX_TOKENS) {
+            break;
+        }
+        if (t->prefix)
+            dictionary_add(dict, t->text, t->prefix);
+        if (t->suffix)
+            dictionary_add(dict, t->text + t->length - t->suffix, t->suffix);
+        added++;
+    }
+
+    free(shortest);
+    free(members);
+    free(templates);
+    free(entries);
+    free(sigs);
+    free(parent);
+    free(lengths);
+    free(texts);
+    return added;
+}
@@ -0,0 +1,27 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include "huffpuff.h"
+#include "parse.h"
+
+int template_extract(const string_list_t *, const charmap_sequence_t *,
+                     dictionary_t *);
+
+#endif  /* !TEMPLATE_H */
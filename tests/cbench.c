@@ -0,0 +1,182 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file is the benchmark of the C output. It decodes every string
+ * of a corpus with the decoder that huffpuff generated for its tree, and
+ * with a plain walk of the decoder table, checks both against the lines
+ * of the corpus, and times them.
+ *
+ * The headers are made by "make cbench", which runs huffpuff with
+ * --output-format=c and --append-byte=0, so that every string ends with a
+ * 0. The corpus must be lines of text without escapes or comments, as
+ * every line is taken to be one string.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cbench_table.h"
+#include "cbench_data.h"
+#include "cbench_decoder.h"
+
+#define STRING_COUNT (int)(sizeof(StringTable) / sizeof(StringTable[0]))
+
+/* How long each decoder is timed, in seconds */
+#define BENCH_TIME 1.0
+
+/* The state of the table walk */
+struct walk_state {
+    const unsigned char *data;  /* next byte to read */
+    unsigned byte;              /* the byte being read */
+    unsigned mask;              /* its next bit, or 0 if it is used up */
+};
+
+/* Starts walking a string. */
+static void walk_start(struct walk_state *s, const unsigned char *data)
+{
+    s->data = data;
+    s->mask = 0;
+}
+
+/* Decodes the next character by walking the table one bit at a time. */
+static unsigned walk_decode(struct walk_state *s)
+{
+    unsigned node = 0;
+    for (;;) {
+        int bit;
+        if (s->mask == 0) {
+            s->byte = *s->data++;
+            s->mask = 0x80;
+        }
+        bit = (s->byte & s->mask) != 0;
+        s->mask >>= 1;
+        node = huff_table[node][bit];
+        if (node & 0x8000)
+            return huff_table_values[node & 0x7FFF];
+    }
+}
+
+/**
+ * Decodes every string with both decoders and checks the result.
+ * @param lines The lines of the corpus
+ * @return 0 if a string is wrong, 1 if OK
+ */
+static int check(char **lines)
+{
+    int i;
+    for (i = 0; i < STRING_COUNT; i++) {
+        struct huff_decode_state s;
+        struct walk_state w;
+        const unsigned char *text = (const unsigned char *)lines[i];
+        int j = 0;
+        huff_decode_start(&s, StringTable[i]);
+        walk_start(&w, StringTable[i]);
+        for (;;) {
+            unsigned c = huff_decode(&s);
+            unsigned d = walk_decode(&w);
+            if ((c != text[j]) || (d != text[j])) {
+                fprintf(stderr, "cbench: string %d, character %d: decoded $%.2X and $%.2X, "
+                        "expected $%.2X\n", i, j, c, d, text[j]);
+                return 0;
+            }
+            if (c == 0)
+                break;
+            j++;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Decodes every string over and over, and measures the throughput.
+ * @param walk 0 for the generated decoder, 1 for the table walk
+ * @param chars Where to add the characters decoded, so that the work is kept
+ * @return Characters per second, in millions
+ */
+static double bench(int walk, unsigned long *chars)
+{
+    unsigned long count = 0;
+    clock_t start = clock();
+    double seconds;
+    do {
+        int i;
+        for (i = 0; i < STRING_COUNT; i++) {
+            if (walk) {
+                struct walk_state w;
+                walk_start(&w, StringTable[i]);
+                while (walk_decode(&w))
+                    count++;
+            } else {
+                struct huff_decode_state s;
+                huff_decode_start(&s, StringTable[i]);
+                while (huff_decode(&s))
+                    count++;
+            }
+        }
+        seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    } while (seconds < BENCH_TIME);
+    *chars += count;
+    return count / seconds / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in;
+    char **lines;
+    char line[4096];
+    unsigned long chars = 0;
+    int count = 0;
+    double specialised, walker;
+    if (argc != 2) {
+        fprintf(stderr, "usage: cbench CORPUS\n");
+        return 1;
+    }
+    in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "cbench: failed to open `%s'\n", argv[1]);
+        return 1;
+    }
+    lines = (char **)malloc(STRING_COUNT * sizeof(char *));
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\n")] = 0;
+        if (count == STRING_COUNT) {
+            count++;
+            break;
+        }
+        lines[count] = (char *)malloc(strlen(line) + 1);
+        strcpy(lines[count++], line);
+    }
+    fclose(in);
+    if (count != STRING_COUNT) {
+        fprintf(stderr, "cbench: `%s' does not have the %d strings of the headers\n",
+                argv[1], STRING_COUNT);
+        return 1;
+    }
+    if (!check(lines))
+        return 1;
+    specialised = bench(0, &chars);
+    walker = bench(1, &chars);
+    printf("%d strings checked\n", STRING_COUNT);
+    printf("  generated decoder: %.1f MB/s\n", specialised);
+    printf("  table walk:        %.1f MB/s\n", walker);
+    printf("  (%lu characters decoded)\n", chars);
+    while (count > 0)
+        free(lines[--count]);
+    free(lines);
+    return 0;
+}
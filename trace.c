@@ -0,0 +1,191 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the writer of --trace files: Chrome trace-event
+ * JSON, which chrome://tracing and Perfetto open. The phases of the main
+ * thread are begin and end events; the work of the parser threads and
+ * the trees built while searching are complete events with a start time
+ * and a duration. Times are in microseconds since the trace was opened.
+ *
+ * Every function returns at once when no trace is open, so tracing costs
+ * a test of one pointer when it is off.
+ *
+ * The phases that are still open when the program exits, for instance on
+ * an error, are ended when the trace is closed, so that the viewers do not
+ * drop them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "trace.h"
+
+/* The open trace, or NULL */
+static FILE *trace_file = NULL;
+
+/* Time the trace was opened, in microseconds */
+static double trace_start;
+
+/* Guards the file against the parser threads */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The phases of the main thread that have begun and not ended, innermost last */
+#define MAX_PHASES 16
+static const char *open_phases[MAX_PHASES];
+static int open_phase_count = 0;
+
+/* The threads that have been named, by ID */
+#define MAX_NAMED_THREADS 64
+static char named_threads[MAX_NAMED_THREADS];
+
+/**
+ * Returns a monotonic time in microseconds.
+ */
+static double clock_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Writes the common fields of an event, with the file locked.
+ */
+static void write_event(const char *name, const char *ph, int tid, double ts)
+{
+    fprintf(trace_file, ",\n{\"name\":\"%s\",\"cat\":\"huffpuff\",\"ph\":\"%s\","
+            "\"pid\":1,\"tid\":%d,\"ts\":%.3f", name, ph, tid, ts);
+}
+
+/**
+ * Opens a trace file. The trace is closed at exit.
+ * @param filename Name of the file
+ * @return 0 if fail, 1 if OK
+ */
+int trace_open(const char *filename)
+{
+    trace_file = fopen(filename, "wt");
+    if (!trace_file) {
+        fprintf(stderr, "error: failed to open `%s' for writing\n", filename);
+        return 0;
+    }
+    trace_start = clock_us();
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"huffpuff\"}},\n"
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"main\"}}",
+            TRACE_MAIN_THREAD, TRACE_MAIN_THREAD);
+    atexit(trace_close);
+    return 1;
+}
+
+/**
+ * Ends the open phases and the trace, and closes its file.
+ */
+void trace_close(void)
+{
+    if (!trace_file)
+        return;
+    while (open_phase_count > 0)
+        trace_end(open_phases[open_phase_count - 1]);
+    fprintf(trace_file, "\n]}\n");
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+/**
+ * Returns the time since the trace was opened in microseconds, or 0 if
+ * there is no trace.
+ */
+double trace_now(void)
+{
+    if (!trace_file)
+        return 0;
+    return clock_us() - trace_start;
+}
+
+/**
+ * Marks the start of a phase of the main thread.
+ */
+void trace_begin(const char *name)
+{
+    if (!trace_file)
+        return;
+    pthread_mutex_lock(&trace_lock);
+    write_event(name, "B", TRACE_MAIN_THREAD, trace_now());
+    fprintf(trace_file, "}");
+    if (open_phase_count < MAX_PHASES)
+        open_phases[open_phase_count++] = name;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Marks the end of a phase of the main thread.
+ */
+void trace_end(const char *name)
+{
+    if (!trace_file)
+        return;
+    pthread_mutex_lock(&trace_lock);
+    write_event(name, "E", TRACE_MAIN_THREAD, trace_now());
+    fprintf(trace_file, "}");
+    if (open_phase_count > 0)
+        open_phase_count--;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Names a thread in the trace, once.
+ * @param tid Thread ID
+ * @param name Its name
+ */
+void trace_thread_name(int tid, const char *name)
+{
+    if (!trace_file || (tid < 0) || (tid >= MAX_NAMED_THREADS) || named_threads[tid])
+        return;
+    pthread_mutex_lock(&trace_lock);
+    named_threads[tid] = 1;
+    fprintf(trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}", tid, name);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Records a piece of work that started at a given time and ends now.
+ * @param name Name of the work
+ * @param tid Thread that did it
+ * @param start Its start, from trace_now()
+ * @param arg_name Name of a number to attach, or NULL
+ * @param arg The number
+ */
+void trace_span(const char *name, int tid, double start,
+                const char *arg_name, long arg)
+{
+    double now;
+    if (!trace_file)
+        return;
+    now = trace_now();
+    pthread_mutex_lock(&trace_lock);
+    write_event(name, "X", tid, start);
+    fprintf(trace_file, ",\"dur\":%.3f", now - start);
+    if (arg_name)
+        fprintf(trace_file, ",\"args\":{\"%s\":%ld}", arg_name, arg);
+    fprintf(trace_file, "}");
+    pthread_mutex_unlock(&trace_lock);
+}
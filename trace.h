@@ -0,0 +1,32 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Thread ID of the main thread in the trace; worker n has ID n + 1 */
+#define TRACE_MAIN_THREAD 1
+
+int trace_open(const char *);
+void trace_close(void);
+double trace_now(void);
+void trace_begin(const char *);
+void trace_end(const char *);
+void trace_span(const char *, int, double, const char *, long);
+void trace_thread_name(int, const char *);
+
+#endif  /* !TRACE_H */
@@ -0,0 +1,448 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** This file contains the SM83 (Game Boy) and Z80 decoder generator.
+ *
+ * The SM83/Z80 decoder table has the same shape as the 6502 one (2 bytes
+ * per node, leaves marked by a 0 in the first byte), but both child offsets
+ * are relative to the node's second byte. The decoder reads the first byte
+ * with a post-incrementing (HL) load, so HL already points there when it
+ * adds the offset of either child.
+ *
+ * Big tables may need two-byte child offsets or addresses (see TABLE_REL16
+ * and TABLE_ABS16). These are stored high byte first, so that the first
+ * byte of a node still tells whether it is a leaf, and the offsets are
+ * relative to the byte that holds their low byte.
+ *
+ * The bit buffer is kept in register C with a sentinel bit: a new byte is
+ * shifted in with carry set, and the buffer is empty once the sentinel has
+ * been shifted out (i.e. C becomes 0).
+ *
+ * When the leaves hold byte sequences, the decoder copies the sequence to
+ * the address in a 2-byte variable and advances that address. A bucket leaf
+ * holds a sentinel bit instead: the extra bits are rotated into it until the
+ * sentinel is shifted out, which leaves the index of the character.
+ *
+ * With a root lookup, the decoder first rotates a fixed number of bits into
+ * a sentinel bit in A (no more than the shortest code has) and loads the
+ * address of the node that they lead to from a table of words after the
+ * routine; the walk goes on from there.
+ *
+ * The fixed-width decoder rotates the bits of a symbol into a sentinel bit
+ * in the same way, and looks the result up in a table of character values.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "z80dec.h"
+#include "sm83.h"
+
+/* Where the validation harness puts things in the 64K address space */
+#define CODE_ADDRESS  0x0100
+#define TABLE_ADDRESS 0x1000
+#define DATA_ADDRESS  0x4000
+#define DATA_LIMIT    0xFF00
+#define OUT_ADDRESS   0x0800    /* output pointer, followed by the buffer */
+
+/**
+ * Generates a decoder routine.
+ * @param a Buffer to generate code into
+ * @param cpu CPU_SM83 or CPU_Z80
+ * @param label Name of the routine
+ * @param table_label Name of the decoder table
+ * @param leaf_format Format of the table leaves (LEAF_VALUE etc.)
+ * @param format Format of the interior nodes (TABLE_REL8 etc.)
+ * @param root_bits Number of bits that the root lookup table takes at once,
+ *        or 0 for none
+ * @param root_positions Table offset of the node that every value of those
+ *        bits leads to (see huffman_root_positions())
+ */
+void z80dec_generate(asm_buffer_t *a, int cpu, const char *label,
+                     const char *table_label, int leaf_format, int format,
+                     int root_bits, const int *root_positions)
+{
+    int z80 = (cpu == CPU_Z80);
+    char encoding[32];
+    int i;
+    asm_scope(a, label);
+    asm_text(a, "; Huffman decoder automatically generated by huffpuff.");
+    asm_text(a, "; in:  de = address of the next byte of encoded string data");
+    asm_text(a, ";      c  = bit buffer; set to 0 before decoding the first character of a string");
+    if (leaf_format == LEAF_SEQUENCE) {
+        asm_text(a, ";      %s_out (2 bytes) = where to store the decoded bytes", label);
+        asm_text(a, "; out: the bytes of the decoded character are stored, and %s_out is", label);
+        asm_text(a, ";      advanced past them; de and c are updated");
+        asm_text(a, "; destroys a, b, hl");
+    } else {
+        asm_text(a, "; out: a  = decoded character; de and c are updated");
+        asm_text(a, "; destroys b, hl");
+    }
+    if (format == TABLE_ABS16)
+        asm_text(a, "; The decoder table must not be in the first 256 bytes of memory.");
+    asm_label(a, "%s", label);
+    if (root_bits) {
+        /* Rotate the first bits into a sentinel bit, and look up the node
+           that they lead to */
+        sprintf(encoding, "3E %.2X", 0x100 >> root_bits);
+        asm_emit(a, encoding, z80 ? "ld a,$%.2X" : "ld a, $%.2X", 0x100 >> root_bits);
+        asm_label(a, ".root");
+        asm_emit(a, "CB 21", "sla c");
+        asm_emit(a, "20 @.root_bit", z80 ? "jr nz,.root_bit" : "jr nz, .root_bit");
+        asm_emit(a, "47", z80 ? "ld b,a" : "ld b, a");
+        asm_emit(a, "1A", z80 ? "ld a,(de)" : "ld a, [de]");
+        asm_emit(a, "13", "inc de");
+        asm_emit(a, "37", "scf");
+        asm_emit(a, "17", "rla");
+        asm_emit(a, "4F", z80 ? "ld c,a" : "ld c, a");
+        asm_emit(a, "78", z80 ? "ld a,b" : "ld a, b");
+        asm_label(a, ".root_bit");
+        asm_emit(a, "17", "rla");
+        asm_emit(a, "30 @.root", z80 ? "jr nc,.root" : "jr nc, .root");
+        asm_emit(a, "87", z80 ? "add a,a" : "add a, a");
+        asm_emit(a, "21 !.root_table", z80 ? "ld hl,.root_table" : "ld hl, .root_table");
+        asm_emit(a, "85", z80 ? "add a,l" : "add a, l");
+        asm_emit(a, "6F", z80 ? "ld l,a" : "ld l, a");
+        asm_emit(a, "30 @.root_load", z80 ? "jr nc,.root_load" : "jr nc, .root_load");
+        asm_emit(a, "24", "inc h");
+        asm_label(a, ".root_load");
+        if (z80) {
+            asm_emit(a, "7E", "ld a,(hl)");
+            asm_emit(a, "23", "inc hl");
+            asm_emit(a, "66", "ld h,(hl)");
+        } else {
+            asm_emit(a, "2A", "ld a, [hl+]");
+            asm_emit(a, "66", "ld h, [hl]");
+        }
+        asm_emit(a, "6F", z80 ? "ld l,a" : "ld l, a");
+    } else {
+        asm_emit(a, "21 !TABLE", z80 ? "ld hl,%s" : "ld hl, %s", table_label);
+    }
+    asm_label(a, ".node");
+    if (z80) {
+        asm_emit(a, "7E", "ld a,(hl)");
+        asm_emit(a, "23", "inc hl");
+    } else {
+        asm_emit(a, "2A", "ld a, [hl+]");
+    }
+    if (format == TABLE_REL16) {
+        asm_emit(a, "CB 7F", z80 ? "bit 7,a" : "bit 7, a");
+        asm_emit(a, "20 @.leaf", z80 ? "jr nz,.leaf" : "jr nz, .leaf");
+    } else {
+        asm_emit(a, "A7", "and a");
+        asm_emit(a, "28 @.leaf", z80 ? "jr z,.leaf" : "jr z, .leaf");
+    }
+    asm_emit(a, "CB 21", "sla c");
+    asm_emit(a, "20 @.bit", z80 ? "jr nz,.bit" : "jr nz, .bit");
+    /* Buffer empty; shift in the next byte */
+    asm_emit(a, "47", z80 ? "ld b,a" : "ld b, a");
+    asm_emit(a, "1A", z80 ? "ld a,(de)" : "ld a, [de]");
+    asm_emit(a, "13", "inc de");
+    asm_emit(a, "37", "scf");
+    asm_emit(a, "17", "rla");
+    asm_emit(a, "4F", z80 ? "ld c,a" : "ld c, a");
+    asm_emit(a, "78", z80 ? "ld a,b" : "ld a, b");
+    asm_label(a, ".bit");
+    if (format == TABLE_REL8) {
+        asm_emit(a, "30 @.add", z80 ? "jr nc,.add" : "jr nc, .add");
+        asm_emit(a, "7E", z80 ? "ld a,(hl)" : "ld a, [hl]");
+        asm_label(a, ".add");
+        asm_emit(a, "85", z80 ? "add a,l" : "add a, l");
+        asm_emit(a, "6F", z80 ? "ld l,a" : "ld l, a");
+        asm_emit(a, "30 @.node", z80 ? "jr nc,.node" : "jr nc, .node");
+        asm_emit(a, "24", "inc h");
+        asm_emit(a, "18 @.node", "jr .node");
+    } else {
+        /* A = high byte of the left child pointer; HL points to its low byte */
+        asm_emit(a, "30 @.left", z80 ? "jr nc,.left" : "jr nc, .left");
+        asm_emit(a, "23", "inc hl");
+        if (z80) {
+            asm_emit(a, "7E", "ld a,(hl)");
+            asm_emit(a, "23", "inc hl");
+        } else {
+            asm_emit(a, "2A", "ld a, [hl+]");
+        }
+        asm_label(a, ".left");
+        asm_emit(a, "47", z80 ? "ld b,a" : "ld b, a");
+        asm_emit(a, "7E", z80 ? "ld a,(hl)" : "ld a, [hl]");
+        if (format == TABLE_REL16) {
+            asm_emit(a, "85", z80 ? "add a,l" : "add a, l");
+            asm_emit(a, "6F", z80 ? "ld l,a" : "ld l, a");
+            asm_emit(a, "78", z80 ? "ld a,b" : "ld a, b");
+            asm_emit(a, "8C", z80 ? "adc a,h" : "adc a, h");
+            asm_emit(a, "67", z80 ? "ld h,a" : "ld h, a");
+        } else {
+            asm_emit(a, "6F", z80 ? "ld l,a" : "ld l, a");
+            asm_emit(a, "60", z80 ? "ld h,b" : "ld h, b");
+        }
+        asm_emit(a, "18 @.node", "jr .node");
+    }
+    asm_label(a, ".leaf");
+    if (leaf_format == LEAF_VALUE) {
+        asm_emit(a, "7E", z80 ? "ld a,(hl)" : "ld a, [hl]");
+    } else if (leaf_format == LEAF_BUCKET) {
+        asm_emit(a, "7E", z80 ? "ld a,(hl)" : "ld a, [hl]");
+        asm_emit(a, "23", "inc hl");
+        asm_emit(a, "A7", "and a");
+        asm_emit(a, "28 @.value", z80 ? "jr z,.value" : "jr z, .value");
+        /* Rotate the extra bits into the sentinel */
+        asm_emit(a, "47", z80 ? "ld b,a" : "ld b, a");
+        asm_label(a, ".extra");
+        asm_emit(a, "CB 21", "sla c");
+        asm_emit(a, "20 @.extra_bit", z80 ? "jr nz,.extra_bit" : "jr nz, .extra_bit");
+        asm_emit(a, "1A", z80 ? "ld a,(de)" : "ld a, [de]");
+        asm_emit(a, "13", "inc de");
+        asm_emit(a, "37", "scf");
+        asm_emit(a, "17", "rla");
+        asm_emit(a, "4F", z80 ? "ld c,a" : "ld c, a");
+        asm_label(a, ".extra_bit");
+        asm_emit(a, "CB 10", "rl b");
+        asm_emit(a, "30 @.extra", z80 ? "jr nc,.extra" : "jr nc, .extra");
+        asm_emit(a, "78", z80 ? "ld a,b" : "ld a, b");
+        asm_label(a, ".value");
+        asm_emit(a, "85", z80 ? "add a,l" : "add a, l");
+        asm_emit(a, "6F", z80 ? "ld l,a" : "ld l, a");
+        asm_emit(a, "30 @.load", z80 ? "jr nc,.load" : "jr nc, .load");
+        asm_emit(a, "24", "inc h");
+        asm_label(a, ".load");
+        asm_emit(a, "7E", z80 ? "ld a,(hl)" : "ld a, [hl]");
+    } else if (z80) {
+        /* Copy the sequence with LDIR */
+        asm_emit(a, "C5", "push bc");
+        asm_emit(a, "D5", "push de");
+        asm_emit(a, "4E", "ld c,(hl)");
+        asm_emit(a, "06 00", "ld b,0");
+        asm_emit(a, "23", "inc hl");
+        asm_emit(a, "ED 5B !.out", "ld de,(.out)");
+        asm_emit(a, "ED B0", "ldir");
+        asm_emit(a, "ED 53 !.out", "ld (.out),de");
+        asm_emit(a, "D1", "pop de");
+        asm_emit(a, "C1", "pop bc");
+    } else {
+        asm_emit(a, "2A", "ld a, [hl+]");
+        asm_emit(a, "47", "ld b, a");
+        asm_emit(a, "D5", "push de");
+        asm_emit(a, "FA !.out", "ld a, [.out]");
+        asm_emit(a, "5F", "ld e, a");
+        asm_emit(a, "FA !.out+1", "ld a, [.out+1]");
+        asm_emit(a, "57", "ld d, a");
+        asm_label(a, ".copy");
+        asm_emit(a, "2A", "ld a, [hl+]");
+        asm_emit(a, "12", "ld [de], a");
+        asm_emit(a, "13", "inc de");
+        asm_emit(a, "05", "dec b");
+        asm_emit(a, "20 @.copy", "jr nz, .copy");
+        asm_emit(a, "7B", "ld a, e");
+        asm_emit(a, "EA !.out", "ld [.out], a");
+        asm_emit(a, "7A", "ld a, d");
+        asm_emit(a, "EA !.out+1", "ld [.out+1], a");
+        asm_emit(a, "D1", "pop de");
+    }
+    asm_emit(a, "C9", "ret");
+    if (root_bits) {
+        /* The address of the node that every value of the first bits leads to */
+        asm_label(a, ".root_table");
+        for (i = 0; i < (1 << root_bits); ++i) {
+            sprintf(encoding, "!TABLE+%d", root_positions[i]);
+            asm_emit(a, encoding, "%s %s+%d", z80 ? ".dw" : "dw", table_label,
+                     root_positions[i]);
+        }
+    }
+}
+
+/**
+ * Generates a fixed-width decoder routine.
+ * @param a Buffer to generate code into
+ * @param cpu CPU_SM83 or CPU_Z80
+ * @param label Name of the routine
+ * @param table_label Name of the table of character values
+ * @param width Bits per symbol (1-8)
+ */
+void z80dec_generate_fixed(asm_buffer_t *a, int cpu, const char *label,
+                           const char *table_label, int width)
+{
+    int z80 = (cpu == CPU_Z80);
+    char encoding[16];
+    int sentinel = (0x100 >> width) & 0xFF;
+    asm_scope(a, label);
+    asm_text(a, "; Fixed-width decoder automatically generated by huffpuff.");
+    asm_text(a, "; Every character is coded in %d bits.", width);
+    asm_text(a, "; in:  de = address of the next byte of encoded string data");
+    asm_text(a, ";      c  = bit buffer; set to 0 before decoding the first character of a string");
+    asm_text(a, "; out: a  = decoded character; de and c are updated");
+    asm_text(a, "; destroys b, hl");
+    asm_label(a, "%s", label);
+    sprintf(encoding, "3E %.2X", sentinel);
+    asm_emit(a, encoding, z80 ? "ld a,$%.2X" : "ld a, $%.2X", sentinel);
+    asm_label(a, ".next");
+    asm_emit(a, "CB 21", "sla c");
+    asm_emit(a, "20 @.bit", z80 ? "jr nz,.bit" : "jr nz, .bit");
+    /* Buffer empty; shift in the next byte */
+    asm_emit(a, "47", z80 ? "ld b,a" : "ld b, a");
+    asm_emit(a, "1A", z80 ? "ld a,(de)" : "ld a, [de]");
+    asm_emit(a, "13", "inc de");
+    asm_emit(a, "37", "scf");
+    asm_emit(a, "17", "rla");
+    asm_emit(a, "4F", z80 ? "ld c,a" : "ld c, a");
+    asm_emit(a, "78", z80 ? "ld a,b" : "ld a, b");
+    asm_label(a, ".bit");
+    asm_emit(a, "17", "rla");
+    asm_emit(a, "30 @.next", z80 ? "jr nc,.next" : "jr nc, .next");
+    asm_emit(a, "21 !TABLE", z80 ? "ld hl,%s" : "ld hl, %s", table_label);
+    asm_emit(a, "85", z80 ? "add a,l" : "add a, l");
+    asm_emit(a, "6F", z80 ? "ld l,a" : "ld l, a");
+    asm_emit(a, "30 @.load", z80 ? "jr nc,.load" : "jr nc, .load");
+    asm_emit(a, "24", "inc h");
+    asm_label(a, ".load");
+    asm_emit(a, "7E", z80 ? "ld a,(hl)" : "ld a, [hl]");
+    asm_emit(a, "C9", "ret");
+}
+
+/**
+ * Runs the generated decoder on every string and checks the result.
+ * @param cpu CPU_SM83 or CPU_Z80
+ * @param root Root of Huffman tree
+ * @param charmap Character map
+ * @param sequences Byte sequences of the characters, or NULL
+ * @param format Format of the interior nodes (TABLE_REL8 etc.)
+ * @param root_bits Number of bits that the root lookup table takes at once,
+ *        or 0 for none
+ * @param fixed The fixed-width code of the strings, or NULL if they are Huffman-coded
+ * @param head Encoded strings
+ * @param code_size Where to store the size of the decoder
+ * @param cycles_per_char Where to store the average decoding time
+ * @return 0 if fail, 1 if OK
+ */
+int z80dec_validate(int cpu, huffman_node_t *root, const unsigned short *charmap,
+                    const charmap_sequence_t *sequences, int format, int root_bits,
+                    const fixed_code_t *fixed, const string_list_t *head,
+                    int *code_size, double *cycles_per_char)
+{
+    asm_buffer_t a;
+    int root_positions[1 << HUFFMAN_MAX_ROOT_BITS];
+    sm83_t *sm;
+    const string_list_t *str;
+    unsigned long total_cycles = 0;
+    unsigned long char_count = 0;
+    int table_size;
+    int ok = 1;
+
+    if (root == 0)
+        return 1;
+    if (root_bits) {
+        /* Lay out the table, for the nodes that the lookup leads to */
+        huffman_table_image(root, charmap, sequences, cpu, format, TABLE_ADDRESS, 0);
+        if (!huffman_root_positions(root, root_bits, root_positions)) {
+            fprintf(stderr, "error: a code is shorter than the %d bits of the root lookup\n",
+                    root_bits);
+            return 0;
+        }
+    }
+    asm_init(&a, CODE_ADDRESS);
+    if (fixed) {
+        z80dec_generate_fixed(&a, cpu, "huff_decode", "huff_table", fixed->width);
+    } else {
+        z80dec_generate(&a, cpu, "huff_decode", "huff_table",
+                        huffman_leaf_format(root, sequences), format, root_bits,
+                        root_positions);
+    }
+    asm_define(&a, "TABLE", TABLE_ADDRESS);
+    asm_define(&a, "huff_table", TABLE_ADDRESS);
+    asm_define(&a, "huff_decode_out", OUT_ADDRESS);
+    if (!asm_link(&a)) {
+        asm_free(&a);
+        return 0;
+    }
+    *code_size = a.size;
+
+    sm = (sm83_t *)malloc(sizeof(sm83_t));
+    sm83_reset(sm, cpu == CPU_Z80);
+    memcpy(&sm->mem[CODE_ADDRESS], a.code, a.size);
+    if (fixed) {
+        table_size = fixed->count;
+    } else {
+        table_size = huffman_table_image(root, charmap, sequences, cpu, format,
+                                         TABLE_ADDRESS, 0);
+    }
+    if ((table_size < 0) || (TABLE_ADDRESS + table_size > DATA_ADDRESS)) {
+        fprintf(stderr, "error: decoder table does not fit the SM83/Z80 table format\n");
+        free(sm);
+        asm_free(&a);
+        return 0;
+    }
+    if (fixed) {
+        int i;
+        for (i = 0; i < fixed->count; ++i)
+            sm->mem[TABLE_ADDRESS + i] = (unsigned char)charmap[fixed->symbols[i]];
+    } else {
+        huffman_table_image(root, charmap, sequences, cpu, format,
+                            TABLE_ADDRESS, &sm->mem[TABLE_ADDRESS]);
+    }
+
+    for (str = head; ok && (str != NULL); str = str->next) {
+        int i;
+        if (DATA_ADDRESS + str->huff_size > DATA_LIMIT) {
+            fprintf(stderr, "error: encoded string too large for the SM83/Z80 test harness\n");
+            ok = 0;
+            break;
+        }
+        memcpy(&sm->mem[DATA_ADDRESS], str->huff_data, str->huff_size);
+        sm->d = DATA_ADDRESS >> 8;
+        sm->e = DATA_ADDRESS & 0xFF;
+        sm->c = 0;
+        for (i = 0; i < str->length; ++i) {
+            int c = str->symbols[i];
+            unsigned long start;
+            sm->mem[OUT_ADDRESS] = (OUT_ADDRESS + 2) & 0xFF;
+            sm->mem[OUT_ADDRESS + 1] = (OUT_ADDRESS + 2) >> 8;
+            memset(&sm->mem[OUT_ADDRESS + 2], 0, CHARMAP_MAX_SEQUENCE);
+            start = sm->cycles;
+            if (!sm83_call(sm, CODE_ADDRESS, 100000)) {
+                fprintf(stderr, "*** fatal error: generated %s decoder crashed at $%.4X\n",
+                        (cpu == CPU_Z80) ? "Z80" : "SM83", sm->pc);
+                ok = 0;
+                break;
+            }
+            if (sequences) {
+                /* Check the copied bytes and the updated output pointer */
+                const charmap_sequence_t *seq = &sequences[c];
+                int end = OUT_ADDRESS + 2 + seq->length;
+                if (memcmp(&sm->mem[OUT_ADDRESS + 2], seq->bytes, seq->length)
+                    || (sm->mem[OUT_ADDRESS] != (end & 0xFF))
+                    || (sm->mem[OUT_ADDRESS + 1] != (end >> 8))) {
+                    fprintf(stderr, "*** fatal error: generated %s decoder output wrong byte sequence\n",
+                            (cpu == CPU_Z80) ? "Z80" : "SM83");
+                    fprintf(stderr, "    original: %s\n", str->text);
+                    ok = 0;
+                    break;
+                }
+            } else if (sm->a != charmap[c]) {
+                fprintf(stderr, "*** fatal error: generated %s decoder returned $%.2X, expected $%.2X\n",
+                        (cpu == CPU_Z80) ? "Z80" : "SM83", sm->a, charmap[c]);
+                fprintf(stderr, "    original: %s\n", str->text);
+                ok = 0;
+                break;
+            }
+            total_cycles += sm->cycles - start;
+            char_count++;
+        }
+    }
+    *cycles_per_char = char_count ? (double)total_cycles / char_count : 0;
+    free(sm);
+    asm_free(&a);
+    return ok;
+}
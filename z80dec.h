@@ -0,0 +1,33 @@
+/*
+    This file is part of huffpuff.
+
+    huffpuff is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    huffpuff is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with huffpuff.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef Z80DEC_H
+#define Z80DEC_H
+
+#include "asmgen.h"
+#include "huffpuff.h"
+#include "fixed.h"
+
+void z80dec_generate(asm_buffer_t *, int, const char *, const char *, int, int, int,
+                     const int *);
+void z80dec_generate_fixed(asm_buffer_t *, int, const char *, const char *, int);
+int z80dec_validate(int, huffman_node_t *, const unsigned short *,
+                    const charmap_sequence_t *, int, int, const fixed_code_t *,
+                    const string_list_t *,
+                    int *, double *);
+
+#endif  /* !Z80DEC_H */